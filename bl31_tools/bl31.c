@@ -0,0 +1,1089 @@
+// Miyoo Flip — host model of a stripped rk3568 BL31 image, see bl31.h.
+
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<ctype.h>
+#include<dirent.h>
+#include<elf.h>
+
+#include "bl31.h"
+
+//====================== files ======================================================
+
+static unsigned char * bl31_read_file(const char * path, size_t * size)
+{
+    unsigned char * buf;
+    long len;
+    FILE * f = fopen(path, "rb");
+
+    if (!f)
+    {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(len + 1);
+    if (!buf || fread(buf, 1, len, f) != (size_t)len)
+    {
+        fprintf(stderr, "%s: read failed\n", path);
+        fclose(f);
+        free(buf);
+        return NULL;
+    }
+    buf[len] = '\0';
+    fclose(f);
+    *size = len;
+    return buf;
+}
+
+//====================== files end ==================================================
+
+//====================== ELF ========================================================
+
+static int bl31_load_elf(struct bl31_image * img, const char * path)
+{
+    const Elf64_Ehdr * eh;
+    const Elf64_Shdr * sh;
+    const char * names;
+    int i;
+
+    img->elf = bl31_read_file(path, &img->elf_size);
+    if (!img->elf)
+        return -1;
+    eh = (const Elf64_Ehdr *)img->elf;
+    if (img->elf_size < sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG)
+        || eh->e_ident[EI_CLASS] != ELFCLASS64 || eh->e_machine != EM_AARCH64
+        || eh->e_shoff + (uint64_t)eh->e_shnum * sizeof(*sh) > img->elf_size
+        || eh->e_shstrndx >= eh->e_shnum)
+    {
+        fprintf(stderr, "%s: not an AArch64 ELF64 image\n", path);
+        return -1;
+    }
+    img->entry = eh->e_entry;
+    sh = (const Elf64_Shdr *)(img->elf + eh->e_shoff);
+    names = (const char *)img->elf + sh[eh->e_shstrndx].sh_offset;
+
+    for (i = 0; i < eh->e_shnum && img->n_sec < BL31_MAX_SECTIONS; i++)
+    {
+        struct bl31_section * s = &img->sec[img->n_sec];
+
+        if (!(sh[i].sh_flags & SHF_ALLOC) || !sh[i].sh_size)
+            continue;
+        if (sh[i].sh_type != SHT_NOBITS && sh[i].sh_offset + sh[i].sh_size > img->elf_size)
+        {
+            fprintf(stderr, "%s: section %d past end of file\n", path, i);
+            return -1;
+        }
+        snprintf(s->name, sizeof(s->name), "%s", names + sh[i].sh_name);
+        s->addr = sh[i].sh_addr;
+        s->size = sh[i].sh_size;
+        s->offset = sh[i].sh_offset;
+        s->flags = (sh[i].sh_flags & SHF_EXECINSTR ? BL31_SEC_EXEC : 0)
+            | (sh[i].sh_flags & SHF_WRITE ? BL31_SEC_WRITE : 0)
+            | (sh[i].sh_type == SHT_NOBITS ? BL31_SEC_NOBITS : 0);
+        img->n_sec++;
+    }
+    return 0;
+}
+
+int bl31_section_of(const struct bl31_image * img, uint64_t addr, int prefer)
+{
+    int i;
+
+    if (prefer >= 0 && addr - img->sec[prefer].addr < img->sec[prefer].size)
+        return prefer;
+    for (i = 0; i < img->n_sec; i++)
+        if (addr - img->sec[i].addr < img->sec[i].size)
+            return i;
+    return -1;
+}
+
+const unsigned char * bl31_bytes(const struct bl31_image * img, uint64_t addr, size_t len, int sec)
+{
+    const struct bl31_section * s;
+
+    sec = bl31_section_of(img, addr, sec);
+    if (sec < 0)
+        return NULL;
+    s = &img->sec[sec];
+    if (s->flags & BL31_SEC_NOBITS || addr + len - s->addr > s->size)
+        return NULL;
+    return img->elf + s->offset + (addr - s->addr);
+}
+
+const char * bl31_string_at(const struct bl31_image * img, uint64_t addr)
+{
+    const unsigned char * p = bl31_bytes(img, addr, 1, -1);
+    int sec = bl31_section_of(img, addr, -1);
+    const unsigned char * end;
+    int n = 0;
+
+    if (!p)
+        return NULL;
+    end = img->elf + img->sec[sec].offset + img->sec[sec].size;
+    while (p + n < end && p[n] && (isprint(p[n]) || p[n] == '\n' || p[n] == '\t' || p[n] == '\r'))
+        n++;
+    if (p + n == end || p[n] || n < 3)
+        return NULL;
+    return (const char *)p;
+}
+
+//====================== ELF end ====================================================
+
+//====================== listing ====================================================
+
+// "    fdcc1004:\t52800301 \tmov\tw1, #0x18                  \t// #24"
+static int bl31_parse_line(char * line, uint64_t * addr, uint32_t * word, char ** text)
+{
+    char * p = line, * end;
+    char * out;
+
+    while (*p == ' ')
+        p++;
+    *addr = strtoull(p, &end, 16);
+    if (end == p || end[0] != ':' || end[1] != '\t')
+        return 0;
+    p = end + 2;
+    *word = strtoul(p, &end, 16);
+    if (end - p != 8 || *end != ' ')
+        return 0;
+    p = end;
+    while (*p == ' ' || *p == '\t')
+        p++;
+
+    // comment after the operands: "\t// #24", " ; undefined"
+    if ((end = strstr(p, "//")) || (end = strstr(p, " ;")))
+        *end = '\0';
+    end = p + strlen(p);
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+        *--end = '\0';
+    // "mov\tw1, #0x18" -> "mov w1, #0x18"
+    for (out = p; *out; out++)
+        if (*out == '\t')
+            *out = ' ';
+    *text = p;
+    return 1;
+}
+
+static int bl31_load_listing(struct bl31_image * img, const char * path)
+{
+    size_t size, pool_used = 0;
+    char * buf = (char *)bl31_read_file(path, &size);
+    char * line, * next;
+    int sec = -1, cap = 0, i;
+
+    if (!buf)
+        return -1;
+    img->text_pool = malloc(size + 1);
+    for (i = 0; i < img->n_sec; i++)
+        img->sec[i].first = img->sec[i].count = 0;
+
+    for (line = buf; line && *line; line = next)
+    {
+        uint64_t addr;
+        uint32_t word;
+        char * text;
+
+        next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
+        if (!strncmp(line, "Disassembly of section ", 23))
+        {
+            char * name = line + 23;
+            name[strcspn(name, ":")] = '\0';
+            for (sec = 0; sec < img->n_sec && strcmp(img->sec[sec].name, name); sec++)
+                ;
+            if (sec == img->n_sec)
+            {
+                fprintf(stderr, "%s: section %s not in the ELF\n", path, name);
+                sec = -1;
+                continue;
+            }
+            img->sec[sec].first = img->n_insn;
+            continue;
+        }
+        if (sec < 0 || !bl31_parse_line(line, &addr, &word, &text))
+            continue;
+
+        if (img->n_insn == cap)
+        {
+            cap = cap ? cap * 2 : 16384;
+            img->insn = realloc(img->insn, cap * sizeof(*img->insn));
+        }
+        struct bl31_insn * in = &img->insn[img->n_insn++];
+        memset(in, 0, sizeof(*in));
+        in->addr = addr;
+        in->word = word;
+        in->sec = sec;
+        in->fn = in->ref = -1;
+        in->text = strcpy(img->text_pool + pool_used, text);
+        pool_used += strlen(text) + 1;
+        if (strncmp(text, ".inst", 5) && strncmp(text, "udf", 3))
+            in->flags |= BL31_INSN_VALID;
+        img->sec[sec].count++;
+    }
+    free(buf);
+    if (!img->n_insn)
+    {
+        fprintf(stderr, "%s: no instructions (not an objdump -d listing?)\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+int bl31_insn_at(const struct bl31_image * img, uint64_t addr, int sec)
+{
+    int lo, hi, i;
+
+    sec = bl31_section_of(img, addr, sec);
+    if (sec < 0 || !img->sec[sec].count)
+    {
+        // overlapping VMAs: try any other code section holding addr
+        for (i = 0; i < img->n_sec; i++)
+            if (i != sec && img->sec[i].count && addr - img->sec[i].addr < img->sec[i].size)
+                return bl31_insn_at(img, addr, i);
+        return -1;
+    }
+    lo = img->sec[sec].first;
+    hi = lo + img->sec[sec].count - 1;
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (img->insn[mid].addr == addr)
+            return mid;
+        if (img->insn[mid].addr < addr)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return -1;
+}
+
+int bl31_func_at(const struct bl31_image * img, uint64_t addr, int sec)
+{
+    int i = bl31_insn_at(img, addr, sec);
+    return i >= 0 && img->insn[i].flags & BL31_INSN_ENTRY ? img->insn[i].fn : -1;
+}
+
+static const char * bl31_base_name(const char * path)
+{
+    const char * p = strrchr(path, '/');
+    return p ? p + 1 : path;
+}
+
+int bl31_load(struct bl31_image * img, const char * listing, const char * elf)
+{
+    const char * v = strstr(bl31_base_name(elf), "_v");
+
+    memset(img, 0, sizeof(*img));
+    snprintf(img->name, sizeof(img->name), "%s", v ? v + 1 : bl31_base_name(elf));
+    img->name[strcspn(img->name, "_")] = '\0';
+    if (strlen(img->name) > 4 && !strcmp(img->name + strlen(img->name) - 4, ".elf"))
+        img->name[strlen(img->name) - 4] = '\0';
+    snprintf(img->listing_path, sizeof(img->listing_path), "%s", listing);
+    snprintf(img->elf_path, sizeof(img->elf_path), "%s", elf);
+    if (bl31_load_elf(img, elf) < 0 || bl31_load_listing(img, listing) < 0)
+        return -1;
+    return 0;
+}
+
+int bl31_load_dir(struct bl31_image * img, const char * dir)
+{
+    char listing[4096] = "", elf[4096] = "";
+    struct dirent * de;
+    DIR * d = opendir(dir);
+
+    if (!d)
+    {
+        perror(dir);
+        return -1;
+    }
+    while ((de = readdir(d)))
+    {
+        size_t len = strlen(de->d_name);
+        if (len > 7 && !strcmp(de->d_name + len - 7, "_full.S"))
+            snprintf(listing, sizeof(listing), "%s/%s", dir, de->d_name);
+        else if (len > 4 && !strcmp(de->d_name + len - 4, ".elf"))
+            snprintf(elf, sizeof(elf), "%s/%s", dir, de->d_name);
+    }
+    closedir(d);
+    if (!*listing || !*elf)
+    {
+        fprintf(stderr, "%s: need a *_full.S listing and a *.elf\n", dir);
+        return -1;
+    }
+    return bl31_load(img, listing, elf);
+}
+
+void bl31_free(struct bl31_image * img)
+{
+    int i;
+
+    for (i = 0; i < img->n_fn; i++)
+    {
+        free(img->fn[i].insns);
+        free(img->fn[i].blocks);
+        free(img->fn[i].block_len);
+    }
+    free(img->fn);
+    free(img->insn);
+    free(img->text_pool);
+    free(img->elf);
+    memset(img, 0, sizeof(*img));
+}
+
+//====================== listing end ================================================
+
+//====================== A64 decode =================================================
+
+static int64_t bl31_sext(uint64_t v, int bits)
+{
+    return (int64_t)(v << (64 - bits)) >> (64 - bits);
+}
+
+int bl31_is_call(uint32_t w)
+{
+    return (w & 0xfc000000) == 0x94000000;
+}
+
+int bl31_is_jump(uint32_t w)
+{
+    return (w & 0xfc000000) == 0x14000000;
+}
+
+int bl31_is_cond(uint32_t w)
+{
+    return (w & 0xff000010) == 0x54000000         // b.cond
+        || (w & 0x7e000000) == 0x34000000         // cbz, cbnz
+        || (w & 0x7e000000) == 0x36000000;        // tbz, tbnz
+}
+
+int bl31_is_stop(uint32_t w)
+{
+    return (w & 0xfffffc1f) == 0xd65f0000         // ret
+        || (w & 0xfffffc1f) == 0xd61f0000         // br
+        || w == 0xd69f03e0;                       // eret
+}
+
+int bl31_branch_target(uint32_t w, uint64_t pc, uint64_t * target)
+{
+    if (bl31_is_call(w) || bl31_is_jump(w))
+        *target = pc + (bl31_sext(w & 0x3ffffff, 26) << 2);
+    else if ((w & 0x7e000000) == 0x36000000)
+        *target = pc + (bl31_sext((w >> 5) & 0x3fff, 14) << 2);
+    else if (bl31_is_cond(w))
+        *target = pc + (bl31_sext((w >> 5) & 0x7ffff, 19) << 2);
+    else
+        return 0;
+    return 1;
+}
+
+int bl31_adrp(uint32_t w, uint64_t pc, int * rd, uint64_t * target)
+{
+    uint64_t imm;
+
+    if ((w & 0x9f000000) != 0x90000000)
+        return 0;
+    imm = ((w >> 29) & 3) | (((w >> 5) & 0x7ffff) << 2);
+    *rd = w & 31;
+    *target = (pc & ~0xfffull) + (bl31_sext(imm, 21) << 12);
+    return 1;
+}
+
+int bl31_adr(uint32_t w, uint64_t pc, int * rd, uint64_t * target)
+{
+    uint64_t imm;
+
+    if ((w & 0x9f000000) != 0x10000000)
+        return 0;
+    imm = ((w >> 29) & 3) | (((w >> 5) & 0x7ffff) << 2);
+    *rd = w & 31;
+    *target = pc + bl31_sext(imm, 21);
+    return 1;
+}
+
+// ldr wt/xt, ldrsw xt from a pc-relative literal
+int bl31_ldr_literal(uint32_t w, uint64_t pc, int * rt, uint64_t * target, int * size)
+{
+    if ((w & 0x3f000000) != 0x18000000 || (w >> 30) == 3)
+        return 0;
+    *rt = w & 31;
+    *target = pc + (bl31_sext((w >> 5) & 0x7ffff, 19) << 2);
+    *size = (w >> 30) == 1 ? 8 : 4;
+    return 1;
+}
+
+// add xd, xn, #imm12 (no shift)
+static int bl31_add_imm(uint32_t w, int * rd, int * rn, uint32_t * imm)
+{
+    if ((w & 0xffc00000) != 0x91000000)
+        return 0;
+    *rd = w & 31;
+    *rn = (w >> 5) & 31;
+    *imm = (w >> 10) & 0xfff;
+    return 1;
+}
+
+// ldr/str (b, h, w, x, signed variants) [xn, #imm12], scaled
+static int bl31_ldst_uimm(uint32_t w, int * rt, int * rn, uint32_t * off, int * load)
+{
+    if ((w & 0x3f000000) != 0x39000000)
+        return 0;
+    *rt = w & 31;
+    *rn = (w >> 5) & 31;
+    *off = ((w >> 10) & 0xfff) << (w >> 30);
+    *load = ((w >> 22) & 3) != 0;
+    return 1;
+}
+
+uint64_t bl31_hash(uint64_t h, const void * data, size_t len)
+{
+    const unsigned char * p = data;
+    while (len--)
+    {
+        h ^= *p++;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+//====================== A64 decode end =============================================
+
+//====================== functions ==================================================
+
+// instruction after i in the same section, if contiguous
+static int bl31_next(const struct bl31_image * img, int i)
+{
+    const struct bl31_insn * in = &img->insn[i];
+    const struct bl31_section * s = &img->sec[in->sec];
+
+    if (i + 1 >= s->first + s->count || img->insn[i + 1].addr != in->addr + 4)
+        return -1;
+    return i + 1;
+}
+
+static int bl31_falls_through(uint32_t w)
+{
+    return !bl31_is_jump(w) && !bl31_is_stop(w);
+}
+
+// recursive descent from every root; marks reached instructions and turns
+// bl targets into new entries; returns the number of new entries
+static int bl31_descend(struct bl31_image * img, const unsigned char * root, unsigned char * entry,
+    unsigned char * seen, int * stack)
+{
+    int i, found = 0;
+
+    for (i = 0; i < img->n_insn; i++)
+    {
+        int sp = 0;
+
+        if (!root[i] || seen[i])
+            continue;
+        stack[sp++] = i;
+        while (sp)
+        {
+            int j = stack[--sp];
+            const struct bl31_insn * in;
+            uint64_t target;
+            int t;
+
+            while (j >= 0 && !seen[j])
+            {
+                in = &img->insn[j];
+                seen[j] = 1;
+                if (!(in->flags & BL31_INSN_VALID))
+                    break;
+                if (bl31_branch_target(in->word, in->addr, &target)
+                    && (t = bl31_insn_at(img, target, in->sec)) >= 0)
+                {
+                    if (bl31_is_call(in->word))
+                    {
+                        if (!entry[t])
+                            found++;
+                        entry[t] = 1;
+                    }
+                    else if (!seen[t])
+                        stack[sp++] = t;
+                }
+                if (!bl31_falls_through(in->word))
+                    break;
+                j = bl31_next(img, j);
+            }
+        }
+    }
+    return found;
+}
+
+static int bl31_after_gap(const struct bl31_image * img, const unsigned char * seen, int i)
+{
+    const struct bl31_insn * p;
+
+    if (i == img->sec[img->insn[i].sec].first || img->insn[i - 1].addr != img->insn[i].addr - 4)
+        return 1;
+    p = &img->insn[i - 1];
+    return !(p->flags & BL31_INSN_VALID) || !bl31_falls_through(p->word) || !strcmp(p->text, "nop");
+}
+
+// a guessed entry must run into a return or jump through decodable
+// instructions whose branches stay inside the image; data rarely does
+static int bl31_plausible(const struct bl31_image * img, int i)
+{
+    uint64_t target;
+    int n;
+
+    for (n = 0; n < 64 && i >= 0; n++, i = bl31_next(img, i))
+    {
+        const struct bl31_insn * in = &img->insn[i];
+
+        if (!(in->flags & BL31_INSN_VALID))
+            return 0;
+        if (bl31_branch_target(in->word, in->addr, &target) && bl31_insn_at(img, target, in->sec) < 0)
+            return 0;
+        if (!bl31_falls_through(in->word))
+            return 1;
+    }
+    return n == 64;
+}
+
+// code addresses stored as 64-bit data (handler tables, psci ops, vectors)
+// or materialized with adr / adrp+add / literal loads
+static int bl31_pointer_seeds(struct bl31_image * img, unsigned char * entry, const unsigned char * seen)
+{
+    int i, s, t, found = 0;
+
+    for (s = 0; s < img->n_sec; s++)
+    {
+        const struct bl31_section * sec = &img->sec[s];
+        uint64_t off;
+
+        if (sec->flags & BL31_SEC_NOBITS)
+            continue;
+        for (off = 0; off + 8 <= sec->size; off += 8)
+        {
+            uint64_t v;
+            memcpy(&v, img->elf + sec->offset + off, 8);
+            if ((v & 3) || (t = bl31_insn_at(img, v, -1)) < 0 || entry[t] || seen[t]
+                || !bl31_after_gap(img, seen, t) || !bl31_plausible(img, t))
+                continue;
+            entry[t] = 1;
+            found++;
+        }
+    }
+    for (i = 0; i < img->n_insn; i++)
+    {
+        const struct bl31_insn * in = &img->insn[i];
+        uint64_t target, page = 0;
+        int rd, rn;
+        uint32_t imm;
+
+        if (!seen[i])
+            continue;
+        if (bl31_adrp(in->word, in->addr, &rd, &page) && (t = bl31_next(img, i)) >= 0
+            && bl31_add_imm(img->insn[t].word, &rd, &rn, &imm) && rn == (int)(in->word & 31))
+            target = page + imm;
+        else if (!bl31_adr(in->word, in->addr, &rd, &target))
+            continue;
+        if ((t = bl31_insn_at(img, target, in->sec)) < 0 || entry[t] || seen[t]
+            || !bl31_after_gap(img, seen, t) || !bl31_plausible(img, t))
+            continue;
+        entry[t] = 1;
+        found++;
+    }
+    return found;
+}
+
+// unreached code right after a return / jump that opens a frame
+static int bl31_prologue_seeds(struct bl31_image * img, unsigned char * entry, const unsigned char * seen)
+{
+    int i, found = 0;
+
+    for (i = 0; i < img->n_insn; i++)
+    {
+        const struct bl31_insn * in = &img->insn[i];
+
+        if (seen[i] || entry[i] || !bl31_after_gap(img, seen, i) || !bl31_plausible(img, i))
+            continue;
+        if (!strncmp(in->text, "stp x29, x30, [sp, #-", 21) || !strcmp(in->text, "paciasp")
+            || !strncmp(in->text, "sub sp, sp, #", 13))
+        {
+            entry[i] = 1;
+            found++;
+        }
+    }
+    return found;
+}
+
+// body of function f: reachable from its entry without entering another
+// function (jumps to an entry are tail calls) or an already owned insn
+static void bl31_claim(struct bl31_image * img, int f, const unsigned char * entry, int * stack)
+{
+    int sp = 0;
+
+    stack[sp++] = img->fn[f].entry;
+    while (sp)
+    {
+        int j = stack[--sp];
+        uint64_t target;
+        int t;
+
+        while (j >= 0 && img->insn[j].fn < 0 && (j == img->fn[f].entry || !entry[j]))
+        {
+            struct bl31_insn * in = &img->insn[j];
+            in->fn = f;
+            if (!(in->flags & BL31_INSN_VALID))
+                break;
+            if (!bl31_is_call(in->word) && bl31_branch_target(in->word, in->addr, &target)
+                && (t = bl31_insn_at(img, target, in->sec)) >= 0 && !entry[t] && img->insn[t].fn < 0)
+                stack[sp++] = t;
+            if (!bl31_falls_through(in->word))
+                break;
+            j = bl31_next(img, j);
+        }
+    }
+}
+
+// unowned runs between a function's code and the next entry, ending in a
+// return or jump: jump table cases (br xN ends the descent)
+static void bl31_claim_orphans(struct bl31_image * img, const unsigned char * entry)
+{
+    int i = 0;
+
+    while (i < img->n_insn)
+    {
+        int start = i, f, ok = 1;
+
+        if (img->insn[i].fn >= 0)
+        {
+            i++;
+            continue;
+        }
+        while (i < img->n_insn && img->insn[i].fn < 0 && img->insn[i].sec == img->insn[start].sec
+            && !(i > start && entry[i]))
+        {
+            if (!(img->insn[i].flags & BL31_INSN_VALID) || (i > start && img->insn[i].addr != img->insn[i - 1].addr + 4))
+                ok = 0;
+            i++;
+        }
+        if (!ok || start == img->sec[img->insn[start].sec].first || entry[start]
+            || img->insn[start - 1].sec != img->insn[start].sec
+            || (f = img->insn[start - 1].fn) < 0 || bl31_falls_through(img->insn[i - 1].word))
+            continue;
+        for (int j = start; j < i; j++)
+            img->insn[j].fn = f;
+    }
+}
+
+//====================== functions end ==============================================
+
+//====================== normalize ==================================================
+
+struct bl31_ctx
+{
+    struct bl31_image * img;
+    struct bl31_func * f;
+    int fi;
+    const int * block_of;               // insn -> block number in f, or -1
+};
+
+static void bl31_quote(char * out, size_t size, const char * s)
+{
+    size_t n = 0;
+
+    if (size < 8)
+    {
+        *out = '\0';
+        return;
+    }
+    out[n++] = '"';
+    for (; *s && n + 5 < size; s++)
+    {
+        if (*s == '\n' || *s == '\t' || *s == '"' || *s == '\\' || *s == '\r')
+        {
+            out[n++] = '\\';
+            out[n++] = *s == '\n' ? 'n' : *s == '\t' ? 't' : *s == '\r' ? 'r' : *s;
+        }
+        else
+            out[n++] = *s;
+    }
+    if (*s)
+    {
+        out[n++] = '.';
+        out[n++] = '.';
+    }
+    out[n++] = '"';
+    out[n] = '\0';
+}
+
+// linker end symbols (__BSS_END__ and friends) point one past a section
+static int bl31_section_ending(const struct bl31_image * img, uint64_t addr)
+{
+    int i;
+
+    for (i = 0; i < img->n_sec; i++)
+        if (img->sec[i].addr + img->sec[i].size == addr)
+            return i;
+    return -1;
+}
+
+// address -> symbolic operand; sets *ref for a function entry
+static void bl31_symbol(struct bl31_ctx * c, uint64_t addr, int sec, int * ref, char * out, size_t size)
+{
+    struct bl31_image * img = c->img;
+    const char * str;
+    int t = bl31_insn_at(img, addr, sec), s;
+
+    if (t >= 0 && img->insn[t].flags & BL31_INSN_ENTRY)
+    {
+        *ref = img->insn[t].fn;
+        snprintf(out, size, "%c", BL31_FN_REF);
+    }
+    else if (t >= 0 && img->insn[t].fn == c->fi && c->block_of[t] >= 0)
+        snprintf(out, size, ".L%d", c->block_of[t]);
+    else if (t >= 0 && img->insn[t].fn == c->fi)
+        snprintf(out, size, ".+%d", (int)(addr - c->f->addr));
+    else if ((str = bl31_string_at(img, addr)))
+    {
+        bl31_quote(out, size, str);
+        if (!c->f->label)
+            c->f->label = str;
+    }
+    else if ((s = bl31_section_of(img, addr, sec)) >= 0)
+        snprintf(out, size, "<%s>", img->sec[s].name);
+    else if ((s = bl31_section_ending(img, addr)) >= 0)
+        snprintf(out, size, "<%s_end>", img->sec[s].name);
+    else
+        snprintf(out, size, "0x%llx", (unsigned long long)addr);
+}
+
+uint32_t bl31_writes(const struct bl31_insn * in)
+{
+    static const char * const s_no_dest[] = {
+        "cmp", "cmn", "tst", "cbz", "cbnz", "tbz", "tbnz", "b", "bl", "br", "blr", "ret",
+        "msr", "prfm", "dc", "ic", "tlbi", "at", "sys", "hint", "nop", "isb", "dsb", "dmb",
+        "eret", "wfi", "wfe", "sev", "sevl", "smc", "hvc", "svc", "ccmp", "ccmn", NULL };
+    const char * t = in->text, * ops = strchr(t, ' ');
+    size_t mlen = ops ? (size_t)(ops - t) : strlen(t);
+    uint32_t mask = 0;
+    const char * p;
+    int i;
+
+    if (bl31_is_call(in->word) || (in->word & 0xfffffc1f) == 0xd63f0000)
+        return 0x4007ffff;              // x0-x18 and x30 are caller-saved
+    if (!ops)
+        return 0;
+    for (i = 0; s_no_dest[i]; i++)
+        if (strlen(s_no_dest[i]) == mlen && !strncmp(t, s_no_dest[i], mlen))
+            return 0;
+    if (!strncmp(t, "b.", 2))
+        return 0;
+
+    ops++;
+    if (t[0] != 's' || t[1] != 't')     // stores name no destination
+    {
+        if ((ops[0] == 'x' || ops[0] == 'w') && isdigit((unsigned char)ops[1]))
+            mask |= 1u << atoi(ops + 1);
+        if (!strncmp(t, "ldp", 3) || !strncmp(t, "ldnp", 4) || !strncmp(t, "ldxp", 4) || !strncmp(t, "ldaxp", 5))
+        {
+            p = strchr(ops, ',');
+            if (p && (p[2] == 'x' || p[2] == 'w') && isdigit((unsigned char)p[3]))
+                mask |= 1u << atoi(p + 3);
+        }
+    }
+    // writeback: [xN, #imm]! and [xN], #imm
+    if ((p = strchr(ops, '[')) && p[1] == 'x' && isdigit((unsigned char)p[2])
+        && (strstr(p, "]!") || strstr(p, "], ")))
+        mask |= 1u << atoi(p + 2);
+    return mask & 0x7fffffff;
+}
+
+// norm = first plen chars of the listed text + rest
+static void bl31_set_norm(struct bl31_insn * in, const char * text, int plen, const char * rest)
+{
+    size_t n = plen < (int)sizeof(in->norm) ? (size_t)plen : sizeof(in->norm) - 1;
+
+    memcpy(in->norm, text, n);
+    in->norm[n] = '\0';
+    strncat(in->norm, rest, sizeof(in->norm) - n - 1);
+}
+
+static void bl31_normalize(struct bl31_ctx * c, struct bl31_insn * in, uint64_t * val, uint32_t * live)
+{
+    char sym[BL31_SYM_LEN], rest[BL31_NORM_LEN];
+    const char * t = in->text;
+    const unsigned char * lit;
+    uint64_t target, value;
+    int rd, rn, size, load;
+    uint32_t imm, kill = bl31_writes(in);
+    const char * p;
+
+    in->ref = -1;
+    in->data = 0;
+    if (!(in->flags & BL31_INSN_VALID))
+        snprintf(in->norm, sizeof(in->norm), "%s", t);
+    else if (bl31_branch_target(in->word, in->addr, &target) && (p = strstr(t, "0x")))
+    {
+        bl31_symbol(c, target, in->sec, &in->ref, sym, sizeof(sym));
+        bl31_set_norm(in, t, p - t, sym);
+    }
+    else if (bl31_adrp(in->word, in->addr, &rd, &target))
+    {
+        // the page alone says little; its users below name the target
+        snprintf(in->norm, sizeof(in->norm), "adrp x%d, @page", rd);
+        val[rd] = target;
+        *live = (*live & ~kill) | 1u << rd;
+        return;
+    }
+    else if (bl31_adr(in->word, in->addr, &rd, &target))
+    {
+        in->data = target;
+        bl31_symbol(c, target, in->sec, &in->ref, sym, sizeof(sym));
+        snprintf(in->norm, sizeof(in->norm), "adr x%d, %s", rd, sym);
+    }
+    else if (bl31_ldr_literal(in->word, in->addr, &rd, &target, &size) && (p = strstr(t, "0x")))
+    {
+        if ((lit = bl31_bytes(c->img, target, size, in->sec)))
+        {
+            value = 0;
+            memcpy(&value, lit, size);
+            in->data = value;
+            if (bl31_section_of(c->img, value, -1) >= 0)
+                bl31_symbol(c, value, -1, &in->ref, sym, sizeof(sym));
+            else
+                snprintf(sym, sizeof(sym), "0x%llx", (unsigned long long)value);
+            snprintf(rest, sizeof(rest), "=%s", sym);
+            bl31_set_norm(in, t, p - t, rest);
+        }
+        else
+            bl31_set_norm(in, t, p - t, "<literal>");
+    }
+    else if (bl31_add_imm(in->word, &rd, &rn, &imm) && rn != 31 && *live & 1u << rn
+        && (p = strchr(t, '#')))
+    {
+        in->data = val[rn] + imm;
+        bl31_symbol(c, val[rn] + imm, in->sec, &in->ref, sym, sizeof(sym));
+        snprintf(rest, sizeof(rest), "#%s", sym);
+        bl31_set_norm(in, t, p - t, rest);
+        // keep following the address: section-anchored globals are reached
+        // as [anchor, #offset] and the offsets move with the layout
+        val[rd] = val[rn] + imm;
+        *live = (*live & ~kill) | 1u << rd;
+        return;
+    }
+    else if (bl31_ldst_uimm(in->word, &rd, &rn, &imm, &load) && rn != 31 && *live & 1u << rn
+        && (p = strchr(t, '[')))
+    {
+        in->data = val[rn] + imm;
+        bl31_symbol(c, val[rn] + imm, in->sec, &in->ref, sym, sizeof(sym));
+        snprintf(rest, sizeof(rest), "[x%d, #%s]", rn, sym);
+        bl31_set_norm(in, t, p - t, rest);
+    }
+    else
+        snprintf(in->norm, sizeof(in->norm), "%s", t);
+    *live &= ~kill;
+}
+
+void bl31_render(const struct bl31_insn * insn, char * out, size_t size,
+    const char * (*fn_name)(void * ctx, int fn), void * ctx)
+{
+    const char * p = strchr(insn->norm, BL31_FN_REF);
+
+    if (!p || insn->ref < 0)
+        snprintf(out, size, "%s", insn->norm);
+    else
+        snprintf(out, size, "%.*s%s%s", (int)(p - insn->norm), insn->norm, fn_name(ctx, insn->ref), p + 1);
+}
+
+//====================== normalize end ==============================================
+
+//====================== analysis ===================================================
+
+// register addresses known on entry to a block, merged over the forward
+// branches into it; registers that disagree are dropped
+struct bl31_regs
+{
+    uint64_t val[32];
+    uint32_t live;
+    int set;
+};
+
+static void bl31_merge(struct bl31_regs * into, const uint64_t * val, uint32_t live)
+{
+    int r;
+
+    if (!into->set)
+    {
+        memcpy(into->val, val, sizeof(into->val));
+        into->live = live;
+        into->set = 1;
+        return;
+    }
+    into->live &= live;
+    for (r = 0; r < 32; r++)
+        if (into->live & 1u << r && into->val[r] != val[r])
+            into->live &= ~(1u << r);
+}
+
+static void bl31_blocks(struct bl31_image * img, int fi, int * block_of)
+{
+    struct bl31_func * f = &img->fn[fi];
+    struct bl31_regs * in_regs;
+    uint64_t val[32];                   // address held by each live register
+    uint32_t live = 0;
+    struct bl31_ctx c = { img, f, fi, block_of };
+    int k, n = 0, pass;
+
+    // leaders: entry, branch targets, after a branch, after a hole
+    for (k = 0; k < f->n_insns; k++)
+    {
+        struct bl31_insn * in = &img->insn[f->insns[k]];
+        uint64_t target;
+        int t;
+
+        if (k == 0 || img->insn[f->insns[k - 1]].addr + 4 != in->addr)
+            in->flags |= BL31_INSN_LEADER;
+        if (bl31_is_call(in->word))
+            continue;
+        if (bl31_branch_target(in->word, in->addr, &target)
+            && (t = bl31_insn_at(img, target, in->sec)) >= 0 && img->insn[t].fn == fi)
+            img->insn[t].flags |= BL31_INSN_LEADER;
+        if ((bl31_is_cond(in->word) || !bl31_falls_through(in->word)) && k + 1 < f->n_insns)
+            img->insn[f->insns[k + 1]].flags |= BL31_INSN_LEADER;
+    }
+    for (k = 0; k < f->n_insns; k++)
+        if (img->insn[f->insns[k]].flags & BL31_INSN_LEADER)
+            block_of[f->insns[k]] = n++;
+
+    f->blocks = calloc(n, sizeof(*f->blocks));
+    f->block_len = calloc(n, sizeof(*f->block_len));
+    f->n_blocks = n;
+    f->hash = BL31_HASH_INIT;
+    in_regs = calloc(n, sizeof(*in_regs));
+    // second pass sees what loop back-edges carried in the first
+    for (pass = 0; pass < 2; pass++)
+    {
+        live = 0;
+        n = -1;
+        for (k = 0; k < f->n_insns; k++)
+        {
+            struct bl31_insn * in = &img->insn[f->insns[k]];
+            uint64_t target;
+            int t;
+
+            if (in->flags & BL31_INSN_LEADER)
+            {
+                struct bl31_insn * prev = k ? &img->insn[f->insns[k - 1]] : NULL;
+                if (prev && prev->addr + 4 == in->addr && (prev->flags & BL31_INSN_VALID)
+                    && bl31_falls_through(prev->word))
+                    bl31_merge(&in_regs[n + 1], val, live);
+                memcpy(val, in_regs[n + 1].val, sizeof(val));
+                live = in_regs[n + 1].live;
+                n++;
+                if (pass)
+                    f->blocks[n] = BL31_HASH_INIT;
+            }
+            bl31_normalize(&c, in, val, &live);
+            if (!bl31_is_call(in->word) && bl31_branch_target(in->word, in->addr, &target)
+                && (t = bl31_insn_at(img, target, in->sec)) >= 0 && block_of[t] >= 0 && img->insn[t].fn == fi)
+                bl31_merge(&in_regs[block_of[t]], val, live);
+            if (pass)
+            {
+                f->blocks[n] = bl31_hash(f->blocks[n], in->norm, strlen(in->norm) + 1);
+                f->block_len[n]++;
+            }
+        }
+    }
+    for (k = 0; k < f->n_blocks; k++)
+        f->hash = bl31_hash(f->hash, &f->blocks[k], sizeof(f->blocks[k]));
+    free(in_regs);
+}
+
+void bl31_analyze(struct bl31_image * img)
+{
+    unsigned char * entry = calloc(img->n_insn, 1);
+    unsigned char * seen = calloc(img->n_insn, 1);
+    unsigned char * root = malloc(img->n_insn);
+    int * stack = malloc(img->n_insn * sizeof(int) * 2);
+    int * block_of = malloc(img->n_insn * sizeof(int));
+    int i, t;
+
+    // seeds: ELF entry point and the start of every code section
+    if ((t = bl31_insn_at(img, img->entry, -1)) >= 0)
+        entry[t] = 1;
+    for (i = 0; i < img->n_sec; i++)
+        if (img->sec[i].count)
+            entry[img->sec[i].first] = 1;
+    do
+    {
+        do
+        {
+            while (bl31_descend(img, entry, entry, seen, stack))
+                ;
+        }
+        while (bl31_pointer_seeds(img, entry, seen) + bl31_prologue_seeds(img, entry, seen));
+
+        free(img->fn);
+        img->n_fn = 0;
+        for (i = 0; i < img->n_insn; i++)
+        {
+            if (!(img->insn[i].flags & BL31_INSN_VALID))
+                entry[i] = 0;
+            img->n_fn += entry[i];
+            img->insn[i].fn = -1;
+            img->insn[i].flags &= ~BL31_INSN_ENTRY;
+        }
+        img->fn = calloc(img->n_fn, sizeof(*img->fn));
+        img->n_fn = 0;
+        for (i = 0; i < img->n_insn; i++)
+        {
+            if (!entry[i])
+                continue;
+            img->fn[img->n_fn].addr = img->insn[i].addr;
+            img->fn[img->n_fn].sec = img->insn[i].sec;
+            img->fn[img->n_fn].entry = i;
+            img->insn[i].flags |= BL31_INSN_ENTRY;
+            img->n_fn++;
+        }
+        for (i = 0; i < img->n_fn; i++)
+            bl31_claim(img, i, entry, stack);
+        bl31_claim_orphans(img, entry);
+
+        // jump table cases were never descended: their calls are entries too
+        for (i = 0; i < img->n_insn; i++)
+            root[i] = img->insn[i].fn >= 0 && !seen[i];
+    }
+    while (bl31_descend(img, root, entry, seen, stack));
+
+    // owned instruction lists, in address order
+    for (i = 0; i < img->n_insn; i++)
+        if (img->insn[i].fn >= 0)
+            img->fn[img->insn[i].fn].n_insns++;
+    for (i = 0; i < img->n_fn; i++)
+    {
+        img->fn[i].insns = malloc(img->fn[i].n_insns * sizeof(int));
+        img->fn[i].n_insns = 0;
+    }
+    for (i = 0; i < img->n_insn; i++)
+    {
+        block_of[i] = -1;
+        if (img->insn[i].fn >= 0)
+        {
+            struct bl31_func * f = &img->fn[img->insn[i].fn];
+            f->insns[f->n_insns++] = i;
+        }
+    }
+    for (i = 0; i < img->n_fn; i++)
+        bl31_blocks(img, i, block_of);
+
+    free(entry);
+    free(seen);
+    free(root);
+    free(stack);
+    free(block_of);
+}
+
+//====================== analysis end ===============================================
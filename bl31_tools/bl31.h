@@ -0,0 +1,130 @@
+// Miyoo Flip — host model of a stripped rk3568 BL31 image.
+//
+// Loads the ELF (section table + bytes) and the matching objdump listing
+// (bl31_v1.4x_full.S), recovers function boundaries and renders every
+// instruction in an address-independent form:
+//
+//   bl  0x627cc                 -> bl  <fn>           callee, resolved later
+//   adrp x0, 0x66000            -> adrp x0, @page
+//   add  x0, x0, #0xf42         -> add  x0, x0, #"WAKEUP SOURCE"
+//   ldr  w1, [x0, #1774]        -> ldr  w1, [x0, #<.data_sram_init>]
+//   ldr  x5, 0xfdcd00d8         -> ldr  x5, =0xfdc20000  (literal pool value)
+//   b.ne 0xfdcc14b0             -> b.ne .L3            block of this function
+//
+// Shared by the tools in this directory; nothing here is rk3568-specific
+// beyond the section names it prints.
+
+#ifndef BL31_H
+#define BL31_H
+
+#include<stdint.h>
+#include<stddef.h>
+
+#define BL31_MAX_SECTIONS   32
+#define BL31_NORM_LEN       96
+#define BL31_SYM_LEN        64
+#define BL31_FN_REF         '\x01'      // placeholder for a function reference in norm[]
+
+// section flags
+#define BL31_SEC_EXEC       0x1
+#define BL31_SEC_WRITE      0x2
+#define BL31_SEC_NOBITS     0x4
+
+// instruction flags
+#define BL31_INSN_VALID     0x1         // not .inst / udf
+#define BL31_INSN_LEADER    0x2         // starts a basic block
+#define BL31_INSN_ENTRY     0x4         // function entry
+
+struct bl31_section
+{
+    char name[32];
+    uint64_t addr;
+    uint64_t size;
+    uint64_t offset;                    // file offset, unused for NOBITS
+    int flags;
+    int first, count;                   // listing instructions, code sections only
+};
+
+struct bl31_insn
+{
+    uint64_t addr;
+    uint32_t word;
+    short sec;
+    short flags;
+    int fn;                             // owning function, -1 if unreached
+    int ref;                            // function referenced by norm, -1 if none
+    uint64_t data;                      // address a data operand resolves to, 0 if none
+    const char * text;                  // "mnemonic operands" as listed
+    char norm[BL31_NORM_LEN];
+};
+
+struct bl31_func
+{
+    uint64_t addr;
+    int sec;
+    int entry;                          // instruction index
+    int * insns;                        // owned instructions, address order
+    int n_insns;
+    uint64_t * blocks;                  // basic-block hashes, address order
+    int * block_len;
+    int n_blocks;
+    uint64_t hash;                      // shape: callees hashed as "<fn>"
+    const char * label;                 // first string referenced, or NULL
+};
+
+struct bl31_image
+{
+    char name[64];                      // "v1.44", from the file name
+    char listing_path[256], elf_path[256];
+    unsigned char * elf;
+    size_t elf_size;
+    uint64_t entry;
+    struct bl31_section sec[BL31_MAX_SECTIONS];
+    int n_sec;
+    struct bl31_insn * insn;
+    int n_insn;
+    struct bl31_func * fn;
+    int n_fn;
+    char * text_pool;
+};
+
+// load <dir>/*_full.S and <dir>/*.elf, or a listing and an ELF given directly;
+// returns 0 or -1 with a message on stderr
+int bl31_load(struct bl31_image * img, const char * listing, const char * elf);
+int bl31_load_dir(struct bl31_image * img, const char * dir);
+void bl31_free(struct bl31_image * img);
+
+// find functions, split blocks, fill insn.norm / fn.hash
+void bl31_analyze(struct bl31_image * img);
+
+// bytes at a virtual address; prefers section `sec` where VMAs overlap
+// (.text_pmusram and .text_pmusram_reuse both sit at 0xfdcd0000)
+const unsigned char * bl31_bytes(const struct bl31_image * img, uint64_t addr, size_t len, int sec);
+int bl31_section_of(const struct bl31_image * img, uint64_t addr, int prefer);
+int bl31_insn_at(const struct bl31_image * img, uint64_t addr, int sec);
+int bl31_func_at(const struct bl31_image * img, uint64_t addr, int sec);
+
+// NUL-terminated printable string starting at addr (at least 3 chars), else NULL
+const char * bl31_string_at(const struct bl31_image * img, uint64_t addr);
+
+// A64 decode helpers, on the raw instruction word
+int bl31_is_call(uint32_t w);
+int bl31_is_jump(uint32_t w);           // b
+int bl31_is_cond(uint32_t w);           // b.cond, cbz/cbnz, tbz/tbnz
+int bl31_is_stop(uint32_t w);           // ret, br, eret
+int bl31_branch_target(uint32_t w, uint64_t pc, uint64_t * target);
+int bl31_adrp(uint32_t w, uint64_t pc, int * rd, uint64_t * target);
+int bl31_adr(uint32_t w, uint64_t pc, int * rd, uint64_t * target);
+int bl31_ldr_literal(uint32_t w, uint64_t pc, int * rt, uint64_t * target, int * size);
+
+// x registers a listed instruction writes, as a bitmask (bl: x0-x18, x30)
+uint32_t bl31_writes(const struct bl31_insn * in);
+
+uint64_t bl31_hash(uint64_t h, const void * data, size_t len);
+#define BL31_HASH_INIT      0xcbf29ce484222325ull
+
+// render insn.norm with function references replaced by fn_name(ctx, index)
+void bl31_render(const struct bl31_insn * insn, char * out, size_t size,
+    const char * (*fn_name)(void * ctx, int fn), void * ctx);
+
+#endif
@@ -0,0 +1,579 @@
+// Function-level diff of two BL31 builds with addresses taken out.
+//
+// Both images are loaded from their objdump listing + ELF (bl31.h), split
+// into functions and rendered with symbolic operands, so a relocated
+// adrp/add pair or a shifted bl target compares equal. Functions are paired
+// in rounds:
+//
+//   1. identical shape hash (hash of basic-block hashes), unique on both sides
+//   2. same first referenced string, unique on both sides
+//   3. callees at the same position in an already paired caller, and a lone
+//      unpaired function between two pairs in address order
+//   4. best basic-block overlap (weighted by block size) >= 50 %, same section
+//
+// Calls to paired functions print under the old build's name, so a pair
+// differs only if the code or what it calls changed. Only those pairs, and
+// the functions with no partner, are printed.
+//
+//   make
+//   ./build/bl31_diff ../bl31_v1.44_stock_disasm ../bl31_v1.45_rocknix_disasm
+//   ./build/bl31_diff -c 1 -f suspend old_dir new_dir
+//   ./build/bl31_diff -s old_dir new_dir            (summary and lists only)
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<time.h>
+
+#include "bl31.h"
+
+#define DIFF_NAME_LEN       96
+#define DIFF_LINE_LEN       160
+#define DIFF_MAX_CELLS      (64 * 1024 * 1024)
+#define DIFF_MIN_SIMILARITY 0.5
+
+struct diff_side
+{
+    struct bl31_image img;
+    int * pair;                         // partner function index, -1 if none
+    char (*name)[DIFF_NAME_LEN];
+};
+
+static struct diff_side s_old, s_new;
+static int s_context = 3;
+static int s_summary;
+static const char * s_filter;
+
+static double diff_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//====================== matching ===================================================
+
+static void diff_pair(int a, int b)
+{
+    s_old.pair[a] = b;
+    s_new.pair[b] = a;
+}
+
+struct diff_key
+{
+    uint64_t key;
+    int fn;
+};
+
+static int diff_cmp_key(const void * a, const void * b)
+{
+    const struct diff_key * x = a, * y = b;
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+    return x->fn - y->fn;
+}
+
+// pair functions whose key is unique on both sides; key 0 never pairs
+static int diff_match_unique(uint64_t (*key)(const struct bl31_image *, int))
+{
+    struct diff_key * a = malloc(s_old.img.n_fn * sizeof(*a));
+    struct diff_key * b = malloc(s_new.img.n_fn * sizeof(*b));
+    int na = 0, nb = 0, i = 0, j = 0, found = 0;
+
+    for (int k = 0; k < s_old.img.n_fn; k++)
+        if (s_old.pair[k] < 0 && (a[na].key = key(&s_old.img, k)))
+            a[na++].fn = k;
+    for (int k = 0; k < s_new.img.n_fn; k++)
+        if (s_new.pair[k] < 0 && (b[nb].key = key(&s_new.img, k)))
+            b[nb++].fn = k;
+    qsort(a, na, sizeof(*a), diff_cmp_key);
+    qsort(b, nb, sizeof(*b), diff_cmp_key);
+
+    while (i < na && j < nb)
+    {
+        int ei = i, ej = j;
+
+        if (a[i].key != b[j].key)
+        {
+            if (a[i].key < b[j].key)
+                i++;
+            else
+                j++;
+            continue;
+        }
+        while (ei < na && a[ei].key == a[i].key)
+            ei++;
+        while (ej < nb && b[ej].key == b[j].key)
+            ej++;
+        if (ei - i == 1 && ej - j == 1)
+        {
+            diff_pair(a[i].fn, b[j].fn);
+            found++;
+        }
+        i = ei;
+        j = ej;
+    }
+    free(a);
+    free(b);
+    return found;
+}
+
+static uint64_t diff_key_shape(const struct bl31_image * img, int f)
+{
+    return img->fn[f].hash;
+}
+
+static uint64_t diff_key_label(const struct bl31_image * img, int f)
+{
+    const char * l = img->fn[f].label;
+    return l ? bl31_hash(BL31_HASH_INIT, l, strlen(l)) : 0;
+}
+
+// functions referenced by f, in address order
+static int diff_refs(const struct bl31_image * img, int f, int * out, int max)
+{
+    int n = 0;
+
+    for (int k = 0; k < img->fn[f].n_insns && n < max; k++)
+    {
+        int r = img->insn[img->fn[f].insns[k]].ref;
+        if (r >= 0)
+            out[n++] = r;
+    }
+    return n;
+}
+
+static int diff_match_neighbours()
+{
+    int ra[256], rb[256], found = 0;
+
+    for (int a = 0; a < s_old.img.n_fn; a++)
+    {
+        int b = s_old.pair[a], na, nb;
+
+        if (b < 0)
+            continue;
+        na = diff_refs(&s_old.img, a, ra, 256);
+        nb = diff_refs(&s_new.img, b, rb, 256);
+        if (na != nb)
+            continue;
+        for (int k = 0; k < na; k++)
+            if (s_old.pair[ra[k]] < 0 && s_new.pair[rb[k]] < 0
+                && !strcmp(s_old.img.sec[s_old.img.fn[ra[k]].sec].name, s_new.img.sec[s_new.img.fn[rb[k]].sec].name))
+            {
+                diff_pair(ra[k], rb[k]);
+                found++;
+            }
+    }
+
+    // a single unpaired function on each side between two consecutive pairs
+    for (int a = 0, prev = -1; a < s_old.img.n_fn; a++)
+    {
+        int b = s_old.pair[a];
+
+        if (b < 0)
+            continue;
+        if (prev >= 0 && a - prev == 2 && b - s_old.pair[prev] == 2
+            && s_old.pair[a - 1] < 0 && s_new.pair[b - 1] < 0
+            && s_old.img.fn[a - 1].sec == s_old.img.fn[a].sec)
+        {
+            diff_pair(a - 1, b - 1);
+            found++;
+        }
+        prev = a;
+    }
+    return found;
+}
+
+static int diff_cmp_u64(const void * a, const void * b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// block hashes sorted, each block repeated once per instruction, so the
+// overlap is counted in instructions
+static uint64_t * diff_block_bag(const struct bl31_func * f)
+{
+    uint64_t * bag = malloc((f->n_insns + 1) * sizeof(*bag));
+    int n = 0;
+
+    for (int k = 0; k < f->n_blocks; k++)
+        for (int r = 0; r < f->block_len[k]; r++)
+            bag[n++] = f->blocks[k];
+    qsort(bag, n, sizeof(*bag), diff_cmp_u64);
+    return bag;
+}
+
+struct diff_cand
+{
+    double score;
+    int a, b;
+};
+
+static int diff_cmp_cand(const void * x, const void * y)
+{
+    const struct diff_cand * p = x, * q = y;
+    if (p->score != q->score)
+        return p->score > q->score ? -1 : 1;
+    return p->a != q->a ? p->a - q->a : p->b - q->b;
+}
+
+static int diff_match_similar()
+{
+    uint64_t ** bag_a = calloc(s_old.img.n_fn, sizeof(*bag_a));
+    uint64_t ** bag_b = calloc(s_new.img.n_fn, sizeof(*bag_b));
+    struct diff_cand * cand = NULL;
+    int n = 0, cap = 0, found = 0;
+
+    for (int a = 0; a < s_old.img.n_fn; a++)
+        if (s_old.pair[a] < 0)
+            bag_a[a] = diff_block_bag(&s_old.img.fn[a]);
+    for (int b = 0; b < s_new.img.n_fn; b++)
+        if (s_new.pair[b] < 0)
+            bag_b[b] = diff_block_bag(&s_new.img.fn[b]);
+
+    for (int a = 0; a < s_old.img.n_fn; a++)
+    {
+        const struct bl31_func * fa = &s_old.img.fn[a];
+
+        if (!bag_a[a])
+            continue;
+        for (int b = 0; b < s_new.img.n_fn; b++)
+        {
+            const struct bl31_func * fb = &s_new.img.fn[b];
+            int i = 0, j = 0, common = 0;
+
+            if (!bag_b[b] || fa->n_insns > 2 * fb->n_insns || fb->n_insns > 2 * fa->n_insns
+                || strcmp(s_old.img.sec[fa->sec].name, s_new.img.sec[fb->sec].name))
+                continue;
+            while (i < fa->n_insns && j < fb->n_insns)
+            {
+                if (bag_a[a][i] == bag_b[b][j])
+                {
+                    common++;
+                    i++;
+                    j++;
+                }
+                else if (bag_a[a][i] < bag_b[b][j])
+                    i++;
+                else
+                    j++;
+            }
+            if (2.0 * common / (fa->n_insns + fb->n_insns) < DIFF_MIN_SIMILARITY)
+                continue;
+            if (n == cap)
+            {
+                cap = cap ? cap * 2 : 1024;
+                cand = realloc(cand, cap * sizeof(*cand));
+            }
+            cand[n].score = 2.0 * common / (fa->n_insns + fb->n_insns);
+            cand[n].a = a;
+            cand[n].b = b;
+            n++;
+        }
+    }
+    qsort(cand, n, sizeof(*cand), diff_cmp_cand);
+    for (int k = 0; k < n; k++)
+        if (s_old.pair[cand[k].a] < 0 && s_new.pair[cand[k].b] < 0)
+        {
+            diff_pair(cand[k].a, cand[k].b);
+            found++;
+        }
+
+    for (int a = 0; a < s_old.img.n_fn; a++)
+        free(bag_a[a]);
+    for (int b = 0; b < s_new.img.n_fn; b++)
+        free(bag_b[b]);
+    free(bag_a);
+    free(bag_b);
+    free(cand);
+    return found;
+}
+
+static void diff_match()
+{
+    diff_match_unique(diff_key_shape);
+    diff_match_unique(diff_key_label);
+    while (diff_match_neighbours())
+        ;
+    diff_match_similar();
+    while (diff_match_neighbours())
+        ;
+}
+
+//====================== matching end ===============================================
+
+//====================== output =====================================================
+
+static void diff_names(struct diff_side * side, int is_new)
+{
+    const struct bl31_image * img = &side->img;
+
+    side->name = calloc(img->n_fn, sizeof(*side->name));
+    for (int f = 0; f < img->n_fn; f++)
+    {
+        const struct bl31_func * fn = &img->fn[f];
+        char * out = side->name[f];
+        int overlap = 0;
+
+        if (is_new && side->pair[f] >= 0)
+        {
+            memcpy(out, s_old.name[side->pair[f]], DIFF_NAME_LEN);
+            continue;
+        }
+        // .text_pmusram and .text_pmusram_reuse share VMAs
+        for (int s = 0; s < img->n_sec; s++)
+            if (s != fn->sec && img->sec[s].count && fn->addr - img->sec[s].addr < img->sec[s].size)
+                overlap = 1;
+        snprintf(out, DIFF_NAME_LEN, "%s%s%llx%s%s", is_new ? img->name : "", is_new ? ":fn_" : "fn_",
+            (unsigned long long)fn->addr, overlap ? "@" : "", overlap ? img->sec[fn->sec].name : "");
+    }
+}
+
+static const char * diff_fn_name(void * ctx, int f)
+{
+    return ((struct diff_side *)ctx)->name[f];
+}
+
+// rendered lines of f and their hashes
+static char (*diff_lines(struct diff_side * side, int f, uint64_t ** hash))[DIFF_LINE_LEN]
+{
+    const struct bl31_func * fn = &side->img.fn[f];
+    char (*lines)[DIFF_LINE_LEN] = malloc((fn->n_insns + 1) * sizeof(*lines));
+
+    *hash = malloc((fn->n_insns + 1) * sizeof(**hash));
+    for (int k = 0; k < fn->n_insns; k++)
+    {
+        bl31_render(&side->img.insn[fn->insns[k]], lines[k], DIFF_LINE_LEN, diff_fn_name, side);
+        (*hash)[k] = bl31_hash(BL31_HASH_INIT, lines[k], strlen(lines[k]));
+    }
+    return lines;
+}
+
+static const char * diff_label(const struct bl31_func * f, char * buf, size_t size)
+{
+    const char * l = f->label;
+    size_t n = 0;
+
+    if (!l)
+        return "";
+    while (*l == '\n' || *l == ' ')
+        l++;
+    buf[n++] = ' ';
+    buf[n++] = ' ';
+    buf[n++] = '"';
+    for (; *l && *l != '\n' && n + 4 < size; l++)
+        buf[n++] = *l;
+    buf[n++] = '"';
+    buf[n] = '\0';
+    return buf;
+}
+
+static int diff_wanted(const struct diff_side * side, int f)
+{
+    const struct bl31_func * fn = &side->img.fn[f];
+    return !s_filter || strstr(side->name[f], s_filter) || (fn->label && strstr(fn->label, s_filter));
+}
+
+enum { DIFF_SAME, DIFF_DEL, DIFF_ADD };
+
+struct diff_op
+{
+    int type, a, b;
+};
+
+// LCS edit script between two line-hash arrays
+static struct diff_op * diff_script(const uint64_t * ha, int na, const uint64_t * hb, int nb, int * n_ops)
+{
+    int * lcs = malloc((size_t)(na + 1) * (nb + 1) * sizeof(int));
+    struct diff_op * ops = malloc((na + nb + 1) * sizeof(*ops));
+    int i, j, n = 0;
+#define LCS(i, j) lcs[(size_t)(i) * (nb + 1) + (j)]
+
+    for (i = na; i >= 0; i--)
+        for (j = nb; j >= 0; j--)
+        {
+            if (i == na || j == nb)
+                LCS(i, j) = 0;
+            else if (ha[i] == hb[j])
+                LCS(i, j) = LCS(i + 1, j + 1) + 1;
+            else
+                LCS(i, j) = LCS(i + 1, j) > LCS(i, j + 1) ? LCS(i + 1, j) : LCS(i, j + 1);
+        }
+    for (i = j = 0; i < na || j < nb; )
+    {
+        if (i < na && j < nb && ha[i] == hb[j])
+            ops[n++] = (struct diff_op){ DIFF_SAME, i++, j++ };
+        else if (i < na && (j == nb || LCS(i + 1, j) >= LCS(i, j + 1)))
+            ops[n++] = (struct diff_op){ DIFF_DEL, i++, j };
+        else
+            ops[n++] = (struct diff_op){ DIFF_ADD, i, j++ };
+    }
+#undef LCS
+    free(lcs);
+    *n_ops = n;
+    return ops;
+}
+
+// prints the pair if it differs; returns 1 if it does
+static int diff_function(int a, int b)
+{
+    const struct bl31_func * fa = &s_old.img.fn[a], * fb = &s_new.img.fn[b];
+    uint64_t * ha, * hb;
+    char (*la)[DIFF_LINE_LEN] = diff_lines(&s_old, a, &ha);
+    char (*lb)[DIFF_LINE_LEN] = diff_lines(&s_new, b, &hb);
+    struct diff_op * ops;
+    int n_ops, adds = 0, dels = 0, last = -1, k, changed;
+    char label[64];
+
+    changed = fa->n_insns != fb->n_insns || memcmp(ha, hb, fa->n_insns * sizeof(*ha));
+    if (!changed || !diff_wanted(&s_old, a))
+        goto out;
+    if ((size_t)(fa->n_insns + 1) * (fb->n_insns + 1) > DIFF_MAX_CELLS)
+    {
+        printf("~ %s -> %s 0x%llx%s  (%d -> %d insns, too large to diff)\n", s_old.name[a],
+            s_new.img.name, (unsigned long long)fb->addr, diff_label(fa, label, sizeof(label)),
+            fa->n_insns, fb->n_insns);
+        goto out;
+    }
+
+    ops = diff_script(ha, fa->n_insns, hb, fb->n_insns, &n_ops);
+    for (k = 0; k < n_ops; k++)
+    {
+        adds += ops[k].type == DIFF_ADD;
+        dels += ops[k].type == DIFF_DEL;
+    }
+    printf("~ %s -> %s 0x%llx%s  (+%d -%d, %d -> %d insns)\n", s_old.name[a], s_new.img.name,
+        (unsigned long long)fb->addr, diff_label(fa, label, sizeof(label)), adds, dels,
+        fa->n_insns, fb->n_insns);
+    if (!s_summary)
+    {
+        for (k = 0; k < n_ops; k++)
+        {
+            int near = 0;
+
+            for (int d = k - s_context; d <= k + s_context && !near; d++)
+                near = d >= 0 && d < n_ops && ops[d].type != DIFF_SAME;
+            if (!near)
+                continue;
+            if (last >= 0 && k != last + 1)
+                printf("    ...\n");
+            last = k;
+            if (ops[k].type == DIFF_ADD)
+                printf("  + %8llx  %s\n", (unsigned long long)s_new.img.insn[fb->insns[ops[k].b]].addr, lb[ops[k].b]);
+            else
+                printf("  %c %8llx  %s\n", ops[k].type == DIFF_DEL ? '-' : ' ',
+                    (unsigned long long)s_old.img.insn[fa->insns[ops[k].a]].addr, la[ops[k].a]);
+        }
+        printf("\n");
+    }
+    free(ops);
+out:
+    free(la);
+    free(lb);
+    free(ha);
+    free(hb);
+    return changed;
+}
+
+static void diff_unpaired(struct diff_side * side, char mark)
+{
+    char label[64];
+
+    for (int f = 0; f < side->img.n_fn; f++)
+        if (side->pair[f] < 0 && diff_wanted(side, f))
+            printf("%c %s  %s  (%d insns)%s\n", mark, side->name[f], side->img.sec[side->img.fn[f].sec].name,
+                side->img.fn[f].n_insns, diff_label(&side->img.fn[f], label, sizeof(label)));
+}
+
+static void diff_stats(const struct diff_side * side)
+{
+    int owned = 0, valid = 0, paired = 0;
+
+    for (int i = 0; i < side->img.n_insn; i++)
+    {
+        valid += !!(side->img.insn[i].flags & BL31_INSN_VALID);
+        owned += side->img.insn[i].fn >= 0;
+    }
+    for (int f = 0; f < side->img.n_fn; f++)
+        paired += side->pair[f] >= 0;
+    printf("# %s: %d functions (%d paired), %d of %d decodable insns in functions\n",
+        side->img.name, side->img.n_fn, paired, owned, valid);
+}
+
+//====================== output end =================================================
+
+static void usage(const char * name)
+{
+    fprintf(stderr, "usage: %s [-s] [-c context] [-f name|string] old_dir new_dir\n"
+        "       %s [-s] [-c context] [-f name|string] old.S old.elf new.S new.elf\n", name, name);
+    exit(2);
+}
+
+static int diff_load(struct diff_side * side, char ** argv, int files)
+{
+    if ((files ? bl31_load(&side->img, argv[0], argv[1]) : bl31_load_dir(&side->img, argv[0])) < 0)
+        return -1;
+    bl31_analyze(&side->img);
+    side->pair = malloc(side->img.n_fn * sizeof(int));
+    memset(side->pair, 0xff, side->img.n_fn * sizeof(int));
+    return 0;
+}
+
+int main(int argc, char * argv[])
+{
+    double t0 = diff_now(), t1, t2;
+    int opt, files, changed = 0, same = 0, removed = 0, added = 0;
+
+    while ((opt = getopt(argc, argv, "sc:f:")) != -1)
+    {
+        if (opt == 's')
+            s_summary = 1;
+        else if (opt == 'c')
+            s_context = atoi(optarg);
+        else if (opt == 'f')
+            s_filter = optarg;
+        else
+            usage(argv[0]);
+    }
+    files = argc - optind == 4;
+    if (!files && argc - optind != 2)
+        usage(argv[0]);
+    if (diff_load(&s_old, argv + optind, files) < 0
+        || diff_load(&s_new, argv + optind + (files ? 2 : 1), files) < 0)
+        return 1;
+    t1 = diff_now();
+
+    diff_match();
+    diff_names(&s_old, 0);
+    diff_names(&s_new, 1);
+
+    diff_stats(&s_old);
+    diff_stats(&s_new);
+    printf("\n");
+    for (int a = 0; a < s_old.img.n_fn; a++)
+    {
+        if (s_old.pair[a] < 0)
+            continue;
+        if (diff_function(a, s_old.pair[a]))
+            changed++;
+        else
+            same++;
+    }
+    for (int a = 0; a < s_old.img.n_fn; a++)
+        removed += s_old.pair[a] < 0;
+    for (int b = 0; b < s_new.img.n_fn; b++)
+        added += s_new.pair[b] < 0;
+    diff_unpaired(&s_old, '-');
+    diff_unpaired(&s_new, '+');
+    t2 = diff_now();
+
+    printf("\n# %d identical, %d changed, %d only in %s, %d only in %s\n",
+        same, changed, removed, s_old.img.name, added, s_new.img.name);
+    fprintf(stderr, "load+analyze %.0f ms, match+diff %.0f ms\n", (t1 - t0) * 1e3, (t2 - t1) * 1e3);
+    bl31_free(&s_old.img);
+    bl31_free(&s_new.img);
+    return changed || removed || added;
+}
@@ -0,0 +1,1733 @@
+// Offline profiler for BL31 SIP and suspend paths: a small AArch64
+// interpreter over the image model (bl31.h) with stub devices.
+//
+// Each image is loaded the way the SPL loads it (PT_LOAD segments at their
+// physical address), then a list of steps runs on one CPU, sharing memory:
+//
+//   boot                  cold boot from the ELF entry until the eret to BL33
+//   sip <fid> [x1 x2 x3]  rockchip_plat_sip_handler(fid, x1, x2, x3, .., handle)
+//   suspend               pmu_v0_sys_suspend_wfi, until its wfi
+//   call <fn|"string"> [x0 ..]  any function, by address or by a string it uses
+//
+// Functions are found by the __func__ strings they print, so the same step
+// runs on both builds. Per step the report gives the instruction count, the
+// time at -f MHz (one instruction per cycle; the generic timer counts 24 MHz
+// in step with it, so udelay costs what it asks for), the hottest functions,
+// every device access and the loops that waited on one.
+//
+// Device model: everything in 0xf0000000-0xffffffff outside the SRAMs reads
+// back what was last written (0 before that), or a fixed value from -r. A
+// register read -p times in a row from the same place with the same result
+// is a poll and from then on reads back inverted. A loop that goes round with no register changing is a poll nobody will ever
+// satisfy here; after -p such rounds it is forced out and reported.
+//
+//   make emu
+//   ./build/bl31_emu ../bl31_v1.44_stock_disasm ../bl31_v1.45_rocknix_disasm boot suspend
+//   ./build/bl31_emu -v -r 0xfdc20120=0xe old_dir boot sip 0x82000003 0x1 0x0 suspend
+//
+// With two images, the device traces of each step are diffed as well.
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<elf.h>
+#include<time.h>
+
+#include "bl31.h"
+
+#define EMU_PAGE_SHIFT      12
+#define EMU_PAGE_SIZE       (1u << EMU_PAGE_SHIFT)
+#define EMU_PAGES           (1u << (32 - EMU_PAGE_SHIFT))
+#define EMU_RETURN          0x100000000ull      // link register of a step: outside the 4 GB map
+#define EMU_STACK_TOP       0x01000000ull       // DRAM, clear of the image and the mailbox at 0xe0000
+#define EMU_HANDLE          0x00f00000ull       // SMC context handed to the SIP handler
+#define EMU_DEVICE_LO       0xf0000000ull
+#define EMU_SRAM_LO         0xfdcc0000ull       // system + PMU SRAM
+#define EMU_SRAM_HI         0xfdce0000ull
+#define EMU_TIMER_HZ        24000000ull
+#define EMU_MAX_IMAGES      2
+#define EMU_MAX_STEPS       16
+#define EMU_MAX_OVERRIDES   32
+#define EMU_MAX_SYSREGS     128
+#define EMU_POLL_SITES      1024                // power of two
+#define EMU_MAX_DEPTH       64                  // shadow call stack, for the stop backtrace
+#define EMU_DIFF_MAX        4000                // trace lines per side the diff accepts
+#define EMU_LINE_LEN        80
+#define EMU_UART_THR        0xfe660000u         // UART2, the BL31 console
+#define EMU_UART_LSR        0xfe660014u
+
+// system register keys: op0:op1:CRn:CRm:op2 as in MRS bits 20:5
+#define EMU_SYSREG(op0, op1, crn, crm, op2) ((op0) << 14 | (op1) << 11 | (crn) << 7 | (crm) << 3 | (op2))
+#define EMU_CNTFRQ          EMU_SYSREG(3, 3, 14, 0, 0)
+#define EMU_CNTPCT          EMU_SYSREG(3, 3, 14, 0, 1)
+#define EMU_CNTVCT          EMU_SYSREG(3, 3, 14, 0, 2)
+#define EMU_MIDR            EMU_SYSREG(3, 0, 0, 0, 0)
+#define EMU_MPIDR           EMU_SYSREG(3, 0, 0, 0, 5)
+#define EMU_CURRENTEL       EMU_SYSREG(3, 0, 4, 2, 2)
+#define EMU_NZCV            EMU_SYSREG(3, 3, 4, 2, 0)
+#define EMU_DAIF            EMU_SYSREG(3, 3, 4, 2, 1)
+#define EMU_SPSEL           EMU_SYSREG(3, 0, 4, 2, 0)
+#define EMU_SP_EL0          EMU_SYSREG(3, 0, 4, 1, 0)
+
+enum
+{
+    EMU_RUNNING,
+    EMU_RETURNED,                       // back at EMU_RETURN
+    EMU_WFI,
+    EMU_ERET,
+    EMU_SMC,
+    EMU_LIMIT,                          // -n instructions
+    EMU_STUCK,                          // no-progress loop with no way out
+    EMU_FAULT,                          // access outside the 4 GB map
+    EMU_UNDEF,                          // instruction the interpreter does not know
+};
+
+static const char * const s_stop_names[] =
+{
+    "running", "returned", "wfi", "eret", "smc", "instruction limit", "stuck", "fault", "unimplemented",
+};
+
+struct emu_access
+{
+    uint64_t n;                         // instruction count at the access
+    uint64_t pc;
+    uint32_t addr;
+    uint32_t value;
+    char kind;                          // 'R' / 'W'
+    char size;
+};
+
+struct emu_poll
+{
+    uint64_t pc;                        // backward branch closing the loop
+    uint64_t hash;                      // register state when it was last taken
+    uint32_t same;                      // rounds in a row with that state
+    uint32_t rounds;                    // no-progress rounds in total
+    uint64_t insns;                     // instructions spent in them
+    uint64_t last_n;
+    uint32_t addr;                      // last address read in the loop
+    int forced;
+};
+
+// a device read instruction, tracked for polls
+struct emu_site
+{
+    uint64_t pc;
+    uint64_t addr, value;               // last read, before any answer
+    uint64_t answer;                    // value returned once the poll was answered
+    uint64_t last_n;
+    uint64_t seq;                       // device access count at the last read
+    uint32_t same;                      // reads in a row with the same value
+    int answered;
+    uint32_t repeats;                   // reads that repeated the previous one
+    uint32_t answers;                   // reads given the answer
+    uint64_t insns;                     // instructions between repeated reads
+};
+
+struct emu_step
+{
+    const char * name;
+    const char * target;                // call: function address or string
+    uint64_t args[8];
+    int n_args;
+};
+
+struct emu_result
+{
+    int stop;
+    uint64_t pc, n_insn;
+    uint64_t x0;
+    uint64_t entry;
+    int entry_fn;
+    uint64_t reads, writes;
+    struct emu_access * trace;
+    size_t n_trace, cap_trace;
+    struct emu_poll * polls;            // copied out of the site tables
+    int n_polls;
+    struct emu_site * sites;
+    int n_sites;
+    uint64_t * fn_insns;                // exclusive, per function
+    uint32_t * fn_calls;
+    uint64_t unlisted;                  // executed outside any listed instruction
+    char why[160];
+    char backtrace[160];                // where a step stopped other than by returning
+};
+
+struct emu
+{
+    const struct bl31_image * img;
+    unsigned char ** page;
+    uint64_t x[32];                     // x[31] is sp
+    uint64_t pc;
+    uint32_t nzcv;                      // N Z C V in bits 31:28
+    int spsel;                          // x[31] is SP_EL3 when set, SP_EL0 otherwise
+    uint64_t sp_other;                  // the stack pointer not selected
+    uint64_t n_insn, limit;
+    uint64_t excl_addr;
+    int excl;
+    uint32_t sysreg_key[EMU_MAX_SYSREGS];
+    uint64_t sysreg_val[EMU_MAX_SYSREGS];
+    int n_sysregs;
+    int last_insn;                      // listing index of the previous pc, for the profile
+    int called;                         // the last instruction was bl / blr
+    uint64_t calls[EMU_MAX_DEPTH];      // return addresses
+    int depth;
+    uint32_t last_read;
+    uint64_t dev_seq;                   // device accesses so far
+    uint64_t last_cond_pc, last_cond_target;
+    uint64_t stuck_pc;
+    struct emu_poll polls[EMU_POLL_SITES];
+    struct emu_site sites[EMU_POLL_SITES];  // kept across steps: the device stays "ready"
+    struct emu_result * r;
+};
+
+// device registers the boot path needs to read something other than 0:
+// the GIC driver checks the architecture revision, the redistributor walk
+// stops at TYPER.Last, the console waits on the UART line status
+static const struct
+{
+    uint64_t addr, value;
+    int size;
+} s_reset[] =
+{
+    { 0xfd40ffe8, 0x3b, 4 },                    // GICD_PIDR2: GICv3
+    { 0xfd46ffe8, 0x3b, 4 },                    // GICR_PIDR2
+    { 0xfd460008, 0x0000000000000000ull, 8 },   // GICR_TYPER, cpu0
+    { 0xfd480008, 0x0000010000000100ull, 8 },   // cpu1: affinity 0.0.1.0, processor 1
+    { 0xfd4a0008, 0x0000020000000200ull, 8 },
+    { 0xfd4c0008, 0x0000030000000310ull, 8 },   // cpu3, Last
+    { EMU_UART_LSR, 0x60, 4 },                    // UART2 LSR: THRE | TEMT
+};
+
+static uint64_t s_mhz = 1800;
+static uint64_t s_limit = 50000000;
+static uint32_t s_patience = 64;
+static int s_verbose, s_top = 12;
+static uint32_t s_override_addr[EMU_MAX_OVERRIDES], s_override_val[EMU_MAX_OVERRIDES];
+static int s_n_overrides;
+
+//====================== memory =====================================================
+
+static uint64_t emu_ones(int n)
+{
+    return n >= 64 ? ~0ull : (1ull << n) - 1;
+}
+
+static int emu_is_device(uint64_t addr)
+{
+    return addr >= EMU_DEVICE_LO && (addr < EMU_SRAM_LO || addr >= EMU_SRAM_HI);
+}
+
+static unsigned char * emu_page(struct emu * e, uint64_t addr)
+{
+    uint32_t p = addr >> EMU_PAGE_SHIFT;
+
+    if (!e->page[p])
+        e->page[p] = calloc(1, EMU_PAGE_SIZE);
+    return e->page[p];
+}
+
+static void emu_trace(struct emu * e, char kind, uint64_t addr, int size, uint64_t value)
+{
+    struct emu_result * r = e->r;
+    struct emu_access * a;
+
+    if (r->n_trace == r->cap_trace)
+    {
+        r->cap_trace = r->cap_trace ? r->cap_trace * 2 : 1024;
+        r->trace = realloc(r->trace, r->cap_trace * sizeof(*r->trace));
+    }
+    a = &r->trace[r->n_trace++];
+    e->dev_seq++;
+    a->n = e->n_insn;
+    a->pc = e->pc;
+    a->addr = addr;
+    a->value = value;
+    a->kind = kind;
+    a->size = size;
+    if (kind == 'R')
+        r->reads++;
+    else
+        r->writes++;
+}
+
+static int emu_fault(struct emu * e, uint64_t addr)
+{
+    snprintf(e->r->why, sizeof(e->r->why), "access to 0x%llx", (unsigned long long)addr);
+    return -1;
+}
+
+// The same instruction reading the same register and value s_patience
+// times in a row, with no other device access in between, is waiting for a
+// bit to flip. The stub flips all of them: that read and every later one from this
+// instruction get the complement. Equality polls on a multi-bit value are
+// not satisfied this way; emu_branch cuts those.
+static uint64_t emu_device_read(struct emu * e, uint64_t addr, int size, uint64_t v)
+{
+    uint32_t slot = (e->pc >> 2) & (EMU_POLL_SITES - 1);
+    struct emu_site * s;
+
+    while ((s = &e->sites[slot])->pc && s->pc != e->pc)
+        slot = (slot + 1) & (EMU_POLL_SITES - 1);
+    if (!s->pc)
+    {
+        s->pc = e->pc;
+        s->addr = addr ^ 1;
+    }
+    if (s->addr == addr && s->value == v && s->seq + 1 == e->dev_seq)
+    {
+        s->repeats++;
+        s->insns += e->n_insn - s->last_n;
+        if (!s->answered && ++s->same >= s_patience)
+        {
+            s->answered = 1;
+            s->answer = ~v & emu_ones(size * 8);
+        }
+    }
+    else
+        s->same = 0;
+    s->addr = addr;
+    s->value = v;
+    s->last_n = e->n_insn;
+    s->seq = e->dev_seq;
+    if (s->answered && s->addr == addr)
+    {
+        s->answers++;
+        return s->answer;
+    }
+    return v;
+}
+
+static int emu_read(struct emu * e, uint64_t addr, int size, uint64_t * val)
+{
+    uint64_t v = 0;
+    int fixed = 0;
+
+    if (addr >= EMU_RETURN || addr + size > EMU_RETURN)
+        return emu_fault(e, addr);
+    for (int i = size - 1; i >= 0; i--)
+        v = v << 8 | emu_page(e, addr + i)[(addr + i) & (EMU_PAGE_SIZE - 1)];
+    if (emu_is_device(addr))
+    {
+        for (int i = 0; i < s_n_overrides; i++)
+            if (s_override_addr[i] == addr)
+            {
+                v = s_override_val[i];
+                fixed = 1;
+            }
+        if (!fixed)
+            v = emu_device_read(e, addr, size, v);
+        emu_trace(e, 'R', addr, size, v);
+    }
+    e->last_read = addr;
+    *val = v;
+    return 0;
+}
+
+static int emu_write(struct emu * e, uint64_t addr, int size, uint64_t v)
+{
+    if (addr >= EMU_RETURN || addr + size > EMU_RETURN)
+        return emu_fault(e, addr);
+    if (emu_is_device(addr))
+        emu_trace(e, 'W', addr, size, v);
+    for (int i = 0; i < size; i++, v >>= 8)
+        emu_page(e, addr + i)[(addr + i) & (EMU_PAGE_SIZE - 1)] = v;
+    return 0;
+}
+
+// PT_LOAD segments at their physical address: .text_pmusram_reuse lands at
+// 0x69000 and is copied into PMU SRAM by the suspend path itself
+static void emu_load_image(struct emu * e)
+{
+    const Elf64_Ehdr * eh = (const Elf64_Ehdr *)e->img->elf;
+    const Elf64_Phdr * ph = (const Elf64_Phdr *)(e->img->elf + eh->e_phoff);
+
+    for (size_t i = 0; i < sizeof(s_reset) / sizeof(s_reset[0]); i++)
+        for (int k = 0; k < s_reset[i].size; k++)
+            emu_page(e, s_reset[i].addr + k)[(s_reset[i].addr + k) & (EMU_PAGE_SIZE - 1)] = s_reset[i].value >> (k * 8);
+
+    for (int i = 0; i < eh->e_phnum; i++)
+    {
+        if (ph[i].p_type != PT_LOAD)
+            continue;
+        for (uint64_t k = 0; k < ph[i].p_filesz; k++)
+            emu_page(e, ph[i].p_paddr + k)[(ph[i].p_paddr + k) & (EMU_PAGE_SIZE - 1)]
+                = e->img->elf[ph[i].p_offset + k];
+    }
+}
+
+//====================== memory end =================================================
+
+//====================== system registers ===========================================
+
+static uint64_t * emu_sysreg(struct emu * e, uint32_t key)
+{
+    for (int i = 0; i < e->n_sysregs; i++)
+        if (e->sysreg_key[i] == key)
+            return &e->sysreg_val[i];
+    if (e->n_sysregs == EMU_MAX_SYSREGS)
+        return NULL;
+    e->sysreg_key[e->n_sysregs] = key;
+    e->sysreg_val[e->n_sysregs] = 0;
+    return &e->sysreg_val[e->n_sysregs++];
+}
+
+static uint64_t emu_mrs(struct emu * e, uint32_t key)
+{
+    uint64_t * v;
+
+    switch (key)
+    {
+    case EMU_CNTPCT:
+    case EMU_CNTVCT:
+        return e->n_insn * EMU_TIMER_HZ / (s_mhz * 1000000);
+    case EMU_NZCV:
+        return e->nzcv;
+    case EMU_SPSEL:
+        return e->spsel;
+    case EMU_SP_EL0:
+        return e->spsel ? e->sp_other : e->x[31];
+    }
+    v = emu_sysreg(e, key);
+    return v ? *v : 0;
+}
+
+static void emu_msr(struct emu * e, uint32_t key, uint64_t val)
+{
+    uint64_t * v;
+
+    if (key == EMU_NZCV)
+        e->nzcv = val & 0xf0000000u;
+    else if (key == EMU_SPSEL)
+    {
+        if ((val & 1) != e->spsel)
+        {
+            uint64_t sp = e->x[31];
+            e->x[31] = e->sp_other;
+            e->sp_other = sp;
+            e->spsel = val & 1;
+        }
+    }
+    else if (key == EMU_SP_EL0)
+    {
+        if (e->spsel)
+            e->sp_other = val;
+        else
+            e->x[31] = val;
+    }
+    else if ((v = emu_sysreg(e, key)))
+        *v = val;
+}
+
+static void emu_reset_sysregs(struct emu * e)
+{
+    e->n_sysregs = 0;
+    emu_msr(e, EMU_CNTFRQ, EMU_TIMER_HZ);
+    emu_msr(e, EMU_MIDR, 0x412fd050);       // Cortex-A55 r2p0
+    emu_msr(e, EMU_MPIDR, 0x81000000);      // cpu0, MT
+    emu_msr(e, EMU_CURRENTEL, 3 << 2);
+    emu_msr(e, EMU_DAIF, 0xf << 6);
+}
+
+//====================== system registers end =======================================
+
+//====================== A64 ========================================================
+
+static uint64_t emu_ror(uint64_t v, int r, int size)
+{
+    r %= size;
+    if (!r)
+        return v;
+    return ((v >> r) | (v << (size - r))) & emu_ones(size);
+}
+
+// DecodeBitMasks() from the ARM ARM
+static int emu_bitmasks(int n, int imms, int immr, int immediate, int size, uint64_t * wmask, uint64_t * tmask)
+{
+    int len = 6, levels, s, r, d, esize;
+    uint64_t welem, telem;
+
+    while (len >= 0 && !((n << 6 | (~imms & 0x3f)) >> len & 1))
+        len--;
+    if (len < 1)
+        return -1;
+    levels = (1 << len) - 1;
+    if (immediate && (imms & levels) == levels)
+        return -1;
+    s = imms & levels;
+    r = immr & levels;
+    d = (s - r) & levels;
+    esize = 1 << len;
+    welem = emu_ror(emu_ones(s + 1), r, esize);
+    telem = emu_ones(d + 1);
+    *wmask = *tmask = 0;
+    for (int i = 0; i < size; i += esize)
+    {
+        *wmask |= welem << i;
+        *tmask |= telem << i;
+    }
+    return 0;
+}
+
+static uint64_t emu_reg(struct emu * e, int r, int sf)
+{
+    uint64_t v = r == 31 ? 0 : e->x[r];
+    return sf ? v : (uint32_t)v;
+}
+
+static uint64_t emu_reg_sp(struct emu * e, int r, int sf)
+{
+    return sf ? e->x[r] : (uint32_t)e->x[r];
+}
+
+static void emu_set(struct emu * e, int r, uint64_t v, int sf)
+{
+    if (r != 31)
+        e->x[r] = sf ? v : (uint32_t)v;
+}
+
+static void emu_set_sp(struct emu * e, int r, uint64_t v, int sf)
+{
+    e->x[r] = sf ? v : (uint32_t)v;
+}
+
+static uint64_t emu_add(struct emu * e, uint64_t a, uint64_t b, int carry, int sf, int flags)
+{
+    uint64_t mask = emu_ones(sf ? 64 : 32), top = sf ? 1ull << 63 : 1ull << 31;
+    uint64_t r;
+
+    a &= mask;
+    b &= mask;
+    r = (a + b + carry) & mask;
+    if (flags)
+    {
+        int c = sf ? (carry ? r <= a : r < a) : a + b + carry > mask;
+        int v = !((a ^ b) & top) && ((a ^ r) & top);
+        e->nzcv = (r & top ? 1u << 31 : 0) | (!r ? 1u << 30 : 0) | (c ? 1u << 29 : 0) | (v ? 1u << 28 : 0);
+    }
+    return r;
+}
+
+static void emu_logic_flags(struct emu * e, uint64_t r, int sf)
+{
+    uint64_t top = sf ? 1ull << 63 : 1ull << 31;
+    e->nzcv = (r & top ? 1u << 31 : 0) | (!r ? 1u << 30 : 0);
+}
+
+static int emu_cond(struct emu * e, int cond)
+{
+    int n = e->nzcv >> 31 & 1, z = e->nzcv >> 30 & 1, c = e->nzcv >> 29 & 1, v = e->nzcv >> 28 & 1;
+    int r;
+
+    switch (cond >> 1)
+    {
+    case 0: r = z; break;
+    case 1: r = c; break;
+    case 2: r = n; break;
+    case 3: r = v; break;
+    case 4: r = c && !z; break;
+    case 5: r = n == v; break;
+    case 6: r = n == v && !z; break;
+    default: r = 1; break;
+    }
+    return (cond & 1) && cond != 0xf ? !r : r;
+}
+
+static uint64_t emu_shift(uint64_t v, int type, int amount, int sf)
+{
+    int size = sf ? 64 : 32;
+
+    amount %= size;
+    switch (type)
+    {
+    case 0: return (v << amount) & emu_ones(size);
+    case 1: return v >> amount;
+    case 2: return sf ? (uint64_t)((int64_t)v >> amount) : (uint32_t)((int32_t)v >> amount);
+    default: return emu_ror(v, amount, size);
+    }
+}
+
+static uint64_t emu_extend(uint64_t v, int option, int shift)
+{
+    switch (option)
+    {
+    case 0: v = (uint8_t)v; break;
+    case 1: v = (uint16_t)v; break;
+    case 2: v = (uint32_t)v; break;
+    case 4: v = (int64_t)(int8_t)v; break;
+    case 5: v = (int64_t)(int16_t)v; break;
+    case 6: v = (int64_t)(int32_t)v; break;
+    }
+    return v << shift;
+}
+
+static int64_t emu_sext(uint64_t v, int bits)
+{
+    return (int64_t)(v << (64 - bits)) >> (64 - bits);
+}
+
+static void emu_branch(struct emu * e, uint64_t target, int64_t cond_target);
+static int emu_owner(const struct bl31_image * img, uint64_t pc);
+static const char * emu_fn_name(const struct bl31_image * img, int fn, char * buf, size_t size);
+
+// data processing, immediate
+static int emu_dp_imm(struct emu * e, uint32_t w)
+{
+    int sf = w >> 31, rd = w & 31, rn = w >> 5 & 31;
+    int op = w >> 23 & 7;
+    uint64_t a, b, r, wmask, tmask;
+
+    switch (op)
+    {
+    case 0: case 1:                     // adr, adrp
+    {
+        int64_t imm = emu_sext((w >> 5 & 0x7ffff) << 2 | (w >> 29 & 3), 21);
+        emu_set(e, rd, w >> 31 ? (e->pc & ~0xfffull) + (imm << 12) : e->pc + imm, 1);
+        return 0;
+    }
+    case 2:                             // add / sub immediate
+        a = emu_reg_sp(e, rn, sf);
+        b = (uint64_t)(w >> 10 & 0xfff) << (w >> 22 & 1 ? 12 : 0);
+        if (w >> 30 & 1)
+            r = emu_add(e, a, ~b, 1, sf, w >> 29 & 1);
+        else
+            r = emu_add(e, a, b, 0, sf, w >> 29 & 1);
+        if (w >> 29 & 1)
+            emu_set(e, rd, r, sf);
+        else
+            emu_set_sp(e, rd, r, sf);
+        return 0;
+    case 4:                             // logical immediate
+        if (emu_bitmasks(w >> 22 & 1, w >> 10 & 0x3f, w >> 16 & 0x3f, 1, sf ? 64 : 32, &wmask, &tmask) < 0)
+            return -1;
+        a = emu_reg(e, rn, sf);
+        switch (w >> 29 & 3)
+        {
+        case 0: emu_set_sp(e, rd, a & wmask, sf); break;
+        case 1: emu_set_sp(e, rd, a | wmask, sf); break;
+        case 2: emu_set_sp(e, rd, a ^ wmask, sf); break;
+        case 3: r = a & wmask; emu_logic_flags(e, r, sf); emu_set(e, rd, r, sf); break;
+        }
+        return 0;
+    case 5:                             // move wide
+    {
+        int hw = (w >> 21 & 3) * 16;
+        uint64_t imm = (uint64_t)(w >> 5 & 0xffff) << hw;
+        switch (w >> 29 & 3)
+        {
+        case 0: emu_set(e, rd, ~imm, sf); return 0;
+        case 2: emu_set(e, rd, imm, sf); return 0;
+        case 3: emu_set(e, rd, (emu_reg(e, rd, 1) & ~(0xffffull << hw)) | imm, sf); return 0;
+        }
+        return -1;
+    }
+    case 6:                             // sbfm / bfm / ubfm
+    {
+        int opc = w >> 29 & 3, immr = w >> 16 & 0x3f, imms = w >> 10 & 0x3f, size = sf ? 64 : 32;
+        uint64_t src, dst, bot, top;
+        if (opc == 3 || emu_bitmasks(w >> 22 & 1, imms, immr, 0, size, &wmask, &tmask) < 0)
+            return -1;
+        src = emu_reg(e, rn, sf);
+        dst = opc == 1 ? emu_reg(e, rd, sf) : 0;
+        bot = (dst & ~wmask) | (emu_ror(src, immr, size) & wmask);
+        top = opc == 0 ? (src >> imms & 1 ? emu_ones(size) : 0) : dst;
+        emu_set(e, rd, (top & ~tmask) | (bot & tmask), sf);
+        return 0;
+    }
+    case 7:                             // extr
+    {
+        int lsb = w >> 10 & 0x3f, size = sf ? 64 : 32;
+        uint64_t hi = emu_reg(e, rn, sf), lo = emu_reg(e, w >> 16 & 31, sf);
+        emu_set(e, rd, lsb ? (lo >> lsb | hi << (size - lsb)) & emu_ones(size) : lo, sf);
+        return 0;
+    }
+    }
+    return -1;
+}
+
+// data processing, register
+static int emu_dp_reg(struct emu * e, uint32_t w)
+{
+    int sf = w >> 31, rd = w & 31, rn = w >> 5 & 31, rm = w >> 16 & 31;
+    uint64_t a, b, r;
+
+    if ((w >> 24 & 0x1f) == 0x0a)       // logical, shifted register
+    {
+        a = emu_reg(e, rn, sf);
+        b = emu_shift(emu_reg(e, rm, sf), w >> 22 & 3, w >> 10 & 0x3f, sf);
+        if (w >> 21 & 1)
+            b = ~b & emu_ones(sf ? 64 : 32);
+        switch (w >> 29 & 3)
+        {
+        case 0: r = a & b; break;
+        case 1: r = a | b; break;
+        case 2: r = a ^ b; break;
+        default: r = a & b; emu_logic_flags(e, r, sf); break;
+        }
+        emu_set(e, rd, r, sf);
+        return 0;
+    }
+    if ((w >> 24 & 0x1f) == 0x0b)       // add / sub, shifted or extended register
+    {
+        int sub = w >> 30 & 1, s = w >> 29 & 1;
+        if (w >> 21 & 1)
+        {
+            a = emu_reg_sp(e, rn, sf);
+            b = emu_extend(emu_reg(e, rm, 1), w >> 13 & 7, w >> 10 & 7);
+        }
+        else
+        {
+            a = emu_reg(e, rn, sf);
+            b = emu_shift(emu_reg(e, rm, sf), w >> 22 & 3, w >> 10 & 0x3f, sf);
+        }
+        r = sub ? emu_add(e, a, ~b, 1, sf, s) : emu_add(e, a, b, 0, sf, s);
+        if (w >> 21 & 1 && !s)
+            emu_set_sp(e, rd, r, sf);
+        else
+            emu_set(e, rd, r, sf);
+        return 0;
+    }
+    switch (w >> 21 & 0xff)
+    {
+    case 0xd0:                          // adc / sbc
+        a = emu_reg(e, rn, sf);
+        b = emu_reg(e, rm, sf);
+        r = emu_add(e, a, w >> 30 & 1 ? ~b : b, e->nzcv >> 29 & 1, sf, w >> 29 & 1);
+        emu_set(e, rd, r, sf);
+        return 0;
+    case 0xd2:                          // ccmn / ccmp
+    {
+        int cond = w >> 12 & 15;
+        a = emu_reg(e, rn, sf);
+        b = w >> 11 & 1 ? rm : emu_reg(e, rm, sf);
+        if (emu_cond(e, cond))
+        {
+            if (w >> 30 & 1)
+                emu_add(e, a, ~b, 1, sf, 1);
+            else
+                emu_add(e, a, b, 0, sf, 1);
+        }
+        else
+            e->nzcv = (w & 15) << 28;
+        return 0;
+    }
+    case 0xd4:                          // csel / csinc / csinv / csneg
+        if (emu_cond(e, w >> 12 & 15))
+            r = emu_reg(e, rn, sf);
+        else
+        {
+            r = emu_reg(e, rm, sf);
+            if (w >> 30 & 1)
+                r = ~r;
+            if (w >> 10 & 1)
+                r++;
+        }
+        emu_set(e, rd, r, sf);
+        return 0;
+    case 0xd6:
+        a = emu_reg(e, rn, sf);
+        if (w >> 30 & 1)                // one source
+        {
+            int size = sf ? 64 : 32;
+            switch (w >> 10 & 0x3f)
+            {
+            case 0:                     // rbit
+                r = 0;
+                for (int i = 0; i < size; i++)
+                    r |= (a >> i & 1) << (size - 1 - i);
+                break;
+            case 1:                     // rev16
+                r = (a & 0x00ff00ff00ff00ffull) << 8 | (a >> 8 & 0x00ff00ff00ff00ffull);
+                break;
+            case 2:                     // rev32 / rev (w)
+                r = (uint64_t)__builtin_bswap32(a >> 32) << 32 | __builtin_bswap32(a);
+                break;
+            case 3:
+                r = __builtin_bswap64(a);
+                break;
+            case 4:                     // clz
+                r = a ? (sf ? __builtin_clzll(a) : __builtin_clz((uint32_t)a)) : size;
+                break;
+            default:
+                return -1;
+            }
+            emu_set(e, rd, r, sf);
+            return 0;
+        }
+        b = emu_reg(e, rm, sf);
+        switch (w >> 10 & 0x3f)
+        {
+        case 2: r = b ? a / b : 0; break;
+        case 3:
+            if (!b)
+                r = 0;
+            else if (sf)
+                r = (int64_t)a == INT64_MIN && (int64_t)b == -1 ? a : (uint64_t)((int64_t)a / (int64_t)b);
+            else
+                r = (int32_t)a == INT32_MIN && (int32_t)b == -1 ? a : (uint32_t)((int32_t)a / (int32_t)b);
+            break;
+        case 8: case 9: case 10: case 11:
+            r = emu_shift(a, (w >> 10 & 3), b & (sf ? 63 : 31), sf);
+            break;
+        default:
+            return -1;
+        }
+        emu_set(e, rd, r, sf);
+        return 0;
+    }
+    if ((w >> 24 & 0x1f) == 0x1b)       // three source
+    {
+        uint64_t ra = emu_reg(e, w >> 10 & 31, sf), m;
+        int sub = w >> 15 & 1;
+        a = emu_reg(e, rn, 1);
+        b = emu_reg(e, rm, 1);
+        switch (w >> 21 & 7)
+        {
+        case 0: m = a * b; break;
+        case 1: m = (uint64_t)((int64_t)(int32_t)a * (int64_t)(int32_t)b); break;
+        case 5: m = (uint64_t)(uint32_t)a * (uint32_t)b; break;
+        case 2:
+            emu_set(e, rd, (uint64_t)((__int128)(int64_t)a * (int64_t)b >> 64), 1);
+            return 0;
+        case 6:
+            emu_set(e, rd, (uint64_t)((unsigned __int128)a * b >> 64), 1);
+            return 0;
+        default:
+            return -1;
+        }
+        emu_set(e, rd, sub ? ra - m : ra + m, sf);
+        return 0;
+    }
+    return -1;
+}
+
+static int emu_ld_st(struct emu * e, int load, int size, int sign, int sf, int rt, uint64_t addr)
+{
+    uint64_t v;
+
+    if (!load)
+        return emu_write(e, addr, size, emu_reg(e, rt, 1));
+    if (emu_read(e, addr, size, &v) < 0)
+        return -1;
+    if (sign)
+        v = emu_sext(v, size * 8);
+    emu_set(e, rt, v, sf);
+    return 0;
+}
+
+// loads and stores, integer registers only
+static int emu_ldst(struct emu * e, uint32_t w)
+{
+    int rt = w & 31, rn = w >> 5 & 31, size = 1 << (w >> 30), opc = w >> 22 & 3;
+    uint64_t addr;
+
+    if (w >> 26 & 1)                    // SIMD&FP
+        return -1;
+    if ((w >> 24 & 0x3f) == 0x08)       // exclusive / acquire-release
+    {
+        int l = w >> 22 & 1, pair = w >> 21 & 1, rs = w >> 16 & 31, o2 = w >> 23 & 1;
+        if (pair)
+            return -1;
+        addr = emu_reg_sp(e, rn, 1);
+        if (l)
+        {
+            e->excl = !o2;
+            e->excl_addr = addr;
+            return emu_ld_st(e, 1, size, 0, size == 8, rt, addr);
+        }
+        if (emu_ld_st(e, 0, size, 0, 0, rt, addr) < 0)
+            return -1;
+        if (!o2)                        // stxr: always succeeds
+            emu_set(e, rs, 0, 0);
+        e->excl = 0;
+        return 0;
+    }
+    if ((w >> 27 & 7) == 3 && !(w >> 24 & 1))    // literal
+    {
+        addr = e->pc + (emu_sext(w >> 5 & 0x7ffff, 19) << 2);
+        switch (w >> 30)
+        {
+        case 0: return emu_ld_st(e, 1, 4, 0, 0, rt, addr);
+        case 1: return emu_ld_st(e, 1, 8, 0, 1, rt, addr);
+        case 2: return emu_ld_st(e, 1, 4, 1, 1, rt, addr);
+        default: return 0;              // prfm
+        }
+    }
+    if ((w >> 27 & 7) == 5)             // pair
+    {
+        int mode = w >> 23 & 3, l = w >> 22 & 1, psize = w >> 31 ? 8 : 4, sign = w >> 30 == 1;
+        int64_t off = emu_sext(w >> 15 & 0x7f, 7) * psize;
+        int rt2 = w >> 10 & 31;
+        uint64_t base = emu_reg_sp(e, rn, 1);
+        if (w >> 30 == 3 || (sign && !l))
+            return -1;
+        addr = mode == 1 ? base : base + off;
+        if (l && rt == rt2)
+            return -1;
+        if (emu_ld_st(e, l, psize, sign, psize == 8 || sign, rt, addr) < 0
+            || emu_ld_st(e, l, psize, sign, psize == 8 || sign, rt2, addr + psize) < 0)
+            return -1;
+        if (mode == 1 || mode == 3)
+            e->x[rn] = base + off;
+        return 0;
+    }
+    if ((w >> 27 & 7) != 7)
+        return -1;
+    if (size == 8 && opc == 2)          // prfm
+        return 0;
+    {
+        int load = opc != 0, sign = opc >= 2, sf = size == 8 || opc == 2;
+        uint64_t base = emu_reg_sp(e, rn, 1);
+
+        if (size == 8 && opc == 3)
+            return -1;
+        if (w >> 24 & 1)                // unsigned offset
+            return emu_ld_st(e, load, size, sign, sf, rt, base + (uint64_t)(w >> 10 & 0xfff) * size);
+        if (w >> 21 & 1)
+        {
+            int option = w >> 13 & 7;
+            if ((w >> 10 & 3) != 2 || !(option & 2))
+                return -1;              // atomics
+            addr = base + emu_extend(emu_reg(e, w >> 16 & 31, 1), option, w >> 12 & 1 ? w >> 30 : 0);
+            return emu_ld_st(e, load, size, sign, sf, rt, addr);
+        }
+        {
+            int64_t imm = emu_sext(w >> 12 & 0x1ff, 9);
+            int mode = w >> 10 & 3;
+            addr = mode == 1 ? base : base + imm;
+            if (emu_ld_st(e, load, size, sign, sf, rt, addr) < 0)
+                return -1;
+            if (mode == 1 || mode == 3)
+                e->x[rn] = base + imm;
+            return 0;
+        }
+    }
+}
+
+static int emu_system(struct emu * e, uint32_t w)
+{
+    int l = w >> 21 & 1, op0 = w >> 19 & 3, crn = w >> 12 & 15, op2 = w >> 5 & 7, rt = w & 31;
+
+    if (op0 == 0)
+    {
+        if (crn == 2 && !(w >> 8 & 15))     // hints
+        {
+            if (op2 == 3)
+                return EMU_WFI;
+            return 0;                   // nop, yield, wfe, sev, sevl, pac hints
+        }
+        if (crn == 4)                   // msr DAIFSet / DAIFClr / SPSel
+        {
+            int op1 = w >> 16 & 7, imm = w >> 8 & 15;
+            uint64_t * daif = emu_sysreg(e, EMU_DAIF);
+            if (daif && op1 == 3 && op2 == 6)
+                *daif |= imm << 6;
+            else if (daif && op1 == 3 && op2 == 7)
+                *daif &= ~(uint64_t)(imm << 6);
+            else if (op1 == 0 && op2 == 5)
+                emu_msr(e, EMU_SPSEL, imm & 1);
+        }
+        return 0;                       // barriers, clrex
+    }
+    if (op0 == 1)                       // dc / ic / tlbi / at
+        return 0;
+    if (l)
+        emu_set(e, rt, emu_mrs(e, w >> 5 & 0xffff), 1);
+    else
+        emu_msr(e, w >> 5 & 0xffff, emu_reg(e, rt, 1));
+    return 0;
+}
+
+static void emu_call(struct emu * e, uint64_t ret)
+{
+    e->called = 1;
+    if (e->depth == EMU_MAX_DEPTH)
+    {
+        memmove(e->calls, e->calls + 1, (EMU_MAX_DEPTH - 1) * sizeof(*e->calls));
+        e->depth--;
+    }
+    e->calls[e->depth++] = ret;
+}
+
+// pops to the matching frame; a return to anywhere else leaves the stack alone
+static void emu_ret(struct emu * e, uint64_t target)
+{
+    for (int d = e->depth - 1; d >= 0; d--)
+        if (e->calls[d] == target)
+        {
+            e->depth = d;
+            return;
+        }
+}
+
+// returns EMU_RUNNING or the reason to stop
+static int emu_step(struct emu * e, uint32_t w)
+{
+    uint64_t next = e->pc + 4, target;
+
+    switch (w >> 25 & 0xf)
+    {
+    case 0x8: case 0x9:
+        if (emu_dp_imm(e, w) < 0)
+            return EMU_UNDEF;
+        break;
+    case 0x5: case 0xd:
+        if (emu_dp_reg(e, w) < 0)
+            return EMU_UNDEF;
+        break;
+    case 0x4: case 0x6: case 0xc: case 0xe:
+        if (emu_ldst(e, w) < 0)
+            return e->r->why[0] ? EMU_FAULT : EMU_UNDEF;
+        break;
+    case 0xa: case 0xb:
+        if ((w & 0x7c000000) == 0x14000000)         // b / bl
+        {
+            target = e->pc + (emu_sext(w & 0x3ffffff, 26) << 2);
+            if (w >> 31)
+            {
+                e->x[30] = next;
+                emu_call(e, next);
+                e->pc = target;
+            }
+            else
+                emu_branch(e, target, -1);
+            return EMU_RUNNING;
+        }
+        if ((w & 0xff000010) == 0x54000000)         // b.cond
+        {
+            target = e->pc + (emu_sext(w >> 5 & 0x7ffff, 19) << 2);
+            emu_branch(e, emu_cond(e, w & 15) ? target : next, target);
+            return EMU_RUNNING;
+        }
+        if ((w & 0x7e000000) == 0x34000000)         // cbz / cbnz
+        {
+            uint64_t v = emu_reg(e, w & 31, w >> 31);
+            target = e->pc + (emu_sext(w >> 5 & 0x7ffff, 19) << 2);
+            emu_branch(e, (!v) != (w >> 24 & 1) ? target : next, target);
+            return EMU_RUNNING;
+        }
+        if ((w & 0x7e000000) == 0x36000000)         // tbz / tbnz
+        {
+            int bit = (w >> 31) << 5 | (w >> 19 & 31);
+            uint64_t v = emu_reg(e, w & 31, 1) >> bit & 1;
+            target = e->pc + (emu_sext(w >> 5 & 0x3fff, 14) << 2);
+            emu_branch(e, v == (w >> 24 & 1) ? target : next, target);
+            return EMU_RUNNING;
+        }
+        if ((w & 0xfe000000) == 0xd6000000)         // br / blr / ret / eret
+        {
+            int opc = w >> 21 & 15;
+            if (opc == 4)
+                return EMU_ERET;
+            if (opc > 2 || (w & 0x001ffc1f) != 0x001f0000)
+                return EMU_UNDEF;       // pointer-authenticated forms
+            target = emu_reg(e, w >> 5 & 31, 1);
+            if (opc == 1)
+            {
+                e->x[30] = next;
+                emu_call(e, next);
+            }
+            else if (opc == 2)
+                emu_ret(e, target);
+            e->pc = target;
+            return EMU_RUNNING;
+        }
+        if ((w & 0xff000000) == 0xd4000000)         // svc / hvc / smc
+            return EMU_SMC;
+        if ((w & 0xffc00000) == 0xd5000000)
+        {
+            int r = emu_system(e, w);
+            if (r)
+                return r;
+            break;
+        }
+        return EMU_UNDEF;
+    default:
+        return EMU_UNDEF;
+    }
+    e->pc = next;
+    return EMU_RUNNING;
+}
+
+//====================== A64 end ====================================================
+
+//====================== polls ======================================================
+
+static uint64_t emu_state_hash(struct emu * e)
+{
+    uint64_t h = bl31_hash(BL31_HASH_INIT, e->x, sizeof(e->x));
+    return bl31_hash(h, &e->nzcv, sizeof(e->nzcv));
+}
+
+// Called for b, b.cond, cbz and tbz. A taken backward branch whose registers are the
+// same as the last time round made no progress: after s_patience such
+// rounds the loop is left through its own exit (fall through a conditional
+// branch, or take the last forward branch that was not taken).
+// cond_target is the conditional branch's target, -1 for an unconditional one.
+static void emu_branch(struct emu * e, uint64_t target, int64_t cond_target)
+{
+    uint64_t next = e->pc + 4;
+    struct emu_poll * p;
+    uint64_t h;
+    uint32_t slot;
+
+    if (target == next || target > e->pc)
+    {
+        if (cond_target != -1 && target == next && (uint64_t)cond_target > e->pc)
+        {
+            e->last_cond_pc = e->pc;
+            e->last_cond_target = cond_target;
+        }
+        e->pc = target;
+        return;
+    }
+    h = emu_state_hash(e);
+    slot = (e->pc >> 2) & (EMU_POLL_SITES - 1);
+    while ((p = &e->polls[slot])->pc && p->pc != e->pc)
+        slot = (slot + 1) & (EMU_POLL_SITES - 1);
+    if (!p->pc)
+    {
+        p->pc = e->pc;
+        p->hash = h ^ 1;
+    }
+    if (p->hash != h)
+    {
+        p->hash = h;
+        p->same = 0;
+        p->last_n = e->n_insn;
+        e->pc = target;
+        return;
+    }
+    p->same++;
+    p->rounds++;
+    p->insns += e->n_insn - p->last_n;
+    p->last_n = e->n_insn;
+    p->addr = e->last_read;
+    if (p->same < s_patience)
+    {
+        e->pc = target;
+        return;
+    }
+    p->forced++;                        // and again every round the state stays put
+    if (cond_target != -1)
+        e->pc = next;
+    else if (e->last_cond_pc >= target && e->last_cond_pc < e->pc)
+        e->pc = e->last_cond_target;
+    else
+    {
+        snprintf(e->r->why, sizeof(e->r->why), "loop with no exit");
+        e->stuck_pc = e->pc;
+        e->pc = EMU_RETURN + 4;         // emu_run stops as stuck
+    }
+}
+
+//====================== polls end ==================================================
+
+//====================== run ========================================================
+
+static int emu_insn_index(struct emu * e, uint32_t w)
+{
+    const struct bl31_image * img = e->img;
+    int i = e->last_insn + 1;
+
+    if (e->last_insn >= 0 && i < img->n_insn && img->insn[i].addr == e->pc && img->insn[i].word == w)
+        return i;
+    i = bl31_insn_at(img, e->pc, e->last_insn >= 0 ? img->insn[e->last_insn].sec : -1);
+    if (i >= 0 && img->insn[i].word == w)
+        return i;
+    // .text_pmusram and .text_pmusram_reuse: whichever holds this word
+    for (int s = 0; s < img->n_sec; s++)
+        if (img->sec[s].count && e->pc - img->sec[s].addr < img->sec[s].size
+            && (i = bl31_insn_at(img, e->pc, s)) >= 0 && img->insn[i].word == w)
+            return i;
+    return -1;
+}
+
+static void emu_run(struct emu * e)
+{
+    struct emu_result * r = e->r;
+    int stop = EMU_RUNNING;
+
+    e->last_insn = -1;
+    e->last_cond_pc = 0;
+    e->depth = 0;
+    memset(e->polls, 0, sizeof(e->polls));
+    for (int k = 0; k < EMU_POLL_SITES; k++)
+    {
+        e->sites[k].repeats = e->sites[k].answers = 0;
+        e->sites[k].insns = 0;
+    }
+    while (stop == EMU_RUNNING)
+    {
+        uint64_t v;
+        uint32_t w;
+        int i, fn;
+
+        if (e->pc == EMU_RETURN)
+        {
+            stop = EMU_RETURNED;
+            break;
+        }
+        if (e->pc == EMU_RETURN + 4)
+        {
+            stop = EMU_STUCK;
+            break;
+        }
+        if (e->n_insn >= e->limit)
+        {
+            stop = EMU_LIMIT;
+            break;
+        }
+        if (!e->pc || e->pc & 3 || e->pc >= EMU_RETURN || emu_is_device(e->pc))
+        {
+            // a NULL function pointer is almost always state only boot sets up
+            snprintf(r->why, sizeof(r->why), e->pc ? "fetch from 0x%llx" : "jump to 0%.0llx, run boot first?",
+                (unsigned long long)e->pc);
+            stop = EMU_FAULT;
+            break;
+        }
+        v = e->pc & (EMU_PAGE_SIZE - 1);
+        w = *(const uint32_t *)(emu_page(e, e->pc) + v);
+        i = emu_insn_index(e, w);
+        fn = i >= 0 ? e->img->insn[i].fn : -1;
+        if (fn >= 0)
+            r->fn_insns[fn]++;
+        else
+            r->unlisted++;
+        e->last_insn = i;
+        e->n_insn++;
+        e->called = 0;
+        stop = emu_step(e, w);
+        if (stop == EMU_RUNNING && e->called)
+        {
+            int callee = bl31_func_at(e->img, e->pc, i >= 0 ? e->img->insn[i].sec : -1);
+            if (callee >= 0)
+                r->fn_calls[callee]++;
+        }
+        if (stop != EMU_RUNNING)
+            e->n_insn -= stop == EMU_UNDEF || stop == EMU_FAULT;
+        if (stop == EMU_UNDEF)
+            snprintf(r->why, sizeof(r->why), "%08x %s", w, i >= 0 ? e->img->insn[i].text : "(not in the listing)");
+    }
+    r->stop = stop;
+    r->pc = stop == EMU_STUCK ? e->stuck_pc : e->pc;
+    if (stop != EMU_RETURNED)
+    {
+        char name[32];
+        int len = 0, fn = emu_owner(e->img, r->pc);
+        if (fn >= 0)
+            len = snprintf(r->backtrace, sizeof(r->backtrace), "%s", emu_fn_name(e->img, fn, name, sizeof(name)));
+        for (int d = e->depth - 1; d >= 0 && len < (int)sizeof(r->backtrace) - 24; d--)
+            len += snprintf(r->backtrace + len, sizeof(r->backtrace) - len, "%s%s", len ? " <- " : "",
+                emu_fn_name(e->img, emu_owner(e->img, e->calls[d] - 4), name, sizeof(name)));
+    }
+    r->x0 = e->x[0];
+    for (int k = 0; k < EMU_POLL_SITES; k++)
+        if (e->polls[k].forced || e->polls[k].rounds >= s_patience)
+        {
+            r->polls = realloc(r->polls, (r->n_polls + 1) * sizeof(*r->polls));
+            r->polls[r->n_polls++] = e->polls[k];
+        }
+    for (int k = 0; k < EMU_POLL_SITES; k++)
+        if (e->sites[k].repeats || e->sites[k].answers)
+        {
+            r->sites = realloc(r->sites, (r->n_sites + 1) * sizeof(*r->sites));
+            r->sites[r->n_sites++] = e->sites[k];
+        }
+}
+
+// the function that prints a string: the one whose instruction takes its address
+static int emu_find_fn(const struct bl31_image * img, const char * s)
+{
+    size_t len = strlen(s);
+
+    for (int k = 0; k < img->n_sec; k++)
+    {
+        const unsigned char * p = img->elf + img->sec[k].offset;
+        if (img->sec[k].flags & BL31_SEC_NOBITS)
+            continue;
+        for (uint64_t off = 0; off + len < img->sec[k].size; off++)
+        {
+            if (memcmp(p + off, s, len + 1) || (off && p[off - 1]))
+                continue;
+            for (int i = 0; i < img->n_insn; i++)
+                if (img->insn[i].fn >= 0 && img->insn[i].data == img->sec[k].addr + off)
+                    return img->insn[i].fn;
+        }
+    }
+    return -1;
+}
+
+static const char * emu_fn_name(const struct bl31_image * img, int fn, char * buf, size_t size)
+{
+    if (fn < 0)
+        snprintf(buf, size, "?");
+    else
+        snprintf(buf, size, "fn_%llx", (unsigned long long)img->fn[fn].addr);
+    return buf;
+}
+
+static int emu_run_step(struct emu * e, const struct emu_step * st, struct emu_result * r)
+{
+    const struct bl31_image * img = e->img;
+    uint64_t entry;
+    int fn = -1;
+
+    memset(r, 0, sizeof(*r));
+    r->fn_insns = calloc(img->n_fn, sizeof(*r->fn_insns));
+    r->fn_calls = calloc(img->n_fn, sizeof(*r->fn_calls));
+    e->r = r;
+    // boot starts on SP_EL3 like the reset path; everything else is C code
+    // on SP_EL0, leaving SP_EL3 (the cpu context boot set up) alone
+    emu_msr(e, EMU_SPSEL, !strcmp(st->name, "boot"));
+    memset(e->x, 0, sizeof(e->x));
+    e->x[31] = EMU_STACK_TOP;
+    e->x[30] = EMU_RETURN;
+    e->limit = e->n_insn + s_limit;
+
+    if (!strcmp(st->name, "boot"))
+    {
+        entry = img->entry;
+        fn = bl31_func_at(img, entry, -1);
+    }
+    else
+    {
+        const char * target = !strcmp(st->name, "sip") ? "rockchip_plat_sip_handler"
+            : !strcmp(st->name, "suspend") ? "pmu_v0_sys_suspend_wfi" : st->target;
+        char * end;
+
+        entry = strtoull(target, &end, 16);
+        if (*end || end == target)
+        {
+            if ((fn = emu_find_fn(img, target)) < 0)
+            {
+                fprintf(stderr, "%s: no function references \"%s\"\n", img->name, target);
+                return -1;
+            }
+            entry = img->fn[fn].addr;
+        }
+        else
+            fn = bl31_func_at(img, entry, -1);
+        for (int i = 0; i < st->n_args; i++)
+            e->x[i] = st->args[i];
+        if (!strcmp(st->name, "sip"))
+        {
+            // (smc_fid, x1, x2, x3, x4, cookie, handle, flags); SMC_RET writes x0.. into handle
+            for (int i = 0; i < 8; i++)
+                emu_write(e, EMU_HANDLE + i * 8, 8, 0);
+            e->x[6] = EMU_HANDLE;
+        }
+    }
+    r->entry = entry;
+    r->entry_fn = fn;
+    e->pc = entry;
+    r->n_insn = e->n_insn;
+    emu_run(e);
+    r->n_insn = e->n_insn - r->n_insn;
+    if (!strcmp(st->name, "sip"))
+    {
+        uint64_t v;
+        e->r = r;
+        emu_read(e, EMU_HANDLE, 8, &v);
+        r->x0 = v;
+    }
+    return 0;
+}
+
+//====================== run end ====================================================
+
+//====================== report =====================================================
+
+static const struct bl31_image * s_sort_img;
+static const struct emu_result * s_sort_r;
+
+// a register read twice in a row is usually read-modify-write, not a poll
+static int emu_is_poll(const struct emu_site * s)
+{
+    return s->answers || s->repeats >= (s_patience + 7) / 8;
+}
+
+// polls first, most instructions first
+static int emu_cmp_site(const void * a, const void * b)
+{
+    const struct emu_site * x = a, * y = b;
+    if (emu_is_poll(x) != emu_is_poll(y))
+        return emu_is_poll(y) - emu_is_poll(x);
+    return x->insns < y->insns ? 1 : x->insns > y->insns ? -1 : x->pc < y->pc ? -1 : x->pc > y->pc;
+}
+
+static int emu_owner(const struct bl31_image * img, uint64_t pc)
+{
+    int i = bl31_insn_at(img, pc, -1);
+    return i >= 0 ? img->insn[i].fn : -1;
+}
+
+static int emu_cmp_hot(const void * a, const void * b)
+{
+    uint64_t x = s_sort_r->fn_insns[*(const int *)a], y = s_sort_r->fn_insns[*(const int *)b];
+    return x < y ? 1 : x > y ? -1 : *(const int *)a - *(const int *)b;
+}
+
+static const char * emu_label(const struct bl31_image * img, int fn)
+{
+    static char buf[48];
+    const char * l = fn >= 0 ? img->fn[fn].label : NULL;
+    size_t n;
+
+    if (!l)
+        return "";
+    while (*l == '\n' || *l == '(')
+        l++;
+    n = strcspn(l, "\n");
+    snprintf(buf, sizeof(buf), "\"%.*s\"", (int)(n > 40 ? 40 : n), l);
+    return buf;
+}
+
+// one line per device access; runs of the same read from one pc fold into "xN"
+static int emu_is_console(const struct emu_access * a)
+{
+    return (a->kind == 'W' && a->addr == EMU_UART_THR) || (a->kind == 'R' && a->addr == EMU_UART_LSR);
+}
+
+// one line per access, repeated reads folded, console output folded per text line
+static int emu_trace_lines(const struct emu_result * r, char (** lines)[EMU_LINE_LEN])
+{
+    int n = 0;
+
+    *lines = malloc((r->n_trace + 1) * sizeof(**lines));
+    for (size_t i = 0; i < r->n_trace; )
+    {
+        const struct emu_access * a = &r->trace[i];
+        size_t k = i + 1;
+
+        if (emu_is_console(a))
+        {
+            char text[EMU_LINE_LEN - 8];
+            size_t len = 0;
+
+            for (k = i; k < r->n_trace && emu_is_console(&r->trace[k]); k++)
+            {
+                char c = r->trace[k].value;
+                if (r->trace[k].kind != 'W' || c == '\r')
+                    continue;
+                if (c == '\n')
+                {
+                    k++;
+                    break;
+                }
+                if (len < sizeof(text) - 1)
+                    text[len++] = c >= ' ' && c < 0x7f ? c : '.';
+            }
+            text[len] = 0;
+            snprintf((*lines)[n++], EMU_LINE_LEN, "UART \"%s\"", text);
+            i = k;
+            continue;
+        }
+        while (a->kind == 'R' && k < r->n_trace && r->trace[k].kind == 'R' && r->trace[k].pc == a->pc
+            && r->trace[k].addr == a->addr && r->trace[k].value == a->value)
+            k++;
+        if (a->kind == 'W')
+            snprintf((*lines)[n++], EMU_LINE_LEN, "W %08x = %08x", a->addr, a->value);
+        else if (k - i > 1)
+            snprintf((*lines)[n++], EMU_LINE_LEN, "R %08x x%zu", a->addr, k - i);
+        else
+            snprintf((*lines)[n++], EMU_LINE_LEN, "R %08x", a->addr);
+        i = k;
+    }
+    return n;
+}
+
+static void emu_report(const struct bl31_image * img, const struct emu_step * st, const struct emu_result * r)
+{
+    char name[32];
+    int * order;
+    int distinct = 0, n_polls;
+    uint32_t * seen = NULL;
+
+    printf("== %s: %s", img->name, st->name);
+    if (st->target)
+        printf(" %s", st->target);
+    for (int i = 0; i < st->n_args; i++)
+        printf(" 0x%llx", (unsigned long long)st->args[i]);
+    printf("   (%s %s)\n", emu_fn_name(img, r->entry_fn, name, sizeof(name)), emu_label(img, r->entry_fn));
+
+    printf("   stop: %s at 0x%llx", s_stop_names[r->stop], (unsigned long long)r->pc);
+    if (r->why[0])
+        printf(" (%s)", r->why);
+    if (r->backtrace[0])
+        printf("\n   in %s", r->backtrace);
+    if (!strcmp(st->name, "sip"))
+        printf(", SMC x0 = 0x%llx", (unsigned long long)r->x0);
+    else if (r->stop == EMU_RETURNED)
+        printf(", x0 = 0x%llx", (unsigned long long)r->x0);
+    printf("\n   %llu instructions, %.1f us at %llu MHz\n", (unsigned long long)r->n_insn,
+        (double)r->n_insn / s_mhz, (unsigned long long)s_mhz);
+
+    seen = calloc(r->n_trace + 1, sizeof(*seen));
+    for (size_t i = 0; i < r->n_trace; i++)
+    {
+        int k;
+        for (k = 0; k < distinct && seen[k] != r->trace[i].addr; k++)
+            ;
+        if (k == distinct)
+            seen[distinct++] = r->trace[i].addr;
+    }
+    free(seen);
+    printf("   device: %llu reads, %llu writes, %d registers\n", (unsigned long long)r->reads,
+        (unsigned long long)r->writes, distinct);
+
+    qsort(r->sites, r->n_sites, sizeof(*r->sites), emu_cmp_site);
+    for (n_polls = 0; n_polls < r->n_sites && emu_is_poll(&r->sites[n_polls]); n_polls++)
+        ;
+    if (n_polls)
+    {
+        uint64_t spin = 0;
+        for (int i = 0; i < n_polls; i++)
+            spin += r->sites[i].insns;
+        printf("   device polls: %llu instructions, %.1f us between repeated reads\n",
+            (unsigned long long)spin, (double)spin / s_mhz);
+        for (int i = 0; i < n_polls && i < s_top; i++)
+        {
+            const struct emu_site * p = &r->sites[i];
+            int fn = emu_owner(img, p->pc);
+            printf("     %8llx  [0x%08llx]  %6u repeats %9llu insns", (unsigned long long)p->pc,
+                (unsigned long long)p->addr, p->repeats, (unsigned long long)p->insns);
+            if (p->answers)
+                printf("  %u answered 0x%llx", p->answers, (unsigned long long)p->answer);
+            printf("  %s %s\n", emu_fn_name(img, fn, name, sizeof(name)), emu_label(img, fn));
+        }
+    }
+    for (int i = 0, shown = 0; i < r->n_polls; i++)
+    {
+        const struct emu_poll * p = &r->polls[i];
+        int fn = emu_owner(img, p->pc);
+        if (!p->forced)
+            continue;
+        if (!shown++)
+            printf("   loops cut after %u rounds with no register changing:\n", s_patience);
+        printf("     %8llx  [0x%08x]  %6u rounds %9llu insns  cut %dx  %s %s\n", (unsigned long long)p->pc, p->addr,
+            p->rounds, (unsigned long long)p->insns, p->forced, emu_fn_name(img, fn, name, sizeof(name)),
+            emu_label(img, fn));
+    }
+
+    order = malloc(img->n_fn * sizeof(*order));
+    for (int i = 0; i < img->n_fn; i++)
+        order[i] = i;
+    s_sort_img = img;
+    s_sort_r = r;
+    qsort(order, img->n_fn, sizeof(*order), emu_cmp_hot);
+    if (r->n_insn)
+        printf("   hottest functions (exclusive instructions, calls):\n");
+    for (int i = 0; i < s_top && i < img->n_fn && r->fn_insns[order[i]]; i++)
+        printf("     %10llu %5.1f%%  %6u  %-14s %s\n", (unsigned long long)r->fn_insns[order[i]],
+            100.0 * r->fn_insns[order[i]] / (r->n_insn ? r->n_insn : 1), r->fn_calls[order[i]],
+            emu_fn_name(img, order[i], name, sizeof(name)), emu_label(img, order[i]));
+    if (r->unlisted)
+        printf("     %10llu %5.1f%%          (not in the listing)\n", (unsigned long long)r->unlisted,
+            100.0 * r->unlisted / (r->n_insn ? r->n_insn : 1));
+    free(order);
+
+    if (s_verbose)
+    {
+        printf("   device trace:\n");
+        for (size_t i = 0; i < r->n_trace; i++)
+        {
+            const struct emu_access * a = &r->trace[i];
+            int fn = emu_owner(img, a->pc);
+            printf("     %10llu  %c%d 0x%08x %s 0x%08x  %8llx %s\n", (unsigned long long)a->n, a->kind, a->size * 8,
+                a->addr, a->kind == 'W' ? "<-" : "->", a->value, (unsigned long long)a->pc,
+                emu_fn_name(img, fn, name, sizeof(name)));
+        }
+    }
+}
+
+// LCS diff of two device traces, as in bl31_diff
+static void emu_diff(const struct bl31_image * a, const struct emu_result * ra,
+    const struct bl31_image * b, const struct emu_result * rb, const char * step)
+{
+    char (* la)[EMU_LINE_LEN], (* lb)[EMU_LINE_LEN];
+    int n = emu_trace_lines(ra, &la), m = emu_trace_lines(rb, &lb);
+    int changed = 0;
+
+    printf("== %s: device trace %s -> %s\n", step, a->name, b->name);
+    if (n > EMU_DIFF_MAX || m > EMU_DIFF_MAX)
+        printf("   %d / %d lines, too long to diff here: compare -v output\n", n, m);
+    else
+    {
+        uint16_t * t = calloc((size_t)(n + 1) * (m + 1), sizeof(*t));
+        int i = 0, j = 0;
+#define T(i, j) t[(size_t)(i) * (m + 1) + (j)]
+        for (i = n - 1; i >= 0; i--)
+            for (j = m - 1; j >= 0; j--)
+                T(i, j) = !strcmp(la[i], lb[j]) ? T(i + 1, j + 1) + 1
+                    : T(i + 1, j) > T(i, j + 1) ? T(i + 1, j) : T(i, j + 1);
+        for (i = j = 0; i < n || j < m; )
+        {
+            if (i < n && j < m && !strcmp(la[i], lb[j]))
+            {
+                i++;
+                j++;
+            }
+            else if (j == m || (i < n && T(i + 1, j) >= T(i, j + 1)))
+            {
+                printf("   - %s\n", la[i++]);
+                changed++;
+            }
+            else
+            {
+                printf("   + %s\n", lb[j++]);
+                changed++;
+            }
+        }
+#undef T
+        free(t);
+        printf("   %d of %d / %d lines differ\n", changed, n, m);
+    }
+    free(la);
+    free(lb);
+}
+
+//====================== report end =================================================
+
+static void usage(const char * name)
+{
+    fprintf(stderr, "usage: %s [options] image [image] step ...\n"
+        "image: dir with *_full.S and *.elf, or listing.S:image.elf\n"
+        "step:  boot | sip <fid> [x1 x2 x3] | suspend | call <addr|string> [x0 ..]\n"
+        "  -f MHz        cpu clock for the time column (%llu)\n"
+        "  -n count      instruction limit per step (%llu)\n"
+        "  -p rounds     no-progress rounds before a poll is cut (%u)\n"
+        "  -r addr=val   device register reads always return val (repeatable)\n"
+        "  -t count      hottest functions to list (%d)\n"
+        "  -v            full device trace\n", name, (unsigned long long)s_mhz,
+        (unsigned long long)s_limit, s_patience, s_top);
+    exit(2);
+}
+
+static int emu_is_step(const char * s)
+{
+    return !strcmp(s, "boot") || !strcmp(s, "sip") || !strcmp(s, "suspend") || !strcmp(s, "call");
+}
+
+int main(int argc, char * argv[])
+{
+    struct bl31_image img[EMU_MAX_IMAGES];
+    struct emu_step steps[EMU_MAX_STEPS];
+    struct emu_result * res[EMU_MAX_IMAGES];
+    int n_img = 0, n_steps = 0, i, rc = 0;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++)
+    {
+        const char * v = argv[i][1] && !argv[i][2] && argv[i][1] != 'v' && i + 1 < argc ? argv[i + 1] : NULL;
+        switch (argv[i][1])
+        {
+        case 'v': s_verbose = 1; continue;
+        case 'f': if (v) s_mhz = strtoull(v, NULL, 0); break;
+        case 'n': if (v) s_limit = strtoull(v, NULL, 0); break;
+        case 'p': if (v) s_patience = strtoul(v, NULL, 0); break;
+        case 't': if (v) s_top = atoi(v); break;
+        case 'r':
+            if (v && strchr(v, '=') && s_n_overrides < EMU_MAX_OVERRIDES)
+            {
+                s_override_addr[s_n_overrides] = strtoul(v, NULL, 0);
+                s_override_val[s_n_overrides++] = strtoul(strchr(v, '=') + 1, NULL, 0);
+                break;
+            }
+            usage(argv[0]);
+        default: usage(argv[0]);
+        }
+        if (!v || !s_mhz || !s_patience)
+            usage(argv[0]);
+        i++;
+    }
+    for (; i < argc && !emu_is_step(argv[i]); i++)
+    {
+        const char * colon = strchr(argv[i], ':');
+        int r;
+
+        if (n_img == EMU_MAX_IMAGES)
+            usage(argv[0]);
+        if (colon)
+        {
+            char listing[4096];
+            snprintf(listing, sizeof(listing), "%.*s", (int)(colon - argv[i]), argv[i]);
+            r = bl31_load(&img[n_img], listing, colon + 1);
+        }
+        else
+            r = bl31_load_dir(&img[n_img], argv[i]);
+        if (r < 0)
+            return 1;
+        bl31_analyze(&img[n_img++]);
+    }
+    for (; i < argc; i++)
+    {
+        struct emu_step * st = &steps[n_steps];
+
+        if (!emu_is_step(argv[i]) || n_steps == EMU_MAX_STEPS)
+            usage(argv[0]);
+        memset(st, 0, sizeof(*st));
+        st->name = argv[i];
+        if (!strcmp(st->name, "call"))
+        {
+            if (i + 1 == argc)
+                usage(argv[0]);
+            st->target = argv[++i];
+        }
+        while (i + 1 < argc && !emu_is_step(argv[i + 1]) && st->n_args < 8 && strcmp(st->name, "boot")
+            && strcmp(st->name, "suspend"))
+            st->args[st->n_args++] = strtoull(argv[++i], NULL, 0);
+        if (!strcmp(st->name, "sip") && !st->n_args)
+            usage(argv[0]);
+        n_steps++;
+    }
+    if (!n_img || !n_steps)
+        usage(argv[0]);
+
+    for (int k = 0; k < n_img; k++)
+    {
+        struct emu * e = calloc(1, sizeof(*e));
+        double t0 = (double)clock() / CLOCKS_PER_SEC;
+
+        e->img = &img[k];
+        e->page = calloc(EMU_PAGES, sizeof(*e->page));
+        emu_load_image(e);
+        emu_reset_sysregs(e);
+        res[k] = calloc(n_steps, sizeof(*res[k]));
+        for (int s = 0; s < n_steps; s++)
+        {
+            if (emu_run_step(e, &steps[s], &res[k][s]) < 0)
+            {
+                rc = 1;
+                break;
+            }
+            emu_report(&img[k], &steps[s], &res[k][s]);
+            if (res[k][s].stop >= EMU_LIMIT)
+                rc = 1;
+        }
+        fflush(stdout);
+        fprintf(stderr, "%s: %llu instructions emulated in %.0f ms\n", img[k].name,
+            (unsigned long long)e->n_insn, ((double)clock() / CLOCKS_PER_SEC - t0) * 1e3);
+        for (uint32_t p = 0; p < EMU_PAGES; p++)
+            free(e->page[p]);
+        free(e->page);
+        free(e);
+    }
+    if (n_img == 2 && !rc)
+        for (int s = 0; s < n_steps; s++)
+            emu_diff(&img[0], &res[0][s], &img[1], &res[1][s], steps[s].name);
+
+    for (int k = 0; k < n_img; k++)
+    {
+        for (int s = 0; s < n_steps && res[k]; s++)
+        {
+            free(res[k][s].trace);
+            free(res[k][s].polls);
+            free(res[k][s].sites);
+            free(res[k][s].fn_insns);
+            free(res[k][s].fn_calls);
+        }
+        free(res[k]);
+        bl31_free(&img[k]);
+    }
+    return rc;
+}
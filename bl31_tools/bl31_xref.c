@@ -0,0 +1,712 @@
+// String and MMIO cross-reference index over BL31 images.
+//
+// Build once from the listings + ELFs (bl31.h), query many times:
+//
+//   string   -> every instruction that materializes its address -> function
+//   MMIO     -> every instruction that builds a device address (mov/movk,
+//               literal pool, add on a known base) or loads/stores through one
+//   function -> the strings and MMIO addresses it touches
+//
+// The index is one flat file of fixed-size sorted records plus a text pool;
+// a query mmaps it and binary-searches (addresses) or scans the few thousand
+// strings (substrings), so it does not re-read the 32k-line listings.
+//
+//   make xref                                   (build/bl31.xref from both images)
+//   ./build/bl31_xref -b [-d index] dir|listing.S:image.elf ...
+//   ./build/bl31_xref [-d index] virtual_poweroff_en "WAKEUP SOURCE"
+//   ./build/bl31_xref 0xfdc20000+0x10000        (PMUGRF block)
+//   ./build/bl31_xref 0xfdd90000 fn_5f104
+//   ./build/bl31_xref -e suspend_mode_config    (exact string match)
+//
+// Sources are recorded by path, size and mtime; a query warns when one of
+// them changed since the index was built.
+
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<limits.h>
+#include<time.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+
+#include "bl31.h"
+
+#define XREF_MAGIC          "BL31XRF"
+#define XREF_VERSION        1
+#define XREF_DEFAULT        "build/bl31.xref"
+#define XREF_MAX_IMAGES     8
+#define XREF_MIN_STRING     4
+#define XREF_NONE           0xffffffffu
+
+// device window: rk3568 peripherals, GIC and PMU SRAM all sit above this
+#define XREF_MMIO_LO        0xf0000000ull
+#define XREF_MMIO_HI        0x100000000ull
+
+enum
+{
+    XREF_STRING,                        // address of a string taken
+    XREF_MMIO_CONST,                    // device address built in a register
+    XREF_MMIO_READ,                     // load through it
+    XREF_MMIO_WRITE,                    // store through it
+};
+
+static const char * const s_kind_names[] = { "string", "const", "read", "write" };
+
+struct xref_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t n_images;
+    uint32_t n_strings;
+    uint32_t n_refs;                    // string references, grouped by string
+    uint32_t n_mmio;                    // sorted by value
+    uint32_t pool_size;
+    uint64_t off_images, off_strings, off_refs, off_mmio, off_pool;
+};
+
+struct xref_image
+{
+    char name[64];
+    uint32_t listing_off, elf_off;      // absolute source paths, in the pool
+    uint64_t listing_size, listing_mtime;
+    uint64_t elf_size, elf_mtime;
+    uint32_t n_fn, n_insn;
+};
+
+struct xref_string
+{
+    uint64_t addr;
+    uint32_t image;
+    uint32_t text_off;
+    uint32_t first_ref, n_refs;
+};
+
+struct xref_ref
+{
+    uint64_t value;                     // string address / device address
+    uint64_t insn_addr;
+    uint64_t fn_addr;
+    uint32_t image, kind;
+    uint32_t fn_off;                    // "fn_5f104", in the pool
+    uint32_t label_off;                 // function's first string, or XREF_NONE
+    uint32_t text_off;                  // listed instruction
+    uint32_t pad;
+};
+
+//====================== build ======================================================
+
+static struct xref_image s_images[XREF_MAX_IMAGES];
+static struct xref_string * s_strings;
+static struct xref_ref * s_refs, * s_mmio;
+static char * s_pool;
+static uint32_t s_n_images, s_n_strings, s_n_refs, s_n_mmio, s_pool_size;
+static uint32_t s_cap_strings, s_cap_refs, s_cap_mmio, s_cap_pool;
+
+static uint32_t xref_pool_add(const char * s, size_t len)
+{
+    uint32_t off = s_pool_size;
+
+    if (s_pool_size + len + 1 > s_cap_pool)
+    {
+        s_cap_pool = (s_pool_size + len + 1) * 2;
+        s_pool = realloc(s_pool, s_cap_pool);
+    }
+    memcpy(s_pool + off, s, len);
+    s_pool[off + len] = '\0';
+    s_pool_size += len + 1;
+    return off;
+}
+
+#define XREF_PUSH(arr, n, cap) \
+    ((n) == (cap) ? ((cap) = (cap) ? (cap) * 2 : 4096, (arr) = realloc((arr), (cap) * sizeof(*(arr))), &(arr)[(n)++]) : &(arr)[(n)++])
+
+static int xref_cmp_string(const void * a, const void * b)
+{
+    const struct xref_string * x = a, * y = b;
+    if (x->image != y->image)
+        return x->image < y->image ? -1 : 1;
+    return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+static int xref_cmp_ref(const void * a, const void * b)
+{
+    const struct xref_ref * x = a, * y = b;
+    if (x->value != y->value)
+        return x->value < y->value ? -1 : 1;
+    if (x->image != y->image)
+        return x->image < y->image ? -1 : 1;
+    if (x->insn_addr != y->insn_addr)
+        return x->insn_addr < y->insn_addr ? -1 : 1;
+    return (int)x->kind - (int)y->kind;
+}
+
+static void xref_add_string(const struct bl31_image * img, uint32_t image, uint64_t addr, const char * s)
+{
+    struct xref_string * st = XREF_PUSH(s_strings, s_n_strings, s_cap_strings);
+    st->addr = addr;
+    st->image = image;
+    st->text_off = xref_pool_add(s, strlen(s));
+    st->first_ref = st->n_refs = 0;
+}
+
+// NUL-terminated runs of printable bytes starting after a NUL, like strings(1)
+static void xref_scan_strings(const struct bl31_image * img, uint32_t image)
+{
+    for (int i = 0; i < img->n_sec; i++)
+    {
+        const struct bl31_section * s = &img->sec[i];
+        const unsigned char * p;
+        uint64_t off;
+
+        if (s->flags & BL31_SEC_NOBITS)
+            continue;
+        p = img->elf + s->offset;
+        for (off = 0; off < s->size; off++)
+        {
+            const char * str;
+
+            if ((off && p[off - 1]) || !p[off])
+                continue;
+            if ((str = bl31_string_at(img, s->addr + off)) && strlen(str) >= XREF_MIN_STRING)
+            {
+                xref_add_string(img, image, s->addr + off, str);
+                off += strlen(str);
+            }
+        }
+    }
+}
+
+static struct xref_ref * xref_new_ref(struct xref_ref ** arr, uint32_t * n, uint32_t * cap,
+    const struct bl31_image * img, uint32_t image, const uint32_t * fn_off, int f, const struct bl31_insn * in)
+{
+    struct xref_ref * r = XREF_PUSH(*arr, *n, *cap);
+
+    memset(r, 0, sizeof(*r));
+    r->insn_addr = in->addr;
+    r->fn_addr = img->fn[f].addr;
+    r->image = image;
+    r->fn_off = fn_off[f];
+    r->label_off = XREF_NONE;
+    if (img->fn[f].label)
+    {
+        const char * l = img->fn[f].label;
+        while (*l == '\n')
+            l++;
+        r->label_off = xref_pool_add(l, strcspn(l, "\n"));
+    }
+    r->text_off = xref_pool_add(in->text, strlen(in->text));
+    return r;
+}
+
+static int xref_parse_reg(const char * p, int * reg, int * is_w)
+{
+    if ((p[0] != 'x' && p[0] != 'w') || p[1] < '0' || p[1] > '9')
+        return 0;
+    *reg = atoi(p + 1);
+    *is_w = p[0] == 'w';
+    return *reg < 31;
+}
+
+static int xref_is_mmio(uint64_t v)
+{
+    return v >= XREF_MMIO_LO && v < XREF_MMIO_HI;
+}
+
+// device addresses per function: constants followed through mov / movk /
+// add / orr and literal loads, then loads and stores through them
+static void xref_scan_mmio(const struct bl31_image * img, uint32_t image, const uint32_t * fn_off)
+{
+    for (int f = 0; f < img->n_fn; f++)
+    {
+        uint64_t val[32];
+        uint32_t known = 0;
+
+        for (int k = 0; k < img->fn[f].n_insns; k++)
+        {
+            const struct bl31_insn * in = &img->insn[img->fn[f].insns[k]];
+            const char * t = in->text, * ops = strchr(t, ' '), * p;
+            uint32_t kill = bl31_writes(in), set = 0;
+            uint64_t target, v = 0, imm;
+            int rd, rn, w = 0, size, have = 0;
+
+            if (!(in->flags & BL31_INSN_VALID) || !ops)
+            {
+                known &= ~kill;
+                continue;
+            }
+            ops++;
+            if (bl31_ldr_literal(in->word, in->addr, &rd, &target, &size) && in->data)
+            {
+                v = in->data;
+                have = 1;
+            }
+            else if ((!strncmp(t, "mov ", 4) || !strncmp(t, "movz ", 5)) && xref_parse_reg(ops, &rd, &w)
+                && (p = strstr(ops, ", #")))
+            {
+                v = strtoull(p + 3, NULL, 0);
+                have = 1;
+            }
+            else if (!strncmp(t, "movk ", 5) && xref_parse_reg(ops, &rd, &w) && known & 1u << rd
+                && (p = strstr(ops, ", #")))
+            {
+                const char * sh = strstr(p, "lsl #");
+                int shift = sh ? atoi(sh + 5) : 0;
+                imm = strtoull(p + 3, NULL, 0);
+                v = (val[rd] & ~(0xffffull << shift)) | imm << shift;
+                have = 1;
+            }
+            else if ((!strncmp(t, "add ", 4) || !strncmp(t, "orr ", 4)) && xref_parse_reg(ops, &rd, &w)
+                && (p = strchr(ops, ',')) && xref_parse_reg(p + 2, &rn, &w) && known & 1u << rn
+                && (p = strstr(p + 2, ", #")))
+            {
+                const char * sh = strstr(p, "lsl #");
+                imm = strtoull(p + 3, NULL, 0) << (sh ? atoi(sh + 5) : 0);
+                v = t[0] == 'a' ? val[rn] + imm : val[rn] | imm;
+                have = 1;
+            }
+            if (have && xref_parse_reg(ops, &rd, &w))
+            {
+                if (w)
+                    v &= 0xffffffffull;
+                val[rd] = v;
+                set = 1u << rd;
+                if (xref_is_mmio(v))
+                {
+                    struct xref_ref * r = xref_new_ref(&s_mmio, &s_n_mmio, &s_cap_mmio, img, image, fn_off, f, in);
+                    r->value = v;
+                    r->kind = XREF_MMIO_CONST;
+                }
+                // a movk chain reports its last step only: drop the previous
+                if (!strncmp(t, "movk ", 5) && s_n_mmio > 1 && xref_is_mmio(v)
+                    && s_mmio[s_n_mmio - 2].insn_addr + 4 == in->addr
+                    && s_mmio[s_n_mmio - 2].kind == XREF_MMIO_CONST && s_mmio[s_n_mmio - 2].image == image)
+                {
+                    s_mmio[s_n_mmio - 2] = s_mmio[s_n_mmio - 1];
+                    s_n_mmio--;
+                }
+            }
+            else if ((t[0] == 'l' && t[1] == 'd') || (t[0] == 's' && t[1] == 't'))
+            {
+                // [xN] / [xN, #imm] / [xN, #imm]! / [xN], #imm
+                if ((p = strchr(ops, '[')) && xref_parse_reg(p + 1, &rn, &w) && !w && known & 1u << rn)
+                {
+                    const char * q = strchr(p, ']'), * imm_at = strstr(p, ", #"), * comma = strchr(p, ',');
+                    uint64_t off = 0;
+
+                    if (q && imm_at && imm_at < q)
+                        off = strtoll(imm_at + 3, NULL, 0);
+                    else if (q && comma && comma < q)
+                        off = XREF_MMIO_HI;     // register offset: unknown
+                    if (off != XREF_MMIO_HI && xref_is_mmio(val[rn] + off))
+                    {
+                        struct xref_ref * r = xref_new_ref(&s_mmio, &s_n_mmio, &s_cap_mmio, img, image, fn_off, f, in);
+                        r->value = val[rn] + off;
+                        r->kind = t[0] == 'l' ? XREF_MMIO_READ : XREF_MMIO_WRITE;
+                    }
+                }
+            }
+            known = (known & ~kill) | set;
+        }
+    }
+}
+
+static int xref_add_image(const char * arg)
+{
+    struct bl31_image img;
+    struct xref_image * xi = &s_images[s_n_images];
+    char listing[PATH_MAX], elf[PATH_MAX], path[PATH_MAX];
+    const char * colon = strchr(arg, ':');
+    uint32_t image = s_n_images, first_string = s_n_strings, * fn_off;
+    struct stat st;
+    int rc;
+
+    if (s_n_images == XREF_MAX_IMAGES)
+    {
+        fprintf(stderr, "at most %d images\n", XREF_MAX_IMAGES);
+        return -1;
+    }
+    if (colon)
+    {
+        snprintf(listing, sizeof(listing), "%.*s", (int)(colon - arg), arg);
+        snprintf(elf, sizeof(elf), "%s", colon + 1);
+        rc = bl31_load(&img, listing, elf);
+    }
+    else
+        rc = bl31_load_dir(&img, arg);
+    if (rc < 0)
+        return -1;
+    bl31_analyze(&img);
+
+    memset(xi, 0, sizeof(*xi));
+    snprintf(xi->name, sizeof(xi->name), "%s", img.name);
+    if (realpath(img.listing_path, path) && !stat(path, &st))
+    {
+        xi->listing_off = xref_pool_add(path, strlen(path));
+        xi->listing_size = st.st_size;
+        xi->listing_mtime = st.st_mtime;
+    }
+    else
+        xi->listing_off = XREF_NONE;
+    if (realpath(img.elf_path, path) && !stat(path, &st))
+    {
+        xi->elf_off = xref_pool_add(path, strlen(path));
+        xi->elf_size = st.st_size;
+        xi->elf_mtime = st.st_mtime;
+    }
+    else
+        xi->elf_off = XREF_NONE;
+    xi->n_fn = img.n_fn;
+    xi->n_insn = img.n_insn;
+
+    fn_off = malloc(img.n_fn * sizeof(*fn_off));
+    for (int f = 0; f < img.n_fn; f++)
+    {
+        char name[64];
+        int n = snprintf(name, sizeof(name), "fn_%llx", (unsigned long long)img.fn[f].addr);
+        // .text_pmusram and .text_pmusram_reuse share VMAs
+        for (int s = 0; s < img.n_sec; s++)
+            if (s != img.fn[f].sec && img.sec[s].count && img.fn[f].addr - img.sec[s].addr < img.sec[s].size)
+                n = snprintf(name, sizeof(name), "fn_%llx@%s", (unsigned long long)img.fn[f].addr,
+                    img.sec[img.fn[f].sec].name);
+        fn_off[f] = xref_pool_add(name, n);
+    }
+
+    xref_scan_strings(&img, image);
+    // referenced strings that do not start after a NUL (merged suffixes)
+    for (int i = 0; i < img.n_insn; i++)
+    {
+        const struct bl31_insn * in = &img.insn[i];
+        const char * str;
+        struct xref_string key = { .addr = in->data, .image = image };
+
+        if (in->fn < 0 || !in->data || !(str = bl31_string_at(&img, in->data)))
+            continue;
+        if (!bsearch(&key, s_strings + first_string, s_n_strings - first_string, sizeof(key), xref_cmp_string))
+        {
+            xref_add_string(&img, image, in->data, str);
+            qsort(s_strings + first_string, s_n_strings - first_string, sizeof(*s_strings), xref_cmp_string);
+        }
+        xref_new_ref(&s_refs, &s_n_refs, &s_cap_refs, &img, image, fn_off, in->fn, in)->value = in->data;
+    }
+    xref_scan_mmio(&img, image, fn_off);
+
+    fprintf(stderr, "%s: %d functions, %u strings, %u string refs, %u mmio refs so far\n",
+        img.name, img.n_fn, s_n_strings - first_string, s_n_refs, s_n_mmio);
+    free(fn_off);
+    bl31_free(&img);
+    s_n_images++;
+    return 0;
+}
+
+static int xref_write(const char * path)
+{
+    struct xref_header h;
+    uint32_t i, j;
+    FILE * f;
+
+    qsort(s_strings, s_n_strings, sizeof(*s_strings), xref_cmp_string);
+    qsort(s_mmio, s_n_mmio, sizeof(*s_mmio), xref_cmp_ref);
+    // string refs grouped under their string: same order, (image, addr)
+    for (i = 0; i < s_n_refs; i++)
+    {
+        uint64_t v = s_refs[i].value;
+        s_refs[i].value = (uint64_t)s_refs[i].image << 56 | v;
+    }
+    qsort(s_refs, s_n_refs, sizeof(*s_refs), xref_cmp_ref);
+    for (i = 0; i < s_n_refs; i++)
+        s_refs[i].value &= (1ull << 56) - 1;
+    for (i = j = 0; i < s_n_strings; i++)
+    {
+        struct xref_string * st = &s_strings[i];
+        while (j < s_n_refs && (s_refs[j].image < st->image
+            || (s_refs[j].image == st->image && s_refs[j].value < st->addr)))
+            j++;
+        st->first_ref = j;
+        while (j < s_n_refs && s_refs[j].image == st->image && s_refs[j].value == st->addr)
+            j++;
+        st->n_refs = j - st->first_ref;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, XREF_MAGIC, sizeof(h.magic));
+    h.version = XREF_VERSION;
+    h.n_images = s_n_images;
+    h.n_strings = s_n_strings;
+    h.n_refs = s_n_refs;
+    h.n_mmio = s_n_mmio;
+    h.pool_size = s_pool_size;
+    h.off_images = sizeof(h);
+    h.off_strings = h.off_images + s_n_images * sizeof(*s_images);
+    h.off_refs = h.off_strings + s_n_strings * sizeof(*s_strings);
+    h.off_mmio = h.off_refs + s_n_refs * sizeof(*s_refs);
+    h.off_pool = h.off_mmio + s_n_mmio * sizeof(*s_mmio);
+
+    f = fopen(path, "wb");
+    if (!f)
+    {
+        perror(path);
+        return -1;
+    }
+    fwrite(&h, sizeof(h), 1, f);
+    fwrite(s_images, sizeof(*s_images), s_n_images, f);
+    fwrite(s_strings, sizeof(*s_strings), s_n_strings, f);
+    fwrite(s_refs, sizeof(*s_refs), s_n_refs, f);
+    fwrite(s_mmio, sizeof(*s_mmio), s_n_mmio, f);
+    fwrite(s_pool, 1, s_pool_size, f);
+    if (fclose(f))
+    {
+        perror(path);
+        return -1;
+    }
+    fprintf(stderr, "%s: %u images, %u strings, %u string refs, %u mmio refs, %llu bytes\n", path,
+        s_n_images, s_n_strings, s_n_refs, s_n_mmio, (unsigned long long)(h.off_pool + s_pool_size));
+    return 0;
+}
+
+//====================== build end ==================================================
+
+//====================== query ======================================================
+
+static const struct xref_header * s_h;
+static const struct xref_image * s_qimages;
+static const struct xref_string * s_qstrings;
+static const struct xref_ref * s_qrefs, * s_qmmio;
+static const char * s_qpool;
+static int s_exact;
+
+static int xref_open(const char * path)
+{
+    struct stat st;
+    void * map;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        perror(path);
+        fprintf(stderr, "build it first: bl31_xref -b -d %s <image dirs>\n", path);
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+    s_h = map;
+    if ((size_t)st.st_size < sizeof(*s_h) || memcmp(s_h->magic, XREF_MAGIC, sizeof(s_h->magic))
+        || s_h->version != XREF_VERSION || s_h->off_pool + s_h->pool_size != (uint64_t)st.st_size)
+    {
+        fprintf(stderr, "%s: not a bl31_xref index (version %d), rebuild it with -b\n", path, XREF_VERSION);
+        return -1;
+    }
+    s_qimages = (const void *)((const char *)map + s_h->off_images);
+    s_qstrings = (const void *)((const char *)map + s_h->off_strings);
+    s_qrefs = (const void *)((const char *)map + s_h->off_refs);
+    s_qmmio = (const void *)((const char *)map + s_h->off_mmio);
+    s_qpool = (const char *)map + s_h->off_pool;
+
+    for (uint32_t i = 0; i < s_h->n_images; i++)
+    {
+        const struct xref_image * xi = &s_qimages[i];
+        if ((xi->listing_off != XREF_NONE && (stat(s_qpool + xi->listing_off, &st)
+                || (uint64_t)st.st_size != xi->listing_size || (uint64_t)st.st_mtime != xi->listing_mtime))
+            || (xi->elf_off != XREF_NONE && (stat(s_qpool + xi->elf_off, &st)
+                || (uint64_t)st.st_size != xi->elf_size || (uint64_t)st.st_mtime != xi->elf_mtime)))
+            fprintf(stderr, "warning: %s sources changed since the index was built\n", xi->name);
+    }
+    return 0;
+}
+
+static void xref_print_ref(const struct xref_ref * r, int show_value)
+{
+    const char * label = r->label_off != XREF_NONE ? s_qpool + r->label_off : NULL;
+
+    if (show_value)
+        printf("  0x%08llx", (unsigned long long)r->value);
+    printf("  %-6s %-6s %8llx  %-22s %-36s", s_qimages[r->image].name, s_kind_names[r->kind],
+        (unsigned long long)r->insn_addr, s_qpool + r->fn_off, s_qpool + r->text_off);
+    if (label)
+        printf("  \"%.40s\"", label);
+    printf("\n");
+}
+
+static void xref_print_text(const char * s)
+{
+    putchar('"');
+    for (; *s; s++)
+        if (*s == '\n')
+            fputs("\\n", stdout);
+        else if (*s == '\t')
+            fputs("\\t", stdout);
+        else
+            putchar(*s);
+    putchar('"');
+}
+
+static int xref_cmp_text(const void * a, const void * b)
+{
+    const struct xref_string * x = *(const struct xref_string * const *)a;
+    const struct xref_string * y = *(const struct xref_string * const *)b;
+    int c = strcmp(s_qpool + x->text_off, s_qpool + y->text_off);
+    return c ? c : (int)x->image - (int)y->image;
+}
+
+static int xref_query_string(const char * q)
+{
+    const struct xref_string ** hit = malloc(s_h->n_strings * sizeof(*hit));
+    int n = 0;
+
+    for (uint32_t i = 0; i < s_h->n_strings; i++)
+    {
+        const char * text = s_qpool + s_qstrings[i].text_off;
+        if (s_exact ? !strcmp(text, q) : !!strstr(text, q))
+            hit[n++] = &s_qstrings[i];
+    }
+    qsort(hit, n, sizeof(*hit), xref_cmp_text);
+    for (int i = 0; i < n; i++)
+    {
+        const struct xref_string * st = hit[i];
+
+        if (!i || strcmp(s_qpool + st->text_off, s_qpool + hit[i - 1]->text_off))
+        {
+            xref_print_text(s_qpool + st->text_off);
+            printf("\n");
+        }
+        printf("  %-6s @0x%llx  %u ref%s\n", s_qimages[st->image].name, (unsigned long long)st->addr,
+            st->n_refs, st->n_refs == 1 ? "" : "s");
+        for (uint32_t k = 0; k < st->n_refs; k++)
+        {
+            printf("  ");
+            xref_print_ref(&s_qrefs[st->first_ref + k], 0);
+        }
+    }
+    free(hit);
+    return n;
+}
+
+static int xref_query_mmio(uint64_t lo, uint64_t hi)
+{
+    uint32_t a = 0, b = s_h->n_mmio;
+    int n = 0;
+
+    while (a < b)                       // lower bound of lo
+    {
+        uint32_t mid = (a + b) / 2;
+        if (s_qmmio[mid].value < lo)
+            a = mid + 1;
+        else
+            b = mid;
+    }
+    for (; a < s_h->n_mmio && s_qmmio[a].value < hi; a++, n++)
+        xref_print_ref(&s_qmmio[a], 1);
+    return n;
+}
+
+static int xref_query_fn(const char * name)
+{
+    int n = 0;
+
+    for (uint32_t i = 0; i < s_h->n_refs; i++)
+        if (!strcmp(s_qpool + s_qrefs[i].fn_off, name))
+        {
+            printf("  ");
+            xref_print_ref(&s_qrefs[i], 0);
+            printf("      -> ");
+            for (uint32_t k = 0; k < s_h->n_strings; k++)
+                if (s_qstrings[k].image == s_qrefs[i].image && s_qstrings[k].addr == s_qrefs[i].value)
+                    xref_print_text(s_qpool + s_qstrings[k].text_off);
+            printf("\n");
+            n++;
+        }
+    for (uint32_t i = 0; i < s_h->n_mmio; i++)
+        if (!strcmp(s_qpool + s_qmmio[i].fn_off, name))
+        {
+            xref_print_ref(&s_qmmio[i], 1);
+            n++;
+        }
+    return n;
+}
+
+static double xref_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//====================== query end ==================================================
+
+static void usage(const char * name)
+{
+    fprintf(stderr, "usage: %s -b [-d index] dir|listing.S:image.elf ...   build the index\n"
+        "       %s [-d index] [-e] query ...\n"
+        "query: text (substring of a string, -e: whole string), 0xaddr, 0xaddr+len, fn_<addr>\n"
+        "index: %s by default\n", name, name, XREF_DEFAULT);
+    exit(2);
+}
+
+int main(int argc, char * argv[])
+{
+    const char * index = XREF_DEFAULT;
+    int opt, build = 0, total = 0;
+    double t0 = xref_now();
+
+    while ((opt = getopt(argc, argv, "bd:e")) != -1)
+    {
+        if (opt == 'b')
+            build = 1;
+        else if (opt == 'd')
+            index = optarg;
+        else if (opt == 'e')
+            s_exact = 1;
+        else
+            usage(argv[0]);
+    }
+    if (optind == argc)
+        usage(argv[0]);
+
+    if (build)
+    {
+        for (int i = optind; i < argc; i++)
+            if (xref_add_image(argv[i]) < 0)
+                return 1;
+        if (xref_write(index) < 0)
+            return 1;
+        fprintf(stderr, "built in %.0f ms\n", (xref_now() - t0) * 1e3);
+        return 0;
+    }
+
+    if (xref_open(index) < 0)
+        return 1;
+    for (int i = optind; i < argc; i++)
+    {
+        const char * q = argv[i];
+        int n;
+
+        if (!strncmp(q, "0x", 2))
+        {
+            char * end;
+            uint64_t lo = strtoull(q, &end, 16), hi = lo + 1;
+            if (*end == '+')
+                hi = lo + strtoull(end + 1, NULL, 0);
+            printf("%s\n", q);
+            n = xref_query_mmio(lo, hi);
+        }
+        else if (!strncmp(q, "fn_", 3))
+        {
+            printf("%s\n", q);
+            n = xref_query_fn(q);
+        }
+        else
+            n = xref_query_string(q);
+        if (!n)
+            printf("%s: no match\n", q);
+        total += n;
+    }
+    fprintf(stderr, "%d results in %.2f ms\n", total, (xref_now() - t0) * 1e3);
+    return total ? 0 : 1;
+}
@@ -3,7 +3,10 @@
 # write-preloader-mtd.sh — Pure shell: write preloader.img to internal SPI NAND
 #
 # Uses Busybox flash_eraseall + nandwrite on the MTD "preloader" partition
-# (first 2 MiB of SPI NAND). No C binary.
+# (first 2 MiB of SPI NAND). No C binary needed: if spi_tools' preloader_flash
+# (make cross) is in the same folder, it is used instead and writes only the
+# erase blocks that differ, reading each one back. It also refuses an image
+# without a valid IDBLOCK; the script then reports that and stops.
 #
 # Intended for Miyoo Flip images from github.com/Zetarancio/distribution branch
 # "flip" (GitHub Actions), which expose the "preloader" MTD partition.
@@ -75,6 +78,40 @@ echo ""
 echo "Press Ctrl+C within 5 seconds to cancel..."
 sleep 5
 
+if [ -x "$SCRIPT_DIR/preloader_flash" ]; then
+	# Ctrl+C reaches preloader_flash, which finishes the current block and
+	# exits 3; the shell waits for it instead of dying first.
+	trap ':' INT TERM HUP
+	rc=0
+	"$SCRIPT_DIR/preloader_flash" -y -d "$PRELOADER_CHR" "$IMG" || rc=$?
+	trap - INT TERM HUP
+	case $rc in
+	0)
+		echo ""
+		echo "Done. Reboot to boot from internal SPI NAND."
+		exit 0
+		;;
+	3)
+		echo "" >&2
+		echo "STOPPED: preloader_flash was interrupted." >&2
+		echo "If it had started writing, the partition is incomplete: do not reboot," >&2
+		echo "run this script again to finish the remaining blocks." >&2
+		exit 3
+		;;
+	*)
+		echo "" >&2
+		echo "FAILED: preloader_flash exited with status $rc; its reason is printed above." >&2
+		echo "- \"no IDBLOCK\" / \"no IDBLOCK with matching hashes\": the image was refused and" >&2
+		echo "  nothing was written. The bootrom would not boot it. Extract preloader.img" >&2
+		echo "  again from a full SPI dump (extract-preloader-from-spi-dump.sh)." >&2
+		echo "- \"does not hold the image\": a block failed its readback. Do not reboot;" >&2
+		echo "  run this script again, or restore with xrock from MASKROM." >&2
+		echo "nandwrite was not used as a fallback: it would write the same image unchecked." >&2
+		exit 1
+		;;
+	esac
+fi
+
 echo "Erasing (flash_eraseall) ..."
 flash_eraseall "$PRELOADER_CHR"
 
@@ -0,0 +1,403 @@
+// Host microbenchmark for the miyoo_inputd hot path.
+//
+// Pulls in miyoo_inputd.c without its main() so the static helpers can be
+// timed directly; the uinput calls are stubbed out (they only count). Each
+// stage is timed against a copy of the stock code path it replaced:
+//
+//   cal parse      getKeyValueDefault() x6 on a config buffer, and the
+//                  whole pk_read_cal_config() (fopen + parse), ns/call
+//   axis           pk_frame_to_axis_x/y() for the four axes
+//   deadzone       radial check: multiply vs LUT squares
+//   calibrate      axis + deadzone: divide vs LUT
+//   frame check    stock memcpy + magic test vs trimui_pad_stream_feed()
+//   dispatch       stock per-map key_pressed()/key_released() loop vs
+//                  XOR + ctz trimui_dispatch_bits()
+//
+//   make bench                     (or make cross for aarch64)
+//   gcc -O2 -I. -o miyoo_inputd_bench bench/miyoo_inputd_bench.c
+//   ./miyoo_inputd_bench [iterations]
+
+// only the hot path is called; the event loop and its handlers come along
+// unused, so that warning is off for the daemon source alone
+#define MIYOO_INPUTD_NO_MAIN
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#include "../miyoo_inputd.c"
+#pragma GCC diagnostic pop
+
+#include <time.h>
+
+int s_bench_events;
+
+int trimui_setup_xpad(int port, const int * keys, int count) { return 0; }
+int trimui_vkey(int port, int code, int value) { s_bench_events += code + value; return 0; }
+int trimui_vaxis(int port, int axis, int value) { s_bench_events += axis + value; return 0; }
+int trimui_vswitch(int port, int code, int value) { s_bench_events += code + value; return 0; }
+int trimui_setup_syskeys() { return 0; }
+int trimui_vflush(int port) { return 0; }
+int trimui_vflush_all() { return 0; }
+void trimui_destroy_xpad(int port) { }
+int trimui_xpad_fd(int port) { return -1; }
+int trimui_ff_handle(int port, ukey_ff_play_fn play) { return 0; }
+
+#define BENCH_FRAMES    (4096)
+
+static struct TRIMUI_PAD_FRAME s_bench_frames[BENCH_FRAMES];
+static volatile int s_sink;
+
+static uint64_t bench_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void bench_make_frames()
+{
+    uint32_t seed = 0x355;
+    int i;
+    for (i = 0; i < BENCH_FRAMES; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        s_bench_frames[i].magic = TM_PLAYER_MAGIC;
+        s_bench_frames[i].axisYL = 60 + (seed >> 8) % 170;
+        s_bench_frames[i].axisXL = 60 + (seed >> 16) % 170;
+        s_bench_frames[i].axisYR = 60 + (seed >> 4) % 170;
+        s_bench_frames[i].axisXR = 60 + (seed >> 20) % 170;
+        s_bench_frames[i].magicEnd = TM_PLAYER_MAGIC_END;
+    }
+}
+
+static void bench_report_unit(const char * name, uint64_t ns, long count, const char * unit)
+{
+    printf("%-28s %8.2f ns/%s\n", name, (double)ns / count, unit);
+}
+
+static void bench_report(const char * name, uint64_t ns, long frames)
+{
+    bench_report_unit(name, ns, frames, "frame");
+}
+
+// Stock report_axis_lr() math: two branches and a divide per axis.
+static int cal_divide(const struct TRIMUI_PAD_FRAME * f)
+{
+    int xl = pk_frame_to_axis_x(&s_cal_l, f->axisXL);
+    int yl = pk_frame_to_axis_y(&s_cal_l, f->axisYL);
+    int xr = pk_frame_to_axis_x(&s_cal_r, f->axisXR);
+    int yr = pk_frame_to_axis_y(&s_cal_r, f->axisYR);
+    if (xl * xl + yl * yl < PK_ADC_DEAD_ZONE_SQUA)
+        xl = yl = 0;
+    if (xr * xr + yr * yr < PK_ADC_DEAD_ZONE_SQUA)
+        xr = yr = 0;
+    return xl + yl + xr + yr;
+}
+
+static int cal_lut(const struct TRIMUI_PAD_FRAME * f)
+{
+    const struct PK_LUT_SET * lut = &s_lut;
+    int xl = 0, yl = 0, xr = 0, yr = 0;
+    if (lut->l.x.square[f->axisXL] + lut->l.y.square[f->axisYL] >= PK_ADC_DEAD_ZONE_SQUA)
+    {
+        xl = lut->l.x.value[f->axisXL];
+        yl = lut->l.y.value[f->axisYL];
+    }
+    if (lut->r.x.square[f->axisXR] + lut->r.y.square[f->axisYR] >= PK_ADC_DEAD_ZONE_SQUA)
+    {
+        xr = lut->r.x.value[f->axisXR];
+        yr = lut->r.y.value[f->axisYR];
+    }
+    return xl + yl + xr + yr;
+}
+
+static void bench_cal(long iterations)
+{
+    uint64_t t0;
+    long i, n = iterations * BENCH_FRAMES;
+    int sum = 0, mismatch = 0;
+
+    for (i = 0; i < BENCH_FRAMES; i++)
+    {
+        if (cal_divide(&s_bench_frames[i]) != cal_lut(&s_bench_frames[i]))
+            mismatch++;
+    }
+
+    t0 = bench_now_ns();
+    for (i = 0; i < n; i++)
+        sum += cal_divide(&s_bench_frames[i & (BENCH_FRAMES - 1)]);
+    bench_report("calibrate (divide)", bench_now_ns() - t0, n);
+
+    t0 = bench_now_ns();
+    for (i = 0; i < n; i++)
+        sum += cal_lut(&s_bench_frames[i & (BENCH_FRAMES - 1)]);
+    bench_report("calibrate (LUT)", bench_now_ns() - t0, n);
+
+    s_sink = sum;
+    if (mismatch)
+        printf("  LUT mismatches: %d\n", mismatch);
+}
+
+static const char s_bench_config[] =
+    "x_min=83\n"
+    "x_max=195\n"
+    "y_min=74\n"
+    "y_max=226\n"
+    "x_zero=134\n"
+    "y_zero=148\n";
+
+static void bench_parse(long iterations)
+{
+    char path[] = "/tmp/miyoo_inputd_bench.XXXXXX";
+    struct PK_CAL cal;
+    uint64_t t0;
+    long i, n = iterations * 16;
+    int fd, sum = 0, out;
+
+    t0 = bench_now_ns();
+    for (i = 0; i < n; i++)
+    {
+        sum += getKeyValueDefault(s_bench_config, "x_min", PK_ADC_DEFAULT_MIN_X);
+        sum += getKeyValueDefault(s_bench_config, "x_max", PK_ADC_DEFAULT_MAX_X);
+        sum += getKeyValueDefault(s_bench_config, "y_min", PK_ADC_DEFAULT_MIN_Y);
+        sum += getKeyValueDefault(s_bench_config, "y_max", PK_ADC_DEFAULT_MAX_Y);
+        sum += getKeyValueDefault(s_bench_config, "x_zero", PK_ADC_DEFAULT_ZERO_X);
+        sum += getKeyValueDefault(s_bench_config, "y_zero", PK_ADC_DEFAULT_ZERO_Y);
+    }
+    bench_report_unit("cal parse (6 keys)", bench_now_ns() - t0, n, "call");
+
+    fd = mkstemp(path);
+    if (fd < 0 || write(fd, s_bench_config, sizeof(s_bench_config) - 1) < 0)
+    {
+        perror(path);
+        return;
+    }
+    close(fd);
+
+    // pk_read_cal_config() logs every call; keep that out of the report
+    fflush(stdout);
+    out = dup(1);
+    fd = open("/dev/null", O_WRONLY);
+    dup2(fd, 1);
+    t0 = bench_now_ns();
+    for (i = 0; i < n; i++)
+    {
+        cal = pk_read_cal_config(path);
+        sum += cal.x_zero;
+    }
+    t0 = bench_now_ns() - t0;
+    fflush(stdout);
+    dup2(out, 1);
+    close(out);
+    close(fd);
+    unlink(path);
+    bench_report_unit("pk_read_cal_config (file)", t0, n, "call");
+    s_sink = sum;
+}
+
+static void bench_axis(long iterations)
+{
+    const struct TRIMUI_PAD_FRAME * f;
+    uint64_t t0;
+    long i, n = iterations * BENCH_FRAMES;
+    int sum = 0;
+
+    t0 = bench_now_ns();
+    for (i = 0; i < n; i++)
+    {
+        f = &s_bench_frames[i & (BENCH_FRAMES - 1)];
+        sum += pk_frame_to_axis_x(&s_cal_l, f->axisXL) + pk_frame_to_axis_y(&s_cal_l, f->axisYL)
+             + pk_frame_to_axis_x(&s_cal_r, f->axisXR) + pk_frame_to_axis_y(&s_cal_r, f->axisYR);
+    }
+    bench_report("pk_frame_to_axis x4", bench_now_ns() - t0, n);
+    s_sink = sum;
+}
+
+static void bench_deadzone(long iterations)
+{
+    static int16_t axis[BENCH_FRAMES][2];
+    const struct PK_LUT_SET * lut = &s_lut;
+    const struct TRIMUI_PAD_FRAME * f;
+    uint64_t t0;
+    long i, n = iterations * BENCH_FRAMES;
+    int x, y, sum = 0;
+
+    for (i = 0; i < BENCH_FRAMES; i++)
+    {
+        axis[i][0] = pk_frame_to_axis_x(&s_cal_l, s_bench_frames[i].axisXL);
+        axis[i][1] = pk_frame_to_axis_y(&s_cal_l, s_bench_frames[i].axisYL);
+    }
+
+    t0 = bench_now_ns();
+    for (i = 0; i < n; i++)
+    {
+        x = axis[i & (BENCH_FRAMES - 1)][0];
+        y = axis[i & (BENCH_FRAMES - 1)][1];
+        sum += (x * x + y * y) < PK_ADC_DEAD_ZONE_SQUA;
+    }
+    bench_report("deadzone (multiply)", bench_now_ns() - t0, n);
+
+    t0 = bench_now_ns();
+    for (i = 0; i < n; i++)
+    {
+        f = &s_bench_frames[i & (BENCH_FRAMES - 1)];
+        sum += (lut->l.x.square[f->axisXL] + lut->l.y.square[f->axisYL]) < PK_ADC_DEAD_ZONE_SQUA;
+    }
+    bench_report("deadzone (LUT squares)", bench_now_ns() - t0, n);
+    s_sink = sum;
+}
+
+// Stock miyoo_parse_serial_input(): trust the first 6 bytes of the read.
+static int frame_check_stock(const uint8_t * data, int len, struct TRIMUI_PAD_FRAME * out)
+{
+    if (len < TRIMUI_PAD_FRAME_LEN)
+        return 0;
+    memcpy(out, data, sizeof(*out));
+    return out->magic == TM_PLAYER_MAGIC && out->magicEnd == TM_PLAYER_MAGIC_END;
+}
+
+static void bench_frame_check(long iterations)
+{
+    static uint8_t stream[BENCH_FRAMES * TRIMUI_PAD_FRAME_LEN];
+    struct trimui_pad_stream st;
+    struct TRIMUI_PAD_FRAME out;
+    uint64_t t0;
+    long i, n = iterations * BENCH_FRAMES;
+    int sum = 0;
+
+    for (i = 0; i < BENCH_FRAMES; i++)
+        memcpy(&stream[i * TRIMUI_PAD_FRAME_LEN], &s_bench_frames[i], TRIMUI_PAD_FRAME_LEN);
+
+    t0 = bench_now_ns();
+    for (i = 0; i < n; i++)
+        sum += frame_check_stock(&stream[(i & (BENCH_FRAMES - 1)) * TRIMUI_PAD_FRAME_LEN],
+                                 TRIMUI_PAD_FRAME_LEN, &out);
+    bench_report("frame check (stock)", bench_now_ns() - t0, n);
+
+    memset(&st, 0, sizeof(st));
+    t0 = bench_now_ns();
+    for (i = 0; i < n; i++)
+        sum += trimui_pad_stream_feed(&st, &stream[(i & (BENCH_FRAMES - 1)) * TRIMUI_PAD_FRAME_LEN],
+                                      TRIMUI_PAD_FRAME_LEN, &out);
+    bench_report("frame check (stream)", bench_now_ns() - t0, n);
+
+    s_sink = sum;
+    if (st.resyncs || st.dropped_bytes)
+        printf("  stream resyncs: %u dropped: %u\n", st.resyncs, st.dropped_bytes);
+}
+
+// Stock trimui_poll_thread_miyooio() dispatch: every map entry tests its
+// key against the previous snapshot; released d-pad axes scan for a hold.
+static int s_stock_io[MIYOOIO_DATA_COUNT];
+static int s_stock_io_last[MIYOOIO_DATA_COUNT];
+
+static int stock_axis_hold(int axis)
+{
+    int i;
+    for (i = 0; i < ARRAY_SIZE(s_tm_map_axis); i++)
+    {
+        if (axis == s_tm_map_axis[i].axis && s_stock_io[s_tm_map_axis[i].keymask])
+            return 1;
+    }
+    return 0;
+}
+
+static void dispatch_stock()
+{
+    int i, k;
+    for (i = 0; i < ARRAY_SIZE(s_tm_map); i++)
+    {
+        k = s_tm_map[i].keymask;
+        if (s_stock_io[k] && !s_stock_io_last[k])
+            trimui_vkey(s_tm_map[i].port, s_tm_map[i].keycode, 1);
+        if (!s_stock_io[k] && s_stock_io_last[k])
+            trimui_vkey(s_tm_map[i].port, s_tm_map[i].keycode, 0);
+    }
+    for (i = 0; i < ARRAY_SIZE(s_tm_map_axis); i++)
+    {
+        k = s_tm_map_axis[i].keymask;
+        if (s_stock_io[k] && !s_stock_io_last[k])
+            trimui_vaxis(s_tm_map_axis[i].port, s_tm_map_axis[i].axis, s_tm_map_axis[i].value);
+        if (!s_stock_io[k] && s_stock_io_last[k] && !stock_axis_hold(s_tm_map_axis[i].axis))
+            trimui_vaxis(s_tm_map_axis[i].port, s_tm_map_axis[i].axis, 0);
+    }
+    memcpy(s_stock_io_last, s_stock_io, sizeof(s_stock_io));
+}
+
+static void bench_dispatch(long iterations)
+{
+    static int io[BENCH_FRAMES][MIYOOIO_DATA_COUNT];
+    static uint32_t bits[BENCH_FRAMES];
+    uint32_t seed = 0x1f, last = 0;
+    uint64_t t0;
+    long i, n = iterations * BENCH_FRAMES;
+    int j, events;
+
+    // mostly idle snapshots with the occasional press / release
+    for (i = 0; i < BENCH_FRAMES; i++)
+    {
+        memcpy(io[i], i ? io[i - 1] : io[0], sizeof(io[i]));
+        seed = seed * 1103515245 + 12345;
+        if (((seed >> 16) & 7) == 0)
+        {
+            j = (seed >> 20) % (RETRO_MIYOO355_ID_MENU + 1);
+            io[i][j] = !io[i][j];
+        }
+        bits[i] = trimui_pack_io(io[i]);
+    }
+
+    s_bench_events = 0;
+    t0 = bench_now_ns();
+    for (i = 0; i < n; i++)
+    {
+        memcpy(s_stock_io, io[i & (BENCH_FRAMES - 1)], sizeof(s_stock_io));
+        dispatch_stock();
+    }
+    bench_report("dispatch (stock loop)", bench_now_ns() - t0, n);
+    events = s_bench_events;
+
+    s_bench_events = 0;
+    t0 = bench_now_ns();
+    for (i = 0; i < n; i++)
+    {
+        uint32_t cur = trimui_pack_io(io[i & (BENCH_FRAMES - 1)]);
+        if (cur ^ last)
+            trimui_dispatch_bits(cur, cur ^ last);
+        last = cur;
+    }
+    bench_report("dispatch (pack + XOR/ctz)", bench_now_ns() - t0, n);
+    if (events != s_bench_events)
+        printf("  dispatch mismatch: stock %d new %d\n", events, s_bench_events);
+
+    s_bench_events = 0;
+    last = 0;
+    t0 = bench_now_ns();
+    for (i = 0; i < n; i++)
+    {
+        uint32_t cur = bits[i & (BENCH_FRAMES - 1)];
+        if (cur ^ last)
+            trimui_dispatch_bits(cur, cur ^ last);
+        last = cur;
+    }
+    bench_report("dispatch (XOR/ctz only)", bench_now_ns() - t0, n);
+}
+
+int main(int argc, char **argv)
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 2000;
+
+    s_cal_l.x_min = 83;  s_cal_l.x_zero = 134; s_cal_l.x_max = 195;
+    s_cal_l.y_min = 74;  s_cal_l.y_zero = 148; s_cal_l.y_max = 226;
+    defaule_cal_config(&s_cal_r);
+    pk_build_stick_lut(&s_lut.l, &s_cal_l);
+    pk_build_stick_lut(&s_lut.r, &s_cal_r);
+
+    bench_make_frames();
+    printf("miyoo_inputd bench: %ld x %d frames\n", iterations, BENCH_FRAMES);
+    bench_parse(iterations / 16 ? iterations / 16 : 1);
+    bench_axis(iterations);
+    bench_deadzone(iterations);
+    bench_cal(iterations);
+    bench_frame_check(iterations);
+    trimui_build_action_table();
+    bench_dispatch(iterations);
+    return 0;
+}
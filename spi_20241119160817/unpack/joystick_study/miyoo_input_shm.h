@@ -0,0 +1,117 @@
+#ifndef __MIYOO_INPUT_SHM_H__
+#define __MIYOO_INPUT_SHM_H__
+
+// Shared-memory view of the miyoo_inputd pad state, for frontends that
+// want to sample input at vblank without going through evdev.
+//
+// miyoo_inputd publishes one sample per wakeup that changed anything into
+// a small ring in POSIX shm (/dev/shm/miyoo_inputd). Reading the latest
+// sample is a few loads and no syscall; a reader that wants to block until
+// the next sample can futex-wait on the header sequence.
+//
+//   int fd = shm_open(MIYOO_INPUT_SHM_NAME, O_RDWR, 0);
+//   struct miyoo_input_shm * shm = mmap(NULL, sizeof(*shm),
+//           PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+//   struct miyoo_input_sample s;
+//   if (miyoo_input_shm_valid(shm) && miyoo_input_shm_latest(shm, &s))
+//       ... s.buttons, s.axis[], s.trigger[] ...
+//
+// The uinput pad keeps working unchanged; this is an additional path.
+// Usable from C and C++ (GCC/Clang __atomic builtins, no <stdatomic.h>).
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define MIYOO_INPUT_SHM_NAME     "/miyoo_inputd"
+#define MIYOO_INPUT_SHM_MAGIC    (0x4e49594du)   // "MYIN"
+#define MIYOO_INPUT_SHM_VERSION  (1)
+#define MIYOO_INPUT_SHM_SLOTS    (16)            // power of two
+
+enum
+{
+    MIYOO_INPUT_AXIS_LX = 0,
+    MIYOO_INPUT_AXIS_LY,
+    MIYOO_INPUT_AXIS_RX,
+    MIYOO_INPUT_AXIS_RY,
+    MIYOO_INPUT_AXIS_COUNT,
+};
+
+struct miyoo_input_sample
+{
+    uint32_t seq;           // equals the header seq it was published under
+    uint32_t buttons;       // bit n = RETRO_DEVICE_ID_JOYPAD_* / RETRO_MIYOO355_ID_* n, after turbo
+    int16_t  axis[MIYOO_INPUT_AXIS_COUNT];  // calibrated, dead zone applied, +-32760
+    uint8_t  trigger[2];    // L2, R2: 0 or 255 (digital on this device)
+    uint16_t reserved;
+    uint64_t time_ns;       // CLOCK_MONOTONIC when published
+};
+
+struct miyoo_input_shm
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t sample_size;
+    uint32_t seq;           // last published sample, futex word
+    uint32_t waiters;       // readers blocked in miyoo_input_shm_wait()
+    uint32_t reserved[10];  // keep the ring on its own cache line
+    struct miyoo_input_sample ring[MIYOO_INPUT_SHM_SLOTS];
+};
+
+static inline int miyoo_input_shm_valid(const struct miyoo_input_shm * shm)
+{
+    return shm->magic == MIYOO_INPUT_SHM_MAGIC
+        && shm->version == MIYOO_INPUT_SHM_VERSION
+        && shm->slots == MIYOO_INPUT_SHM_SLOTS
+        && shm->sample_size == sizeof(struct miyoo_input_sample);
+}
+
+// Copy the newest sample. Returns its seq, 0 if nothing was published yet.
+static inline uint32_t miyoo_input_shm_latest(const struct miyoo_input_shm * shm,
+                                              struct miyoo_input_sample * out)
+{
+    const struct miyoo_input_sample * slot;
+    uint32_t seq;
+
+    do
+    {
+        seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+        if (!seq)
+            return 0;
+        slot = &shm->ring[seq & (MIYOO_INPUT_SHM_SLOTS - 1)];
+        memcpy(out, slot, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        // the writer lapped the ring while we copied: retry
+    } while (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq || out->seq != seq);
+    return seq;
+}
+
+// Block until a sample newer than last_seq is published (or timeout_ns
+// elapses, 0 = forever). Returns the current seq.
+static inline uint32_t miyoo_input_shm_wait(struct miyoo_input_shm * shm, uint32_t last_seq,
+                                            uint64_t timeout_ns)
+{
+    struct timespec ts, * pts = NULL;
+    uint32_t seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+
+    if (seq != last_seq)
+        return seq;
+
+    if (timeout_ns)
+    {
+        ts.tv_sec = timeout_ns / 1000000000ull;
+        ts.tv_nsec = timeout_ns % 1000000000ull;
+        pts = &ts;
+    }
+
+    __atomic_add_fetch(&shm->waiters, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &shm->seq, FUTEX_WAIT, last_seq, pts, NULL, 0);
+    __atomic_sub_fetch(&shm->waiters, 1, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+}
+
+#endif
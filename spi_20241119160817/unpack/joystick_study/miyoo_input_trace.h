@@ -0,0 +1,44 @@
+#ifndef __MIYOO_INPUT_TRACE_H__
+#define __MIYOO_INPUT_TRACE_H__
+
+// Binary trace of what miyoo_inputd read from its input nodes, written by
+// the daemon when MIYOO_INPUTD_RECORD=<file> is set and played back by
+// replay/miyoo_input_replay.c.
+//
+// File: one miyoo_input_trace_header, then records back to back. Each
+// record is a miyoo_input_trace_record followed by `len` payload bytes:
+//
+//   MIYOO_TRACE_TTY  raw bytes of one read() on /dev/ttyS1, unparsed
+//   MIYOO_TRACE_IO   the 32-int /dev/miyooio snapshot, only when it changed
+//
+// time_ns is CLOCK_MONOTONIC relative to the header. Native byte order
+// (aarch64 and x86_64 are both little endian).
+
+#include <stdint.h>
+
+#define MIYOO_TRACE_MAGIC        (0x5254594du)   // "MYTR"
+#define MIYOO_TRACE_VERSION      (1)
+
+enum
+{
+    MIYOO_TRACE_TTY = 1,
+    MIYOO_TRACE_IO  = 2,
+};
+
+struct miyoo_input_trace_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+};
+
+struct miyoo_input_trace_record
+{
+    uint64_t time_ns;
+    uint8_t  type;
+    uint8_t  reserved;
+    uint16_t len;
+    uint32_t reserved2;     // explicit tail padding, 16 bytes per record
+};
+
+#endif
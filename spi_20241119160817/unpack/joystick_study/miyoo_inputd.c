@@ -1,3 +1,6 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // sched_setaffinity, CPU_SET
+#endif
 #include<stdio.h>
 #include<stdlib.h>
 #include<unistd.h>
@@ -8,12 +11,30 @@
 #include<errno.h>
 #include<string.h>    
 #include<unistd.h>      
-#include<pthread.h> 
+#include<sys/epoll.h>
+#include<sys/timerfd.h>
+#include<sys/signalfd.h>
+#include<sys/inotify.h>
+#include<signal.h>
 
 #include<stdint.h> 
+#include<time.h>
+
+#include<sys/mman.h>
+#include<sys/uio.h>
+#include<limits.h>
+#include<sys/ioctl.h>
+#include<linux/serial.h>
+#include<sched.h>
+#include<malloc.h>
+#include<dirent.h>
+#include<spawn.h>
+#include<ctype.h>
 
 #include <linux/input.h>
 #include "ukey.h"
+#include "miyoo_input_shm.h"
+#include "miyoo_input_trace.h"
 
 
 
@@ -50,8 +71,11 @@ struct PK_CAL
 static int PK_ADC_DEAD_ZONE_SQUA  =  (TRIMUI_AXIS_RANGE >> 3) * (TRIMUI_AXIS_RANGE >> 3);
 static int PK_REPORT_THRESHOLD    = (TRIMUI_AXIS_RANGE >> 8);
 
-#define JOYPAD_CONFIG_FILE_LEFT     "/userdata/joypad.config"
-#define JOYPAD_CONFIG_FILE_RIGHT    "/userdata/joypad_right.config"
+#define JOYPAD_CONFIG_DIR           "/userdata"
+#define JOYPAD_CONFIG_NAME_LEFT     "joypad.config"
+#define JOYPAD_CONFIG_NAME_RIGHT    "joypad_right.config"
+#define JOYPAD_CONFIG_FILE_LEFT     JOYPAD_CONFIG_DIR "/" JOYPAD_CONFIG_NAME_LEFT
+#define JOYPAD_CONFIG_FILE_RIGHT    JOYPAD_CONFIG_DIR "/" JOYPAD_CONFIG_NAME_RIGHT
 
 static struct PK_CAL s_cal_l;
 static struct PK_CAL s_cal_r;
@@ -110,7 +134,9 @@ static void defaule_cal_config(struct PK_CAL * cal)
 static struct PK_CAL pk_read_cal_config(const char * configFile)
 {
     struct PK_CAL cal;
-	char configBuf[4096];
+	// static: only the event loop reloads, and a realtime daemon must not
+	// fault in 4 KB of fresh stack on a recalibration
+	static char configBuf[4096];
 	memset(configBuf, 0, sizeof(configBuf));
 	fileToMem(configFile, configBuf);
 
@@ -207,6 +233,54 @@ int pk_frame_to_axis_y(struct PK_CAL * cal, int rawY)
     return value;
 }
 
+// A raw ADC sample is a uint8_t, so each PK_CAL is compiled into 256-entry
+// tables: the clamped axis value and its square for the radial dead zone.
+// The hot path is then two loads and an add per stick instead of two
+// branches, a divide and two multiplies per axis.
+struct PK_AXIS_LUT
+{
+    int16_t value[256];
+    int32_t square[256];
+};
+
+struct PK_STICK_LUT
+{
+    struct PK_AXIS_LUT x;
+    struct PK_AXIS_LUT y;
+};
+
+struct PK_LUT_SET
+{
+    struct PK_STICK_LUT l;
+    struct PK_STICK_LUT r;
+};
+
+// Rebuilt in place from the event loop, between frames.
+static struct PK_LUT_SET s_lut;
+
+static void pk_build_stick_lut(struct PK_STICK_LUT * lut, struct PK_CAL * cal)
+{
+    int raw, v;
+    for (raw = 0; raw < 256; raw++)
+    {
+        v = pk_frame_to_axis_x(cal, raw);
+        lut->x.value[raw] = v;
+        lut->x.square[raw] = v * v;
+
+        v = pk_frame_to_axis_y(cal, raw);
+        lut->y.value[raw] = v;
+        lut->y.square[raw] = v * v;
+    }
+}
+
+static void pk_reload_cal()
+{
+    s_cal_l = pk_read_cal_config(JOYPAD_CONFIG_FILE_LEFT);
+    s_cal_r = pk_read_cal_config(JOYPAD_CONFIG_FILE_RIGHT);
+    pk_build_stick_lut(&s_lut.l, &s_cal_l);
+    pk_build_stick_lut(&s_lut.r, &s_cal_r);
+}
+
 //====================== joypad cal end ======================
 
 
@@ -376,6 +450,83 @@ int trimui_uart_set(int fd, int speed, int flow_ctrl, int databits, int stopbits
     return 0;
 }
 
+// termios2 / BOTHER: any integer baud the UART divisor can reach (the
+// Flip's other UARTs run 1.5 Mbaud). <asm/termbits.h> clashes with
+// <termios.h>, so the kernel layout is mirrored here (asm-generic, used by
+// aarch64 and x86).
+#ifndef BOTHER
+#define BOTHER 0010000
+#endif
+#ifndef IBSHIFT
+#define IBSHIFT 16
+#endif
+
+struct termios2
+{
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t c_line;
+    cc_t c_cc[19];
+    speed_t c_ispeed;
+    speed_t c_ospeed;
+};
+
+// ASYNC_LOW_LATENCY: push received bytes to the line discipline at once
+// instead of batching them; best effort, not every driver (or a pty) has it
+int trimui_uart_low_latency(int fd, int on)
+{
+    struct serial_struct ss;
+    if (ioctl(fd, TIOCGSERIAL, &ss) < 0)
+        return -1;
+    if (on)
+        ss.flags |= ASYNC_LOW_LATENCY;
+    else
+        ss.flags &= ~ASYNC_LOW_LATENCY;
+    return ioctl(fd, TIOCSSERIAL, &ss);
+}
+
+// Set an arbitrary baud and a VMIN with VTIME=0. poll()/epoll only report
+// the tty readable once `vmin` bytes are buffered, but n_tty still wakes the
+// waiter for every chunk the UART driver pushes: VMIN saves read() calls on
+// partial frames, not wakeups. Call after trimui_uart_set() for the framing
+// flags. Returns the rate the driver actually set.
+int trimui_uart_set_speed(int fd, int baud, int vmin)
+{
+    struct termios2 tio;
+
+    if (ioctl(fd, TCGETS2, &tio) < 0)
+    {
+        perror("TCGETS2");
+        return -1;
+    }
+    tio.c_cflag &= ~(CBAUD | CIBAUD);
+    tio.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+    tio.c_ispeed = baud;
+    tio.c_ospeed = baud;
+    tio.c_cc[VMIN] = vmin;
+    tio.c_cc[VTIME] = 0;
+    if (ioctl(fd, TCSETS2, &tio) < 0)
+    {
+        perror("TCSETS2");
+        return -1;
+    }
+    if (ioctl(fd, TCGETS2, &tio) < 0)
+        return -1;
+    return tio.c_ospeed;
+}
+
+// VMIN only, for re-aligning wakeups to frame boundaries
+int trimui_uart_set_vmin(int fd, int vmin)
+{
+    struct termios2 tio;
+    if (ioctl(fd, TCGETS2, &tio) < 0)
+        return -1;
+    tio.c_cc[VMIN] = vmin;
+    return ioctl(fd, TCSETS2, &tio);
+}
+
 int trimui_uart_recv(int fd, char *rcv_buf, int data_len)
 {
     int len, fs_sel;
@@ -455,6 +606,16 @@ void dump_cmd_frame(const char * buf, int len)
 #define RETRO_MIYOO355_ID_VOLUP        17
 #define RETRO_MIYOO355_ID_VOLDOWN      18
 #define RETRO_MIYOO355_ID_POWER        19
+#define RETRO_MIYOO355_ID_LID          20
+#define MIYOO_KEY_COUNT                (RETRO_MIYOO355_ID_LID + 1)
+
+// keymask names, as used by the mapping file and the turbo_<name> nodes
+static const char * s_tm_key_names[MIYOO_KEY_COUNT] =
+{
+    "b", "y", "select", "start", "up", "down", "left", "right",
+    "a", "x", "l", "r", "l2", "r2", "l3", "r3",
+    "menu", "volup", "voldown", "power", "lid",
+};
 
 
 //FF 80 9A 88 93 FE
@@ -470,10 +631,115 @@ struct TRIMUI_PAD_FRAME
 
 #define  TRIMUI_PAD_FRAME_LEN      6  //sizeof(struct TRIMUI_PAD_FRAME)
 
-static struct TRIMUI_PAD_FRAME s_frame_l, s_frame_r, s_last_l, s_last_r;
-static int s_io_data[MIYOOIO_DATA_COUNT];
-static int s_io_data_last[MIYOOIO_DATA_COUNT];
-static int s_lock_suspend = 0;
+static int s_io_data[MIYOOIO_DATA_COUNT];     // raw read() buffer, one int per key
+static uint32_t s_io_bits, s_io_bits_last;   // packed: bit n = s_io_data[n] != 0
+
+//====================== pad state ==========================
+// The one copy of the latest stick frame; buttons live in s_io_bits.
+// frame_seq only moves when the UART parser stores a new frame, letting
+// report_axis_lr() skip wakeups that carried no frame. The event loop is the
+// only reader and writer.
+struct miyoo_pad_state
+{
+    struct TRIMUI_PAD_FRAME frame;
+    uint32_t frame_seq;
+};
+
+static struct miyoo_pad_state s_pad;
+//====================== pad state end ======================
+
+//====================== shared memory state =================
+// Besides uinput, the calibrated state is published to a POSIX shm ring
+// (layout and reader helpers in miyoo_input_shm.h). Changes are staged in
+// s_shm_cur and published once per event-loop wakeup, like the uinput
+// flush; blocked readers are woken with FUTEX_WAKE only if any are waiting.
+static struct miyoo_input_shm * s_shm;
+static struct miyoo_input_sample s_shm_cur;
+static int s_shm_dirty;
+
+static uint64_t miyoo_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void miyoo_shm_open()
+{
+    void * p;
+    int fd = shm_open(MIYOO_INPUT_SHM_NAME, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (fd < 0)
+    {
+        perror("shm_open " MIYOO_INPUT_SHM_NAME);
+        return;
+    }
+    fchmod(fd, 0666);   // readers futex-wait, so they map it writable
+    if (ftruncate(fd, sizeof(struct miyoo_input_shm)) < 0)
+    {
+        perror("ftruncate " MIYOO_INPUT_SHM_NAME);
+        close(fd);
+        return;
+    }
+    p = mmap(NULL, sizeof(struct miyoo_input_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        perror("mmap " MIYOO_INPUT_SHM_NAME);
+        return;
+    }
+
+    s_shm = p;
+    memset(s_shm, 0, sizeof(*s_shm));
+    s_shm->version = MIYOO_INPUT_SHM_VERSION;
+    s_shm->slots = MIYOO_INPUT_SHM_SLOTS;
+    s_shm->sample_size = sizeof(struct miyoo_input_sample);
+    __atomic_store_n(&s_shm->magic, MIYOO_INPUT_SHM_MAGIC, __ATOMIC_RELEASE);
+}
+
+static void miyoo_shm_set_stick(int axis, int x, int y)
+{
+    if (s_shm_cur.axis[axis] == x && s_shm_cur.axis[axis + 1] == y)
+        return;
+    s_shm_cur.axis[axis] = x;
+    s_shm_cur.axis[axis + 1] = y;
+    s_shm_dirty = 1;
+}
+
+static void miyoo_shm_set_buttons(uint32_t buttons)
+{
+    s_shm_cur.buttons = buttons;
+    s_shm_cur.trigger[0] = (buttons & (1u << RETRO_DEVICE_ID_JOYPAD_L2)) ? 255 : 0;
+    s_shm_cur.trigger[1] = (buttons & (1u << RETRO_DEVICE_ID_JOYPAD_R2)) ? 255 : 0;
+    s_shm_dirty = 1;
+}
+
+static void miyoo_shm_publish()
+{
+    struct miyoo_input_sample * slot;
+    uint32_t seq;
+
+    if (!s_shm || !s_shm_dirty)
+        return;
+    s_shm_dirty = 0;
+
+    seq = s_shm->seq + 1;
+    if (!seq)
+        seq = 1;    // 0 means "nothing published"
+    slot = &s_shm->ring[seq & (MIYOO_INPUT_SHM_SLOTS - 1)];
+
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->buttons = s_shm_cur.buttons;
+    memcpy(slot->axis, s_shm_cur.axis, sizeof(slot->axis));
+    memcpy(slot->trigger, s_shm_cur.trigger, sizeof(slot->trigger));
+    slot->time_ns = miyoo_now_ns();
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&s_shm->seq, seq, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&s_shm->waiters, __ATOMIC_SEQ_CST))
+        syscall(SYS_futex, &s_shm->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+//====================== shared memory state end =============
 
 struct tm_map
 {
@@ -494,8 +760,6 @@ struct tm_map_turbo
 {
 	int port; //player1/2/3/4
 	int keymask;
-	const char * node; // /tmp/miyoo_inputd/turbo_a
-    const char * label;
 };
 
 
@@ -521,6 +785,11 @@ static struct tm_map s_tm_map[] =
 	{0, RETRO_DEVICE_ID_JOYPAD_R3,      BTN_THUMBR},
 	{0, RETRO_MIYOO355_ID_MENU,         BTN_MODE},
 
+	// MIYOO_INPUTD_SYSKEYS sources, on the companion device
+	{UKEY_PORT_SYSKEYS, RETRO_MIYOO355_ID_VOLUP,   KEY_VOLUMEUP},
+	{UKEY_PORT_SYSKEYS, RETRO_MIYOO355_ID_VOLDOWN, KEY_VOLUMEDOWN},
+	{UKEY_PORT_SYSKEYS, RETRO_MIYOO355_ID_POWER,   KEY_POWER},
+
 	// {0, RETRO_DEVICE_ID_JOYPAD_UP,      BTN_DPAD_UP},
 	// {0, RETRO_DEVICE_ID_JOYPAD_DOWN,    BTN_DPAD_DOWN},
 	// {0, RETRO_DEVICE_ID_JOYPAD_LEFT,    BTN_DPAD_LEFT},
@@ -540,298 +809,2563 @@ static struct tm_map_axis s_tm_map_axis[] =
     {0, RETRO_DEVICE_ID_JOYPAD_R2,      ABS_RZ,    255},
 };
 
+static struct tm_map s_tm_map_switch[] =
+{
+	{UKEY_PORT_SYSKEYS, RETRO_MIYOO355_ID_LID,     SW_LID},
+};
+
+
+//====================== control flags ======================
+// The suspend / turbo flag files are mirrored into s_ctl_flags by an
+// inotify watch on /tmp and /tmp/miyoo_inputd (see miyoo_handle_inotify).
+// The hot path only tests bits here, no access() per frame.
+#define SYSTEM_SUSPEND_DIR       "/tmp"
+#define SYSTEM_SUSPEND_NAME      "system_suspend"
+#define SYSTEM_SUSPEND_FLAG      SYSTEM_SUSPEND_DIR "/" SYSTEM_SUSPEND_NAME
+#define MIYOO_CTL_DIR_NAME       "miyoo_inputd"
+#define MIYOO_CTL_DIR            SYSTEM_SUSPEND_DIR "/" MIYOO_CTL_DIR_NAME
+#define MIYOO_TURBO_ENABLE_NAME  "enable_turbo_input"
+#define MIYOO_UART_BAUD_NAME     "uart_baud"
+#define MIYOO_UART_STOCK_BAUD    (9600)
+#define MIYOO_UART_MAX_BAUD      (4000000)
+
+#define MIYOO_CTL_SUSPEND        (1u << 31)
+#define MIYOO_CTL_TURBO_ENABLE   (1u << 30)
+#define MIYOO_CTL_TURBO_KEYS     ((1u << (RETRO_MIYOO355_ID_POWER + 1)) - 1)   // bit n: turbo on keymask n
+#define MIYOO_TURBO_NODE_PREFIX  "turbo_"
 
-static int s_enable_turbo = 0;
-static uint32_t s_turbo_bits = 0;
+#define TM_TURBO_KEYS   ((1u << (RETRO_DEVICE_ID_JOYPAD_R2 + 1)) - 1)   // keys with a turbo node
 
+static uint32_t s_ctl_flags;
+
+// keys turbo may drive in the built-in profile; nodes are
+// /tmp/miyoo_inputd/turbo_<name>
 struct tm_map_turbo s_tm_map_turbo[] =
 {
-    {0, RETRO_DEVICE_ID_JOYPAD_A,   "/tmp/miyoo_inputd/turbo_a",   "MIYOO KEY A"  },
-	{0, RETRO_DEVICE_ID_JOYPAD_B,   "/tmp/miyoo_inputd/turbo_b",   "MIYOO KEY B"  },
-	{0, RETRO_DEVICE_ID_JOYPAD_X,   "/tmp/miyoo_inputd/turbo_x",   "MIYOO KEY X"  },
-	{0, RETRO_DEVICE_ID_JOYPAD_Y,   "/tmp/miyoo_inputd/turbo_y",   "MIYOO KEY Y"  },
-	{0, RETRO_DEVICE_ID_JOYPAD_R,   "/tmp/miyoo_inputd/turbo_r",   "MIYOO KEY R"  },
-    {0, RETRO_DEVICE_ID_JOYPAD_R2,  "/tmp/miyoo_inputd/turbo_r2",  "MIYOO KEY R2" },
-	{0, RETRO_DEVICE_ID_JOYPAD_L,   "/tmp/miyoo_inputd/turbo_l",   "MIYOO KEY L"  },
-	{0, RETRO_DEVICE_ID_JOYPAD_L2,  "/tmp/miyoo_inputd/turbo_l2",  "MIYOO KEY L2" },
+    {0, RETRO_DEVICE_ID_JOYPAD_A},
+	{0, RETRO_DEVICE_ID_JOYPAD_B},
+	{0, RETRO_DEVICE_ID_JOYPAD_X},
+	{0, RETRO_DEVICE_ID_JOYPAD_Y},
+	{0, RETRO_DEVICE_ID_JOYPAD_R},
+    {0, RETRO_DEVICE_ID_JOYPAD_R2},
+	{0, RETRO_DEVICE_ID_JOYPAD_L},
+	{0, RETRO_DEVICE_ID_JOYPAD_L2},
 };
 
 
-static void trimui_check_turbo_settting()
+static void miyoo_ctl_update(uint32_t mask, uint32_t value)
 {
-    int i;
-    for(i = 0; i < ARRAY_SIZE(s_tm_map_turbo); i++)
+    uint32_t old = s_ctl_flags;
+    uint32_t flags = (old & ~mask) | (value & mask);
+    uint32_t keymask;
+    char label[16];
+    int i, j;
+
+    for(i = 0; i < MIYOO_KEY_COUNT; i++)
     {
-        uint32_t keymask = 1 << s_tm_map_turbo[i].keymask;
-        if(!access(s_tm_map_turbo[i].node, F_OK))
-        {
-            if(!(s_turbo_bits & keymask))
-                printf("enable turbo: %s\n", s_tm_map_turbo[i].label);
-            s_turbo_bits |= keymask;
-        }
+        keymask = 1u << i;
+        if(!(keymask & TM_TURBO_KEYS) || !((flags ^ old) & keymask))
+            continue;
+        for(j = 0; s_tm_key_names[i][j] && j < sizeof(label) - 1; j++)
+            label[j] = toupper((unsigned char)s_tm_key_names[i][j]);    // "MIYOO KEY L2"
+        label[j] = '\0';
+        if(flags & keymask)
+            printf("enable turbo: MIYOO KEY %s\n", label);
         else
-        {
-            if(s_turbo_bits & keymask)
-                printf("disable turbo:%s\n", s_tm_map_turbo[i].label);
-            s_turbo_bits &= ~keymask;
-        }
+            printf("disable turbo:MIYOO KEY %s\n", label);
     }
-
-    if(!access("/tmp/miyoo_inputd/enable_turbo_input", F_OK))
-        s_enable_turbo = 1;
-    else
-        s_enable_turbo = 0;
+    s_ctl_flags = flags;
 }
 
-static void trimui_do_turbo()
+// Map a file name in /tmp/miyoo_inputd to its flag bit, 0 if unknown.
+static uint32_t miyoo_ctl_turbo_bit(const char * name)
 {
-    static int s_toggle = 0;
-    uint32_t mask = 0;
-    if(!s_enable_turbo)
-        return;
-
-// s_io_data[MIYOOIO_DATA_COUNT];
+    int i;
 
-//    for(int i = 0; i <= MIYOOIO_DATA_COUNT; i++)
-    for(int i = 0; i <= RETRO_DEVICE_ID_JOYPAD_R2; i++)
+    if (!strcmp(name, MIYOO_TURBO_ENABLE_NAME))
+        return MIYOO_CTL_TURBO_ENABLE;
+    if (strncmp(name, MIYOO_TURBO_NODE_PREFIX, sizeof(MIYOO_TURBO_NODE_PREFIX) - 1))
+        return 0;
+    name += sizeof(MIYOO_TURBO_NODE_PREFIX) - 1;
+    for(i = 0; i < MIYOO_KEY_COUNT; i++)
     {
-        mask = 1 << i;
-        if(s_io_data[i] && (s_turbo_bits & mask))
-        {
-            if(s_toggle)
-                s_io_data[i] = 0;
-        }
+        if ((TM_TURBO_KEYS & (1u << i)) && !strcmp(name, s_tm_key_names[i]))
+            return 1u << i;
     }
-    s_toggle = !s_toggle;
+    return 0;
 }
 
-static int key_pressed(int index)
+// Turbo rate per key. A turbo node may hold "<hz> [duty%]", e.g.
+//   echo "20 30" > /tmp/miyoo_inputd/turbo_a
+// an empty node (runmiyoo.sh just touches them) uses the defaults.
+#define MIYOO_TURBO_DEFAULT_HZ   (15)
+#define MIYOO_TURBO_DEFAULT_DUTY (50)
+#define MIYOO_TURBO_MIN_HZ       (1)
+#define MIYOO_TURBO_MAX_HZ       (60)
+
+struct tm_turbo_rate
 {
-    if(s_io_data[index] && !s_io_data_last[index])
-        return 1;
-    return 0;
+    int hz;
+    int duty;   // percent of the period the key reads pressed
+};
+
+static struct tm_turbo_rate s_turbo_rate[MIYOOIO_DATA_COUNT];
+
+static void trimui_turbo_node(int keymask, char * node, int size)
+{
+    snprintf(node, size, MIYOO_CTL_DIR "/" MIYOO_TURBO_NODE_PREFIX "%s", s_tm_key_names[keymask]);
 }
 
-static int key_released(int index)
+static void trimui_read_turbo_rate(int keymask, const char * node)
 {
-    if(!s_io_data[index] && s_io_data_last[index])
-        return 1;
-    return 0;
+    struct tm_turbo_rate * r = &s_turbo_rate[keymask];
+    char buf[32];
+    int len, hz = MIYOO_TURBO_DEFAULT_HZ, duty = MIYOO_TURBO_DEFAULT_DUTY;
+
+    memset(buf, 0, sizeof(buf));
+    len = fileToMem(node, buf);
+    if (len > 0 && len < sizeof(buf))
+        sscanf(buf, "%d %d", &hz, &duty);
+
+    if (hz < MIYOO_TURBO_MIN_HZ || hz > MIYOO_TURBO_MAX_HZ)
+        hz = MIYOO_TURBO_DEFAULT_HZ;
+    if (duty < 1 || duty > 99)
+        duty = MIYOO_TURBO_DEFAULT_DUTY;
+
+    if (r->hz != hz || r->duty != duty)
+        printf("turbo rate: %s %d Hz %d%%\n", node, hz, duty);
+    r->hz = hz;
+    r->duty = duty;
 }
 
-static int axis_hold(int axis, struct tm_map_axis * map, int count)
+static void trimui_reload_turbo_rate(uint32_t keymask)
 {
+    char node[64];
     int i;
-    for(i = 0; i < count; i++)
+    for(i = 0; i < MIYOO_KEY_COUNT; i++)
     {
-        if ((axis == map[i].axis))
+        if(keymask & TM_TURBO_KEYS & (1u << i))
         {
-            if(s_io_data[map[i].keymask])
-                return 1;
+            trimui_turbo_node(i, node, sizeof(node));
+            trimui_read_turbo_rate(i, node);
         }
     }
-    return 0;
 }
 
-static int report_axis_lr()
+// Full rescan, only at startup and when the inotify queue overflowed.
+static void trimui_check_turbo_settting()
 {
-    int x, y;
-    static int lastXL = -1;
-    static int lastYL = -1;
-    static int lastXR = -1;
-    static int lastYR = -1;
-
-    x = s_frame_l.axisXL;
-    y = s_frame_l.axisYL;
-    //trimui_vaxis(0, ABS_Y, value);
-
-    if(DEBUG_AXIS) printf("Left :\t%d,%d ->", x, y);
-    x = pk_frame_to_axis_x(&s_cal_l, x);
-    y = pk_frame_to_axis_y(&s_cal_l, y);
-
-    if((x * x + y * y) < PK_ADC_DEAD_ZONE_SQUA)
+    uint32_t flags = 0;
+    char node[64];
+    int i;
+    for(i = 0; i < MIYOO_KEY_COUNT; i++)
     {
-        x = 0;
-        y = 0;
+        if(!(TM_TURBO_KEYS & (1u << i)))
+            continue;
+        trimui_turbo_node(i, node, sizeof(node));
+        if(!access(node, F_OK))
+        {
+            flags |= 1u << i;
+            trimui_read_turbo_rate(i, node);
+        }
     }
-    if(DEBUG_AXIS) printf(" %d,%d \t\t", x, y);
 
-    if(abs(x - lastXL) > PK_REPORT_THRESHOLD)
-    {
-        if(abs(x) < TRIMUI_AXIS_RANGE)
-            trimui_vaxis(0, ABS_X, x);
-        lastXL = x;
-    }
+    if(!access(MIYOO_CTL_DIR "/" MIYOO_TURBO_ENABLE_NAME, F_OK))
+        flags |= MIYOO_CTL_TURBO_ENABLE;
 
-    if(abs(y - lastYL) > PK_REPORT_THRESHOLD)
-    {
-        if(abs(y) < TRIMUI_AXIS_RANGE)
-            trimui_vaxis(0, ABS_Y, y);
-        lastYL = y;
-    }
+    miyoo_ctl_update(MIYOO_CTL_TURBO_KEYS | MIYOO_CTL_TURBO_ENABLE, flags);
+}
 
+static void check_suspend_lock()
+{
+    miyoo_ctl_update(MIYOO_CTL_SUSPEND, access(SYSTEM_SUSPEND_FLAG, F_OK) == 0 ? MIYOO_CTL_SUSPEND : 0);
+}
+//====================== control flags end ==================
+
+// A mapping profile compiled to one entry per keymask bit, so a cycle
+// only visits the bits that changed. The built-in profile comes from
+// s_tm_map / s_tm_map_axis / s_tm_map_switch / s_tm_map_turbo, the others
+// from the mapping file (see "mapping profiles" below). The dispatcher
+// only ever reads the live copy in s_tm_action.
+#define MIYOO_PROFILE_MAX        (8)
+#define MIYOO_PROFILE_NAME_LEN   (32)
+#define MIYOO_PROFILE_BUILTIN    "default"
+
+struct tm_action
+{
+    int type;       // EV_KEY / EV_ABS / EV_SW, 0 = unmapped
+    int port;
+    int code;
+    int value;      // EV_ABS value while pressed
+    uint32_t hold;  // other bits driving the same axis (stock axis_hold())
+};
 
-    x = s_frame_l.axisXR;
-    y = s_frame_l.axisYR;
-    //trimui_vaxis(0, ABS_Y, value);
+struct tm_profile
+{
+    char name[MIYOO_PROFILE_NAME_LEN];
+    struct tm_action action[MIYOOIO_DATA_COUNT];
+    uint32_t action_mask;
+    uint32_t turbo_keys;    // keys the turbo nodes may drive
+};
 
-    if(DEBUG_AXIS) printf("Right :\t%d,%d ->", x, y);
-    x = pk_frame_to_axis_x(&s_cal_r, x);
-    y = pk_frame_to_axis_y(&s_cal_r, y);
+static struct tm_profile s_profiles[MIYOO_PROFILE_MAX];
+static int s_profile_count;
+static int s_profile_live = -1;
 
-    if((x * x + y * y) < PK_ADC_DEAD_ZONE_SQUA)
-    {
-        x = 0;
-        y = 0;
-    }
-    if(DEBUG_AXIS) printf(" %d,%d \t\t", x, y);
+static struct tm_action s_tm_action[MIYOOIO_DATA_COUNT];
+static uint32_t s_tm_action_mask;
+static uint32_t s_turbo_keys;
 
-    if(abs(x - lastXR) > PK_REPORT_THRESHOLD)
-    {
-        if(abs(x) < TRIMUI_AXIS_RANGE)
-            trimui_vaxis(0, ABS_RX, x);
-        lastXR = x;
-    }
+// stock axis_hold(): releasing one direction must not zero an axis that
+// another held key still drives
+static void trimui_profile_link_axes(struct tm_profile * pr)
+{
+    struct tm_action * a, * b;
+    int i, j;
 
-    if(abs(y - lastYR) > PK_REPORT_THRESHOLD)
+    for (i = 0; i < MIYOOIO_DATA_COUNT; i++)
     {
-        if(abs(y) < TRIMUI_AXIS_RANGE)
-            trimui_vaxis(0, ABS_RY, y);
-        lastYR = y;
+        a = &pr->action[i];
+        a->hold = 0;
+        if (a->type != EV_ABS)
+            continue;
+        for (j = 0; j < MIYOOIO_DATA_COUNT; j++)
+        {
+            b = &pr->action[j];
+            if (j != i && b->type == EV_ABS && b->port == a->port && b->code == a->code)
+                a->hold |= 1u << j;
+        }
     }
-    return 0;
 }
 
+static void trimui_profile_set(struct tm_profile * pr, int keymask, int type, int port, int code, int value)
+{
+    struct tm_action * a = &pr->action[keymask];
+    a->type = type;
+    a->port = port;
+    a->code = code;
+    a->value = value;
+    if (type)
+        pr->action_mask |= 1u << keymask;
+    else
+        pr->action_mask &= ~(1u << keymask);
+}
 
-#define SYSTEM_SUSPEND_FLAG   "/tmp/system_suspend"
-static void miyoo_parse_serial_input(const char * cmd, int len)
+static void trimui_build_action_table()
 {
+    struct tm_profile * pr = &s_profiles[0];
     int i;
-    if(access(SYSTEM_SUSPEND_FLAG, F_OK) == 0) return;
 
-    //printf("len=%d, size=%d\n", len, sizeof(s_frame));
-    if(len < TRIMUI_PAD_FRAME_LEN)
-        return;
+    memset(pr, 0, sizeof(*pr));
+    snprintf(pr->name, sizeof(pr->name), "%s", MIYOO_PROFILE_BUILTIN);
+
+    for (i = 0; i < ARRAY_SIZE(s_tm_map); i++)
+        trimui_profile_set(pr, s_tm_map[i].keymask, EV_KEY, s_tm_map[i].port, s_tm_map[i].keycode, 0);
+    for (i = 0; i < ARRAY_SIZE(s_tm_map_axis); i++)
+        trimui_profile_set(pr, s_tm_map_axis[i].keymask, EV_ABS, s_tm_map_axis[i].port,
+            s_tm_map_axis[i].axis, s_tm_map_axis[i].value);
+    for (i = 0; i < ARRAY_SIZE(s_tm_map_switch); i++)
+        trimui_profile_set(pr, s_tm_map_switch[i].keymask, EV_SW, s_tm_map_switch[i].port,
+            s_tm_map_switch[i].keycode, 0);
+    for (i = 0; i < ARRAY_SIZE(s_tm_map_turbo); i++)
+        pr->turbo_keys |= 1u << s_tm_map_turbo[i].keymask;
+    trimui_profile_link_axes(pr);
+
+    s_profile_count = 1;
+    s_profile_live = 0;
+    memcpy(s_tm_action, pr->action, sizeof(s_tm_action));
+    s_tm_action_mask = pr->action_mask;
+    s_turbo_keys = pr->turbo_keys;
+}
 
-    //FIXME: check frame shift finding 0xFF/0xFE, seems no issue now 19200 rate.
-    memcpy(&s_frame_l, cmd, sizeof(s_frame_l));
-    if(s_frame_l.magic != TM_PLAYER_MAGIC 
-      ||s_frame_l.magicEnd != TM_PLAYER_MAGIC_END)
-      return;
+// forced inline: the profile switch is a second caller, and gcc would
+// otherwise stop inlining it into trimui_apply_io() (+0.4 ns/frame)
+static inline __attribute__((always_inline)) void trimui_dispatch_bits(uint32_t bits, uint32_t changed)
+{
+    const struct tm_action * a;
+    uint32_t mask;
+    int i;
 
-    s_last_l = s_frame_l;
+    changed &= s_tm_action_mask;
+    while (changed)
+    {
+        i = __builtin_ctz(changed);
+        changed &= changed - 1;
+        mask = 1u << i;
+        a = &s_tm_action[i];
+
+        if (a->type == EV_KEY)
+            trimui_vkey(a->port, a->code, (bits & mask) ? 1 : 0);
+        else if (a->type == EV_SW)
+            trimui_vswitch(a->port, a->code, (bits & mask) ? 1 : 0);
+        else if (bits & mask)
+            trimui_vaxis(a->port, a->code, a->value);
+        else if (!(bits & a->hold))
+            trimui_vaxis(a->port, a->code, 0);
+    }
 }
 
+// Last reported axis values; report_axis_invalidate() forces all four
+// out on the next frame (used after resume).
+static int lastXL = -1;
+static int lastYL = -1;
+static int lastXR = -1;
+static int lastYR = -1;
+
+static int s_stick_active;  // either stick outside the dead zone
+
+//====================== mapping profiles ====================
+// Named profiles are read from /userdata/miyoo_inputd.map (or
+// MIYOO_INPUTD_MAP). Each one starts as a copy of the built-in profile and
+// changes single keys:
+//
+//   [nintendo]
+//   a = BTN_A
+//   b = BTN_B
+//   up = BTN_DPAD_UP      # D-pad as buttons instead of the hat
+//   l2 = BTN_TL2          # digital trigger
+//   menu = none
+//   turbo = a b x y       # keys the turbo_<name> nodes may drive
+//
+// Keys are s_tm_key_names. Targets are the codes the virtual devices
+// declare (s_tm_codes), with "ABS_* <value>" for an axis. The file is
+// parsed and compiled whenever it changes (inotify on /userdata).
+// /tmp/miyoo_inputd/profile names the live profile; "default" is used
+// when the file is missing or names an unknown profile.
+//
+// A switch runs between two wakeups. Keys held across it are released
+// under the old mapping and pressed under the new one in the same uinput
+// batch, so readers see one packet and nothing sticks. The dispatcher
+// still walks one flat table, so the per-frame cost does not change.
+#define MIYOO_MAP_NAME           "miyoo_inputd.map"
+#define MIYOO_MAP_FILE           JOYPAD_CONFIG_DIR "/" MIYOO_MAP_NAME
+#define MIYOO_PROFILE_NAME       "profile"
+
+struct tm_code
+{
+    const char * name;
+    int type;
+    int code;
+    int port;
+};
 
-static pthread_t s_ntid_left, s_ntid_right, s_ntid_miyooio;
-char s_rcv_buf_l[1024];
-//char s_rcv_buf_r[1024];
+#define TM_CODE(type, code, port)   { #code, type, code, port }
 
-static void * trimui_poll_thread_joystick(void *arg)
+static const struct tm_code s_tm_codes[] =
 {
-    int fd, len;
-    fd = trimui_uart_open(MIYOO_NODE_JOYSTICK);
-    trimui_uart_set(fd, 9600, 0, 8, 1, 'N');
+    TM_CODE(EV_KEY, BTN_A, 0),          TM_CODE(EV_KEY, BTN_B, 0),
+    TM_CODE(EV_KEY, BTN_X, 0),          TM_CODE(EV_KEY, BTN_Y, 0),
+    TM_CODE(EV_KEY, BTN_TL, 0),         TM_CODE(EV_KEY, BTN_TR, 0),
+    TM_CODE(EV_KEY, BTN_TL2, 0),        TM_CODE(EV_KEY, BTN_TR2, 0),
+    TM_CODE(EV_KEY, BTN_SELECT, 0),     TM_CODE(EV_KEY, BTN_START, 0),
+    TM_CODE(EV_KEY, BTN_MODE, 0),
+    TM_CODE(EV_KEY, BTN_THUMBL, 0),     TM_CODE(EV_KEY, BTN_THUMBR, 0),
+    TM_CODE(EV_KEY, BTN_DPAD_UP, 0),    TM_CODE(EV_KEY, BTN_DPAD_DOWN, 0),
+    TM_CODE(EV_KEY, BTN_DPAD_LEFT, 0),  TM_CODE(EV_KEY, BTN_DPAD_RIGHT, 0),
+    TM_CODE(EV_ABS, ABS_X, 0),          TM_CODE(EV_ABS, ABS_Y, 0),
+    TM_CODE(EV_ABS, ABS_RX, 0),         TM_CODE(EV_ABS, ABS_RY, 0),
+    TM_CODE(EV_ABS, ABS_Z, 0),          TM_CODE(EV_ABS, ABS_RZ, 0),
+    TM_CODE(EV_ABS, ABS_HAT0X, 0),      TM_CODE(EV_ABS, ABS_HAT0Y, 0),
+    TM_CODE(EV_KEY, KEY_VOLUMEUP, UKEY_PORT_SYSKEYS),
+    TM_CODE(EV_KEY, KEY_VOLUMEDOWN, UKEY_PORT_SYSKEYS),
+    TM_CODE(EV_KEY, KEY_POWER, UKEY_PORT_SYSKEYS),
+    TM_CODE(EV_SW,  SW_LID, UKEY_PORT_SYSKEYS),
+};
+
+static char * miyoo_map_trim(char * str)
+{
+    char * end;
+    while (*str == ' ' || *str == '\t')
+        str++;
+    end = str + strlen(str);
+    while (end > str && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n'))
+        *--end = '\0';
+    return str;
+}
 
-    while (1)
+static int miyoo_map_key(const char * name)
+{
+    int i;
+    for (i = 0; i < MIYOO_KEY_COUNT; i++)
     {
-        len = trimui_uart_recv(fd, s_rcv_buf_l, 99);
-        if (len > 0)
-        {
-            s_rcv_buf_l[len] = '\0';
-            //dump_cmd_frame(s_rcv_buf_l, len);
-            //trimui_parse_input_left(s_rcv_buf_l, len);
-            miyoo_parse_serial_input(s_rcv_buf_l, len);
-        }
-        else
-        {
-            printf("cannot receive data\n");
-        }
-        usleep(16666 / 2);
+        if (!strcmp(name, s_tm_key_names[i]))
+            return i;
     }
-    trimui_uart_Close(fd);
-    return NULL;
+    return -1;
 }
 
-static void * trimui_poll_thread_miyooio(void *arg)
+static const struct tm_code * miyoo_map_code(const char * name)
 {
-    int fd, len, i;
-    fd = open(MIYOO_NODE_IO, O_RDWR);
-    trimui_uart_set(fd, 9600, 0, 8, 1, 'N');
+    int i;
+    for (i = 0; i < ARRAY_SIZE(s_tm_codes); i++)
+    {
+        if (!strcmp(name, s_tm_codes[i].name))
+            return &s_tm_codes[i];
+    }
+    return NULL;
+}
 
-    memset(s_io_data, 0, sizeof(s_io_data));
-    memset(s_io_data_last, 0, sizeof(s_io_data_last));
+// "<key> = <code> [value]" / "<key> = none" / "turbo = <key>..."
+static void miyoo_map_line(struct tm_profile * pr, char * key, char * value, const char * where)
+{
+    const struct tm_code * c;
+    char * tok, * arg, * save;
+    int k;
 
-    while (1)
+    if (!strcmp(key, "turbo"))
     {
-        if(s_lock_suspend) 
+        pr->turbo_keys = 0;
+        for (tok = strtok_r(value, " \t", &save); tok; tok = strtok_r(NULL, " \t", &save))
         {
-            usleep(100 * 1000);
-            continue;
+            k = miyoo_map_key(tok);
+            if (k < 0 || !(TM_TURBO_KEYS & (1u << k)))
+                printf("%s: no turbo for '%s'\n", where, tok);
+            else
+                pr->turbo_keys |= 1u << k;
         }
+        return;
+    }
+
+    k = miyoo_map_key(key);
+    tok = strtok_r(value, " \t", &save);
+    arg = tok ? strtok_r(NULL, " \t", &save) : NULL;
+    if (k < 0 || !tok)
+    {
+        printf("%s: bad mapping '%s'\n", where, key);
+        return;
+    }
+    if (!strcmp(tok, "none"))
+    {
+        trimui_profile_set(pr, k, 0, 0, 0, 0);
+        return;
+    }
+    c = miyoo_map_code(tok);
+    if (!c)
+    {
+        printf("%s: unknown code '%s'\n", where, tok);
+        return;
+    }
+    trimui_profile_set(pr, k, c->type, c->port, c->code,
+        c->type == EV_ABS ? (arg ? atoi(arg) : 1) : 0);
+}
 
-        read(fd, s_io_data, sizeof(s_io_data));
-        
-        trimui_do_turbo();
+// out[0] holds the built-in profile; returns the profile count
+static int miyoo_map_parse(const char * path, struct tm_profile * out, int max)
+{
+    char line[256], where[96], * p, * eq;
+    struct tm_profile * pr = NULL;
+    int count = 1, lineno = 0, i;
+    FILE * fp = fopen(path, "r");
+
+    if (!fp)
+        return count;
+    while (fgets(line, sizeof(line), fp))
+    {
+        lineno++;
+        snprintf(where, sizeof(where), "%s:%d", path, lineno);
+        if ((p = strchr(line, '#')))
+            *p = '\0';
+        p = miyoo_map_trim(line);
+        if (!*p)
+            continue;
 
-        for (i = 0; i < ARRAY_SIZE(s_tm_map); i++)
-        {
-            if(key_pressed(s_tm_map[i].keymask))
-                trimui_vkey(s_tm_map[i].port, s_tm_map[i].keycode, 1);
-            if(key_released(s_tm_map[i].keymask))
-                trimui_vkey(s_tm_map[i].port, s_tm_map[i].keycode, 0);
-        }
-        for (i = 0; i < ARRAY_SIZE(s_tm_map_axis); i++)
+        if (*p == '[')
         {
-            if(key_pressed(s_tm_map_axis[i].keymask))
-                trimui_vaxis(s_tm_map_axis[i].port, s_tm_map_axis[i].axis, s_tm_map_axis[i].value);
-            if(key_released(s_tm_map_axis[i].keymask))
+            pr = NULL;
+            eq = strchr(p, ']');
+            if (eq)
+                *eq = '\0';
+            p = miyoo_map_trim(p + 1);
+            for (i = 0; i < count; i++)
+            {
+                if (!strcmp(out[i].name, p))
+                    break;
+            }
+            if (!eq || !*p || strlen(p) >= MIYOO_PROFILE_NAME_LEN || i < count)
+                printf("%s: bad or duplicate profile '%s'\n", where, p);
+            else if (count >= max)
+                printf("%s: more than %d profiles\n", where, max);
+            else
             {
-                if (!axis_hold(s_tm_map_axis[i].axis, s_tm_map_axis, ARRAY_SIZE(s_tm_map_axis)))
-                    trimui_vaxis(s_tm_map_axis[i].port, s_tm_map_axis[i].axis, 0);
+                pr = &out[count++];
+                *pr = out[0];
+                snprintf(pr->name, sizeof(pr->name), "%s", p);
             }
+            continue;
         }
-        memcpy(s_io_data_last, s_io_data, sizeof(s_io_data));
-        
-        report_axis_lr();
 
-        usleep(16666 / 4);
+        eq = strchr(p, '=');
+        if (!eq || !pr)
+        {
+            printf("%s: ignored\n", where);
+            continue;
+        }
+        *eq = '\0';
+        miyoo_map_line(pr, miyoo_map_trim(p), miyoo_map_trim(eq + 1), where);
     }
-    trimui_uart_Close(fd);
-    return NULL;
+    fclose(fp);
+
+    for (i = 1; i < count; i++)
+        trimui_profile_link_axes(&out[i]);
+    return count;
 }
 
-static void trimui_start_pad_thread()
+static int miyoo_action_same(const struct tm_action * a, const struct tm_action * b)
 {
-    pthread_create(&s_ntid_left, NULL, trimui_poll_thread_joystick, NULL);
-    pthread_create(&s_ntid_right, NULL, trimui_poll_thread_miyooio, NULL);
+    return a->type == b->type && a->port == b->port && a->code == b->code && a->value == b->value;
 }
 
-static void check_suspend_lock()
+// Pad buttons beyond the stock eleven are declared only while the live
+// profile emits them, so the pad keeps the stock layout unless a profile
+// maps a digital trigger or the D-pad to buttons.
+static const int s_xpad_optional[] =
 {
-    if (access(SYSTEM_SUSPEND_FLAG, F_OK) == 0)
-        s_lock_suspend = 1;
-    else
-        s_lock_suspend = 0;
+    BTN_TL2, BTN_TR2, BTN_DPAD_UP, BTN_DPAD_DOWN, BTN_DPAD_LEFT, BTN_DPAD_RIGHT,
+};
+static uint32_t s_xpad_optional_live;       // bit n: s_xpad_optional[n] declared
+
+static uint32_t miyoo_xpad_optional(const struct tm_profile * pr)
+{
+    const struct tm_action * a;
+    uint32_t bits, mask = 0;
+    int k;
+
+    for (bits = pr->action_mask; bits; bits &= bits - 1)
+    {
+        a = &pr->action[__builtin_ctz(bits)];
+        if (a->type != EV_KEY || a->port != 0)
+            continue;
+        for (k = 0; k < ARRAY_SIZE(s_xpad_optional); k++)
+        {
+            if (a->code == s_xpad_optional[k])
+                mask |= 1u << k;
+        }
+    }
+    return mask;
 }
 
-int main(int argc, char **argv)
+// 1 if the pad was declared again: a new device, with every key up, the
+// axes at 0 and no uploaded effects
+static int miyoo_xpad_declare(uint32_t optional)
 {
-    printf("MIYOO Input Daemon %s\n", __DATE__);
-    memset(&s_frame_l, 0, sizeof(s_frame_l));
-    memset(&s_last_l,  0, sizeof(s_last_l));
+    int keys[ARRAY_SIZE(s_xpad_optional)];
+    int k, n = 0;
+
+    if (optional == s_xpad_optional_live)
+        return 0;
+    s_xpad_optional_live = optional;
+    if (trimui_xpad_fd(0) < 0)
+        return 0;       // no pad, or a raw sink without key bits
+    for (k = 0; k < ARRAY_SIZE(s_xpad_optional); k++)
+    {
+        if (optional & (1u << k))
+            keys[n++] = s_xpad_optional[k];
+    }
+    trimui_setup_xpad(0, keys, n);
+    printf("pad: %d optional button(s) declared\n", n);
+    return 1;
+}
 
-    s_cal_l = pk_read_cal_config(JOYPAD_CONFIG_FILE_LEFT);
-    s_cal_r = pk_read_cal_config(JOYPAD_CONFIG_FILE_RIGHT);
-    trimui_setup_xpad(0); //player1 only
-    trimui_start_pad_thread();
-    while (1)
+// 1 if the pad was declared again for the new profile
+static int miyoo_profile_switch(int index)
+{
+    const struct tm_profile * pr = &s_profiles[index];
+    uint32_t held = s_io_bits_last, changed = 0, bits;
+    int i, redeclared;
+
+    for (bits = held & (s_tm_action_mask | pr->action_mask); bits; bits &= bits - 1)
     {
-        usleep(1 * 1000 * 1000);
-        check_suspend_lock();
-        trimui_check_turbo_settting();
-        // trimui_check_rotate_settting();
+        i = __builtin_ctz(bits);
+        if (!miyoo_action_same(&s_tm_action[i], &pr->action[i]))
+            changed |= 1u << i;
     }
 
-    return 0;
+    // release under the old table; the keys still held stay in `bits`, so
+    // an axis one of them drives is not zeroed (stock axis_hold())
+    trimui_dispatch_bits(held & ~changed, changed);
+    redeclared = miyoo_xpad_declare(miyoo_xpad_optional(pr));
+    if (redeclared)
+        changed = held;     // the new device starts with every key up
+    memcpy(s_tm_action, pr->action, sizeof(s_tm_action));
+    s_tm_action_mask = pr->action_mask;
+    s_turbo_keys = pr->turbo_keys;
+    s_profile_live = index;
+    trimui_dispatch_bits(held, changed);    // press under the new one
+    return redeclared;
 }
+
+static int miyoo_profile_reload()
+{
+    char buf[MIYOO_PROFILE_NAME_LEN + 8], * name = MIYOO_PROFILE_BUILTIN;
+    FILE * fp = fopen(MIYOO_CTL_DIR "/" MIYOO_PROFILE_NAME, "r");
+    int i, index = 0;
+
+    if (fp)
+    {
+        if (fgets(buf, sizeof(buf), fp) && *miyoo_map_trim(buf))
+            name = miyoo_map_trim(buf);
+        fclose(fp);
+    }
+    for (i = 0; i < s_profile_count; i++)
+    {
+        if (!strcmp(s_profiles[i].name, name))
+            index = i;
+    }
+    if (strcmp(s_profiles[index].name, name))
+        printf("profile: '%s' not found\n", name);
+    printf("profile: %s\n", s_profiles[index].name);
+    return miyoo_profile_switch(index);
+}
+
+// the live table is switched through miyoo_profile_switch(), never
+// overwritten under a held key
+static int miyoo_map_reload()
+{
+    static struct tm_profile parsed[MIYOO_PROFILE_MAX];
+    const char * path = getenv("MIYOO_INPUTD_MAP");
+    int count;
+
+    if (!path || !*path)
+        path = MIYOO_MAP_FILE;
+    parsed[0] = s_profiles[0];
+    count = miyoo_map_parse(path, parsed, MIYOO_PROFILE_MAX);
+    memcpy(&s_profiles[1], &parsed[1], (count - 1) * sizeof(parsed[0]));
+    s_profile_count = count;
+    printf("mapping: %d profile(s) from %s\n", count - 1, path);
+    return miyoo_profile_reload();
+}
+//====================== mapping profiles end ================
+
+//====================== axis filter =========================
+// One-Euro filter (Casiez et al., CHI 2012) on each calibrated axis before
+// the PK_REPORT_THRESHOLD check. The cutoff rises with the filtered speed:
+// a stick resting off-centre (ADC noise of ~1 LSB = ~470 units) is smoothed
+// below the report threshold, while a full flick raises the cutoff to
+// ~200 Hz and passes ~90% of the step in the same frame. The radial dead
+// zone bypasses the filter and re-primes it, so returning to centre is
+// never lagged and leaving it starts from the raw value.
+//
+// Off unless /tmp/miyoo_inputd/axis_filter holds "<min_cutoff_hz>
+// [<beta> <d_cutoff_hz>]"; the suggested setting is the defaults below.
+// It stays opt-in until its lag has been measured on the device.
+#define MIYOO_FILTER_NAME            "axis_filter"
+#define MIYOO_FILTER_MIN_CUTOFF      (1.0f)
+#define MIYOO_FILTER_BETA            (0.001f)
+#define MIYOO_FILTER_D_CUTOFF        (1.0f)
+#define MIYOO_FILTER_MAX_DT          (0.1f)      // after a gap, restart
+
+struct miyoo_euro
+{
+    float x;        // filtered value
+    float dx;       // filtered speed, units/s
+    int primed;
+};
+
+static struct miyoo_euro s_euro[MIYOO_INPUT_AXIS_COUNT];
+static float s_euro_min_cutoff;     // 0: off
+static float s_euro_beta = MIYOO_FILTER_BETA;
+static float s_euro_d_cutoff = MIYOO_FILTER_D_CUTOFF;
+static uint64_t s_euro_last_ns;
+
+static float miyoo_euro_alpha(float cutoff, float dt)
+{
+    float tau = 1.0f / (6.2831853f * cutoff);
+    return 1.0f / (1.0f + tau / dt);
+}
+
+static int miyoo_euro_filter(struct miyoo_euro * f, int value, float dt)
+{
+    float dx, cutoff;
+
+    if (s_euro_min_cutoff <= 0.0f)
+        return value;
+    if (!f->primed || dt <= 0.0f || dt > MIYOO_FILTER_MAX_DT)
+    {
+        f->x = value;
+        f->dx = 0.0f;
+        f->primed = 1;
+        return value;
+    }
+
+    dx = (value - f->x) / dt;
+    f->dx += miyoo_euro_alpha(s_euro_d_cutoff, dt) * (dx - f->dx);
+    cutoff = s_euro_min_cutoff + s_euro_beta * (f->dx < 0.0f ? -f->dx : f->dx);
+    f->x += miyoo_euro_alpha(cutoff, dt) * (value - f->x);
+    return (int)(f->x < 0.0f ? f->x - 0.5f : f->x + 0.5f);
+}
+
+// stick in the dead zone: next frame outside it starts unfiltered
+static void miyoo_euro_clear(struct miyoo_euro * f)
+{
+    f->primed = 0;
+}
+
+static void miyoo_euro_reset()
+{
+    memset(s_euro, 0, sizeof(s_euro));
+    s_euro_last_ns = 0;
+}
+
+static void miyoo_filter_reload()
+{
+    char buf[64];
+    int len;
+    float min_cutoff = 0.0f, beta = MIYOO_FILTER_BETA;
+    float d_cutoff = MIYOO_FILTER_D_CUTOFF;
+
+    memset(buf, 0, sizeof(buf));
+    len = fileToMem(MIYOO_CTL_DIR "/" MIYOO_FILTER_NAME, buf);
+    if (len > 0 && len < sizeof(buf))
+        sscanf(buf, "%f %f %f", &min_cutoff, &beta, &d_cutoff);
+    if (min_cutoff < 0.0f || min_cutoff > 1000.0f)
+        min_cutoff = MIYOO_FILTER_MIN_CUTOFF;
+    if (beta < 0.0f)
+        beta = MIYOO_FILTER_BETA;
+    if (d_cutoff <= 0.0f || d_cutoff > 1000.0f)
+        d_cutoff = MIYOO_FILTER_D_CUTOFF;
+
+    s_euro_min_cutoff = min_cutoff;
+    s_euro_beta = beta;
+    s_euro_d_cutoff = d_cutoff;
+    miyoo_euro_reset();
+    if (min_cutoff > 0.0f)
+        printf("axis filter: min_cutoff %.2f Hz, beta %.5f, d_cutoff %.2f Hz\n", min_cutoff, beta, d_cutoff);
+    else
+        printf("axis filter: off\n");
+}
+//====================== axis filter end =====================
+
+static void report_axis_invalidate()
+{
+    lastXL = lastYL = lastXR = lastYR = TRIMUI_AXIS_RANGE * 4;
+    miyoo_euro_reset();
+}
+
+static int report_axis_lr()
+{
+    const struct TRIMUI_PAD_FRAME * frame = &s_pad.frame;
+    int x, y;
+    const struct PK_LUT_SET * lut = &s_lut;
+    uint64_t now = miyoo_now_ns();
+    float dt = s_euro_last_ns ? (now - s_euro_last_ns) / 1e9f : 0.0f;
+
+    s_euro_last_ns = now;
+
+    s_stick_active = 0;
+    if(DEBUG_AXIS) printf("Left :\t%d,%d ->", frame->axisXL, frame->axisYL);
+    if(lut->l.x.square[frame->axisXL] + lut->l.y.square[frame->axisYL] < PK_ADC_DEAD_ZONE_SQUA)
+    {
+        x = 0;
+        y = 0;
+        miyoo_euro_clear(&s_euro[MIYOO_INPUT_AXIS_LX]);
+        miyoo_euro_clear(&s_euro[MIYOO_INPUT_AXIS_LY]);
+    }
+    else
+    {
+        x = miyoo_euro_filter(&s_euro[MIYOO_INPUT_AXIS_LX], lut->l.x.value[frame->axisXL], dt);
+        y = miyoo_euro_filter(&s_euro[MIYOO_INPUT_AXIS_LY], lut->l.y.value[frame->axisYL], dt);
+        s_stick_active = 1;
+    }
+    if(DEBUG_AXIS) printf(" %d,%d \t\t", x, y);
+    miyoo_shm_set_stick(MIYOO_INPUT_AXIS_LX, x, y);
+
+    if(abs(x - lastXL) > PK_REPORT_THRESHOLD)
+    {
+        if(abs(x) < TRIMUI_AXIS_RANGE)
+            trimui_vaxis(0, ABS_X, x);
+        lastXL = x;
+    }
+
+    if(abs(y - lastYL) > PK_REPORT_THRESHOLD)
+    {
+        if(abs(y) < TRIMUI_AXIS_RANGE)
+            trimui_vaxis(0, ABS_Y, y);
+        lastYL = y;
+    }
+
+
+    if(DEBUG_AXIS) printf("Right :\t%d,%d ->", frame->axisXR, frame->axisYR);
+    if(lut->r.x.square[frame->axisXR] + lut->r.y.square[frame->axisYR] < PK_ADC_DEAD_ZONE_SQUA)
+    {
+        x = 0;
+        y = 0;
+        miyoo_euro_clear(&s_euro[MIYOO_INPUT_AXIS_RX]);
+        miyoo_euro_clear(&s_euro[MIYOO_INPUT_AXIS_RY]);
+    }
+    else
+    {
+        x = miyoo_euro_filter(&s_euro[MIYOO_INPUT_AXIS_RX], lut->r.x.value[frame->axisXR], dt);
+        y = miyoo_euro_filter(&s_euro[MIYOO_INPUT_AXIS_RY], lut->r.y.value[frame->axisYR], dt);
+        s_stick_active = 1;
+    }
+    if(DEBUG_AXIS) printf(" %d,%d \t\t", x, y);
+    miyoo_shm_set_stick(MIYOO_INPUT_AXIS_RX, x, y);
+
+    if(abs(x - lastXR) > PK_REPORT_THRESHOLD)
+    {
+        if(abs(x) < TRIMUI_AXIS_RANGE)
+            trimui_vaxis(0, ABS_RX, x);
+        lastXR = x;
+    }
+
+    if(abs(y - lastYR) > PK_REPORT_THRESHOLD)
+    {
+        if(abs(y) < TRIMUI_AXIS_RANGE)
+            trimui_vaxis(0, ABS_RY, y);
+        lastYR = y;
+    }
+    return 0;
+}
+
+
+//====================== pad frame stream ====================
+// Bytes from /dev/ttyS1 are fed through a 6-byte window that hunts for
+// 0xFF, checks 0xFE at the end and otherwise slides to the next 0xFF.
+// Partial frames carry over to the next read(); if one read() holds
+// several frames only the newest is published.
+struct trimui_pad_stream
+{
+    uint8_t  win[TRIMUI_PAD_FRAME_LEN];
+    int      fill;
+    uint32_t frames;        // valid frames seen
+    uint32_t dropped_bytes; // bytes discarded while hunting / resyncing
+    uint32_t resyncs;       // windows rejected on a bad end magic
+    uint32_t superseded;    // valid frames replaced by a newer one in the same read
+};
+
+static struct trimui_pad_stream s_stream_l;
+
+static int trimui_pad_stream_feed(struct trimui_pad_stream * st, const uint8_t * data, int len,
+                                  struct TRIMUI_PAD_FRAME * out)
+{
+    int i, k, found = 0;
+    for (i = 0; i < len; i++)
+    {
+        if (st->fill == 0 && data[i] != TM_PLAYER_MAGIC)
+        {
+            st->dropped_bytes++;
+            continue;
+        }
+
+        st->win[st->fill++] = data[i];
+        if (st->fill < TRIMUI_PAD_FRAME_LEN)
+            continue;
+
+        if (st->win[TRIMUI_PAD_FRAME_LEN - 1] == TM_PLAYER_MAGIC_END)
+        {
+            memcpy(out, st->win, TRIMUI_PAD_FRAME_LEN);
+            st->frames++;
+            st->fill = 0;
+            found++;
+            continue;
+        }
+
+        // shifted data: restart the window at the next 0xFF inside it
+        st->resyncs++;
+        for (k = 1; k < TRIMUI_PAD_FRAME_LEN; k++)
+        {
+            if (st->win[k] == TM_PLAYER_MAGIC)
+                break;
+        }
+        st->dropped_bytes += k;
+        memmove(st->win, st->win + k, TRIMUI_PAD_FRAME_LEN - k);
+        st->fill = TRIMUI_PAD_FRAME_LEN - k;
+    }
+    if (found > 1)
+        st->superseded += found - 1;
+    return found;
+}
+
+//====================== pad frame stream end ================
+
+//====================== latency stats =======================
+// Per-frame timestamps at read (epoll wakeup on /dev/ttyS1), parse (valid
+// frame out of miyoo_parse_serial_input), calibrate (report_axis_lr done)
+// and emit (uinput write() returned), kept as log-linear HDR-style
+// histograms: 8 sub-buckets per power of two, so any bucket is within
+// 12.5% of the true value. Updated from the event loop only, so it costs
+// four vDSO clock reads per frame and is left on. The idle tick also records how late it ran after its timer expired,
+// i.e. the scheduling latency the event loop sees under load, and each
+// rumble start / stop how late it reached the motor. SIGUSR1
+// writes everything to MIYOO_STATS_FILE.
+#define MIYOO_STATS_FILE         "/tmp/miyoo_inputd.stats"
+#define MIYOO_HIST_SUB_BITS      (3)
+#define MIYOO_HIST_BUCKETS       (64 << MIYOO_HIST_SUB_BITS)
+
+enum
+{
+    MIYOO_LAT_READ_PARSE = 0,
+    MIYOO_LAT_PARSE_CAL,
+    MIYOO_LAT_CAL_EMIT,
+    MIYOO_LAT_READ_EMIT,
+    MIYOO_LAT_TICK_LATE,    // idle tick ran this long after its expiry
+    MIYOO_LAT_RUMBLE_LATE,  // rumble edge written this long after its time
+    MIYOO_LAT_COUNT,
+};
+
+static const char * s_lat_names[MIYOO_LAT_COUNT] =
+{
+    "read_to_parse", "parse_to_calibrate", "calibrate_to_emit", "read_to_emit",
+    "tick_lateness", "rumble_lateness",
+};
+
+struct miyoo_hist
+{
+    uint32_t bucket[MIYOO_HIST_BUCKETS];
+    uint64_t count;
+    uint64_t max_ns;
+};
+
+struct miyoo_stats
+{
+    struct miyoo_hist lat[MIYOO_LAT_COUNT];
+    uint64_t events_emitted;
+    uint64_t uinput_writes;
+    uint64_t wakeups;
+    uint64_t idle_entries;
+    uint64_t idle_ns;                   // completed idle periods
+    uint64_t idle_since;
+    uint64_t io_poll_fallbacks;         // miyooio .poll given up for the sampler
+    uint64_t t_read, t_parse, t_cal;    // timestamps of the frame in flight
+    int pending;                        // a calibrated frame awaits the flush
+};
+
+static struct miyoo_stats s_stats;
+
+static int miyoo_hist_bucket(uint64_t v)
+{
+    int msb;
+    if (v < (1u << MIYOO_HIST_SUB_BITS))
+        return v;
+    msb = 63 - __builtin_clzll(v);
+    return ((msb - MIYOO_HIST_SUB_BITS + 1) << MIYOO_HIST_SUB_BITS)
+         | ((v >> (msb - MIYOO_HIST_SUB_BITS)) & ((1u << MIYOO_HIST_SUB_BITS) - 1));
+}
+
+// upper bound of a bucket, for percentiles
+static uint64_t miyoo_hist_value(int b)
+{
+    int e = b >> MIYOO_HIST_SUB_BITS;
+    uint64_t m = b & ((1u << MIYOO_HIST_SUB_BITS) - 1);
+    if (!e)
+        return m;
+    return (((1u << MIYOO_HIST_SUB_BITS) + m + 1) << (e - 1)) - 1;
+}
+
+static void miyoo_hist_add(struct miyoo_hist * h, uint64_t ns)
+{
+    h->bucket[miyoo_hist_bucket(ns)]++;
+    h->count++;
+    if (ns > h->max_ns)
+        h->max_ns = ns;
+}
+
+static uint64_t miyoo_hist_percentile(const struct miyoo_hist * h, double pct)
+{
+    uint64_t want = (uint64_t)(h->count * pct / 100.0), seen = 0;
+    int b;
+    for (b = 0; b < MIYOO_HIST_BUCKETS; b++)
+    {
+        seen += h->bucket[b];
+        if (seen > want)
+            return miyoo_hist_value(b) < h->max_ns ? miyoo_hist_value(b) : h->max_ns;
+    }
+    return h->max_ns;
+}
+
+static void miyoo_stats_frame_emitted(uint64_t now)
+{
+    struct miyoo_stats * st = &s_stats;
+    if (!st->pending)
+        return;
+    st->pending = 0;
+    miyoo_hist_add(&st->lat[MIYOO_LAT_READ_PARSE], st->t_parse - st->t_read);
+    miyoo_hist_add(&st->lat[MIYOO_LAT_PARSE_CAL], st->t_cal - st->t_parse);
+    miyoo_hist_add(&st->lat[MIYOO_LAT_CAL_EMIT], now - st->t_cal);
+    miyoo_hist_add(&st->lat[MIYOO_LAT_READ_EMIT], now - st->t_read);
+}
+
+static void miyoo_stats_dump(FILE * fp)
+{
+    const struct trimui_pad_stream * ps = &s_stream_l;
+    const struct miyoo_hist * h;
+    int i;
+
+    fprintf(fp, "frames %u\n", ps->frames);
+    fprintf(fp, "bad_magic %u\n", ps->resyncs);
+    fprintf(fp, "dropped_bytes %u\n", ps->dropped_bytes);
+    fprintf(fp, "dropped_frames %u\n", ps->superseded);
+    fprintf(fp, "events_emitted %llu\n", (unsigned long long)s_stats.events_emitted);
+    fprintf(fp, "uinput_writes %llu\n", (unsigned long long)s_stats.uinput_writes);
+    fprintf(fp, "wakeups %llu\n", (unsigned long long)s_stats.wakeups);
+    fprintf(fp, "idle_entries %llu\n", (unsigned long long)s_stats.idle_entries);
+    fprintf(fp, "idle_ms %llu\n", (unsigned long long)s_stats.idle_ns / 1000000);
+    fprintf(fp, "io_poll_fallbacks %llu\n", (unsigned long long)s_stats.io_poll_fallbacks);
+    fprintf(fp, "# latency_ns count p50 p90 p99 p999 max\n");
+    for (i = 0; i < MIYOO_LAT_COUNT; i++)
+    {
+        h = &s_stats.lat[i];
+        fprintf(fp, "%s %llu %llu %llu %llu %llu %llu\n", s_lat_names[i],
+            (unsigned long long)h->count,
+            (unsigned long long)miyoo_hist_percentile(h, 50.0),
+            (unsigned long long)miyoo_hist_percentile(h, 90.0),
+            (unsigned long long)miyoo_hist_percentile(h, 99.0),
+            (unsigned long long)miyoo_hist_percentile(h, 99.9),
+            (unsigned long long)h->max_ns);
+    }
+}
+
+// written to a temp file and renamed so a scraper never sees half a dump
+static void miyoo_stats_write()
+{
+    FILE * fp = fopen(MIYOO_STATS_FILE ".tmp", "w");
+    if (!fp)
+    {
+        perror("fopen " MIYOO_STATS_FILE);
+        return;
+    }
+    miyoo_stats_dump(fp);
+    fclose(fp);
+    rename(MIYOO_STATS_FILE ".tmp", MIYOO_STATS_FILE);
+}
+//====================== latency stats end ===================
+
+//====================== trace capture =======================
+// Node paths can be overridden from the environment so the same binary
+// runs against a pty / FIFO on a host (replay/miyoo_input_replay.c), and
+// MIYOO_INPUTD_RECORD=<file> logs every UART read and every miyooio
+// change to a miyoo_input_trace.h file for later replay.
+static int s_fd_trace = -1;
+static uint64_t s_trace_start;
+static int s_trace_io[MIYOOIO_DATA_COUNT];
+
+static const char * miyoo_node(const char * env, const char * def)
+{
+    const char * path = getenv(env);
+    return (path && *path) ? path : def;
+}
+
+static void miyoo_trace_open()
+{
+    struct miyoo_input_trace_header hdr;
+    const char * path = getenv("MIYOO_INPUTD_RECORD");
+
+    if (!path || !*path)
+        return;
+    s_fd_trace = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (s_fd_trace < 0)
+    {
+        perror(path);
+        return;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = MIYOO_TRACE_MAGIC;
+    hdr.version = MIYOO_TRACE_VERSION;
+    if (write(s_fd_trace, &hdr, sizeof(hdr)) != sizeof(hdr))
+        perror(path);
+    s_trace_start = miyoo_now_ns();
+    memset(s_trace_io, 0, sizeof(s_trace_io));
+    printf("recording input trace to %s\n", path);
+}
+
+// one writev() per record: unbuffered, so a killed daemon loses nothing
+static void miyoo_trace_write(int type, const void * data, int len)
+{
+    struct miyoo_input_trace_record rec;
+    struct iovec iov[2];
+
+    if (s_fd_trace < 0)
+        return;
+    memset(&rec, 0, sizeof(rec));
+    rec.time_ns = miyoo_now_ns() - s_trace_start;
+    rec.type = type;
+    rec.len = len;
+    iov[0].iov_base = &rec;
+    iov[0].iov_len = sizeof(rec);
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = len;
+    if (writev(s_fd_trace, iov, 2) < 0)
+    {
+        perror("trace write");
+        close(s_fd_trace);
+        s_fd_trace = -1;
+    }
+}
+
+static void miyoo_trace_io(const int * data)
+{
+    if (s_fd_trace < 0 || !memcmp(s_trace_io, data, sizeof(s_trace_io)))
+        return;
+    memcpy(s_trace_io, data, sizeof(s_trace_io));
+    miyoo_trace_write(MIYOO_TRACE_IO, data, sizeof(s_trace_io));
+}
+//====================== trace capture end ===================
+
+
+static void miyoo_parse_serial_input(const char * cmd, int len)
+{
+    if(s_ctl_flags & MIYOO_CTL_SUSPEND) return;
+
+    if (trimui_pad_stream_feed(&s_stream_l, (const uint8_t *)cmd, len, &s_pad.frame))
+        s_pad.frame_seq++;
+}
+
+// Run calibration only when a new frame has been published since last time.
+static void miyoo_report_new_frame()
+{
+    static uint32_t s_reported_seq = 0;
+
+    if (s_pad.frame_seq == s_reported_seq)
+        return;
+    s_reported_seq = s_pad.frame_seq;
+    report_axis_lr();
+    s_stats.t_cal = miyoo_now_ns();
+    s_stats.pending = 1;
+}
+
+
+char s_rcv_buf_l[1024];
+//char s_rcv_buf_r[1024];
+
+//====================== event loop =========================
+// One epoll loop replaces the stock joystick / miyooio / 1 s main threads.
+// The UART fd wakes us the moment stick bytes arrive. /dev/miyooio is
+// sampled by a timerfd at the stock 16666/4 us cadence, as the stock thread
+// read it: there is no driver source, and whether its .poll works is not
+// verified on hardware. MIYOO_INPUTD_IO_POLL=1 puts the fd in epoll
+// instead; a .poll that reports readable without a new word (always
+// readable) makes the loop fall back to the timer after
+// MIYOO_IO_POLL_SPIN such wakeups in a row, counted as io_poll_fallbacks
+// in the stats file. A .poll that never signals still drops keys, so the
+// option stays off until that is checked. Flag files are tracked by
+// inotify.
+#define MIYOO_EPOLL_MAX_EVENTS    (8)
+#define MIYOO_IO_POLL_NS          (16666L * 1000 / 4)
+#define MIYOO_IO_POLL_SPIN        (64)
+
+enum
+{
+    MIYOO_EV_JOYSTICK = 1,
+    MIYOO_EV_IO,
+    MIYOO_EV_IO_TIMER,
+    MIYOO_EV_TURBO_TIMER,
+    MIYOO_EV_SIGNAL,
+    MIYOO_EV_INOTIFY,
+    MIYOO_EV_IDLE_TIMER,
+    MIYOO_EV_UINPUT,
+    MIYOO_EV_RUMBLE_TIMER,
+    MIYOO_EV_SYSKEY,            // + source index, keep last
+};
+
+static int s_epoll_fd = -1;
+static int s_fd_joystick = -1;
+static int s_fd_io = -1;
+static int s_fd_io_timer = -1;      // the sampler; -1 while miyooio is in epoll
+static int s_io_spin;               // readable wakeups in a row with no new word
+static int s_parked = 0;
+static int s_quit = 0;
+
+static int miyoo_epoll_add(int fd, uint32_t tag)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = tag;
+    return epoll_ctl(s_epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+// interval_ns == 0 disarms the timer
+static void miyoo_timerfd_arm(int fd, long interval_ns)
+{
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_interval.tv_sec = interval_ns / 1000000000L;
+    its.it_interval.tv_nsec = interval_ns % 1000000000L;
+    its.it_value = its.it_interval;
+    timerfd_settime(fd, 0, &its, NULL);
+}
+
+static int miyoo_timerfd_open(long interval_ns)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0)
+    {
+        perror("timerfd_create");
+        return -1;
+    }
+    miyoo_timerfd_arm(fd, interval_ns);
+    return fd;
+}
+
+static void miyoo_timerfd_ack(int fd)
+{
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+        perror("timerfd read");
+}
+
+static int trimui_open_joystick()
+{
+    int fd = trimui_uart_open(miyoo_node("MIYOO_INPUTD_TTY", MIYOO_NODE_JOYSTICK));
+    if (fd < 0)
+        return -1;
+    trimui_uart_set(fd, MIYOO_UART_STOCK_BAUD, 0, 8, 1, 'N');
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+// Low-latency UART mode, picked at runtime by writing a baud rate to
+// /tmp/miyoo_inputd/uart_baud (termios2 BOTHER, ASYNC_LOW_LATENCY, VTIME=0
+// and VMIN = bytes left in the current frame, so each read() carries one
+// whole frame). Removing the file restores the stock 9600 / VMIN=1 /
+// VTIME=1 setup. Watch `frames` / `bad_magic` in the stats file to see
+// which rates the stick MCU actually talks at.
+static int s_uart_baud;     // 0: stock setup
+static int s_uart_vmin;
+
+// A stream that started mid-frame would otherwise stay misaligned and
+// deliver every frame one period late.
+static void miyoo_uart_align()
+{
+    int vmin;
+    if (!s_uart_baud || s_fd_joystick < 0)
+        return;
+    vmin = TRIMUI_PAD_FRAME_LEN - s_stream_l.fill;
+    if (vmin != s_uart_vmin && trimui_uart_set_vmin(s_fd_joystick, vmin) == 0)
+        s_uart_vmin = vmin;
+}
+
+static void miyoo_uart_reload()
+{
+    char buf[32];
+    int len, baud = 0, actual = 0;
+
+    if (s_fd_joystick < 0)
+        return;
+
+    memset(buf, 0, sizeof(buf));
+    len = fileToMem(MIYOO_CTL_DIR "/" MIYOO_UART_BAUD_NAME, buf);
+    if (len > 0 && len < sizeof(buf))
+        sscanf(buf, "%d", &baud);
+    if (baud < 0 || baud > MIYOO_UART_MAX_BAUD)
+    {
+        printf("uart: ignoring baud %d\n", baud);
+        baud = 0;
+    }
+    if (baud == s_uart_baud)
+        return;
+
+    trimui_uart_set(s_fd_joystick, MIYOO_UART_STOCK_BAUD, 0, 8, 1, 'N');
+    if (baud)
+        actual = trimui_uart_set_speed(s_fd_joystick, baud, TRIMUI_PAD_FRAME_LEN);
+    if (actual > 0)
+    {
+        printf("uart: %d baud (driver %d), VMIN=%d, low latency %s\n", baud, actual,
+            TRIMUI_PAD_FRAME_LEN, trimui_uart_low_latency(s_fd_joystick, 1) ? "n/a" : "on");
+    }
+    else
+    {
+        baud = 0;
+        trimui_uart_low_latency(s_fd_joystick, 0);
+        printf("uart: stock %d baud\n", MIYOO_UART_STOCK_BAUD);
+    }
+    s_uart_baud = baud;
+    s_uart_vmin = baud ? TRIMUI_PAD_FRAME_LEN : 0;
+    s_stream_l.fill = 0;
+}
+
+static void trimui_handle_joystick(int fd)
+{
+    uint64_t t_read = miyoo_now_ns();
+    uint32_t frames = s_stream_l.frames;
+    int len;
+    while ((len = read(fd, s_rcv_buf_l, sizeof(s_rcv_buf_l) - 1)) > 0)
+    {
+        s_rcv_buf_l[len] = '\0';
+        //dump_cmd_frame(s_rcv_buf_l, len);
+        miyoo_trace_write(MIYOO_TRACE_TTY, s_rcv_buf_l, len);
+        miyoo_parse_serial_input(s_rcv_buf_l, len);
+    }
+    if (len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR))
+        printf("cannot receive data\n");
+    miyoo_uart_align();
+
+    if (s_stream_l.frames != frames)
+    {
+        s_stats.t_read = t_read;
+        s_stats.t_parse = miyoo_now_ns();
+    }
+    miyoo_report_new_frame();
+}
+
+static uint32_t trimui_pack_io(const int * data)
+{
+    uint32_t bits = 0;
+    int i;
+    // branch-free so the compiler can vectorise it; mostly-zero snapshots
+    // made the if() form mispredict on every pressed key
+    for (i = 0; i < MIYOOIO_DATA_COUNT; i++)
+        bits |= (uint32_t)(data[i] != 0) << i;
+    return bits;
+}
+
+//====================== turbo engine =======================
+// Turbo runs on its own absolute timerfd instead of flipping once per
+// miyooio read. A held turbo key starts in the pressed phase (no added
+// latency), then alternates pressed / released at its configured rate and
+// duty; each edge is dispatched as a real key event on its own schedule.
+static int s_fd_turbo = -1;
+static uint32_t s_io_raw;           // s_io_pad | s_sys_bits, before turbo
+static uint32_t s_io_pad;           // packed miyooio word
+static uint32_t s_sys_bits;         // system keys (volume / power / lid)
+static uint32_t s_turbo_active;     // held keys under turbo control
+static uint32_t s_turbo_phase;      // ... of which currently "pressed"
+static uint64_t s_turbo_next[MIYOOIO_DATA_COUNT];
+
+static uint64_t trimui_turbo_phase_ns(int keymask, int pressed)
+{
+    const struct tm_turbo_rate * r = &s_turbo_rate[keymask];
+    uint64_t period = 1000000000ull / (r->hz ? r->hz : MIYOO_TURBO_DEFAULT_HZ);
+    uint64_t on = period * (r->duty ? r->duty : MIYOO_TURBO_DEFAULT_DUTY) / 100;
+    return pressed ? on : period - on;
+}
+
+static uint32_t trimui_turbo_mask()
+{
+    uint32_t flags = s_ctl_flags;
+    return (flags & MIYOO_CTL_TURBO_ENABLE) ? (flags & s_turbo_keys) : 0;
+}
+
+static void trimui_turbo_rearm()
+{
+    struct itimerspec its;
+    uint64_t next = 0;
+    uint32_t bits = s_turbo_active;
+    int i;
+
+    while (bits)
+    {
+        i = __builtin_ctz(bits);
+        bits &= bits - 1;
+        if (!next || s_turbo_next[i] < next)
+            next = s_turbo_next[i];
+    }
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = next / 1000000000ull;
+    its.it_value.tv_nsec = next % 1000000000ull;
+    if (s_fd_turbo >= 0)
+        timerfd_settime(s_fd_turbo, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+// Start / stop turbo phases for keys entering or leaving turbo control.
+static void trimui_turbo_update(uint32_t raw)
+{
+    uint32_t active = raw & trimui_turbo_mask();
+    uint32_t start = active & ~s_turbo_active;
+    uint64_t now;
+    int i;
+
+    if (active == s_turbo_active)
+        return;
+
+    now = miyoo_now_ns();
+    s_turbo_phase = (s_turbo_phase & active) | start;
+    while (start)
+    {
+        i = __builtin_ctz(start);
+        start &= start - 1;
+        s_turbo_next[i] = now + trimui_turbo_phase_ns(i, 1);
+    }
+    s_turbo_active = active;
+    trimui_turbo_rearm();
+}
+
+static void trimui_turbo_tick()
+{
+    uint64_t now = miyoo_now_ns();
+    uint32_t bits = s_turbo_active;
+    int i;
+
+    while (bits)
+    {
+        i = __builtin_ctz(bits);
+        bits &= bits - 1;
+        if (s_turbo_next[i] > now)
+            continue;
+
+        s_turbo_phase ^= 1u << i;
+        s_turbo_next[i] += trimui_turbo_phase_ns(i, s_turbo_phase & (1u << i));
+        if (s_turbo_next[i] <= now)     // fell behind: restart from now
+            s_turbo_next[i] = now + trimui_turbo_phase_ns(i, s_turbo_phase & (1u << i));
+    }
+    trimui_turbo_rearm();
+}
+
+static void trimui_turbo_stop()
+{
+    s_turbo_active = 0;
+    s_turbo_phase = 0;
+    trimui_turbo_rearm();
+}
+//====================== turbo engine end ===================
+
+// Apply a packed miyooio word: turbo filter, diff, dispatch.
+static void trimui_apply_io(uint32_t raw)
+{
+    uint32_t changed;
+
+    s_io_raw = raw;
+    trimui_turbo_update(raw);
+    s_io_bits = (raw & ~s_turbo_active) | (s_turbo_active & s_turbo_phase);
+    changed = s_io_bits ^ s_io_bits_last;
+    if (!changed)
+        return;
+
+    trimui_dispatch_bits(s_io_bits, changed);
+    s_io_bits_last = s_io_bits;
+    miyoo_shm_set_buttons(s_io_bits);
+}
+
+// 1 if the driver returned a new word, 0 if not (unchanged, EAGAIN, short)
+static int trimui_handle_miyooio(int fd)
+{
+    uint32_t pad;
+
+    if(s_ctl_flags & MIYOO_CTL_SUSPEND)
+        return 0;
+
+    if (read(fd, s_io_data, sizeof(s_io_data)) != sizeof(s_io_data))
+        return 0;
+
+    miyoo_trace_io(s_io_data);
+    pad = trimui_pack_io(s_io_data);
+    if (pad == s_io_pad)
+        return 0;
+    s_io_pad = pad;
+    trimui_apply_io(s_io_pad | s_sys_bits);
+    return 1;
+}
+
+//====================== system keys =========================
+// Opt-in replacement for the stock keymon / input-event-daemon readers:
+// the evdev nodes carrying the volume keys, power key and lid (gpio-keys,
+// rk8xx pwrkey, hall) are read by this epoll loop. Each key is a keymask
+// bit (RETRO_MIYOO355_ID_VOLUP .. _LID) ORed into the miyooio word, so the
+// action table, the pad state and the shm button word see it like any
+// other key; the action table sends these bits to the "MIYOO System Keys"
+// companion device, not the gamepad.
+//
+//   MIYOO_INPUTD_SYSKEYS=1                          every /dev/input/event*
+//                                                   reporting one of them
+//   MIYOO_INPUTD_SYSKEYS=/dev/input/event1:...      exactly these nodes
+//   MIYOO_INPUTD_POWER_KEY_CMD=/usr/bin/power-key.sh
+//                                                   run "<cmd> press|release"
+//                                                   on power key edges, as
+//                                                   /etc/input-event-daemon.conf.d
+//                                                   does
+//
+// The sources are not grabbed, so a reader left on them still works. They
+// stay in epoll while suspend-parked: the power key and lid must still
+// come through.
+#define MIYOO_SYSKEY_MAX_NODES   (4)
+#define MIYOO_SYSKEY_STATE       (1u << RETRO_MIYOO355_ID_LID)  // not activity
+
+static int s_fd_syskey[MIYOO_SYSKEY_MAX_NODES];
+static uint32_t s_syskey_bits[MIYOO_SYSKEY_MAX_NODES];
+static int s_syskey_drop[MIYOO_SYSKEY_MAX_NODES];      // after SYN_DROPPED
+static int s_syskey_count;
+static const char * s_power_key_cmd;
+
+#define MIYOO_TEST_BIT(bits, n) \
+    (((bits)[(n) / (8 * sizeof(long))] >> ((n) % (8 * sizeof(long)))) & 1)
+
+static int miyoo_syskey_bit(int type, int code)
+{
+    if (type == EV_SW)
+        return code == SW_LID ? RETRO_MIYOO355_ID_LID : -1;
+    if (type != EV_KEY)
+        return -1;
+    switch (code)
+    {
+    case KEY_VOLUMEUP:      return RETRO_MIYOO355_ID_VOLUP;
+    case KEY_VOLUMEDOWN:    return RETRO_MIYOO355_ID_VOLDOWN;
+    case KEY_POWER:         return RETRO_MIYOO355_ID_POWER;
+    }
+    return -1;
+}
+
+// held keys / closed lid right now; 0 for a non-evdev source (host FIFO)
+static uint32_t miyoo_syskey_state(int fd)
+{
+    unsigned long keys[KEY_CNT / (8 * sizeof(long)) + 1];
+    unsigned long sw[SW_CNT / (8 * sizeof(long)) + 1];
+    uint32_t bits = 0;
+
+    memset(keys, 0, sizeof(keys));
+    memset(sw, 0, sizeof(sw));
+    ioctl(fd, EVIOCGKEY(sizeof(keys)), keys);
+    ioctl(fd, EVIOCGSW(sizeof(sw)), sw);
+    if (MIYOO_TEST_BIT(keys, KEY_VOLUMEUP))
+        bits |= 1u << RETRO_MIYOO355_ID_VOLUP;
+    if (MIYOO_TEST_BIT(keys, KEY_VOLUMEDOWN))
+        bits |= 1u << RETRO_MIYOO355_ID_VOLDOWN;
+    if (MIYOO_TEST_BIT(keys, KEY_POWER))
+        bits |= 1u << RETRO_MIYOO355_ID_POWER;
+    if (MIYOO_TEST_BIT(sw, SW_LID))
+        bits |= 1u << RETRO_MIYOO355_ID_LID;
+    return bits;
+}
+
+// reports one of our keys and is not one of our own uinput devices
+static int miyoo_syskey_wanted(int fd)
+{
+    unsigned long keys[KEY_CNT / (8 * sizeof(long)) + 1];
+    unsigned long sw[SW_CNT / (8 * sizeof(long)) + 1];
+    char name[64];
+
+    memset(name, 0, sizeof(name));
+    memset(keys, 0, sizeof(keys));
+    memset(sw, 0, sizeof(sw));
+    if (ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name) < 0 || !strncmp(name, "MIYOO ", 6))
+        return 0;
+    ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys);
+    ioctl(fd, EVIOCGBIT(EV_SW, sizeof(sw)), sw);
+    return MIYOO_TEST_BIT(keys, KEY_VOLUMEUP) || MIYOO_TEST_BIT(keys, KEY_VOLUMEDOWN)
+        || MIYOO_TEST_BIT(keys, KEY_POWER) || MIYOO_TEST_BIT(sw, SW_LID);
+}
+
+static void miyoo_syskey_add(const char * node, int scan)
+{
+    int fd;
+
+    if (s_syskey_count >= MIYOO_SYSKEY_MAX_NODES)
+        return;
+    fd = open(node, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+    {
+        if (!scan)
+            perror(node);
+        return;
+    }
+    if (scan && !miyoo_syskey_wanted(fd))
+    {
+        close(fd);
+        return;
+    }
+    s_fd_syskey[s_syskey_count] = fd;
+    s_syskey_bits[s_syskey_count] = miyoo_syskey_state(fd);
+    s_syskey_drop[s_syskey_count] = 0;
+    s_syskey_count++;
+    printf("system keys: %s\n", node);
+}
+
+static uint32_t miyoo_syskey_bits()
+{
+    uint32_t bits = 0;
+    int i;
+    for (i = 0; i < s_syskey_count; i++)
+        bits |= s_syskey_bits[i];
+    return bits;
+}
+
+static void miyoo_syskeys_open()
+{
+    const char * env = getenv("MIYOO_INPUTD_SYSKEYS");
+    char list[256], node[64], * tok, * save;
+    int i;
+
+    if (!env || !*env || !strcmp(env, "0"))
+        return;
+    if (!strcmp(env, "1"))
+    {
+        for (i = 0; i < 32; i++)
+        {
+            snprintf(node, sizeof(node), "/dev/input/event%d", i);
+            miyoo_syskey_add(node, 1);
+        }
+    }
+    else
+    {
+        snprintf(list, sizeof(list), "%s", env);
+        for (tok = strtok_r(list, ":", &save); tok; tok = strtok_r(NULL, ":", &save))
+            miyoo_syskey_add(tok, 0);
+    }
+    if (!s_syskey_count)
+    {
+        printf("system keys: no source found\n");
+        return;
+    }
+
+    s_power_key_cmd = getenv("MIYOO_INPUTD_POWER_KEY_CMD");
+    if (s_power_key_cmd && *s_power_key_cmd)
+        signal(SIGCHLD, SIG_IGN);   // spawned handlers reap themselves
+    else
+        s_power_key_cmd = NULL;
+    trimui_setup_syskeys();
+    s_sys_bits = miyoo_syskey_bits();
+}
+
+// The handler is an ordinary process: SCHED_OTHER even when the loop runs
+// SCHED_FIFO (realtime mode), no signals blocked for the signalfd, and
+// SIGCHLD back to default so the script can wait for its own children.
+static void miyoo_power_key_spawn(int pressed)
+{
+    char * argv[] = { (char *)s_power_key_cmd, pressed ? "press" : "release", NULL };
+    posix_spawnattr_t attr;
+    struct sched_param sp;
+    sigset_t mask, def;
+    pid_t pid;
+    int err;
+
+    memset(&sp, 0, sizeof(sp));
+    sigemptyset(&mask);
+    sigemptyset(&def);
+    sigaddset(&def, SIGCHLD);
+    sigaddset(&def, SIGUSR1);
+    sigaddset(&def, SIGTERM);
+    sigaddset(&def, SIGINT);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSCHEDULER | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setschedpolicy(&attr, SCHED_OTHER);
+    posix_spawnattr_setschedparam(&attr, &sp);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setsigdefault(&attr, &def);
+    err = posix_spawn(&pid, s_power_key_cmd, NULL, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    if (err)
+        printf("%s: %s\n", s_power_key_cmd, strerror(err));
+}
+
+// one source SYN_REPORT -> one companion packet, so a lid or power tap
+// that arrives press + release in one read() is not collapsed
+static void miyoo_syskey_report(int i, uint32_t bits)
+{
+    uint32_t power = 1u << RETRO_MIYOO355_ID_POWER;
+    uint32_t old = s_sys_bits;
+
+    s_syskey_bits[i] = bits;
+    s_sys_bits = miyoo_syskey_bits();
+    if (s_sys_bits == old)
+        return;
+    trimui_apply_io(s_io_pad | s_sys_bits);
+    trimui_vflush(UKEY_PORT_SYSKEYS);
+    if (s_power_key_cmd && ((s_sys_bits ^ old) & power))
+        miyoo_power_key_spawn(s_sys_bits & power);
+}
+
+static void miyoo_handle_syskey(int i)
+{
+    struct input_event ev[16];
+    uint32_t bits = s_syskey_bits[i];
+    ssize_t len;
+    int k, bit;
+
+    while ((len = read(s_fd_syskey[i], ev, sizeof(ev))) > 0)
+    {
+        for (k = 0; k < len / (ssize_t)sizeof(ev[0]); k++)
+        {
+            if (ev[k].type == EV_SYN)
+            {
+                // the queue overflowed: skip to the next report, then
+                // take the state from the driver
+                if (ev[k].code == SYN_DROPPED)
+                    s_syskey_drop[i] = 1;
+                else if (ev[k].code == SYN_REPORT)
+                {
+                    if (s_syskey_drop[i])
+                        bits = miyoo_syskey_state(s_fd_syskey[i]);
+                    s_syskey_drop[i] = 0;
+                    miyoo_syskey_report(i, bits);
+                }
+                continue;
+            }
+            bit = miyoo_syskey_bit(ev[k].type, ev[k].code);
+            if (bit < 0 || s_syskey_drop[i] || ev[k].value == 2)    // autorepeat
+                continue;
+            if (ev[k].value)
+                bits |= 1u << bit;
+            else
+                bits &= ~(1u << bit);
+        }
+    }
+}
+//====================== system keys end =====================
+
+//====================== rumble =============================
+// The pad declares FF_RUMBLE (ukey.c); effect uploads and play / stop
+// requests arrive on the uinput fd in this loop. Every effect edge (start
+// after replay.delay, stop after replay.length, repeats) is scheduled on
+// one absolute CLOCK_MONOTONIC timerfd, so a 40 ms effect stops 40 ms after
+// the client asked, independent of the 8 ms stick frames or io sampling.
+// Effects that overlap are summed (strong + weak / 2 each) and clamped.
+//
+// Motor, first one found:
+//   PWM   PWM5 (fe6f0010.pwm) when the DTS enables it (mainline / ROCKNIX):
+//         pwmchipN/pwm0 is exported and duty_cycle follows the magnitude
+//   GPIO  gpio20 (GPIO0_C4, PWM5's pin as a plain output; stock, exported
+//         by runmiyoo.sh): on/off, on for any non-zero magnitude
+// MIYOO_INPUTD_SYSFS=<dir> prefixes both sysfs paths, so a host run can
+// drive a mock tree (test-scripts/miyoo-inputd-rumble-mock.sh).
+//
+// /tmp/miyoo_inputd/rumble: "<gain_pct>", 0 disables the motor.
+#define MIYOO_RUMBLE_NAME          "rumble"
+#define MIYOO_RUMBLE_GPIO          (20)
+#define MIYOO_RUMBLE_PWM_DEVICE    "fe6f0010.pwm"
+#define MIYOO_RUMBLE_PWM_PERIOD    (1000000)   // ns, if the DT left it at 0
+#define MIYOO_RUMBLE_MAX           (0xffff)
+
+struct miyoo_rumble
+{
+    int level;                  // strong + weak / 2, clamped
+    int repeats;                // plays left after the current one
+    uint64_t delay_ns, length_ns;
+    uint64_t start_ns, end_ns;  // end_ns 0: until stopped
+};
+
+static struct miyoo_rumble s_rumble[UKEY_FF_EFFECTS];
+static uint32_t s_rumble_active;
+static uint64_t s_rumble_next_ns;   // armed edge, 0 = none
+static int s_rumble_gain = 100;
+static int s_fd_rumble = -1;        // edge timer
+static int s_fd_motor = -1;         // gpio value or pwm duty_cycle
+static int s_motor_pwm;
+static int s_motor_file;            // regular file (mock tree): truncate on write
+static long s_motor_period;
+static int s_motor_level = -1;
+
+static void miyoo_sysfs_path(char * path, int size, const char * rel)
+{
+    snprintf(path, size, "%s%s", miyoo_node("MIYOO_INPUTD_SYSFS", ""), rel);
+}
+
+static int miyoo_sysfs_write(const char * path, const char * value)
+{
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    int len = strlen(value), ret;
+    if (fd < 0)
+        return -1;
+    ret = write(fd, value, len) == len ? 0 : -1;
+    close(fd);
+    return ret;
+}
+
+static long miyoo_sysfs_read_long(const char * path)
+{
+    char buf[32];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    int len;
+    if (fd < 0)
+        return -1;
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0)
+        return -1;
+    buf[len] = '\0';
+    return strtol(buf, NULL, 10);
+}
+
+// pwmchipN whose device link ends in MIYOO_RUMBLE_PWM_DEVICE
+static int miyoo_motor_find_pwm(char * chip, int size)
+{
+    char root[PATH_MAX / 2], link[PATH_MAX], target[PATH_MAX];
+    struct dirent * de;
+    DIR * dir;
+    ssize_t len;
+    int found = 0;
+
+    miyoo_sysfs_path(root, sizeof(root), "/sys/class/pwm");
+    dir = opendir(root);
+    if (!dir)
+        return 0;
+    while (!found && (de = readdir(dir)))
+    {
+        if (strncmp(de->d_name, "pwmchip", 7))
+            continue;
+        snprintf(link, sizeof(link), "%s/%s/device", root, de->d_name);
+        len = readlink(link, target, sizeof(target) - 1);
+        if (len <= 0)
+            continue;
+        target[len] = '\0';
+        if (strstr(target, MIYOO_RUMBLE_PWM_DEVICE))
+        {
+            snprintf(chip, size, "%s/%s", root, de->d_name);
+            found = 1;
+        }
+    }
+    closedir(dir);
+    return found;
+}
+
+static int miyoo_motor_open()
+{
+    char chip[PATH_MAX], path[PATH_MAX + 32], num[16];
+    struct stat st;
+
+    if (miyoo_motor_find_pwm(chip, sizeof(chip)))
+    {
+        snprintf(path, sizeof(path), "%s/pwm0", chip);
+        if (access(path, F_OK))
+        {
+            snprintf(path, sizeof(path), "%s/export", chip);
+            miyoo_sysfs_write(path, "0");
+        }
+        snprintf(path, sizeof(path), "%s/pwm0/period", chip);
+        s_motor_period = miyoo_sysfs_read_long(path);
+        if (s_motor_period <= 0)
+        {
+            s_motor_period = MIYOO_RUMBLE_PWM_PERIOD;
+            snprintf(num, sizeof(num), "%ld", s_motor_period);
+            miyoo_sysfs_write(path, num);
+        }
+        snprintf(path, sizeof(path), "%s/pwm0/duty_cycle", chip);
+        miyoo_sysfs_write(path, "0");
+        snprintf(path, sizeof(path), "%s/pwm0/enable", chip);
+        miyoo_sysfs_write(path, "1");
+        snprintf(path, sizeof(path), "%s/pwm0/duty_cycle", chip);
+        s_fd_motor = open(path, O_WRONLY | O_CLOEXEC);
+        s_motor_pwm = 1;
+    }
+    else
+    {
+        miyoo_sysfs_path(chip, sizeof(chip), "/sys/class/gpio");
+        snprintf(path, sizeof(path), "%s/gpio%d/value", chip, MIYOO_RUMBLE_GPIO);
+        if (access(path, F_OK))
+        {
+            snprintf(path, sizeof(path), "%s/export", chip);
+            snprintf(num, sizeof(num), "%d", MIYOO_RUMBLE_GPIO);
+            miyoo_sysfs_write(path, num);
+        }
+        snprintf(path, sizeof(path), "%s/gpio%d/direction", chip, MIYOO_RUMBLE_GPIO);
+        miyoo_sysfs_write(path, "out");
+        snprintf(path, sizeof(path), "%s/gpio%d/value", chip, MIYOO_RUMBLE_GPIO);
+        s_fd_motor = open(path, O_WRONLY | O_CLOEXEC);
+        s_motor_pwm = 0;
+    }
+    if (s_fd_motor < 0)
+    {
+        perror(path);
+        return -1;
+    }
+    s_motor_file = fstat(s_fd_motor, &st) == 0 && S_ISREG(st.st_mode);
+    s_motor_level = -1;
+    printf("rumble: %s %s\n", s_motor_pwm ? "pwm" : "gpio", path);
+    return 0;
+}
+
+// level 0..MIYOO_RUMBLE_MAX; gpio only switches on 0 <-> non-zero edges
+static void miyoo_motor_set(int level)
+{
+    char buf[24];
+    int len;
+
+    if (!s_motor_pwm)
+        level = level > 0;
+    if (s_fd_motor < 0 || level == s_motor_level)
+        return;
+    if (s_motor_pwm)
+        len = snprintf(buf, sizeof(buf), "%ld\n", (long)((int64_t)s_motor_period * level / MIYOO_RUMBLE_MAX));
+    else
+        len = snprintf(buf, sizeof(buf), "%d\n", level);
+    if (pwrite(s_fd_motor, buf, len, 0) != len)
+        perror("rumble write");
+    else if (s_motor_file && ftruncate(s_fd_motor, len) < 0)
+        perror("rumble truncate");
+    s_motor_level = level;
+}
+
+static void miyoo_timerfd_arm_at(int fd, uint64_t ns)
+{
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = ns / 1000000000ull;
+    its.it_value.tv_nsec = ns % 1000000000ull;
+    timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+// retire finished plays, sum what is playing now, arm the next edge
+static void miyoo_rumble_update(uint64_t now)
+{
+    struct miyoo_rumble * r;
+    uint32_t pending = s_rumble_active;
+    uint64_t next = 0, edge;
+    int id, level = 0;
+
+    while (pending)
+    {
+        id = __builtin_ctz(pending);
+        pending &= pending - 1;
+        r = &s_rumble[id];
+        while (r->end_ns && now >= r->end_ns && r->repeats)
+        {
+            r->repeats--;
+            r->start_ns = r->end_ns + r->delay_ns;
+            r->end_ns = r->start_ns + r->length_ns;
+        }
+        if (r->end_ns && now >= r->end_ns)
+        {
+            s_rumble_active &= ~(1u << id);
+            continue;
+        }
+        if (now >= r->start_ns)
+        {
+            level += r->level;
+            edge = r->end_ns;
+        }
+        else
+            edge = r->start_ns;
+        if (edge && (!next || edge < next))
+            next = edge;
+    }
+
+    if (level > MIYOO_RUMBLE_MAX)
+        level = MIYOO_RUMBLE_MAX;
+    miyoo_motor_set(level * s_rumble_gain / 100);
+    if (next != s_rumble_next_ns && s_fd_rumble >= 0)
+        miyoo_timerfd_arm_at(s_fd_rumble, next);
+    s_rumble_next_ns = next;
+}
+
+static void miyoo_rumble_play(int port, const struct ff_effect * effect, int value)
+{
+    struct miyoo_rumble * r = &s_rumble[effect->id];
+    uint64_t now = miyoo_now_ns();
+    int level = effect->u.rumble.strong_magnitude + effect->u.rumble.weak_magnitude / 2;
+
+    r->level = level > MIYOO_RUMBLE_MAX ? MIYOO_RUMBLE_MAX : level;
+    if (value == 0 || s_parked || s_fd_motor < 0)    // no motor: accepted, never played
+        s_rumble_active &= ~(1u << effect->id);
+    else if (value > 0)
+    {
+        r->repeats = value - 1;
+        r->delay_ns = effect->replay.delay * 1000000ull;
+        r->length_ns = effect->replay.length * 1000000ull;
+        r->start_ns = now + r->delay_ns;
+        r->end_ns = r->length_ns ? r->start_ns + r->length_ns : 0;
+        s_rumble_active |= 1u << effect->id;
+    }
+    // value < 0: re-uploaded, new magnitude from the next update on
+    miyoo_rumble_update(now);
+}
+
+static void miyoo_rumble_tick()
+{
+    uint64_t now = miyoo_now_ns();
+
+    miyoo_timerfd_ack(s_fd_rumble);
+    if (s_rumble_next_ns && now >= s_rumble_next_ns)
+        miyoo_hist_add(&s_stats.lat[MIYOO_LAT_RUMBLE_LATE], now - s_rumble_next_ns);
+    s_rumble_next_ns = 0;
+    miyoo_rumble_update(now);
+}
+
+static void miyoo_rumble_stop()
+{
+    s_rumble_active = 0;
+    miyoo_rumble_update(miyoo_now_ns());
+}
+
+static void miyoo_rumble_reload()
+{
+    char buf[32];
+    int len, gain = 100;
+
+    memset(buf, 0, sizeof(buf));
+    len = fileToMem(MIYOO_CTL_DIR "/" MIYOO_RUMBLE_NAME, buf);
+    if (len > 0 && len < sizeof(buf))
+        sscanf(buf, "%d", &gain);
+    if (gain < 0 || gain > 100)
+        gain = 100;
+    s_rumble_gain = gain;
+    s_motor_level = -1;     // rewrite the motor with the new gain
+    miyoo_rumble_update(miyoo_now_ns());
+    printf("rumble: gain %d%%\n", gain);
+}
+//====================== rumble end =========================
+
+//====================== adaptive idle =======================
+// The stick MCU streams frames whether or not anyone touches the pad, so a
+// centred, untouched Flip still woke the daemon for every frame. After
+// s_idle_after_ns with both sticks in the dead zone and no key held, the
+// UART leaves the epoll set and one slow timer (s_fd_idle) samples it and
+// a timer-sampled miyooio instead: the bytes queue in the tty buffer and
+// only the newest frame is parsed per tick. The first tick that shows a
+// stick outside the dead zone or a key held puts the UART back in epoll.
+// Added latency on the first input after idle is at most one tick (keys
+// on a pollable miyooio are never delayed).
+//
+// /tmp/miyoo_inputd/idle: "<after_ms> [tick_ms]", "0" disables.
+#define MIYOO_IDLE_NAME              "idle"
+#define MIYOO_IDLE_AFTER_MS          (2000)
+#define MIYOO_IDLE_TICK_MS           (25)
+
+static int s_fd_idle = -1;
+static int s_idle;
+static uint64_t s_idle_after_ns = MIYOO_IDLE_AFTER_MS * 1000000ull;
+static long s_idle_tick_ns = MIYOO_IDLE_TICK_MS * 1000000L;
+static uint64_t s_active_ns;        // last wakeup that saw input
+static uint64_t s_idle_next_ns;     // next tick expiry
+
+static void miyoo_idle_enter()
+{
+    if (s_fd_idle < 0)
+        return;
+    s_idle = 1;
+    s_stats.idle_entries++;
+    s_stats.idle_since = miyoo_now_ns();
+    if (s_fd_joystick >= 0)
+        epoll_ctl(s_epoll_fd, EPOLL_CTL_DEL, s_fd_joystick, NULL);
+    if (s_fd_io_timer >= 0)
+        miyoo_timerfd_arm(s_fd_io_timer, 0);
+    miyoo_timerfd_arm(s_fd_idle, s_idle_tick_ns);
+    s_idle_next_ns = miyoo_now_ns() + s_idle_tick_ns;
+}
+
+// suspend parking owns the nodes while parked: only drop the idle state
+static void miyoo_idle_leave()
+{
+    if (!s_idle)
+        return;
+    s_idle = 0;
+    s_stats.idle_ns += miyoo_now_ns() - s_stats.idle_since;
+    miyoo_timerfd_arm(s_fd_idle, 0);
+    if (s_parked)
+        return;
+    if (s_fd_joystick >= 0)
+        miyoo_epoll_add(s_fd_joystick, MIYOO_EV_JOYSTICK);
+    if (s_fd_io_timer >= 0)
+        miyoo_timerfd_arm(s_fd_io_timer, MIYOO_IO_POLL_NS);
+}
+
+static void miyoo_idle_tick()
+{
+    uint64_t expirations, now = miyoo_now_ns();
+
+    if (read(s_fd_idle, &expirations, sizeof(expirations)) == sizeof(expirations) && expirations)
+    {
+        s_idle_next_ns += (expirations - 1) * s_idle_tick_ns;
+        miyoo_hist_add(&s_stats.lat[MIYOO_LAT_TICK_LATE], now - s_idle_next_ns);
+        s_idle_next_ns += s_idle_tick_ns;
+    }
+    if (s_fd_joystick >= 0)
+        trimui_handle_joystick(s_fd_joystick);
+    if (s_fd_io_timer >= 0)
+        trimui_handle_miyooio(s_fd_io);
+}
+
+static void miyoo_idle_update(uint64_t now)
+{
+    if (s_parked || !s_idle_after_ns || s_stick_active || (s_io_raw & ~MIYOO_SYSKEY_STATE)
+        || s_turbo_active)
+    {
+        s_active_ns = now;
+        miyoo_idle_leave();
+        return;
+    }
+    if (!s_idle && now - s_active_ns >= s_idle_after_ns)
+        miyoo_idle_enter();
+}
+
+static void miyoo_idle_reload()
+{
+    char buf[32];
+    int len, after_ms = MIYOO_IDLE_AFTER_MS, tick_ms = MIYOO_IDLE_TICK_MS;
+
+    memset(buf, 0, sizeof(buf));
+    len = fileToMem(MIYOO_CTL_DIR "/" MIYOO_IDLE_NAME, buf);
+    if (len > 0 && len < sizeof(buf))
+        sscanf(buf, "%d %d", &after_ms, &tick_ms);
+    if (after_ms < 0)
+        after_ms = MIYOO_IDLE_AFTER_MS;
+    if (tick_ms < 1 || tick_ms > 1000)
+        tick_ms = MIYOO_IDLE_TICK_MS;
+
+    // the new settings start from full rate
+    miyoo_idle_leave();
+    s_idle_after_ns = after_ms * 1000000ull;
+    s_idle_tick_ns = tick_ms * 1000000L;
+    printf("idle: after %d ms, tick %d ms\n", after_ms, tick_ms);
+}
+//====================== adaptive idle end ===================
+
+// SIGUSR1 writes the stats file: kill -USR1 $(pidof miyoo_inputd)
+// SIGTERM / SIGINT leave the loop so the rumble motor is switched off
+static int miyoo_signalfd_open()
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+        return -1;
+    return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+static void miyoo_handle_signal(int fd)
+{
+    struct signalfd_siginfo si;
+    while (read(fd, &si, sizeof(si)) == sizeof(si))
+    {
+        if (si.ssi_signo == SIGUSR1)
+            miyoo_stats_write();
+        else
+            s_quit = 1;
+    }
+}
+
+// inotify: MainUI rewrites the calibration files after "Calibration", and
+// MainUI / runmiyoo.sh touch the suspend and turbo flag files. One watch
+// on each directory keeps s_lut and s_ctl_flags current.
+#define MIYOO_INOTIFY_DIR_MASK   (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+static int s_wd_cal = -1;
+static int s_wd_tmp = -1;
+static int s_wd_ctl = -1;
+
+static void miyoo_watch_ctl_dir(int fd)
+{
+    s_wd_ctl = inotify_add_watch(fd, MIYOO_CTL_DIR, MIYOO_INOTIFY_DIR_MASK | IN_CLOSE_WRITE);
+    // files may have appeared before the watch existed
+    trimui_check_turbo_settting();
+}
+
+static int miyoo_inotify_open()
+{
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0)
+    {
+        perror("inotify_init1");
+        return -1;
+    }
+    s_wd_cal = inotify_add_watch(fd, JOYPAD_CONFIG_DIR, IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE);
+    if (s_wd_cal < 0)
+        perror("inotify_add_watch " JOYPAD_CONFIG_DIR);
+    s_wd_tmp = inotify_add_watch(fd, SYSTEM_SUSPEND_DIR, MIYOO_INOTIFY_DIR_MASK | IN_ONLYDIR);
+    if (s_wd_tmp < 0)
+        perror("inotify_add_watch " SYSTEM_SUSPEND_DIR);
+    miyoo_watch_ctl_dir(fd);
+    check_suspend_lock();
+    return fd;
+}
+
+static void miyoo_handle_inotify(int fd)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event * ev;
+    int len, off, reload_cal = 0, reload_uart = 0, reload_idle = 0, reload_filter = 0, reload_rumble = 0;
+    int reload_map = 0, reload_profile = 0, rescan = 0, redeclared = 0;
+    uint32_t bit, on;
+
+    while ((len = read(fd, buf, sizeof(buf))) > 0)
+    {
+        for (off = 0; off < len; off += sizeof(*ev) + ev->len)
+        {
+            ev = (const struct inotify_event *)(buf + off);
+            on = (ev->mask & (IN_CREATE | IN_MOVED_TO)) ? ~0u : 0;
+
+            if (ev->mask & IN_Q_OVERFLOW)
+                rescan = 1;
+            if (!ev->len)
+                continue;
+
+            if (ev->wd == s_wd_cal)
+            {
+                if (!strcmp(ev->name, JOYPAD_CONFIG_NAME_LEFT) || !strcmp(ev->name, JOYPAD_CONFIG_NAME_RIGHT))
+                    reload_cal = 1;
+                else if (!strcmp(ev->name, MIYOO_MAP_NAME))
+                    reload_map = 1;
+            }
+            else if (ev->wd == s_wd_tmp)
+            {
+                if (!strcmp(ev->name, SYSTEM_SUSPEND_NAME))
+                    miyoo_ctl_update(MIYOO_CTL_SUSPEND, on);
+                else if (!strcmp(ev->name, MIYOO_CTL_DIR_NAME) && (ev->mask & IN_ISDIR))
+                {
+                    reload_uart = 1;
+                    reload_idle = 1;
+                    reload_filter = 1;
+                    reload_rumble = 1;
+                    reload_profile = 1;
+                    if (on)
+                        miyoo_watch_ctl_dir(fd);
+                    else
+                    {
+                        s_wd_ctl = -1;
+                        miyoo_ctl_update(MIYOO_CTL_TURBO_KEYS | MIYOO_CTL_TURBO_ENABLE, 0);
+                    }
+                }
+            }
+            else if (ev->wd == s_wd_ctl)
+            {
+                if (!strcmp(ev->name, MIYOO_UART_BAUD_NAME))
+                    reload_uart = 1;
+                else if (!strcmp(ev->name, MIYOO_IDLE_NAME))
+                    reload_idle = 1;
+                else if (!strcmp(ev->name, MIYOO_FILTER_NAME))
+                    reload_filter = 1;
+                else if (!strcmp(ev->name, MIYOO_RUMBLE_NAME))
+                    reload_rumble = 1;
+                else if (!strcmp(ev->name, MIYOO_PROFILE_NAME))
+                    reload_profile = 1;
+                bit = miyoo_ctl_turbo_bit(ev->name);
+                if ((bit & MIYOO_CTL_TURBO_KEYS)
+                    && (ev->mask & (IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE)))
+                    trimui_reload_turbo_rate(bit);
+                if (bit && !(ev->mask & IN_CLOSE_WRITE))
+                    miyoo_ctl_update(bit, on);
+            }
+        }
+    }
+
+    if (rescan)
+    {
+        check_suspend_lock();
+        trimui_check_turbo_settting();
+        reload_uart = 1;
+        reload_idle = 1;
+        reload_filter = 1;
+        reload_rumble = 1;
+        reload_map = 1;
+    }
+    if (reload_cal)
+        pk_reload_cal();
+    if (reload_uart)
+        miyoo_uart_reload();
+    if (reload_idle)
+        miyoo_idle_reload();
+    if (reload_filter)
+        miyoo_filter_reload();
+    if (reload_rumble)
+        miyoo_rumble_reload();
+    if (reload_map)
+        redeclared = miyoo_map_reload();
+    else if (reload_profile)
+        redeclared = miyoo_profile_reload();
+    // a pad declared again lost its effects and axis state with the old device
+    if (redeclared)
+    {
+        miyoo_rumble_stop();
+        report_axis_invalidate();
+    }
+}
+
+//====================== suspend parking ====================
+// While /tmp/system_suspend exists the UART and miyooio sources are taken
+// out of epoll and the sampling timer is disarmed, so the daemon sleeps in
+// epoll_wait() with nothing but inotify / signalfd left to wake it. The
+// rumble motor is stopped and play requests are ignored until resume.
+static void miyoo_suspend_park()
+{
+    if (s_fd_joystick >= 0)
+    {
+        epoll_ctl(s_epoll_fd, EPOLL_CTL_DEL, s_fd_joystick, NULL);
+        tcflush(s_fd_joystick, TCIFLUSH);
+    }
+    if (s_fd_io_timer >= 0)
+        miyoo_timerfd_arm(s_fd_io_timer, 0);
+    else if (s_fd_io >= 0)
+        epoll_ctl(s_epoll_fd, EPOLL_CTL_DEL, s_fd_io, NULL);
+    trimui_turbo_stop();
+    miyoo_rumble_stop();
+
+    s_parked = 1;
+    printf("suspend: input parked\n");
+}
+
+// Drop whatever the MCU sent while we slept, then bring buttons and sticks
+// back in line in one batch: the miyooio diff against the pre-suspend word
+// releases anything let go during suspend, and all four axes are re-sent
+// with the next frame.
+static void miyoo_suspend_resume()
+{
+    if (s_fd_joystick >= 0)
+    {
+        tcflush(s_fd_joystick, TCIFLUSH);
+        s_stream_l.fill = 0;
+        miyoo_uart_align();
+        miyoo_epoll_add(s_fd_joystick, MIYOO_EV_JOYSTICK);
+    }
+    if (s_fd_io_timer >= 0)
+        miyoo_timerfd_arm(s_fd_io_timer, MIYOO_IO_POLL_NS);
+    else if (s_fd_io >= 0)
+    {
+        s_io_spin = 0;
+        miyoo_epoll_add(s_fd_io, MIYOO_EV_IO);
+    }
+
+    s_parked = 0;
+    report_axis_invalidate();
+    if (s_fd_io >= 0)
+        trimui_handle_miyooio(s_fd_io);
+    printf("suspend: input resumed\n");
+}
+
+static void miyoo_suspend_sync()
+{
+    int suspended = (s_ctl_flags & MIYOO_CTL_SUSPEND) ? 1 : 0;
+    if (suspended == s_parked)
+        return;
+    if (suspended)
+        miyoo_suspend_park();
+    else
+        miyoo_suspend_resume();
+}
+//====================== suspend parking end ================
+
+// Sample miyooio on the timerfd, at startup or when its .poll misbehaves.
+// The sampler only runs while the loop is neither idle nor parked; those
+// modes arm and disarm it themselves.
+static void miyoo_io_use_timer()
+{
+    if (s_fd_io_timer < 0)
+        s_fd_io_timer = miyoo_timerfd_open(0);
+    if (s_fd_io_timer < 0)
+        return;
+    miyoo_epoll_add(s_fd_io_timer, MIYOO_EV_IO_TIMER);
+    if (!s_idle && !s_parked)
+        miyoo_timerfd_arm(s_fd_io_timer, MIYOO_IO_POLL_NS);
+}
+
+static void miyoo_io_poll_check(int changed)
+{
+    if (changed)
+    {
+        s_io_spin = 0;
+        return;
+    }
+    if (++s_io_spin < MIYOO_IO_POLL_SPIN)
+        return;
+    epoll_ctl(s_epoll_fd, EPOLL_CTL_DEL, s_fd_io, NULL);
+    miyoo_io_use_timer();
+    s_stats.io_poll_fallbacks++;
+    printf("miyooio: %d readable wakeups without a new word, sampling every %ld us instead\n",
+        MIYOO_IO_POLL_SPIN, MIYOO_IO_POLL_NS / 1000);
+}
+
+static int miyoo_event_loop()
+{
+    struct epoll_event events[MIYOO_EPOLL_MAX_EVENTS];
+    const char * io_poll = getenv("MIYOO_INPUTD_IO_POLL");
+    int fd_signal, fd_inotify, fd_uinput;
+    int i, n;
+
+    s_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (s_epoll_fd < 0)
+    {
+        perror("epoll_create1");
+        return -1;
+    }
+
+    s_fd_joystick = trimui_open_joystick();
+    if (s_fd_joystick >= 0)
+    {
+        miyoo_uart_reload();
+        miyoo_epoll_add(s_fd_joystick, MIYOO_EV_JOYSTICK);
+    }
+
+    memset(s_io_data, 0, sizeof(s_io_data));
+    s_io_bits = s_io_bits_last = 0;
+    // non-blocking: a driver that blocks until the word changes must not
+    // stall the sampler (EAGAIN reads as "no new word")
+    s_fd_io = open(miyoo_node("MIYOO_INPUTD_IO", MIYOO_NODE_IO), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (s_fd_io < 0)
+        perror("open " MIYOO_NODE_IO);
+    else if (!io_poll || strcmp(io_poll, "1") || miyoo_epoll_add(s_fd_io, MIYOO_EV_IO) < 0)
+        miyoo_io_use_timer();       // default, or no .poll at all (EPERM)
+    else
+        printf("miyooio: in epoll (MIYOO_INPUTD_IO_POLL)\n");
+
+    miyoo_syskeys_open();
+    for (i = 0; i < s_syskey_count; i++)
+        miyoo_epoll_add(s_fd_syskey[i], MIYOO_EV_SYSKEY + i);
+    if (s_sys_bits)
+        trimui_apply_io(s_io_pad | s_sys_bits);     // e.g. started with the lid shut
+
+    s_fd_turbo = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (s_fd_turbo >= 0)
+        miyoo_epoll_add(s_fd_turbo, MIYOO_EV_TURBO_TIMER);
+
+    fd_signal = miyoo_signalfd_open();
+    if (fd_signal >= 0)
+        miyoo_epoll_add(fd_signal, MIYOO_EV_SIGNAL);
+
+    fd_inotify = miyoo_inotify_open();
+    if (fd_inotify >= 0)
+        miyoo_epoll_add(fd_inotify, MIYOO_EV_INOTIFY);
+
+    s_fd_idle = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (s_fd_idle >= 0)
+        miyoo_epoll_add(s_fd_idle, MIYOO_EV_IDLE_TIMER);
+
+    // no uinput (raw sink on a host): no force feedback requests to serve.
+    // The pad declares FF_RUMBLE either way, so the uploads and erases are
+    // answered even without a motor; the client would block otherwise.
+    fd_uinput = trimui_xpad_fd(0);
+    if (fd_uinput >= 0)
+        miyoo_epoll_add(fd_uinput, MIYOO_EV_UINPUT);
+    if (fd_uinput >= 0 && miyoo_motor_open() == 0)
+    {
+        s_fd_rumble = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (s_fd_rumble >= 0)
+            miyoo_epoll_add(s_fd_rumble, MIYOO_EV_RUMBLE_TIMER);
+        miyoo_motor_set(0);
+    }
+
+    miyoo_idle_reload();
+    miyoo_filter_reload();
+    miyoo_rumble_reload();
+    miyoo_map_reload();
+    s_active_ns = miyoo_now_ns();
+    miyoo_suspend_sync();
+    while (!s_quit)
+    {
+        n = epoll_wait(s_epoll_fd, events, MIYOO_EPOLL_MAX_EVENTS, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+        s_stats.wakeups++;
+
+        for (i = 0; i < n; i++)
+        {
+            switch (events[i].data.u32)
+            {
+            case MIYOO_EV_JOYSTICK:
+                trimui_handle_joystick(s_fd_joystick);
+                break;
+            case MIYOO_EV_IO:
+                miyoo_io_poll_check(trimui_handle_miyooio(s_fd_io));
+                break;
+            case MIYOO_EV_IO_TIMER:
+                miyoo_timerfd_ack(s_fd_io_timer);
+                trimui_handle_miyooio(s_fd_io);
+                break;
+            case MIYOO_EV_TURBO_TIMER:
+                miyoo_timerfd_ack(s_fd_turbo);
+                trimui_turbo_tick();
+                trimui_apply_io(s_io_raw);
+                break;
+            case MIYOO_EV_SIGNAL:
+                miyoo_handle_signal(fd_signal);
+                break;
+            case MIYOO_EV_INOTIFY:
+                miyoo_handle_inotify(fd_inotify);
+                // turbo flags may have changed under a held key
+                if (!s_parked)
+                    trimui_apply_io(s_io_raw);
+                break;
+            case MIYOO_EV_IDLE_TIMER:
+                miyoo_idle_tick();
+                break;
+            case MIYOO_EV_UINPUT:
+                trimui_ff_handle(0, miyoo_rumble_play);
+                break;
+            case MIYOO_EV_RUMBLE_TIMER:
+                miyoo_rumble_tick();
+                break;
+            default:
+                if (events[i].data.u32 - MIYOO_EV_SYSKEY < s_syskey_count)
+                    miyoo_handle_syskey(events[i].data.u32 - MIYOO_EV_SYSKEY);
+                break;
+            }
+        }
+
+        miyoo_suspend_sync();
+
+        // one write() + SYN_REPORT for everything this wakeup produced
+        n = trimui_vflush_all();
+        if (n > 0)
+        {
+            s_stats.events_emitted += n;
+            s_stats.uinput_writes++;
+        }
+        miyoo_stats_frame_emitted(miyoo_now_ns());
+        miyoo_shm_publish();
+        miyoo_idle_update(miyoo_now_ns());
+    }
+
+    miyoo_motor_set(0);
+    trimui_uart_Close(s_fd_joystick);
+    close(s_fd_io);
+    close(s_epoll_fd);
+    trimui_destroy_xpad(0);
+    return s_quit ? 0 : -1;
+}
+//====================== event loop end =====================
+
+//====================== realtime mode =======================
+// Opt-in, for a Flip under emulator load: MIYOO_INPUTD_RT=<1..99> runs the
+// event loop SCHED_FIFO at that priority, MIYOO_INPUTD_CPU=<n> pins it to
+// one core. Either one also locks all memory (mlockall), prefaults the
+// stack and stops malloc from returning memory to the kernel, so the
+// reads, LUTs, uinput batch and shm ring never page-fault. All hot-path
+// buffers are static; stdio is only touched by reloads and the stats dump.
+#define MIYOO_RT_STACK_PREFAULT  (128 * 1024)
+
+static void miyoo_rt_prefault_stack()
+{
+    volatile char stack[MIYOO_RT_STACK_PREFAULT];
+    int i;
+    for (i = 0; i < sizeof(stack); i += 4096)
+        stack[i] = 0;
+}
+
+static void miyoo_rt_setup()
+{
+    const char * prio_env = getenv("MIYOO_INPUTD_RT");
+    const char * cpu_env = getenv("MIYOO_INPUTD_CPU");
+    struct sched_param sp;
+    cpu_set_t cpus;
+    int prio = prio_env ? atoi(prio_env) : 0;
+    int cpu = cpu_env && *cpu_env ? atoi(cpu_env) : -1;
+    int locked;
+
+    if (prio <= 0 && cpu < 0)
+        return;
+
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    locked = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+    if (!locked)
+        perror("mlockall");
+    miyoo_rt_prefault_stack();
+
+    if (cpu >= 0)
+    {
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+            perror("sched_setaffinity");
+    }
+    if (prio > 0)
+    {
+        memset(&sp, 0, sizeof(sp));
+        sp.sched_priority = prio < sched_get_priority_max(SCHED_FIFO) ? prio : sched_get_priority_max(SCHED_FIFO);
+        if (sched_setscheduler(0, SCHED_FIFO, &sp) < 0)
+            perror("sched_setscheduler");
+    }
+    printf("realtime: SCHED_%s prio %d, cpu %d, memory %slocked\n",
+        prio > 0 ? "FIFO" : "OTHER", prio > 0 ? sp.sched_priority : 0, cpu, locked ? "" : "not ");
+}
+//====================== realtime mode end ===================
+
+#ifndef MIYOO_INPUTD_NO_MAIN
+int main(int argc, char **argv)
+{
+    printf("MIYOO Input Daemon %s\n", __DATE__);
+    memset(&s_stream_l, 0, sizeof(s_stream_l));
+
+    pk_reload_cal();
+    trimui_build_action_table();
+    trimui_setup_xpad(0, NULL, 0); //player1 only; profiles may add buttons
+    miyoo_shm_open();
+    miyoo_trace_open();
+    miyoo_rt_setup();
+
+    return miyoo_event_loop();
+}
+#endif
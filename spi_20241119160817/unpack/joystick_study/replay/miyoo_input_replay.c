@@ -0,0 +1,323 @@
+// Host replay of a miyoo_inputd input trace (miyoo_input_trace.h).
+//
+// Runs an unmodified miyoo_inputd build with its nodes redirected:
+//
+//   /dev/ttyS1    -> pty slave; trace TTY records are written to the master
+//   /dev/miyooio  -> FIFO; each IO record is one 128-byte write
+//   /dev/uinput   -> FIFO; ukey.c sees ENOTTY and writes raw input_events
+//
+// Records are fed at their recorded times (or back to back with -f). Every
+// input_event the daemon emits is printed to stdout as "type code value",
+// one per line with a blank line after each SYN_REPORT, so two runs can be
+// diffed; throughput, feed->SYN_REPORT latency and the daemon's CPU time
+// and voluntary context switches (~ wakeups) go to stderr.
+//
+//   gcc -O2 -I. -o miyoo_inputd miyoo_inputd.c ukey.c
+//   gcc -O2 -I. -o miyoo_input_replay replay/miyoo_input_replay.c
+//   MIYOO_INPUTD_RECORD=/tmp/pad.trace ./miyoo_inputd      (on the Flip)
+//   ./miyoo_input_replay [-f] [-w drain_ms] pad.trace ./miyoo_inputd > events.txt
+//
+// Turbo is driven by the daemon's own timers, so turbo edges only compare
+// equal between runs at real-time speed and within timer jitter.
+
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<errno.h>
+#include<poll.h>
+#include<signal.h>
+#include<termios.h>
+#include<time.h>
+#include<sys/stat.h>
+#include<sys/wait.h>
+#include<sys/resource.h>
+
+#include <linux/input.h>
+#include "miyoo_input_trace.h"
+
+#define REPLAY_IO_LEN            (32 * sizeof(int))
+#define REPLAY_MAX_LATENCIES     (1 << 20)
+#define REPLAY_PIPE_SIZE         (1 << 20)
+
+static char s_dir[] = "/tmp/miyoo_replay.XXXXXX";
+static char s_io_path[64], s_uinput_path[64];
+
+static int s_fd_uinput = -1;
+static uint64_t s_last_feed_ns;         // time of the newest fed record
+static uint64_t s_events, s_reports;
+static uint64_t * s_lat;
+static int s_lat_count;
+
+static uint64_t replay_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void replay_sleep_until(uint64_t ns)
+{
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000ull;
+    ts.tv_nsec = ns % 1000000000ull;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+// drain whatever the daemon wrote, waiting at most timeout_ms for the first
+static void replay_drain_events(int timeout_ms)
+{
+    struct input_event ev[64];
+    struct pollfd pfd = { .fd = s_fd_uinput, .events = POLLIN };
+    ssize_t len;
+    int i;
+
+    if (poll(&pfd, 1, timeout_ms) <= 0)
+        return;
+    while ((len = read(s_fd_uinput, ev, sizeof(ev))) > 0)
+    {
+        uint64_t now = replay_now_ns();
+        for (i = 0; i < len / (ssize_t)sizeof(ev[0]); i++)
+        {
+            if (ev[i].type == EV_SYN && ev[i].code == SYN_REPORT)
+            {
+                printf("\n");
+                s_reports++;
+                if (s_last_feed_ns && s_lat_count < REPLAY_MAX_LATENCIES)
+                    s_lat[s_lat_count++] = now - s_last_feed_ns;
+                continue;
+            }
+            printf("%u %u %d\n", ev[i].type, ev[i].code, ev[i].value);
+            s_events++;
+        }
+    }
+}
+
+static int replay_cmp_u64(const void * a, const void * b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double replay_percentile_us(double pct)
+{
+    int i;
+    if (!s_lat_count)
+        return 0;
+    i = (int)(s_lat_count * pct / 100.0);
+    if (i >= s_lat_count)
+        i = s_lat_count - 1;
+    return s_lat[i] / 1000.0;
+}
+
+// pty in raw mode before the daemon opens it, so nothing written early is
+// echoed or line-buffered
+static int replay_open_pty(char * slave, int size, int * fd_slave)
+{
+    struct termios tio;
+    int fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+
+    if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0 || ptsname_r(fd, slave, size))
+    {
+        perror("posix_openpt");
+        return -1;
+    }
+    *fd_slave = open(slave, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (*fd_slave < 0 || tcgetattr(*fd_slave, &tio) < 0)
+    {
+        perror(slave);
+        return -1;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(*fd_slave, TCSANOW, &tio);
+    return fd;
+}
+
+// the daemon opens /dev/miyooio last of its nodes, right before epoll_wait
+static int replay_wait_ready(pid_t pid, int timeout_ms)
+{
+    char fd_dir[64], link[128], target[128];
+    int n, fd;
+    ssize_t len;
+
+    snprintf(fd_dir, sizeof(fd_dir), "/proc/%d/fd", (int)pid);
+    for (n = 0; n < timeout_ms; n += 10)
+    {
+        for (fd = 0; fd < 64; fd++)
+        {
+            snprintf(link, sizeof(link), "%s/%d", fd_dir, fd);
+            len = readlink(link, target, sizeof(target) - 1);
+            if (len <= 0)
+                continue;
+            target[len] = '\0';
+            if (!strcmp(target, s_io_path))
+            {
+                usleep(20000);
+                return 0;
+            }
+        }
+        if (waitpid(pid, NULL, WNOHANG) == pid)
+            return -1;
+        usleep(10000);
+    }
+    return -1;
+}
+
+static void usage(const char * name)
+{
+    fprintf(stderr, "usage: %s [-f] [-w drain_ms] trace miyoo_inputd [args...]\n", name);
+    exit(2);
+}
+
+int main(int argc, char * argv[])
+{
+    struct miyoo_input_trace_header hdr;
+    struct miyoo_input_trace_record rec;
+    unsigned char payload[65536];
+    char slave[64];
+    int fast = 0, drain_ms = 200, opt;
+    int fd_pty, fd_slave, fd_io;
+    uint64_t start, end, tty_bytes = 0, io_records = 0, records = 0;
+    struct rusage ru;
+    FILE * trace;
+    pid_t pid;
+    double secs;
+
+    while ((opt = getopt(argc, argv, "+fw:")) != -1)
+    {
+        if (opt == 'f')
+            fast = 1;
+        else if (opt == 'w')
+            drain_ms = atoi(optarg);
+        else
+            usage(argv[0]);
+    }
+    if (argc - optind < 2)
+        usage(argv[0]);
+
+    trace = fopen(argv[optind], "rb");
+    if (!trace)
+    {
+        perror(argv[optind]);
+        return 1;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, trace) != 1 || hdr.magic != MIYOO_TRACE_MAGIC
+        || hdr.version != MIYOO_TRACE_VERSION)
+    {
+        fprintf(stderr, "%s: not a miyoo_inputd trace\n", argv[optind]);
+        return 1;
+    }
+    s_lat = malloc(REPLAY_MAX_LATENCIES * sizeof(*s_lat));
+
+    if (!mkdtemp(s_dir))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(s_io_path, sizeof(s_io_path), "%s/miyooio", s_dir);
+    snprintf(s_uinput_path, sizeof(s_uinput_path), "%s/uinput", s_dir);
+    if (mkfifo(s_io_path, 0600) < 0 || mkfifo(s_uinput_path, 0600) < 0)
+    {
+        perror("mkfifo");
+        return 1;
+    }
+
+    fd_pty = replay_open_pty(slave, sizeof(slave), &fd_slave);
+    // O_RDWR on both FIFOs: neither side blocks in open(), and the daemon
+    // never sees EOF / EPIPE between records
+    fd_io = open(s_io_path, O_RDWR | O_CLOEXEC);
+    s_fd_uinput = open(s_uinput_path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd_pty < 0 || fd_io < 0 || s_fd_uinput < 0)
+    {
+        perror("replay nodes");
+        return 1;
+    }
+    fcntl(s_fd_uinput, F_SETPIPE_SZ, REPLAY_PIPE_SIZE);
+
+    pid = fork();
+    if (pid == 0)
+    {
+        setenv("MIYOO_INPUTD_TTY", slave, 1);
+        setenv("MIYOO_INPUTD_IO", s_io_path, 1);
+        setenv("MIYOO_INPUTD_UINPUT", s_uinput_path, 1);
+        unsetenv("MIYOO_INPUTD_RECORD");
+        dup2(2, 1);     // daemon chatter must not mix with the event stream
+        execvp(argv[optind + 1], &argv[optind + 1]);
+        perror(argv[optind + 1]);
+        _exit(127);
+    }
+    if (pid < 0 || replay_wait_ready(pid, 5000) < 0)
+    {
+        fprintf(stderr, "miyoo_inputd did not start\n");
+        return 1;
+    }
+
+    start = replay_now_ns();
+    while (fread(&rec, sizeof(rec), 1, trace) == 1)
+    {
+        if (fread(payload, 1, rec.len, trace) != rec.len)
+        {
+            fprintf(stderr, "truncated record %llu\n", (unsigned long long)records);
+            break;
+        }
+        if (!fast)
+        {
+            // keep reading events while waiting for the record's slot
+            while (replay_now_ns() < start + rec.time_ns)
+                replay_drain_events((start + rec.time_ns - replay_now_ns()) / 1000000 + 1);
+            replay_sleep_until(start + rec.time_ns);
+        }
+
+        s_last_feed_ns = replay_now_ns();
+        if (rec.type == MIYOO_TRACE_TTY)
+        {
+            if (write(fd_pty, payload, rec.len) != rec.len)
+                perror("pty write");
+            tty_bytes += rec.len;
+        }
+        else if (rec.type == MIYOO_TRACE_IO && rec.len == REPLAY_IO_LEN)
+        {
+            if (write(fd_io, payload, rec.len) != rec.len)
+                perror("miyooio write");
+            io_records++;
+        }
+        records++;
+        replay_drain_events(0);
+    }
+    end = replay_now_ns();
+    // let the last reports (and any turbo tail) come out
+    while (replay_now_ns() < end + drain_ms * 1000000ull)
+        replay_drain_events(drain_ms);
+
+    kill(pid, SIGTERM);
+    wait4(pid, NULL, 0, &ru);
+    close(fd_slave);
+    unlink(s_io_path);
+    unlink(s_uinput_path);
+    rmdir(s_dir);
+    fclose(trace);
+    fflush(stdout);
+
+    qsort(s_lat, s_lat_count, sizeof(*s_lat), replay_cmp_u64);
+    fprintf(stderr, "records %llu (tty %llu bytes, io %llu) in %.3f s\n",
+        (unsigned long long)records, (unsigned long long)tty_bytes,
+        (unsigned long long)io_records, (end - start) / 1e9);
+    fprintf(stderr, "events %llu, reports %llu, %.0f records/s\n",
+        (unsigned long long)s_events, (unsigned long long)s_reports,
+        end > start ? records / ((end - start) / 1e9) : 0.0);
+    fprintf(stderr, "feed->SYN_REPORT us: p50 %.1f p90 %.1f p99 %.1f max %.1f\n",
+        replay_percentile_us(50), replay_percentile_us(90),
+        replay_percentile_us(99), replay_percentile_us(100));
+    // whole daemon lifetime, startup included
+    secs = (replay_now_ns() - start) / 1e9;
+    fprintf(stderr, "daemon cpu %.1f ms (%.2f%%), %.1f wakeups/s\n",
+        (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3
+            + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3,
+        ((ru.ru_utime.tv_sec + ru.ru_stime.tv_sec)
+            + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6) * 100.0 / secs,
+        ru.ru_nvcsw / secs);
+    return 0;
+}
@@ -0,0 +1,58 @@
+// Host stand-ins that let the stock miyoo_inputd.c run under
+// miyoo_input_replay, for before / after numbers (README, "Daemon event loop").
+//
+// The stock source is this folder's miyoo_inputd.c as first committed. It
+// needs four changes, all outside the code being compared:
+//
+//   - the node paths come from MIYOO_INPUTD_TTY / MIYOO_INPUTD_IO, like the
+//     current daemon (the harness sets both)
+//   - trimui_vkey() / trimui_vaxis() send at once, one SYN_REPORT each, as the
+//     vendor ukey did (ukey.c only queues until trimui_vflush())
+//   - the miyooio read() returns the current snapshot without blocking, as
+//     the driver does; the replay FIFO only carries changes
+//   - trimui_setup_xpad() takes the (empty) list of optional buttons
+//
+//   git show <first commit>:./miyoo_inputd.c | tr -d '\r' > /tmp/stock.c
+//   sed -i 's|^#define MIYOO_NODE_JOYSTICK .*|#define MIYOO_NODE_JOYSTICK getenv("MIYOO_INPUTD_TTY")|' /tmp/stock.c
+//   sed -i 's|^#define MIYOO_NODE_IO .*|#define MIYOO_NODE_IO getenv("MIYOO_INPUTD_IO")|' /tmp/stock.c
+//   sed -i 's|read(fd, s_io_data, sizeof(s_io_data));|compat_io_read(fd, s_io_data, sizeof(s_io_data));|' /tmp/stock.c
+//   sed -i 's|trimui_setup_xpad(0);|trimui_setup_xpad(0, NULL, 0);|' /tmp/stock.c
+//   sed -i '1i #include <sys/types.h>\nssize_t compat_io_read(int fd, void * buf, size_t len);' /tmp/stock.c
+//   gcc -O2 -w -I. -Dtrimui_vkey=compat_vkey -Dtrimui_vaxis=compat_vaxis -c -o /tmp/stock.o /tmp/stock.c
+//   gcc -O2 -I. -o build/miyoo_inputd_stock /tmp/stock.o replay/stock_compat.c ukey.c -lpthread
+//   build/miyoo_input_replay pad.trace build/miyoo_inputd_stock > stock.txt
+
+#include<string.h>
+#include<unistd.h>
+#include<poll.h>
+
+#include "ukey.h"
+
+static char s_io_snapshot[32 * sizeof(int)];
+
+int compat_vkey(int port, int keycode, int value)
+{
+    trimui_vkey(port, keycode, value);
+    return trimui_vflush(port);
+}
+
+int compat_vaxis(int port, int axis, int value)
+{
+    trimui_vaxis(port, axis, value);
+    return trimui_vflush(port);
+}
+
+ssize_t compat_io_read(int fd, void * buf, size_t len)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+
+    if (len > sizeof(s_io_snapshot))
+        len = sizeof(s_io_snapshot);
+    while (poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN))
+    {
+        if (read(fd, s_io_snapshot, sizeof(s_io_snapshot)) <= 0)
+            break;
+    }
+    memcpy(buf, s_io_snapshot, len);
+    return len;
+}
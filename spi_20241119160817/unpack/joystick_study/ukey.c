@@ -0,0 +1,382 @@
+#include<stdio.h>
+#include<string.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<errno.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<sys/ioctl.h>
+
+#include <linux/input.h>
+#include <linux/uinput.h>
+#include "ukey.h"
+
+#define UKEY_NODE               "/dev/uinput"
+#define UKEY_AXIS_RANGE         (32767)
+
+// identity of the stock pad (the Xbox 360 pad's), which SDL and the
+// frontends already carry a mapping for
+#define UKEY_XPAD_VENDOR        (0x045e)
+#define UKEY_XPAD_PRODUCT       (0x028e)
+#define UKEY_XPAD_VERSION       (0x114)
+
+struct ukey_port
+{
+    int fd;
+    int raw;        // not a uinput node: plain input_event sink (replay)
+    int count;
+    struct input_event ev[UKEY_MAX_EVENTS];
+    uint32_t ff_valid;      // bit per uploaded effect
+    struct ff_effect ff[UKEY_FF_EFFECTS];
+};
+
+static struct ukey_port s_ports[UKEY_NUM_PORTS] =
+{
+    { .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 },
+};
+
+// the stock pad's buttons, in its order
+static const int s_ukey_buttons[] =
+{
+    BTN_A, BTN_B, BTN_X, BTN_Y,
+    BTN_TL, BTN_TR,
+    BTN_SELECT, BTN_START, BTN_MODE,
+    BTN_THUMBL, BTN_THUMBR,
+};
+
+static const int s_ukey_syskeys[] =
+{
+    KEY_VOLUMEUP, KEY_VOLUMEDOWN, KEY_POWER,
+};
+
+static int ukey_setup_abs(int fd, int code, int min, int max)
+{
+    struct uinput_abs_setup abs;
+
+    if (ioctl(fd, UI_SET_ABSBIT, code) < 0)
+    {
+        perror("UI_SET_ABSBIT");
+        return -1;
+    }
+
+    memset(&abs, 0, sizeof(abs));
+    abs.code = code;
+    abs.absinfo.minimum = min;
+    abs.absinfo.maximum = max;
+    if (ioctl(fd, UI_ABS_SETUP, &abs) < 0)
+    {
+        perror("UI_ABS_SETUP");
+        return -1;
+    }
+    return 0;
+}
+
+// 1: uinput node ready for UI_SET_*, 0: not uinput, port is a raw sink
+static int ukey_open(int port, int * fd_out)
+{
+    const char * node;
+    int fd;
+
+    // MIYOO_INPUTD_UINPUT points the pad at a FIFO or file on a host
+    node = getenv("MIYOO_INPUTD_UINPUT");
+    if (!node || !*node)
+        node = UKEY_NODE;
+    // read side carries the force feedback requests
+    fd = open(node, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+    {
+        perror(node);
+        return -1;
+    }
+
+    s_ports[port].count = 0;
+    s_ports[port].ff_valid = 0;
+    if (ioctl(fd, UI_SET_EVBIT, EV_KEY) < 0 && errno == ENOTTY)
+    {
+        printf("%s: not a uinput node, writing raw input events\n", node);
+        s_ports[port].fd = fd;
+        s_ports[port].raw = 1;
+        return 0;
+    }
+    *fd_out = fd;
+    return 1;
+}
+
+static int ukey_create(int port, int fd, const char * name, const struct input_id * id, int ff_effects)
+{
+    struct uinput_setup usetup;
+
+    memset(&usetup, 0, sizeof(usetup));
+    if (id)
+        usetup.id = *id;
+    else
+    {
+        usetup.id.bustype = BUS_VIRTUAL;
+        usetup.id.version = 1;
+    }
+    usetup.ff_effects_max = ff_effects;
+    snprintf(usetup.name, sizeof(usetup.name), "%s", name);
+    if (ioctl(fd, UI_DEV_SETUP, &usetup) < 0)
+    {
+        perror("UI_DEV_SETUP");
+        close(fd);
+        return -1;
+    }
+
+    if (ioctl(fd, UI_DEV_CREATE) < 0)
+    {
+        perror("UI_DEV_CREATE");
+        close(fd);
+        return -1;
+    }
+
+    s_ports[port].fd = fd;
+    s_ports[port].raw = 0;
+    return 0;
+}
+
+int trimui_setup_xpad(int port, const int * keys, int count)
+{
+    static const struct input_id id =
+    {
+        BUS_USB, UKEY_XPAD_VENDOR, UKEY_XPAD_PRODUCT, UKEY_XPAD_VERSION,
+    };
+    char name[UINPUT_MAX_NAME_SIZE];
+    int fd, i, ret;
+
+    if (port < 0 || port >= UKEY_MAX_PORTS)
+        return -1;
+
+    if (s_ports[port].fd >= 0)
+    {
+        // declared again: same fd, so the caller's poll set stays valid
+        if (s_ports[port].raw)
+            return 0;
+        trimui_vflush(port);
+        fd = s_ports[port].fd;
+        s_ports[port].fd = -1;
+        if (ioctl(fd, UI_DEV_DESTROY) < 0)
+            perror("UI_DEV_DESTROY");
+        s_ports[port].count = 0;
+        s_ports[port].ff_valid = 0;
+        ioctl(fd, UI_SET_EVBIT, EV_KEY);
+    }
+    else
+    {
+        ret = ukey_open(port, &fd);
+        if (ret <= 0)
+            return ret;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(s_ukey_buttons); i++)
+        ioctl(fd, UI_SET_KEYBIT, s_ukey_buttons[i]);
+    for (i = 0; i < count; i++)
+        ioctl(fd, UI_SET_KEYBIT, keys[i]);
+
+    ioctl(fd, UI_SET_EVBIT, EV_ABS);
+    ukey_setup_abs(fd, ABS_X,  -UKEY_AXIS_RANGE, UKEY_AXIS_RANGE);
+    ukey_setup_abs(fd, ABS_Y,  -UKEY_AXIS_RANGE, UKEY_AXIS_RANGE);
+    ukey_setup_abs(fd, ABS_RX, -UKEY_AXIS_RANGE, UKEY_AXIS_RANGE);
+    ukey_setup_abs(fd, ABS_RY, -UKEY_AXIS_RANGE, UKEY_AXIS_RANGE);
+    ukey_setup_abs(fd, ABS_Z,  0, 255);
+    ukey_setup_abs(fd, ABS_RZ, 0, 255);
+    ukey_setup_abs(fd, ABS_HAT0X, -1, 1);
+    ukey_setup_abs(fd, ABS_HAT0Y, -1, 1);
+
+    ioctl(fd, UI_SET_EVBIT, EV_FF);
+    ioctl(fd, UI_SET_FFBIT, FF_RUMBLE);
+
+    snprintf(name, sizeof(name), "MIYOO Player%d", port + 1);
+    return ukey_create(port, fd, name, &id, UKEY_FF_EFFECTS);
+}
+
+int trimui_setup_syskeys()
+{
+    int fd, i, ret;
+
+    ret = ukey_open(UKEY_PORT_SYSKEYS, &fd);
+    if (ret <= 0)
+        return ret;
+
+    for (i = 0; i < ARRAY_SIZE(s_ukey_syskeys); i++)
+        ioctl(fd, UI_SET_KEYBIT, s_ukey_syskeys[i]);
+    ioctl(fd, UI_SET_EVBIT, EV_SW);
+    ioctl(fd, UI_SET_SWBIT, SW_LID);
+
+    return ukey_create(UKEY_PORT_SYSKEYS, fd, "MIYOO System Keys", NULL, 0);
+}
+
+void trimui_destroy_xpad(int port)
+{
+    if (port < 0 || port >= UKEY_NUM_PORTS || s_ports[port].fd < 0)
+        return;
+
+    if (!s_ports[port].raw && ioctl(s_ports[port].fd, UI_DEV_DESTROY) < 0)
+        perror("UI_DEV_DESTROY");
+    close(s_ports[port].fd);
+    s_ports[port].fd = -1;
+}
+
+static int ukey_queue(int port, int type, int code, int value)
+{
+    struct ukey_port * p;
+    struct input_event * ev;
+
+    if (port < 0 || port >= UKEY_NUM_PORTS)
+        return -1;
+
+    p = &s_ports[port];
+    // keep one slot for SYN_REPORT; an overfull cycle is split, not dropped
+    if (p->count >= UKEY_MAX_EVENTS - 1)
+        trimui_vflush(port);
+
+    ev = &p->ev[p->count++];
+    ev->type = type;
+    ev->code = code;
+    ev->value = value;
+    return 0;
+}
+
+int trimui_vkey(int port, int keycode, int value)
+{
+    return ukey_queue(port, EV_KEY, keycode, value);
+}
+
+int trimui_vaxis(int port, int axis, int value)
+{
+    return ukey_queue(port, EV_ABS, axis, value);
+}
+
+int trimui_vswitch(int port, int code, int value)
+{
+    return ukey_queue(port, EV_SW, code, value);
+}
+
+int trimui_vflush(int port)
+{
+    struct ukey_port * p;
+    struct input_event * syn;
+    int len, count;
+
+    if (port < 0 || port >= UKEY_NUM_PORTS)
+        return -1;
+
+    p = &s_ports[port];
+    if (!p->count)
+        return 0;
+
+    syn = &p->ev[p->count++];
+    syn->type = EV_SYN;
+    syn->code = SYN_REPORT;
+    syn->value = 0;
+
+    // uinput stamps the events itself, input_event.time is left zeroed
+    count = p->count;
+    len = count * sizeof(struct input_event);
+    p->count = 0;
+    if (p->fd < 0)
+        return -1;
+    if (write(p->fd, p->ev, len) != len)
+    {
+        perror("write " UKEY_NODE);
+        return -1;
+    }
+    return count - 1;
+}
+
+int trimui_vflush_all()
+{
+    int i, n, total = 0;
+    for (i = 0; i < UKEY_NUM_PORTS; i++)
+    {
+        n = trimui_vflush(i);
+        if (n > 0)
+            total += n;
+    }
+    return total;
+}
+
+int trimui_xpad_fd(int port)
+{
+    if (port < 0 || port >= UKEY_NUM_PORTS || s_ports[port].raw)
+        return -1;
+    return s_ports[port].fd;
+}
+
+// uinput blocks the client's EVIOCSFF / EVIOCRMFF until UI_END_FF_* comes
+// back, so the handshakes are answered right here
+static void ukey_ff_upload(struct ukey_port * p, int port, int request, ukey_ff_play_fn play)
+{
+    struct uinput_ff_upload up;
+    int id, update;
+
+    memset(&up, 0, sizeof(up));
+    up.request_id = request;
+    if (ioctl(p->fd, UI_BEGIN_FF_UPLOAD, &up) < 0)
+    {
+        perror("UI_BEGIN_FF_UPLOAD");
+        return;
+    }
+    id = up.effect.id;
+    if (up.effect.type != FF_RUMBLE || id < 0 || id >= UKEY_FF_EFFECTS)
+        up.retval = -EINVAL;
+    else
+    {
+        update = (p->ff_valid >> id) & 1;
+        p->ff[id] = up.effect;
+        p->ff_valid |= 1u << id;
+        if (update)
+            play(port, &p->ff[id], -1);
+    }
+    if (ioctl(p->fd, UI_END_FF_UPLOAD, &up) < 0)
+        perror("UI_END_FF_UPLOAD");
+}
+
+static void ukey_ff_erase(struct ukey_port * p, int port, int request, ukey_ff_play_fn play)
+{
+    struct uinput_ff_erase er;
+
+    memset(&er, 0, sizeof(er));
+    er.request_id = request;
+    if (ioctl(p->fd, UI_BEGIN_FF_ERASE, &er) < 0)
+    {
+        perror("UI_BEGIN_FF_ERASE");
+        return;
+    }
+    if (er.effect_id < UKEY_FF_EFFECTS && ((p->ff_valid >> er.effect_id) & 1))
+    {
+        play(port, &p->ff[er.effect_id], 0);
+        p->ff_valid &= ~(1u << er.effect_id);
+    }
+    else
+        er.retval = -EINVAL;
+    if (ioctl(p->fd, UI_END_FF_ERASE, &er) < 0)
+        perror("UI_END_FF_ERASE");
+}
+
+int trimui_ff_handle(int port, ukey_ff_play_fn play)
+{
+    struct ukey_port * p;
+    struct input_event ev[16];
+    ssize_t len;
+    int i, n = 0;
+
+    if (trimui_xpad_fd(port) < 0)
+        return -1;
+
+    p = &s_ports[port];
+    while ((len = read(p->fd, ev, sizeof(ev))) > 0)
+    {
+        for (i = 0; i < len / (ssize_t)sizeof(ev[0]); i++, n++)
+        {
+            if (ev[i].type == EV_UINPUT && ev[i].code == UI_FF_UPLOAD)
+                ukey_ff_upload(p, port, ev[i].value, play);
+            else if (ev[i].type == EV_UINPUT && ev[i].code == UI_FF_ERASE)
+                ukey_ff_erase(p, port, ev[i].value, play);
+            else if (ev[i].type == EV_FF && ev[i].code < UKEY_FF_EFFECTS
+                && ((p->ff_valid >> ev[i].code) & 1))
+                play(port, &p->ff[ev[i].code], ev[i].value);
+        }
+    }
+    return n;
+}
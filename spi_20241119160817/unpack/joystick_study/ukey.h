@@ -0,0 +1,45 @@
+#ifndef __UKEY_H__
+#define __UKEY_H__
+
+// Virtual gamepad on /dev/uinput ("MIYOO Player1".."MIYOO Player4"), plus
+// an optional companion keyboard, "MIYOO System Keys" (KEY_VOLUMEUP /
+// KEY_VOLUMEDOWN / KEY_POWER, SW_LID), on port UKEY_PORT_SYSKEYS.
+//
+// trimui_vkey()/trimui_vaxis() only queue events; nothing reaches the
+// kernel until trimui_vflush(), which writes the whole batch plus one
+// SYN_REPORT with a single write(). Call it once per poll cycle so every
+// physical frame is delivered to evdev readers as one atomic packet.
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(a)           (sizeof(a) / sizeof((a)[0]))
+#endif
+
+#define UKEY_MAX_PORTS          (4)     // gamepads
+#define UKEY_PORT_SYSKEYS       (UKEY_MAX_PORTS)
+#define UKEY_NUM_PORTS          (UKEY_MAX_PORTS + 1)
+#define UKEY_MAX_EVENTS         (64)    // per port, per cycle (SYN_REPORT included)
+#define UKEY_FF_EFFECTS         (16)    // rumble effect slots per port
+
+// Force feedback: the pad declares FF_RUMBLE. Uploads, erases and play /
+// stop requests from clients come back on the uinput fd, so the caller
+// puts trimui_xpad_fd() in its poll set and calls trimui_ff_handle() when
+// it is readable. That answers the upload / erase handshakes itself and
+// reports to `play`: value > 0 start (repeat count), 0 stop (also for an
+// erased effect), < 0 a stored effect was re-uploaded (new magnitudes).
+struct ff_effect;
+typedef void (*ukey_ff_play_fn)(int port, const struct ff_effect * effect, int value);
+
+// keys: buttons beyond the stock eleven (BTN_TL2 / BTN_TR2 / BTN_DPAD_*).
+// Calling it again for a live pad re-declares it on the same fd.
+int  trimui_setup_xpad(int port, const int * keys, int count);
+int  trimui_setup_syskeys();
+void trimui_destroy_xpad(int port);
+int  trimui_vkey(int port, int keycode, int value);
+int  trimui_vaxis(int port, int axis, int value);
+int  trimui_vswitch(int port, int code, int value);
+int  trimui_vflush(int port);      // events written (SYN excluded), -1 on error
+int  trimui_vflush_all();
+int  trimui_xpad_fd(int port);     // -1 for a raw (non-uinput) port
+int  trimui_ff_handle(int port, ukey_ff_play_fn play);
+
+#endif
@@ -0,0 +1,557 @@
+// Write preloader.img to the "preloader" MTD partition, touching only the
+// erase blocks that differ, and verify every block it touched.
+//
+// write-preloader-mtd.sh runs flash_eraseall over the whole 2 MiB and then
+// nandwrite -p. The result here is the same partition contents: the image,
+// then 0xff up to the end, with bad blocks skipped as nandwrite skips them.
+// The differences:
+//
+//   - each block is read first and left alone when it already holds its target
+//   - a block whose target is all 0xff is only erased; pages that are all 0xff
+//     are not programmed
+//   - each touched block is read back and its CRC32 compared, with the ECC
+//     counters checked around the read; a mismatch is retried once
+//   - the block holding the image's first IDBLOCK goes last, so an interrupted
+//     run leaves either the old first copy or the new later copies intact;
+//     SIGINT / SIGTERM / SIGHUP before the first write cancel, after it they
+//     stop between blocks, never inside one
+//   - the image must carry an IDBLOCK whose hashes check out (rkspi.h),
+//     unless -f
+//
+// The target is an MTD character device or a plain file standing in for one
+// (-e / -w geometry, -B bad blocks): erase fills a block with 0xff and a
+// write ANDs into it, as NAND programming does, so a missed erase shows up in
+// the verify. mtdram and nandsim give a real /dev/mtdN on a host.
+//
+//   ./preloader_flash                           (preloader.img, MTD "preloader")
+//   ./preloader_flash -n /path/to/preloader.img (compare only)
+//   ./build/preloader_flash -y -d standin.bin -B 5 preloader.img
+//
+// Exit status: 0 done (or nothing to do), 1 error, 3 stopped by a signal.
+
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<signal.h>
+#include<time.h>
+#include<sys/ioctl.h>
+#include<sys/stat.h>
+#include<mtd/mtd-user.h>
+
+#include "rkspi.h"
+
+#define FLASH_PAGE          0x800               // SPI NAND page of the Flip
+#define FLASH_MAX_BLOCKS    4096
+
+enum
+{
+    FLASH_SAME,                         // already holds its target
+    FLASH_ERASE,                        // target all 0xff: erase only
+    FLASH_WRITE,                        // erase (if needed) and program
+    FLASH_BAD,
+};
+
+static const char * const s_action_names[] = { "same", "erase", "write", "bad" };
+
+struct flash_dev
+{
+    const char * path;
+    int fd;
+    int is_mtd;
+    uint64_t size;
+    uint32_t erase, page;
+    int n_blocks;
+    uint8_t bad[FLASH_MAX_BLOCKS];      // stand-in only, from -B
+};
+
+struct flash_block
+{
+    int phys;                           // physical block: the k-th good one
+    int action;
+    int blank;                          // erased already, programming needs no erase first
+    uint32_t pages;                     // pages programmed
+    uint32_t crc;                       // CRC32 of the target
+};
+
+static volatile sig_atomic_t s_stop;
+
+//====================== device =====================================================
+
+// the same search as write-preloader-mtd.sh
+static const char * flash_find_mtd(char * buf, size_t size)
+{
+    char line[128];
+    FILE * f;
+
+    if (!access("/dev/mtd/by-name/preloader", F_OK))
+        return "/dev/mtd/by-name/preloader";
+    f = fopen("/proc/mtd", "r");
+    if (!f)
+        return NULL;
+    while (fgets(line, sizeof(line), f))
+    {
+        char * colon = strchr(line, ':');
+        if (colon && strstr(line, "\"preloader\""))
+        {
+            *colon = '\0';
+            snprintf(buf, size, "/dev/%s", line);
+            fclose(f);
+            return buf;
+        }
+    }
+    fclose(f);
+    return NULL;
+}
+
+static int flash_open(struct flash_dev * d, int writable)
+{
+    struct stat st;
+    struct mtd_info_user info;
+
+    d->fd = open(d->path, writable ? O_RDWR : O_RDONLY);
+    if (d->fd < 0 || fstat(d->fd, &st))
+    {
+        perror(d->path);
+        return -1;
+    }
+    if (S_ISCHR(st.st_mode))
+    {
+        if (ioctl(d->fd, MEMGETINFO, &info))
+        {
+            fprintf(stderr, "%s: not an MTD device (%s)\n", d->path, strerror(errno));
+            return -1;
+        }
+        d->is_mtd = 1;
+        d->size = info.size;
+        d->erase = info.erasesize;
+        d->page = info.writesize;
+        // NOR and mtdram have a 1-byte writesize: program in sectors instead
+        if (d->page < RKSPI_SECTOR && !(d->erase % RKSPI_SECTOR))
+            d->page = RKSPI_SECTOR;
+    }
+    else if (S_ISREG(st.st_mode))
+        d->size = st.st_size;
+    else
+    {
+        fprintf(stderr, "%s: neither an MTD character device nor a file\n", d->path);
+        return -1;
+    }
+    if (!d->erase || !d->page || d->erase % d->page || d->size % d->erase
+        || d->size / d->erase > FLASH_MAX_BLOCKS)
+    {
+        fprintf(stderr, "%s: 0x%llx bytes with erase block 0x%x, page 0x%x: unusable geometry\n", d->path,
+            (unsigned long long)d->size, d->erase, d->page);
+        return -1;
+    }
+    d->n_blocks = d->size / d->erase;
+    return 0;
+}
+
+static int flash_is_bad(struct flash_dev * d, int block)
+{
+    loff_t off = (loff_t)block * d->erase;
+    int r;
+
+    if (!d->is_mtd)
+        return d->bad[block];
+    r = ioctl(d->fd, MEMGETBADBLOCK, &off);
+    return r > 0 || (r < 0 && errno != EOPNOTSUPP);    // NOR / mtdram: no bad blocks
+}
+
+static int flash_ecc_failed(struct flash_dev * d, uint32_t * corrected)
+{
+    struct mtd_ecc_stats st;
+
+    if (!d->is_mtd || ioctl(d->fd, ECCGETSTATS, &st))
+    {
+        *corrected = 0;
+        return 0;
+    }
+    *corrected = st.corrected;
+    return st.failed;
+}
+
+// mtdchar hides ECC errors from read(); the counters show them
+static int flash_read(struct flash_dev * d, int block, uint8_t * buf, int * ecc)
+{
+    uint32_t c0, c1;
+    int f0 = flash_ecc_failed(d, &c0);
+    ssize_t n = pread(d->fd, buf, d->erase, (off_t)block * d->erase);
+
+    if (n != (ssize_t)d->erase)
+    {
+        fprintf(stderr, "%s: read block %d: %s\n", d->path, block, n < 0 ? strerror(errno) : "short read");
+        return -1;
+    }
+    *ecc = flash_ecc_failed(d, &c1) != f0 ? -1 : c1 != c0;
+    return 0;
+}
+
+static int flash_erase(struct flash_dev * d, int block, uint8_t * scratch)
+{
+    if (d->is_mtd)
+    {
+        struct erase_info_user ei = { .start = block * d->erase, .length = d->erase };
+        if (!ioctl(d->fd, MEMERASE, &ei))
+            return 0;
+    }
+    else
+    {
+        memset(scratch, 0xff, d->erase);
+        if (pwrite(d->fd, scratch, d->erase, (off_t)block * d->erase) == (ssize_t)d->erase)
+            return 0;
+    }
+    fprintf(stderr, "%s: erase block %d: %s\n", d->path, block, strerror(errno));
+    return -1;
+}
+
+// whole pages; all-0xff pages are left erased. A stand-in page is ANDed in.
+static int flash_program(struct flash_dev * d, int block, const uint8_t * data, uint8_t * scratch, uint32_t * pages)
+{
+    *pages = 0;
+    for (uint32_t off = 0; off < d->erase; off += d->page)
+    {
+        off_t at = (off_t)block * d->erase + off;
+        uint8_t fill;
+
+        if (rkspi_classify(data + off, d->page, &fill) == RKSPI_BLOCK_ERASED)
+            continue;
+        if (!d->is_mtd)
+        {
+            if (pread(d->fd, scratch, d->page, at) != (ssize_t)d->page)
+                goto fail;
+            for (uint32_t i = 0; i < d->page; i++)
+                scratch[i] &= data[off + i];
+            if (pwrite(d->fd, scratch, d->page, at) != (ssize_t)d->page)
+                goto fail;
+        }
+        else if (pwrite(d->fd, data + off, d->page, at) != (ssize_t)d->page)
+            goto fail;
+        (*pages)++;
+    }
+    return 0;
+
+fail:
+    fprintf(stderr, "%s: write block %d: %s\n", d->path, block, strerror(errno));
+    return -1;
+}
+
+//====================== device end =================================================
+
+//====================== plan =======================================================
+
+static uint8_t * flash_load_image(const char * path, size_t * size)
+{
+    uint8_t * buf;
+    long len;
+    FILE * f = fopen(path, "rb");
+
+    if (!f)
+    {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(len ? len : 1);
+    if (!buf || fread(buf, 1, len, f) != (size_t)len)
+    {
+        fprintf(stderr, "%s: read failed\n", path);
+        fclose(f);
+        free(buf);
+        return NULL;
+    }
+    fclose(f);
+    *size = len;
+    return buf;
+}
+
+// an image the bootrom will accept; [*lo, *hi) gets the first IDBLOCK and its
+// images, empty if there is none. Returns -1 to refuse the image.
+static int flash_check_image(const char * path, const uint8_t * img, size_t size, int force,
+    uint64_t * lo, uint64_t * hi)
+{
+    struct rkspi_dump d = { .path = path, .fd = -1, .data = img, .size = size };
+    struct rkspi_idb idb[RKSPI_MAX_IDB];
+    int n = rkspi_find_idb(&d, size, idb, RKSPI_MAX_IDB), good = 0;
+
+    printf("image:  %s, %zu bytes", path, size);
+    for (int i = 0; i < n; i++)
+    {
+        int ok = idb[i].header_ok != 0;
+        for (int k = 0; k < idb[i].n_images; k++)
+            ok &= idb[i].image[k].hash_ok != 0;
+        good += ok;
+        printf("%s 0x%llx %s", i ? "," : ", IDBLOCK", (unsigned long long)idb[i].offset,
+            ok ? "ok" : "HASH MISMATCH");
+    }
+    printf("%s\n", n ? "" : ", no IDBLOCK");
+    *lo = *hi = 0;
+    if (n)
+    {
+        *lo = idb[0].offset;
+        *hi = idb[0].offset + RKSPI_SECTOR;
+        for (int k = 0; k < idb[0].n_images; k++)
+            if (idb[0].image[k].offset + idb[0].image[k].size > *hi)
+                *hi = idb[0].image[k].offset + idb[0].image[k].size;
+    }
+    if (!good && !force)
+    {
+        fprintf(stderr, "%s: %s; the bootrom would not boot it (-f to write it anyway)\n", path,
+            n ? "no IDBLOCK with matching hashes" : "no IDBLOCK");
+        return -1;
+    }
+    return 0;
+}
+
+//====================== plan end ===================================================
+
+static void flash_on_signal(int sig)
+{
+    (void)sig;
+    s_stop = 1;
+}
+
+static void usage(const char * name)
+{
+    fprintf(stderr, "usage: %s [options] [preloader.img]\n"
+        "  -d path       MTD device or stand-in file (MTD \"preloader\")\n"
+        "  -n            compare only, write nothing\n"
+        "  -y            no 5 s countdown\n"
+        "  -f            write an image without a valid IDBLOCK (e.g. zeros, to boot from SD)\n"
+        "  -v            list every block\n"
+        "  stand-in file only:\n"
+        "  -e size       erase block (0x%x)\n"
+        "  -w size       page (0x%x)\n"
+        "  -B n,n..      bad blocks\n", name, RKSPI_ERASE_BLOCK, FLASH_PAGE);
+    exit(2);
+}
+
+int main(int argc, char * argv[])
+{
+    struct flash_dev dev = { .fd = -1, .erase = RKSPI_ERASE_BLOCK, .page = FLASH_PAGE };
+    struct flash_block blocks[FLASH_MAX_BLOCKS];
+    int order[FLASH_MAX_BLOCKS];
+    char mtd_path[160], self[4096];
+    const char * image_path = NULL, * bad_list = NULL;
+    uint8_t * img, * target, * buf, * scratch;
+    size_t img_size;
+    uint64_t idb_lo, idb_hi;
+    int opt, dry = 0, yes = 0, force = 0, verbose = 0, n_good = 0, n_logical, n_order = 0;
+    int count[4] = { 0 }, done = 0, rc = 0, weak = 0;
+    uint64_t erased = 0, programmed = 0, old_erase = 0, old_program;
+    struct timespec t0, t1;
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    // from here on a signal only sets s_stop: checked before writing and between blocks
+    signal(SIGINT, flash_on_signal);
+    signal(SIGTERM, flash_on_signal);
+    signal(SIGHUP, flash_on_signal);
+    while ((opt = getopt(argc, argv, "d:nyfve:w:B:")) != -1)
+        switch (opt)
+        {
+        case 'd': dev.path = optarg; break;
+        case 'n': dry = 1; break;
+        case 'y': yes = 1; break;
+        case 'f': force = 1; break;
+        case 'v': verbose = 1; break;
+        case 'e': dev.erase = strtoul(optarg, NULL, 0); break;
+        case 'w': dev.page = strtoul(optarg, NULL, 0); break;
+        case 'B': bad_list = optarg; break;
+        default: usage(argv[0]);
+        }
+    if (optind + 1 < argc)
+        usage(argv[0]);
+    if (optind < argc)
+        image_path = argv[optind];
+    else
+    {
+        // like the script: preloader.img next to the binary
+        ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 32);
+        char * slash;
+        self[n > 0 ? n : 0] = '\0';
+        slash = strrchr(self, '/');
+        strcpy(slash ? slash + 1 : self, "preloader.img");
+        image_path = self;
+    }
+    if (!dev.path && !(dev.path = flash_find_mtd(mtd_path, sizeof(mtd_path))))
+    {
+        fprintf(stderr, "No MTD device \"preloader\" (-d to name one).\n");
+        return 1;
+    }
+
+    img = flash_load_image(image_path, &img_size);
+    if (!img)
+        return 1;
+    if (!img_size)
+    {
+        fprintf(stderr, "%s: empty\n", image_path);
+        return 1;
+    }
+    if (flash_check_image(image_path, img, img_size, force, &idb_lo, &idb_hi) || flash_open(&dev, !dry))
+        return 1;
+    for (const char * s = bad_list; s && *s; )
+    {
+        char * end;
+        long b = strtol(s, &end, 0);
+        if (end == s || b < 0 || b >= dev.n_blocks || dev.is_mtd)
+        {
+            fprintf(stderr, "-B %s: block numbers of a stand-in file, below %d\n", bad_list, dev.n_blocks);
+            return 2;
+        }
+        dev.bad[b] = 1;
+        s = *end == ',' ? end + 1 : end;
+    }
+    printf("device: %s, %s, 0x%llx bytes, erase block 0x%x, page 0x%x\n", dev.path,
+        dev.is_mtd ? "MTD" : "stand-in file", (unsigned long long)dev.size, dev.erase, dev.page);
+
+    // nandwrite: logical block k goes to the k-th good block. Trailing 0xff
+    // blocks of the image need no room, the 0xff tail covers them.
+    memset(blocks, 0, sizeof(blocks));
+    n_logical = (img_size + dev.erase - 1) / dev.erase;
+    while (n_logical)
+    {
+        size_t at = (size_t)(n_logical - 1) * dev.erase;
+        uint8_t fill;
+        if (rkspi_classify(img + at, img_size - at < dev.erase ? img_size - at : dev.erase, &fill) != RKSPI_BLOCK_ERASED)
+            break;
+        n_logical--;
+    }
+    for (int b = 0; b < dev.n_blocks; b++)
+        if (flash_is_bad(&dev, b))
+            count[FLASH_BAD]++;
+        else
+            blocks[n_good++].phys = b;
+    if (n_logical > n_good)
+    {
+        fprintf(stderr, "%s: %zu bytes do not fit %d good blocks of 0x%x\n", image_path, img_size, n_good, dev.erase);
+        return 1;
+    }
+
+    // targets: the image padded with 0xff to the end of the partition, as after flash_eraseall
+    target = malloc((size_t)n_good * dev.erase);
+    buf = malloc(dev.erase);
+    scratch = malloc(dev.erase);
+    memset(target, 0xff, (size_t)n_good * dev.erase);
+    memcpy(target, img, img_size < (size_t)n_logical * dev.erase ? img_size : (size_t)n_logical * dev.erase);
+    old_program = ((img_size + dev.page - 1) / dev.page) * dev.page;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int k = 0; k < n_good; k++)
+    {
+        struct flash_block * fb = &blocks[k];
+        const uint8_t * want = target + (size_t)k * dev.erase;
+        uint8_t fill;
+        int ecc;
+
+        old_erase += dev.erase;
+        fb->crc = rkspi_crc32(0, want, dev.erase);
+        if (flash_read(&dev, fb->phys, buf, &ecc))
+            return 1;
+        fb->blank = ecc >= 0 && rkspi_classify(buf, dev.erase, &fill) == RKSPI_BLOCK_ERASED;
+        if (ecc >= 0 && !memcmp(buf, want, dev.erase))
+            fb->action = FLASH_SAME;
+        else
+            fb->action = rkspi_classify(want, dev.erase, &fill) == RKSPI_BLOCK_ERASED ? FLASH_ERASE : FLASH_WRITE;
+        count[fb->action]++;
+    }
+
+    // the block(s) of the first IDBLOCK last: until then its old copy stays
+    for (int pass = 0; pass < 2; pass++)
+        for (int k = 0; k < n_good; k++)
+        {
+            uint64_t lo = (uint64_t)k * dev.erase, hi = lo + dev.erase;
+            int first = lo < idb_hi && hi > idb_lo;
+            if (blocks[k].action != FLASH_SAME && first == pass)
+                order[n_order++] = k;
+        }
+
+    printf("plan:   %d blocks: %d same, %d erase only, %d write, %d bad\n", dev.n_blocks,
+        count[FLASH_SAME], count[FLASH_ERASE], count[FLASH_WRITE], count[FLASH_BAD]);
+    if (verbose)
+        for (int k = 0; k < n_good; k++)
+            printf("  block %4d  0x%08llx  %s\n", blocks[k].phys, (unsigned long long)blocks[k].phys * dev.erase,
+                s_action_names[blocks[k].action]);
+    if (!n_order || dry)
+    {
+        printf("%s\n", !n_order ? "Nothing to write: the partition already holds the image." : "Dry run, nothing written.");
+        return 0;
+    }
+
+    if (!yes && !s_stop)
+    {
+        printf("Press Ctrl+C within 5 seconds to cancel...\n");
+        sleep(5);
+    }
+    if (s_stop)
+    {
+        printf("Cancelled, nothing written.\n");
+        return 3;
+    }
+
+    for (int i = 0; i < n_order && !s_stop; i++)
+    {
+        struct flash_block * fb = &blocks[order[i]];
+        const uint8_t * want = target + (size_t)order[i] * dev.erase;
+        int ok = 0, ecc = 0;
+
+        for (int tries = 0; tries < 2 && !ok; tries++)
+        {
+            if (!fb->blank || tries)
+            {
+                if (flash_erase(&dev, fb->phys, scratch))
+                    break;
+                erased += dev.erase;
+            }
+            if (fb->action == FLASH_WRITE && flash_program(&dev, fb->phys, want, scratch, &fb->pages))
+                break;
+            programmed += (uint64_t)fb->pages * dev.page;
+            if (flash_read(&dev, fb->phys, buf, &ecc))
+                break;
+            ok = ecc >= 0 && rkspi_crc32(0, buf, dev.erase) == fb->crc;
+            if (!ok)
+                fprintf(stderr, "%s: block %d: readback %s, %s\n", dev.path, fb->phys,
+                    ecc < 0 ? "uncorrectable ECC error" : "CRC32 mismatch", tries ? "giving up" : "retrying");
+        }
+        if (!ok)
+        {
+            fprintf(stderr, "%s: block %d (0x%llx) does not hold the image. Do not reboot; run again or "
+                "restore with xrock from MASKROM.\n", dev.path, fb->phys, (unsigned long long)fb->phys * dev.erase);
+            rc = 1;
+            break;
+        }
+        weak += ecc > 0;
+        done++;
+        if (verbose)
+            printf("  block %4d  %s, %u pages, CRC32 0x%08x ok\n", fb->phys, s_action_names[fb->action],
+                fb->pages, fb->crc);
+    }
+    if (!dev.is_mtd)
+        fsync(dev.fd);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    printf("done:   %d of %d blocks written and verified in %.0f ms", done, n_order,
+        (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+    printf("%s\n", weak ? ", some needed ECC correction on readback" : "");
+    printf("saved:  0x%llx of 0x%llx bytes erased, 0x%llx of 0x%llx programmed, against flash_eraseall + nandwrite -p\n",
+        (unsigned long long)(old_erase - erased), (unsigned long long)old_erase,
+        (unsigned long long)(old_program > programmed ? old_program - programmed : 0), (unsigned long long)old_program);
+    if (s_stop && !rc)
+    {
+        printf("Stopped by a signal with %d blocks left; run again to finish.\n", n_order - done);
+        rc = 3;
+    }
+    else if (!rc)
+        printf("Done. Reboot to boot from internal SPI NAND.\n");
+    close(dev.fd);
+    free(target);
+    free(buf);
+    free(scratch);
+    free(img);
+    return rc;
+}
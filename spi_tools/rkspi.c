@@ -0,0 +1,765 @@
+// Miyoo Flip — host model of a raw rk3566 SPI NAND dump, see rkspi.h.
+
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<ctype.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#if defined(__x86_64__)
+#include<immintrin.h>
+#include<cpuid.h>
+#endif
+
+#include "rkspi.h"
+
+//====================== files ======================================================
+
+int rkspi_open(struct rkspi_dump * d, const char * path)
+{
+    struct stat st;
+
+    memset(d, 0, sizeof(*d));
+    d->path = path;
+    d->fd = open(path, O_RDONLY);
+    if (d->fd < 0 || fstat(d->fd, &st))
+    {
+        perror(path);
+        if (d->fd >= 0)
+            close(d->fd);
+        return -1;
+    }
+    if (!st.st_size)
+    {
+        fprintf(stderr, "%s: empty\n", path);
+        close(d->fd);
+        return -1;
+    }
+    d->size = st.st_size;
+    d->data = mmap(NULL, d->size, PROT_READ, MAP_SHARED, d->fd, 0);
+    if (d->data == MAP_FAILED)
+    {
+        perror(path);
+        close(d->fd);
+        return -1;
+    }
+    // one sequential pass per partition: let the kernel read ahead
+    madvise((void *)d->data, d->size, MADV_SEQUENTIAL | MADV_WILLNEED);
+    return 0;
+}
+
+void rkspi_close(struct rkspi_dump * d)
+{
+    if (d->data && d->data != MAP_FAILED)
+        munmap((void *)d->data, d->size);
+    if (d->fd >= 0)
+        close(d->fd);
+    d->data = NULL;
+    d->fd = -1;
+}
+
+static char * rkspi_read_text(const char * path)
+{
+    char * buf;
+    long len;
+    FILE * f = fopen(path, "rb");
+
+    if (!f)
+    {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(len + 1);
+    if (!buf || fread(buf, 1, len, f) != (size_t)len)
+    {
+        fprintf(stderr, "%s: read failed\n", path);
+        fclose(f);
+        free(buf);
+        return NULL;
+    }
+    buf[len] = '\0';
+    fclose(f);
+    return buf;
+}
+
+static uint32_t rkspi_le32(const uint8_t * p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t rkspi_le64(const uint8_t * p)
+{
+    return rkspi_le32(p) | (uint64_t)rkspi_le32(p + 4) << 32;
+}
+
+//====================== files end ==================================================
+
+//====================== SHA-256 / CRC32 ============================================
+
+static const uint32_t s_sha256_k[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR32(x, n)         ((x) >> (n) | (x) << (32 - (n)))
+
+static void rkspi_sha256_block(uint32_t h[8], const uint8_t * p)
+{
+    uint32_t w[64], a, b, c, d, e, f, g, k;
+
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)p[i * 4] << 24 | p[i * 4 + 1] << 16 | p[i * 4 + 2] << 8 | p[i * 4 + 3];
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ w[i - 15] >> 3;
+        uint32_t s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ w[i - 2] >> 10;
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    a = h[0]; b = h[1]; c = h[2]; d = h[3];
+    e = h[4]; f = h[5]; g = h[6]; k = h[7];
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = k + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) + ((e & f) ^ (~e & g)) + s_sha256_k[i] + w[i];
+        uint32_t t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        k = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+static void rkspi_sha256_blocks_c(uint32_t h[8], const uint8_t * p, size_t n)
+{
+    for (; n; n--, p += 64)
+        rkspi_sha256_block(h, p);
+}
+
+#if defined(__x86_64__)
+// SHA extensions (Goldmont, Zen and later): 4-5x the portable rounds, which
+// would otherwise be most of a full-dump scan
+__attribute__((target("sha,sse4.1")))
+static void rkspi_sha256_blocks_ni(uint32_t h[8], const uint8_t * p, size_t n)
+{
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+    __m128i state0, state1, tmp, msg, m[4], abef, cdgh;
+
+    tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[0]), 0xb1);        // CDAB
+    state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[4]), 0x1b);     // EFGH
+    state0 = _mm_alignr_epi8(tmp, state1, 8);                                       // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);                                    // CDGH
+
+    for (; n; n--, p += 64)
+    {
+        abef = state0;
+        cdgh = state1;
+        for (int i = 0; i < 4; i++)
+            m[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + i * 16)), bswap);
+        // four rounds per group; m[i & 3] then becomes words 4i+16 .. 4i+19
+        for (int i = 0; i < 16; i++)
+        {
+            msg = _mm_add_epi32(m[i & 3], _mm_loadu_si128((const __m128i *)&s_sha256_k[i * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+            if (i < 12)
+            {
+                tmp = _mm_sha256msg1_epu32(m[i & 3], m[(i + 1) & 3]);
+                tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(m[(i + 3) & 3], m[(i + 2) & 3], 4));
+                m[i & 3] = _mm_sha256msg2_epu32(tmp, m[(i + 3) & 3]);
+            }
+        }
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);                                          // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xb1);                                       // DCHG
+    _mm_storeu_si128((__m128i *)&h[0], _mm_blend_epi16(tmp, state1, 0xf0));         // DCBA
+    _mm_storeu_si128((__m128i *)&h[4], _mm_alignr_epi8(state1, tmp, 8));            // HGFE
+}
+#endif
+
+static void rkspi_sha256_blocks_pick(uint32_t h[8], const uint8_t * p, size_t n);
+static void (* s_sha256_blocks)(uint32_t h[8], const uint8_t * p, size_t n) = rkspi_sha256_blocks_pick;
+
+static void rkspi_sha256_blocks_pick(uint32_t h[8], const uint8_t * p, size_t n)
+{
+    void (* f)(uint32_t h[8], const uint8_t * p, size_t n) = rkspi_sha256_blocks_c;
+#if defined(__x86_64__)
+    unsigned a, b, c, d;
+    if (__get_cpuid_count(7, 0, &a, &b, &c, &d) && b & bit_SHA
+        && __get_cpuid(1, &a, &b, &c, &d) && c & bit_SSE4_1 && !getenv("RKSPI_NO_SHA_NI"))
+        f = rkspi_sha256_blocks_ni;
+#endif
+    __atomic_store_n(&s_sha256_blocks, f, __ATOMIC_RELAXED);
+    f(h, p, n);
+}
+
+void rkspi_sha256_init(struct rkspi_sha256 * c)
+{
+    static const uint32_t init[8] =
+    {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(c->h, init, sizeof(init));
+    c->len = 0;
+    c->n = 0;
+}
+
+void rkspi_sha256_update(struct rkspi_sha256 * c, const void * data, size_t len)
+{
+    const uint8_t * p = data;
+
+    c->len += len;
+    if (c->n)
+    {
+        size_t k = 64 - c->n < len ? 64 - c->n : len;
+        memcpy(c->buf + c->n, p, k);
+        c->n += k;
+        p += k;
+        len -= k;
+        if (c->n < 64)
+            return;
+        s_sha256_blocks(c->h, c->buf, 1);
+        c->n = 0;
+    }
+    s_sha256_blocks(c->h, p, len / 64);
+    p += len & ~(size_t)63;
+    len &= 63;
+    memcpy(c->buf, p, len);
+    c->n = len;
+}
+
+void rkspi_sha256_final(struct rkspi_sha256 * c, uint8_t out[32])
+{
+    uint64_t bits = c->len * 8;
+
+    c->buf[c->n++] = 0x80;
+    if (c->n > 56)
+    {
+        memset(c->buf + c->n, 0, 64 - c->n);
+        s_sha256_blocks(c->h, c->buf, 1);
+        c->n = 0;
+    }
+    memset(c->buf + c->n, 0, 56 - c->n);
+    for (int i = 0; i < 8; i++)
+        c->buf[56 + i] = bits >> (56 - i * 8);
+    s_sha256_blocks(c->h, c->buf, 1);
+    for (int i = 0; i < 8; i++)
+    {
+        out[i * 4] = c->h[i] >> 24;
+        out[i * 4 + 1] = c->h[i] >> 16;
+        out[i * 4 + 2] = c->h[i] >> 8;
+        out[i * 4 + 3] = c->h[i];
+    }
+}
+
+void rkspi_sha256(const void * data, size_t len, uint8_t out[32])
+{
+    struct rkspi_sha256 c;
+    rkspi_sha256_init(&c);
+    rkspi_sha256_update(&c, data, len);
+    rkspi_sha256_final(&c, out);
+}
+
+// reflected 0xedb88320, as GPT and zlib use
+uint32_t rkspi_crc32(uint32_t crc, const void * data, size_t len)
+{
+    static uint32_t table[256];
+    const uint8_t * p = data;
+
+    if (!table[1])
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320 ^ c >> 1 : c >> 1;
+            table[i] = c;
+        }
+    crc = ~crc;
+    while (len--)
+        crc = table[(crc ^ *p++) & 0xff] ^ crc >> 8;
+    return ~crc;
+}
+
+//====================== SHA-256 / CRC32 end ========================================
+
+//====================== IDBLOCK ====================================================
+
+// v2 (rk3566/rk3568 and later), U-Boot tools/rkcommon.c header0_info_v2
+#define IDB_V2_MAGIC        "RKNS"
+#define IDB_V2_HEADER_LEN   0x600               // hashed part; the hash follows it
+#define IDB_V2_IMAGES       0x78
+#define IDB_V2_ENTRY_LEN    88
+
+// v1: one RC4-scrambled sector, header0_info
+#define IDB_V1_MAGIC        0x0ff0aa55
+
+static const uint8_t s_rc4_key[16] = { 124, 78, 3, 4, 85, 5, 9, 7, 45, 44, 123, 56, 23, 13, 23, 17 };
+
+static void rkspi_rc4_stream(uint8_t * out, size_t len)
+{
+    uint8_t s[256], t;
+    int i, j;
+
+    for (i = 0; i < 256; i++)
+        s[i] = i;
+    for (i = j = 0; i < 256; i++)
+    {
+        j = (j + s[i] + s_rc4_key[i % sizeof(s_rc4_key)]) & 0xff;
+        t = s[i]; s[i] = s[j]; s[j] = t;
+    }
+    i = j = 0;
+    for (size_t k = 0; k < len; k++)
+    {
+        i = (i + 1) & 0xff;
+        j = (j + s[i]) & 0xff;
+        t = s[i]; s[i] = s[j]; s[j] = t;
+        out[k] = s[(s[i] + s[j]) & 0xff];
+    }
+}
+
+static int rkspi_idb_v2(const struct rkspi_dump * d, uint64_t off, struct rkspi_idb * idb)
+{
+    const uint8_t * h = d->data + off;
+    uint32_t size_and_nimage = rkspi_le32(h + 8), flag = rkspi_le32(h + 12);
+    int n = size_and_nimage >> 16;
+    uint8_t sum[32];
+
+    if ((size_and_nimage & 0xffff) != IDB_V2_HEADER_LEN / 4 || n < 1 || n > RKSPI_MAX_IDB_IMAGES
+        || off + IDB_V2_HEADER_LEN + 512 > d->size)
+        return 0;
+    memset(idb, 0, sizeof(*idb));
+    idb->offset = off;
+    idb->version = 2;
+    idb->hash = flag & 0xf;
+    idb->n_images = n;
+    idb->header_ok = -1;
+    if (idb->hash == 1)
+    {
+        rkspi_sha256(h, IDB_V2_HEADER_LEN, sum);
+        idb->header_ok = !memcmp(sum, h + IDB_V2_HEADER_LEN, sizeof(sum));
+    }
+    for (int i = 0; i < n; i++)
+    {
+        const uint8_t * e = h + IDB_V2_IMAGES + i * IDB_V2_ENTRY_LEN;
+        struct rkspi_idb_image * im = &idb->image[i];
+        uint32_t size_and_off = rkspi_le32(e);
+
+        im->offset = off + (uint64_t)(size_and_off & 0xffff) * RKSPI_SECTOR;
+        im->size = (uint64_t)(size_and_off >> 16) * RKSPI_SECTOR;
+        im->address = rkspi_le32(e + 4);
+        im->flag = rkspi_le32(e + 8);
+        im->counter = rkspi_le32(e + 12);
+        im->hash_ok = -1;
+        if (im->offset + im->size > d->size)
+        {
+            im->hash_ok = 0;
+            continue;
+        }
+        if (idb->hash == 1)
+        {
+            rkspi_sha256(d->data + im->offset, im->size, sum);
+            im->hash_ok = !memcmp(sum, e + 24, sizeof(sum));
+        }
+    }
+    return 1;
+}
+
+static int rkspi_idb_v1(const struct rkspi_dump * d, uint64_t off, const uint8_t * stream, struct rkspi_idb * idb)
+{
+    uint8_t h[RKSPI_SECTOR];
+    uint16_t init_offset, init_size, init_boot_size;
+
+    for (int i = 0; i < RKSPI_SECTOR; i++)
+        h[i] = d->data[off + i] ^ stream[i];
+    if (rkspi_le32(h) != IDB_V1_MAGIC)
+        return 0;
+    init_offset = h[12] | h[13] << 8;
+    init_size = h[0x1fa] | h[0x1fb] << 8;
+    init_boot_size = h[0x1fc] | h[0x1fd] << 8;
+    if (init_boot_size < init_size)
+        return 0;
+    memset(idb, 0, sizeof(*idb));
+    idb->offset = off;
+    idb->version = 1;
+    idb->header_ok = -1;
+    idb->n_images = init_boot_size > init_size ? 2 : 1;
+    for (int i = 0; i < idb->n_images; i++)
+    {
+        struct rkspi_idb_image * im = &idb->image[i];
+        im->offset = off + (uint64_t)(init_offset + (i ? init_size : 0)) * RKSPI_SECTOR;
+        im->size = (uint64_t)(i ? init_boot_size - init_size : init_size) * RKSPI_SECTOR;
+        im->address = 0xffffffff;
+        im->hash_ok = -1;
+    }
+    return 1;
+}
+
+static uint64_t rkspi_idb_end(const struct rkspi_idb * idb)
+{
+    uint64_t end = idb->offset + RKSPI_SECTOR;
+    for (int i = 0; i < idb->n_images; i++)
+        if (idb->image[i].offset + idb->image[i].size > end)
+            end = idb->image[i].offset + idb->image[i].size;
+    return end;
+}
+
+int rkspi_find_idb(const struct rkspi_dump * d, uint64_t limit, struct rkspi_idb * out, int max)
+{
+    uint8_t stream[RKSPI_SECTOR];
+    int n = 0;
+
+    rkspi_rc4_stream(stream, sizeof(stream));
+    if (limit > d->size)
+        limit = d->size;
+    for (uint64_t off = 0; off + RKSPI_SECTOR <= limit && n < max; off += RKSPI_SECTOR)
+    {
+        const uint8_t * p = d->data + off;
+        struct rkspi_idb * idb = &out[n];
+
+        if (!memcmp(p, IDB_V2_MAGIC, 4) ? !rkspi_idb_v2(d, off, idb)
+            : rkspi_le32(p) != (IDB_V1_MAGIC ^ rkspi_le32(stream)) || !rkspi_idb_v1(d, off, stream, idb))
+            continue;
+        idb->copy_of = -1;
+        for (int i = 0; i < n; i++)
+        {
+            uint64_t len = rkspi_idb_end(&out[i]) - out[i].offset;
+            if (rkspi_idb_end(idb) - off == len && !memcmp(d->data + out[i].offset, p, len))
+            {
+                idb->copy_of = i;
+                break;
+            }
+        }
+        // skip the images of this one: a header inside SPL data is not an IDBLOCK
+        off = ((rkspi_idb_end(idb) + RKSPI_SECTOR - 1) & ~(uint64_t)(RKSPI_SECTOR - 1)) - RKSPI_SECTOR;
+        n++;
+    }
+    return n;
+}
+
+//====================== IDBLOCK end ================================================
+
+//====================== partition tables ===========================================
+
+int rkspi_parse_gpt(const struct rkspi_dump * d, struct rkspi_part * out, int max)
+{
+    const uint8_t * h = d->data + RKSPI_SECTOR;
+    uint32_t hdr_len, n_entries, entry_len, crc;
+    uint64_t entries;
+    uint8_t copy[RKSPI_SECTOR];
+    int n = 0;
+
+    if (d->size < 2 * RKSPI_SECTOR || memcmp(h, "EFI PART", 8))
+        return 0;
+    hdr_len = rkspi_le32(h + 0x0c);
+    entries = rkspi_le64(h + 0x48) * RKSPI_SECTOR;
+    n_entries = rkspi_le32(h + 0x50);
+    entry_len = rkspi_le32(h + 0x54);
+    if (hdr_len < 92 || hdr_len > RKSPI_SECTOR || entry_len < 128 || n_entries > 1024
+        || entries + (uint64_t)n_entries * entry_len > d->size)
+    {
+        fprintf(stderr, "%s: GPT header out of range\n", d->path);
+        return -1;
+    }
+    memcpy(copy, h, hdr_len);
+    memset(copy + 0x10, 0, 4);
+    crc = rkspi_crc32(0, copy, hdr_len);
+    if (crc != rkspi_le32(h + 0x10))
+        fprintf(stderr, "%s: GPT header CRC 0x%08x, expected 0x%08x\n", d->path, crc, rkspi_le32(h + 0x10));
+    crc = rkspi_crc32(0, d->data + entries, (size_t)n_entries * entry_len);
+    if (crc != rkspi_le32(h + 0x58))
+        fprintf(stderr, "%s: GPT entries CRC 0x%08x, expected 0x%08x\n", d->path, crc, rkspi_le32(h + 0x58));
+
+    for (uint32_t i = 0; i < n_entries && n < max; i++)
+    {
+        const uint8_t * e = d->data + entries + (uint64_t)i * entry_len;
+        uint64_t first = rkspi_le64(e + 32), last = rkspi_le64(e + 40);
+        struct rkspi_part * p = &out[n];
+        int k;
+
+        if (!rkspi_le64(e) && !rkspi_le64(e + 8))       // unused: zero type GUID
+            continue;
+        memset(p, 0, sizeof(*p));
+        for (k = 0; k < RKSPI_NAME_LEN && (e[56 + k * 2] || e[57 + k * 2]); k++)
+            p->name[k] = e[57 + k * 2] || !isprint(e[56 + k * 2]) ? '?' : e[56 + k * 2];
+        p->offset = first * RKSPI_SECTOR;
+        p->size = last >= first ? (last - first + 1) * RKSPI_SECTOR : 0;
+        p->ro = rkspi_le64(e + 48) >> 60 & 1;             // basic data: read-only
+        n++;
+    }
+    return n;
+}
+
+static int rkspi_number(const char ** s, uint64_t * v)
+{
+    char * end;
+
+    *v = strtoull(*s, &end, 0);
+    if (end == *s)
+        return -1;
+    switch (*end)
+    {
+    case 'k': case 'K': *v <<= 10; end++; break;
+    case 'm': case 'M': *v <<= 20; end++; break;
+    case 'g': case 'G': *v <<= 30; end++; break;
+    }
+    *s = end;
+    return 0;
+}
+
+// mtdparts=<mtd-id>:<size>[@<offset>][(<name>)][ro][lk],...[;<mtd-id>:...]
+// as drivers/mtd/parsers/cmdlinepart.c; only the first device is used
+int rkspi_parse_mtdparts(const char * s, struct rkspi_part * out, int max)
+{
+    const char * colon;
+    uint64_t next = 0;
+    int n = 0;
+
+    if (!strncmp(s, "mtdparts=", 9))
+        s += 9;
+    colon = strchr(s, ':');
+    if (!colon)
+        goto bad;
+    for (s = colon + 1; *s && *s != ';' && !isspace((unsigned char)*s) && *s != '"'; )
+    {
+        struct rkspi_part * p = &out[n];
+
+        if (n == max)
+        {
+            fprintf(stderr, "mtdparts: more than %d partitions\n", max);
+            return -1;
+        }
+        memset(p, 0, sizeof(*p));
+        if (*s == '-')
+        {
+            p->size = UINT64_MAX;
+            s++;
+        }
+        else if (rkspi_number(&s, &p->size))
+            goto bad;
+        p->offset = next;
+        if (*s == '@' && (s++, rkspi_number(&s, &p->offset)))
+            goto bad;
+        if (*s == '(')
+        {
+            const char * end = strchr(s, ')');
+            size_t len;
+            if (!end)
+                goto bad;
+            len = end - s - 1 < RKSPI_NAME_LEN ? (size_t)(end - s - 1) : RKSPI_NAME_LEN;
+            memcpy(p->name, s + 1, len);
+            s = end + 1;
+        }
+        else
+            snprintf(p->name, sizeof(p->name), "part%d", n);
+        for (;;)
+            if (!strncmp(s, "ro", 2))
+            {
+                p->ro = 1;
+                s += 2;
+            }
+            else if (!strncmp(s, "lk", 2))
+                s += 2;
+            else
+                break;
+        next = p->size == UINT64_MAX ? UINT64_MAX : p->offset + p->size;
+        n++;
+        if (*s == ',')
+            s++;
+        else if (*s && *s != ';' && !isspace((unsigned char)*s) && *s != '"')
+            goto bad;
+    }
+    return n;
+
+bad:
+    fprintf(stderr, "mtdparts: cannot parse near \"%.24s\"\n", s);
+    return -1;
+}
+
+// fixed-partitions children of a decompiled DTS:
+//   partition@200000 { label = "vnvm"; reg = <0x200000 0x100000>; };
+static int rkspi_parse_dts(const char * text, struct rkspi_part * out, int max)
+{
+    const char * compat = strstr(text, "\"fixed-partitions\"");
+    const char * s;
+    int depth = 0, n = 0;
+
+    if (!compat)
+        return 0;
+    for (s = compat; s > text && *s != '{'; s--)
+        ;
+    if (*s != '{')
+        return 0;
+    for (s++; *s && depth >= 0; s++)
+    {
+        if (*s == '{')
+        {
+            // child node: name[@unit] { ... }
+            const char * name = s;
+            struct rkspi_part * p = &out[n];
+            uint64_t cells[4];
+            int n_cells = 0;
+
+            if (depth++ || n == max)
+                continue;
+            memset(p, 0, sizeof(*p));
+            while (name > text && isspace((unsigned char)name[-1]))
+                name--;
+            while (name > text && !isspace((unsigned char)name[-1]) && name[-1] != ';' && name[-1] != '{')
+                name--;
+            for (int k = 0; k < RKSPI_NAME_LEN && name[k] != '@' && !isspace((unsigned char)name[k]); k++)
+                p->name[k] = name[k];
+            for (const char * q = s + 1; *q && *q != '}'; q++)
+            {
+                if (!strncmp(q, "label", 5) && (q = strchr(q, '"')))
+                {
+                    const char * end = strchr(++q, '"');
+                    size_t len;
+                    if (!end)
+                        break;
+                    len = end - q < RKSPI_NAME_LEN ? (size_t)(end - q) : RKSPI_NAME_LEN;
+                    memset(p->name, 0, sizeof(p->name));
+                    memcpy(p->name, q, len);
+                    q = end;
+                }
+                else if (!strncmp(q, "reg", 3) && (q[3] == ' ' || q[3] == '=') && (q = strchr(q, '<')))
+                    for (q++; *q && *q != '>' && n_cells < 4; )
+                    {
+                        char * end;
+                        cells[n_cells] = strtoull(q, &end, 0);
+                        if (end == q)
+                            q++;
+                        else
+                        {
+                            n_cells++;
+                            q = end;
+                        }
+                    }
+                else if (!strncmp(q, "read-only", 9))
+                    p->ro = 1;
+                if (!*q)
+                    break;
+            }
+            if (n_cells == 2)
+            {
+                p->offset = cells[0];
+                p->size = cells[1];
+                n++;
+            }
+            else if (n_cells == 4)
+            {
+                p->offset = cells[0] << 32 | cells[1];
+                p->size = cells[2] << 32 | cells[3];
+                n++;
+            }
+        }
+        else if (*s == '}')
+            depth--;
+    }
+    return n;
+}
+
+int rkspi_parse_layout_file(const char * path, struct rkspi_part * out, int max)
+{
+    char * text = rkspi_read_text(path);
+    const char * m;
+    int n;
+
+    if (!text)
+        return -1;
+    m = strstr(text, "mtdparts=");
+    n = m ? rkspi_parse_mtdparts(m, out, max) : rkspi_parse_dts(text, out, max);
+    if (!n)
+        fprintf(stderr, "%s: no mtdparts= and no fixed-partitions node\n", path);
+    free(text);
+    return n ? n : -1;
+}
+
+static int rkspi_cmp_part(const void * a, const void * b)
+{
+    const struct rkspi_part * x = a, * y = b;
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+int rkspi_fit_parts(struct rkspi_part * p, int n, uint64_t dump_size)
+{
+    int k = 0, past = 0;
+
+    qsort(p, n, sizeof(*p), rkspi_cmp_part);
+    if ((!n || p[0].offset) && n < RKSPI_MAX_PARTS)
+    {
+        memmove(p + 1, p, n * sizeof(*p));
+        memset(p, 0, sizeof(*p));
+        strcpy(p->name, "preloader");
+        p->size = n && p[1].offset < RKSPI_PRELOADER ? p[1].offset : RKSPI_PRELOADER;
+        n++;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (p[i].offset >= dump_size)
+        {
+            // a preloader-only or truncated dump: one line, not one per partition
+            fprintf(stderr, "%s%s", past++ ? ", " : "past the end of the dump, skipped: ", p[i].name);
+            continue;
+        }
+        if (p[i].size > dump_size - p[i].offset)
+        {
+            if (p[i].size != UINT64_MAX)
+                fprintf(stderr, "%s: 0x%llx bytes, only 0x%llx in the dump\n", p[i].name,
+                    (unsigned long long)p[i].size, (unsigned long long)(dump_size - p[i].offset));
+            p[i].size = dump_size - p[i].offset;
+        }
+        p[k++] = p[i];
+    }
+    if (past)
+        fprintf(stderr, "\n");
+    return k;
+}
+
+//====================== partition tables end =======================================
+
+//====================== block scan =================================================
+
+// 32-byte GCC vectors: two SSE2 or NEON registers, no -m flags needed
+typedef uint64_t rkspi_vec __attribute__((vector_size(32)));
+
+int rkspi_classify(const uint8_t * p, size_t len, uint8_t * fill)
+{
+    uint8_t b = p[0];
+    rkspi_vec pat, acc;
+    size_t i = 0;
+
+    *fill = b;
+    memset(&pat, b, sizeof(pat));
+    // 128 bytes per round; data blocks usually differ in the first one
+    for (; i + 4 * sizeof(rkspi_vec) <= len; i += 4 * sizeof(rkspi_vec))
+    {
+        rkspi_vec v0, v1, v2, v3;
+        memcpy(&v0, p + i, sizeof(v0));
+        memcpy(&v1, p + i + 32, sizeof(v1));
+        memcpy(&v2, p + i + 64, sizeof(v2));
+        memcpy(&v3, p + i + 96, sizeof(v3));
+        acc = (v0 ^ pat) | (v1 ^ pat) | (v2 ^ pat) | (v3 ^ pat);
+        if (acc[0] | acc[1] | acc[2] | acc[3])
+            return RKSPI_BLOCK_DATA;
+    }
+    for (; i < len; i++)
+        if (p[i] != b)
+            return RKSPI_BLOCK_DATA;
+    return b == 0xff ? RKSPI_BLOCK_ERASED : b == 0x00 ? RKSPI_BLOCK_ZERO : RKSPI_BLOCK_FILL;
+}
+
+//====================== block scan end =============================================
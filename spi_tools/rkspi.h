@@ -0,0 +1,110 @@
+// Miyoo Flip — host model of a raw rk3566 SPI NAND dump.
+//
+// A full dump (xrock flash read 0 262144, 128 MiB) is laid out as
+//
+//   0x000000  protective MBR + GPT          (what parted / the stock U-Boot see)
+//   0x020000  IDBLOCK "RKNS": DDR init + SPL, read by the bootrom
+//   0x080000  second IDBLOCK copy
+//   0x200000  vnvm, uboot, boot, rootfs, userdata (GPT or mtdparts=)
+//
+// The bootrom-visible 2 MiB up to vnvm is the "preloader" MTD partition of
+// the ROCKNIX kernel. Nothing here writes to the dump.
+
+#ifndef RKSPI_H
+#define RKSPI_H
+
+#include<stdint.h>
+#include<stddef.h>
+
+#define RKSPI_SECTOR        512
+#define RKSPI_ERASE_BLOCK   0x20000             // 128 KiB, 64 pages of 2 KiB
+#define RKSPI_PRELOADER     0x200000            // bootrom-visible region
+#define RKSPI_MAX_PARTS     32
+#define RKSPI_MAX_IDB       8
+#define RKSPI_MAX_IDB_IMAGES 4
+#define RKSPI_NAME_LEN      36                  // GPT names are 36 UTF-16 units
+
+// the stock kernel command line (logs/Stock-dump.txt), used when nothing better is given
+#define RKSPI_STOCK_MTDPARTS "mtdparts=spi-nand0:0x100000@0x200000(vnvm),0x400000@0x300000(uboot)," \
+    "0x2600000@0x700000(boot),0x4000000@0x2d00000(rootfs),0x1260000@0x6d00000(userdata)"
+
+struct rkspi_dump
+{
+    const char * path;
+    int fd;
+    const uint8_t * data;               // read-only mapping of the whole file
+    uint64_t size;
+};
+
+struct rkspi_part
+{
+    char name[RKSPI_NAME_LEN + 1];
+    uint64_t offset, size;              // clipped to the dump by rkspi_fit_parts()
+    int ro;
+};
+
+struct rkspi_idb_image
+{
+    uint64_t offset, size;              // absolute, in the dump
+    uint32_t address, flag, counter;
+    int hash_ok;                        // 1 ok, 0 mismatch, -1 no hash
+};
+
+struct rkspi_idb
+{
+    uint64_t offset;
+    int version;                        // 2: "RKNS"; 1: RC4-scrambled 0x0ff0aa55 header
+    int hash;                           // v2: 0 none, 1 sha256, 2 sha512
+    int header_ok;                      // v2 header hash: 1 ok, 0 mismatch, -1 none / not checked
+    int copy_of;                        // index of an identical earlier IDBLOCK, or -1
+    int n_images;
+    struct rkspi_idb_image image[RKSPI_MAX_IDB_IMAGES];
+};
+
+// erase block contents
+enum
+{
+    RKSPI_BLOCK_DATA,
+    RKSPI_BLOCK_ERASED,                 // all 0xff
+    RKSPI_BLOCK_ZERO,                   // all 0x00: written over, e.g. a cleared preloader
+    RKSPI_BLOCK_FILL,                   // one other byte throughout, e.g. the 0xcc of a dumper
+    RKSPI_BLOCK_KINDS
+};
+
+int rkspi_open(struct rkspi_dump * d, const char * path);
+void rkspi_close(struct rkspi_dump * d);
+
+// IDBLOCK headers on sector boundaries in [0, limit); returns the count
+int rkspi_find_idb(const struct rkspi_dump * d, uint64_t limit, struct rkspi_idb * out, int max);
+
+// partition tables; each returns the number found, or -1 with a message on stderr
+int rkspi_parse_gpt(const struct rkspi_dump * d, struct rkspi_part * out, int max);
+int rkspi_parse_mtdparts(const char * s, struct rkspi_part * out, int max);
+// a text file: the first mtdparts= in it (cmdline, boot log, DTS bootargs), else
+// the fixed-partitions nodes of a DTS
+int rkspi_parse_layout_file(const char * path, struct rkspi_part * out, int max);
+
+// sort by offset, add "preloader" over the uncovered start of the bootrom
+// region, clip to the dump size; returns the new count
+int rkspi_fit_parts(struct rkspi_part * p, int n, uint64_t dump_size);
+
+// RKSPI_BLOCK_*; *fill gets the byte of a uniform block
+int rkspi_classify(const uint8_t * p, size_t len, uint8_t * fill);
+
+struct rkspi_sha256
+{
+    uint32_t h[8];
+    uint64_t len;
+    uint8_t buf[64];
+    size_t n;
+};
+
+void rkspi_sha256_init(struct rkspi_sha256 * c);
+void rkspi_sha256_update(struct rkspi_sha256 * c, const void * data, size_t len);
+void rkspi_sha256_final(struct rkspi_sha256 * c, uint8_t out[32]);
+void rkspi_sha256(const void * data, size_t len, uint8_t out[32]);
+
+// reflected CRC-32 (GPT, zlib); crc is 0 to start, or the previous result to continue
+uint32_t rkspi_crc32(uint32_t crc, const void * data, size_t len);
+
+#endif
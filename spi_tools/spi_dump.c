@@ -0,0 +1,392 @@
+// Inspect a raw SPI NAND dump and cut it into partition images (rkspi.h).
+//
+// The dump is mmapped once. The report gives
+//
+//   IDBLOCK   every bootrom header in the preloader region, its images and
+//             whether their SHA-256 matches the one in the header
+//   layout    partitions from -p (an mtdparts= string, or a file holding one:
+//             /proc/cmdline, a boot log, a DTS), else the dump's own GPT,
+//             else the stock mtdparts
+//   per part  SHA-256 and how many erase blocks are data, erased (0xff),
+//             zeroed (0x00) or one other byte throughout
+//
+// Partitions are hashed and scanned by a small thread pool, largest first.
+// -x writes <dir>/<name>.img with FICLONERANGE (a reflink, no data copied)
+// where the filesystem allows it, else copy_file_range, so the bytes never
+// pass through this process.
+//
+//   make && ./build/spi_dump spi_20241119160817.img
+//   ./build/spi_dump -p ../logs/boot_log_STOCK_INCLUDE_SLEEP_POWEROFF.txt -x out spi_20241119160817.img boot rootfs
+//   ./build/spi_dump -v ../preloader-stock-rocknix/preloader-restore/preloader.img
+
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<pthread.h>
+#include<time.h>
+#include<sys/ioctl.h>
+#include<sys/stat.h>
+#include<linux/fs.h>
+
+#include "rkspi.h"
+
+struct dump_part
+{
+    struct rkspi_part part;
+    int selected;                       // extract it
+    uint8_t sha256[32];
+    uint32_t blocks[RKSPI_BLOCK_KINDS];
+    uint32_t fills[256];                // FILL blocks by byte
+    const char * method;                // how it was extracted, NULL if not
+    int error;
+};
+
+static struct rkspi_dump s_dump;
+static struct dump_part s_parts[RKSPI_MAX_PARTS];
+static int s_n_parts;
+static int * s_order;                   // work list: largest partition first
+static int s_next;                      // next entry of s_order, taken atomically
+static uint8_t * s_block_kind;          // per erase block of the dump, for -v
+static uint64_t s_erase = RKSPI_ERASE_BLOCK;
+static const char * s_out_dir;
+static int s_verbose;
+
+static const char * const s_kind_names[RKSPI_BLOCK_KINDS] = { "data", "erased", "zero", "fill" };
+
+//====================== extract ====================================================
+
+// reflink first: on btrfs / XFS the new file shares the dump's extents
+static const char * dump_extract(const struct rkspi_part * p, int * error)
+{
+    char path[4096];
+    loff_t in = p->offset, out = 0;
+    uint64_t left = p->size;
+    int fd;
+    const char * method = "reflink";
+    struct file_clone_range clone = { .src_fd = s_dump.fd, .src_offset = p->offset, .src_length = p->size };
+
+    snprintf(path, sizeof(path), "%s/%s.img", s_out_dir, p->name);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        *error = errno;
+        return NULL;
+    }
+    if (!ioctl(fd, FICLONERANGE, &clone))
+        left = 0;
+    else
+        method = "copy_file_range";
+    while (left)
+    {
+        ssize_t n = copy_file_range(s_dump.fd, &in, fd, &out, left, 0);
+        if (n > 0)
+        {
+            left -= n;
+            continue;
+        }
+        if (n < 0 && errno != EXDEV && errno != ENOSYS && errno != EOPNOTSUPP && errno != EINVAL)
+        {
+            *error = errno;
+            close(fd);
+            return NULL;
+        }
+        // old kernel or a filesystem without it: write from the mapping
+        method = "write";
+        for (; left; )
+        {
+            n = pwrite(fd, s_dump.data + in, left, out);
+            if (n <= 0)
+            {
+                *error = n < 0 ? errno : EIO;
+                close(fd);
+                return NULL;
+            }
+            in += n;
+            out += n;
+            left -= n;
+        }
+    }
+    if (close(fd))
+    {
+        *error = errno;
+        return NULL;
+    }
+    return method;
+}
+
+//====================== extract end ================================================
+
+//====================== scan =======================================================
+
+// one pass per erase block: hash it, then classify it while it is in cache
+static void dump_scan(struct dump_part * dp)
+{
+    const struct rkspi_part * p = &dp->part;
+    struct rkspi_sha256 c;
+    uint64_t off = p->offset, end = p->offset + p->size;
+
+    rkspi_sha256_init(&c);
+    while (off < end)
+    {
+        uint64_t next = (off / s_erase + 1) * s_erase;
+        uint8_t fill;
+        int kind;
+
+        if (next > end)
+            next = end;
+        rkspi_sha256_update(&c, s_dump.data + off, next - off);
+        kind = rkspi_classify(s_dump.data + off, next - off, &fill);
+        dp->blocks[kind]++;
+        if (kind == RKSPI_BLOCK_FILL)
+            dp->fills[fill]++;
+        s_block_kind[off / s_erase] = kind;
+        off = next;
+    }
+    rkspi_sha256_final(&c, dp->sha256);
+    if (dp->selected && s_out_dir)
+        dp->method = dump_extract(p, &dp->error);
+}
+
+static void * dump_worker(void * arg)
+{
+    int i;
+
+    (void)arg;
+    while ((i = __atomic_fetch_add(&s_next, 1, __ATOMIC_RELAXED)) < s_n_parts)
+        dump_scan(&s_parts[s_order[i]]);
+    return NULL;
+}
+
+static int dump_cmp_size(const void * a, const void * b)
+{
+    const struct dump_part * x = &s_parts[*(const int *)a], * y = &s_parts[*(const int *)b];
+    return x->part.size < y->part.size ? 1 : x->part.size > y->part.size ? -1 : 0;
+}
+
+//====================== scan end ===================================================
+
+//====================== report =====================================================
+
+static void dump_report_idb(const struct rkspi_idb * idb, int n)
+{
+    static const char * const hashes[] = { "no hash", "sha256", "sha512" };
+    static const char * const ok[] = { "MISMATCH", "ok" };
+
+    printf("IDBLOCK:%s\n", n ? "" : " none in the first 2 MiB, the bootrom will fall through to SD");
+    for (int i = 0; i < n; i++)
+    {
+        if (idb[i].copy_of >= 0)
+        {
+            printf("  0x%08llx  %s  copy of 0x%08llx\n", (unsigned long long)idb[i].offset,
+                idb[i].version == 2 ? "RKNS" : "v1  ", (unsigned long long)idb[idb[i].copy_of].offset);
+            continue;
+        }
+        if (idb[i].version == 2)
+            printf("  0x%08llx  RKNS  %d image%s, %s%s%s\n", (unsigned long long)idb[i].offset,
+                idb[i].n_images, idb[i].n_images > 1 ? "s" : "",
+                idb[i].hash < 3 ? hashes[idb[i].hash] : "unknown hash",
+                idb[i].header_ok >= 0 ? ", header " : "", idb[i].header_ok >= 0 ? ok[idb[i].header_ok] : "");
+        else
+            printf("  0x%08llx  v1    RC4 header, %d image%s\n", (unsigned long long)idb[i].offset,
+                idb[i].n_images, idb[i].n_images > 1 ? "s" : "");
+        for (int k = 0; k < idb[i].n_images; k++)
+        {
+            const struct rkspi_idb_image * im = &idb[i].image[k];
+            printf("              0x%08llx  0x%06llx bytes  %-8s %s\n", (unsigned long long)im->offset,
+                (unsigned long long)im->size, im->hash_ok >= 0 ? ok[im->hash_ok] : "",
+                idb[i].n_images == 2 ? (k ? "SPL" : "DDR init") : "");
+        }
+    }
+}
+
+static void dump_report_parts(const char * source)
+{
+    printf("layout: %s\n", source);
+    printf("  %-10s %-10s %-10s %6s %6s %6s %6s  %s\n", "name", "offset", "size",
+        "data", "erased", "zero", "fill", "sha256");
+    for (int i = 0; i < s_n_parts; i++)
+    {
+        const struct dump_part * dp = &s_parts[i];
+        char fill[32] = "";
+
+        printf("  %-10s 0x%08llx 0x%08llx %6u %6u %6u %6u  ", dp->part.name,
+            (unsigned long long)dp->part.offset, (unsigned long long)dp->part.size,
+            dp->blocks[RKSPI_BLOCK_DATA], dp->blocks[RKSPI_BLOCK_ERASED],
+            dp->blocks[RKSPI_BLOCK_ZERO], dp->blocks[RKSPI_BLOCK_FILL]);
+        for (int k = 0; k < 32; k++)
+            printf("%02x", dp->sha256[k]);
+        for (int b = 0, len = 0; b < 256; b++)
+            if (dp->fills[b])
+                len += snprintf(fill + len, sizeof(fill) - len, "%s0x%02x", len ? "," : "  fill ", b);
+        printf("%s%s\n", dp->part.ro ? "  ro" : "", fill);
+        if (dp->blocks[RKSPI_BLOCK_DATA] == 0)
+            printf("  %-10s no data: %s\n", "", dp->blocks[RKSPI_BLOCK_ERASED] ? "erased" : "blank or unread");
+    }
+}
+
+// -v: runs of non-data erase blocks
+static void dump_report_runs(void)
+{
+    uint64_t n = (s_dump.size + s_erase - 1) / s_erase;
+
+    printf("non-data erase blocks:\n");
+    for (uint64_t b = 0; b < n; )
+    {
+        uint64_t e = b + 1;
+        if (s_block_kind[b] == RKSPI_BLOCK_DATA)
+        {
+            b++;
+            continue;
+        }
+        while (e < n && s_block_kind[e] == s_block_kind[b]
+            && (s_block_kind[b] != RKSPI_BLOCK_FILL || s_dump.data[e * s_erase] == s_dump.data[b * s_erase]))
+            e++;
+        printf("  0x%08llx-0x%08llx  %4llu  %s", (unsigned long long)(b * s_erase),
+            (unsigned long long)(e * s_erase < s_dump.size ? e * s_erase : s_dump.size),
+            (unsigned long long)(e - b), s_kind_names[s_block_kind[b]]);
+        if (s_block_kind[b] == RKSPI_BLOCK_FILL)
+            printf(" 0x%02x", s_dump.data[b * s_erase]);
+        printf("\n");
+        b = e;
+    }
+}
+
+//====================== report end =================================================
+
+static void usage(const char * name)
+{
+    fprintf(stderr, "usage: %s [options] dump.img [partition ...]\n"
+        "  -p layout     mtdparts=... string, or a file with one (cmdline, boot log) or a DTS\n"
+        "  -x dir        write the named partitions (all if none) to dir/<name>.img\n"
+        "  -e size       erase block size (0x%x)\n"
+        "  -j threads    hashing threads (online CPUs)\n"
+        "  -v            list the runs of erased / zeroed / filled blocks\n", name, RKSPI_ERASE_BLOCK);
+    exit(2);
+}
+
+int main(int argc, char * argv[])
+{
+    struct rkspi_part parts[RKSPI_MAX_PARTS];
+    struct rkspi_idb idb[RKSPI_MAX_IDB];
+    const char * layout = NULL;
+    char source[128];
+    pthread_t threads[64];
+    struct timespec t0, t1;
+    int opt, n, n_idb, n_threads = sysconf(_SC_NPROCESSORS_ONLN), rc = 0;
+
+    while ((opt = getopt(argc, argv, "p:x:e:j:v")) != -1)
+        switch (opt)
+        {
+        case 'p': layout = optarg; break;
+        case 'x': s_out_dir = optarg; break;
+        case 'e': s_erase = strtoull(optarg, NULL, 0); break;
+        case 'j': n_threads = atoi(optarg); break;
+        case 'v': s_verbose = 1; break;
+        default: usage(argv[0]);
+        }
+    if (optind >= argc || !s_erase || s_erase % RKSPI_SECTOR)
+        usage(argv[0]);
+    if (n_threads < 1)
+        n_threads = 1;
+    if (n_threads > (int)(sizeof(threads) / sizeof(threads[0])))
+        n_threads = sizeof(threads) / sizeof(threads[0]);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (rkspi_open(&s_dump, argv[optind]))
+        return 1;
+
+    if (layout && !strncmp(layout, "mtdparts=", 9))
+    {
+        n = rkspi_parse_mtdparts(layout, parts, RKSPI_MAX_PARTS);
+        snprintf(source, sizeof(source), "mtdparts (-p)");
+    }
+    else if (layout)
+    {
+        n = rkspi_parse_layout_file(layout, parts, RKSPI_MAX_PARTS);
+        snprintf(source, sizeof(source), "%.100s", layout);
+    }
+    else if ((n = rkspi_parse_gpt(&s_dump, parts, RKSPI_MAX_PARTS)) > 0)
+        snprintf(source, sizeof(source), "GPT");
+    else
+    {
+        n = rkspi_parse_mtdparts(RKSPI_STOCK_MTDPARTS, parts, RKSPI_MAX_PARTS);
+        snprintf(source, sizeof(source), "stock mtdparts (no GPT in the dump)");
+    }
+    if (n < 0)
+        return 1;
+    n = rkspi_fit_parts(parts, n, s_dump.size);
+
+    for (int i = 0; i < n; i++)
+    {
+        s_parts[i].part = parts[i];
+        s_parts[i].selected = optind + 1 == argc;
+        for (int a = optind + 1; a < argc; a++)
+            s_parts[i].selected |= !strcmp(argv[a], parts[i].name);
+    }
+    s_n_parts = n;
+    for (int a = optind + 1; a < argc; a++)
+    {
+        int found = 0;
+        for (int i = 0; i < n; i++)
+            found |= !strcmp(argv[a], parts[i].name);
+        if (!found)
+        {
+            fprintf(stderr, "%s: no partition \"%s\"\n", s_dump.path, argv[a]);
+            rc = 1;
+        }
+    }
+    if (s_out_dir && mkdir(s_out_dir, 0755) && errno != EEXIST)
+    {
+        perror(s_out_dir);
+        return 1;
+    }
+
+    n_idb = rkspi_find_idb(&s_dump, RKSPI_PRELOADER, idb, RKSPI_MAX_IDB);
+
+    s_block_kind = calloc((s_dump.size + s_erase - 1) / s_erase, 1);
+    s_order = malloc(n * sizeof(*s_order));
+    for (int i = 0; i < n; i++)
+        s_order[i] = i;
+    qsort(s_order, n, sizeof(*s_order), dump_cmp_size);
+    if (n_threads > n)
+        n_threads = n ? n : 1;
+    for (int i = 1; i < n_threads; i++)
+        if (pthread_create(&threads[i], NULL, dump_worker, NULL))
+            n_threads = i;
+    dump_worker(NULL);
+    for (int i = 1; i < n_threads; i++)
+        pthread_join(threads[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    printf("%s: %llu bytes, %llu erase blocks of 0x%llx\n", s_dump.path, (unsigned long long)s_dump.size,
+        (unsigned long long)((s_dump.size + s_erase - 1) / s_erase), (unsigned long long)s_erase);
+    dump_report_idb(idb, n_idb);
+    dump_report_parts(source);
+    if (s_verbose)
+        dump_report_runs();
+    for (int i = 0; i < n; i++)
+    {
+        const struct dump_part * dp = &s_parts[i];
+        if (!dp->selected || !s_out_dir)
+            continue;
+        if (dp->method)
+            printf("wrote %s/%s.img (%s)\n", s_out_dir, dp->part.name, dp->method);
+        else
+        {
+            fprintf(stderr, "%s/%s.img: %s\n", s_out_dir, dp->part.name, strerror(dp->error));
+            rc = 1;
+        }
+    }
+    fflush(stdout);
+    fprintf(stderr, "%s: %d partitions in %.1f ms, %d thread%s\n", s_dump.path, n,
+        (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6, n_threads, n_threads > 1 ? "s" : "");
+
+    free(s_order);
+    free(s_block_kind);
+    rkspi_close(&s_dump);
+    return rc;
+}
@@ -0,0 +1,88 @@
+#!/bin/sh
+# Miyoo Flip — miyoo_inputd latency under load, with and without realtime
+# mode (MIYOO_INPUTD_RT / MIYOO_INPUTD_CPU, see joystick_study/README.md).
+#
+# For each mode the daemon is restarted and its idle tick is set to 5 ms, so
+# it wakes 200 times/s on a timer even with nobody touching the pad. One
+# busy loop per core plus a memory hog then run for the window. Afterwards
+# the tick_lateness (timer expiry -> event loop running) and read_to_emit
+# percentiles are read from the stats file. Leave the sticks alone: a
+# touched pad leaves idle mode and stops the tick samples.
+#
+# Requires: root, the reworked miyoo_inputd (stats file + idle tick).
+#
+# Usage on device:
+#   sh miyoo-inputd-rt-stress.sh                 # 60 s per mode, RT prio 50 on cpu 3
+#   sh miyoo-inputd-rt-stress.sh 120 80 2        # 120 s, prio 80, cpu 2
+#   DAEMON=/tmp/miyoo_inputd MEM_MB=256 sh miyoo-inputd-rt-stress.sh
+#
+# The daemon is restarted without realtime mode at the end.
+
+SECS="${1:-60}"
+PRIO="${2:-50}"
+CPU="${3:-3}"
+DAEMON="${DAEMON:-/usr/miyoo/bin/miyoo_inputd}"
+MEM_MB="${MEM_MB:-192}"
+CTL=/tmp/miyoo_inputd
+STATS=/tmp/miyoo_inputd.stats
+NCPU=$(grep -c '^processor' /proc/cpuinfo)
+
+if [ ! -x "$DAEMON" ]; then
+	echo "ERROR: $DAEMON not found (set DAEMON=...)." >&2
+	exit 1
+fi
+
+HOGS=""
+stop_hogs() {
+	[ -n "$HOGS" ] && kill $HOGS 2>/dev/null
+	wait $HOGS 2>/dev/null
+	HOGS=""
+}
+
+restart_daemon() {
+	killall miyoo_inputd 2>/dev/null
+	sleep 1
+	env "$@" "$DAEMON" >/dev/null 2>&1 &
+	sleep 3
+}
+
+run_case() {
+	label="$1"
+	shift
+	restart_daemon "$@"
+
+	i=0
+	while [ "$i" -lt "$NCPU" ]; do
+		sh -c 'while :; do :; done' &
+		HOGS="$HOGS $!"
+		i=$((i + 1))
+	done
+	# /dev/zero has no newline: tail keeps all of it in memory
+	head -c "$((MEM_MB * 1024 * 1024))" /dev/zero | tail >/dev/null &
+	HOGS="$HOGS $!"
+	# page cache churn
+	sh -c 'while :; do cat /usr/miyoo/bin/* >/dev/null 2>&1; sync; done' &
+	HOGS="$HOGS $!"
+
+	sleep "$SECS"
+	kill -USR1 "$(pidof miyoo_inputd)"
+	sleep 1
+	stop_hogs
+
+	echo "== $label"
+	grep -E '^(frames|wakeups|idle_entries) ' "$STATS"
+	grep -E '^# latency|^tick_lateness |^read_to_emit ' "$STATS"
+}
+
+trap 'stop_hogs; restart_daemon; rm -f "$CTL/idle"' INT TERM
+
+mkdir -p "$CTL"
+echo "500 5" > "$CTL/idle"
+
+echo "miyoo_inputd under load: ${SECS}s per mode, $NCPU cpu hogs, ${MEM_MB} MB memory hog"
+run_case "SCHED_OTHER (stock scheduling)"
+run_case "realtime: SCHED_FIFO $PRIO, cpu $CPU, mlockall" MIYOO_INPUTD_RT="$PRIO" MIYOO_INPUTD_CPU="$CPU"
+
+rm -f "$CTL/idle"
+restart_daemon
+echo "latency columns are ns: count p50 p90 p99 p999 max"
@@ -0,0 +1,120 @@
+#!/bin/sh
+# Miyoo Flip — miyoo_inputd rumble on a host, against a mock sysfs tree.
+#
+# Builds nothing: point DAEMON at a native build (make in joystick_study).
+# The daemon gets a real /dev/uinput pad (needs root and the uinput module)
+# but MIYOO_INPUTD_SYSFS=<tmp>, so the motor is a plain file:
+#
+#   gpio  <tmp>/sys/class/gpio/gpio20/value            (stock)
+#   pwm   <tmp>/sys/class/pwm/pwmchip0/pwm0/duty_cycle  (device -> fe6f0010.pwm)
+#
+# A python client then uploads FF_RUMBLE effects on "MIYOO Player1" and
+# plays them (EVIOCSFF + EV_FF writes, as SDL does), while the motor file
+# is sampled every 0.5 ms and each change is printed with its time since
+# the play request. The stats file gets a rumble_lateness row.
+#
+# With "none" there is no motor at all: the pad still declares FF_RUMBLE, so
+# each upload and erase must still be answered at once, not after the
+# kernel's ~30 s uinput timeout.
+#
+# Usage on host:
+#   sudo DAEMON=build/miyoo_inputd sh miyoo-inputd-rumble-mock.sh          # gpio
+#   sudo DAEMON=build/miyoo_inputd sh miyoo-inputd-rumble-mock.sh pwm
+#   sudo DAEMON=build/miyoo_inputd sh miyoo-inputd-rumble-mock.sh none
+
+MODE="${1:-gpio}"
+DAEMON="${DAEMON:-build/miyoo_inputd}"
+MOCK=$(mktemp -d /tmp/miyoo_rumble.XXXXXX)
+
+if [ ! -x "$DAEMON" ] || [ ! -w /dev/uinput ]; then
+	echo "ERROR: need DAEMON=<native miyoo_inputd> and a writable /dev/uinput." >&2
+	exit 1
+fi
+
+if [ "$MODE" = pwm ]; then
+	mkdir -p "$MOCK/sys/class/pwm/pwmchip0/pwm0" "$MOCK/sys/devices/platform/fe6f0010.pwm"
+	ln -s ../../../devices/platform/fe6f0010.pwm "$MOCK/sys/class/pwm/pwmchip0/device"
+	: > "$MOCK/sys/class/pwm/pwmchip0/export"
+	echo 0 > "$MOCK/sys/class/pwm/pwmchip0/pwm0/period"
+	echo 0 > "$MOCK/sys/class/pwm/pwmchip0/pwm0/duty_cycle"
+	echo 0 > "$MOCK/sys/class/pwm/pwmchip0/pwm0/enable"
+	MOTOR="$MOCK/sys/class/pwm/pwmchip0/pwm0/duty_cycle"
+elif [ "$MODE" = none ]; then
+	MOTOR=
+else
+	mkdir -p "$MOCK/sys/class/gpio/gpio20"
+	: > "$MOCK/sys/class/gpio/export"
+	echo in > "$MOCK/sys/class/gpio/gpio20/direction"
+	echo 0 > "$MOCK/sys/class/gpio/gpio20/value"
+	MOTOR="$MOCK/sys/class/gpio/gpio20/value"
+fi
+
+# no stick UART / miyooio on a host: both opens fail and are skipped
+MIYOO_INPUTD_SYSFS="$MOCK" MIYOO_INPUTD_TTY="$MOCK/ttyS1" MIYOO_INPUTD_IO="$MOCK/miyooio" \
+	"$DAEMON" > "$MOCK/daemon.log" 2>&1 &
+PID=$!
+trap 'kill $PID 2>/dev/null; wait $PID 2>/dev/null; rm -rf "$MOCK"' EXIT INT TERM
+sleep 1
+
+python3 - "$MOTOR" <<'EOF'
+import fcntl, os, struct, sys, time
+
+motor = sys.argv[1]
+EV_FF, FF_RUMBLE = 0x15, 0x50
+EVIOCSFF = 0x40304580           # _IOW('E', 0x80, struct ff_effect), 48 bytes on 64-bit
+
+def node():
+    name = None
+    for line in open('/proc/bus/input/devices'):
+        if line.startswith('N: Name='):
+            name = line.strip()[9:-1]
+        elif line.startswith('H: Handlers=') and name == 'MIYOO Player1':
+            return '/dev/input/' + [h for h in line.split('=')[1].split() if h.startswith('event')][0]
+    sys.exit('MIYOO Player1 not found')
+
+def upload(fd, strong, weak, length_ms, delay_ms):
+    eff = bytearray(struct.pack('<HhHHHHH2xHH28x', FF_RUMBLE, -1, 0, 0, 0,
+                                length_ms, delay_ms, strong, weak))
+    fcntl.ioctl(fd, EVIOCSFF, eff)
+    return struct.unpack_from('<h', eff, 2)[0]
+
+def play(fd, eid, count):
+    os.write(fd, struct.pack('llHHi', 0, 0, EV_FF, eid, count))
+
+def watch(secs, t0):
+    last = None
+    end = time.monotonic() + secs
+    while time.monotonic() < end:
+        v = open(motor).read().strip()
+        if v != last:
+            print('%8.2f ms  %s' % ((time.monotonic() - t0) * 1e3, v))
+            last = v
+        time.sleep(0.0005)
+
+fd = os.open(node(), os.O_RDWR)
+if not motor:
+    t0 = time.monotonic()
+    a = upload(fd, 0x8000, 0x4000, 40, 10)
+    play(fd, a, 1)
+    os.close(fd)                            # erases a
+    print('no motor: upload, play and erase answered in %.2f ms' % ((time.monotonic() - t0) * 1e3))
+    sys.exit(0)
+a = upload(fd, 0x8000, 0x4000, 40, 10)      # 40 ms after 10 ms, twice
+b = upload(fd, 0xffff, 0, 15, 20)           # full strength burst on top
+t0 = time.monotonic()
+play(fd, a, 2)
+play(fd, b, 1)
+watch(0.2, t0)
+print('-- close (erases both)')
+c = upload(fd, 0x4000, 0, 0, 0)             # until stopped / erased
+t0 = time.monotonic()
+play(fd, c, 1)
+time.sleep(0.05)
+os.close(fd)
+watch(0.05, t0)
+EOF
+
+kill -USR1 $PID
+sleep 0.2
+grep rumble "$MOCK/daemon.log"
+grep rumble_lateness /tmp/miyoo_inputd.stats
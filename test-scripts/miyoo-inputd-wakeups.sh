@@ -0,0 +1,45 @@
+#!/bin/sh
+# Miyoo Flip — count miyoo_inputd wakeups over a window (context switches
+# from /proc/<pid>/status), optionally while faking the suspend flag.
+#
+# Usage on device:
+#   sh miyoo-inputd-wakeups.sh                # 60 s, current state
+#   sh miyoo-inputd-wakeups.sh 60 suspend     # 60 s with /tmp/system_suspend present
+#
+# With the parked event loop the suspend run should report ~0/s; the stock
+# daemon wakes ~10/s (miyooio 100 ms sleep) plus every UART frame.
+
+SECS="${1:-60}"
+MODE="${2:-}"
+
+PID=$(pidof miyoo_inputd 2>/dev/null)
+if [ -z "$PID" ]; then
+	echo "ERROR: miyoo_inputd not running." >&2
+	exit 1
+fi
+
+ctxt() {
+	# sum of all threads, so the stock multi-threaded daemon is comparable
+	total=0
+	for st in /proc/"$PID"/task/*/status; do
+		v=$(awk '/^voluntary_ctxt_switches/ {a=$2} /^nonvoluntary_ctxt_switches/ {b=$2} END {print a+b}' "$st")
+		total=$((total + v))
+	done
+	echo "$total"
+}
+
+CREATED=0
+if [ "$MODE" = "suspend" ] && [ ! -e /tmp/system_suspend ]; then
+	touch /tmp/system_suspend
+	CREATED=1
+	sleep 1
+fi
+
+A=$(ctxt)
+sleep "$SECS"
+B=$(ctxt)
+
+[ "$CREATED" -eq 1 ] && rm -f /tmp/system_suspend
+
+D=$((B - A))
+echo "miyoo_inputd pid $PID: $D context switches in ${SECS}s ($(awk "BEGIN {printf \"%.2f\", $D / $SECS}")/s)${MODE:+ [$MODE]}"
@@ -0,0 +1,93 @@
+#!/bin/sh
+# Miyoo Flip — preloader_flash on a host, against a stand-in for the
+# "preloader" MTD partition.
+#
+# Builds nothing: point FLASHER at a native build (make in spi_tools).
+# By default the partition is a 2 MiB file, which preloader_flash treats like
+# NAND (erase = 0xff, programming ANDs). With MTD=/dev/mtdN it runs on a real
+# MTD device instead, e.g. nandsim with the Flip's geometry, 16 blocks:
+#
+#   modprobe nandsim first_id_byte=0xec second_id_byte=0xa1 third_id_byte=0x00 \
+#       fourth_id_byte=0x15 parts=16                       # -> /dev/mtd0, 2 MiB
+#
+# Runs, each checked with cmp against the image:
+#
+#   1. blank partition (as left by the stock PreloaderEraser: zeros)
+#   2. second run: nothing to write
+#   3. one byte changed in the SPL and one in the tail: two blocks rewritten
+#   4. interrupted with SIGINT, then run again (file stand-in only)
+#   5. two bad blocks, skipped as nandwrite skips them (file stand-in only)
+#
+# Usage on host:
+#   FLASHER=build/preloader_flash sh preloader-flash-mock.sh
+#   sudo MTD=/dev/mtd0 FLASHER=build/preloader_flash sh preloader-flash-mock.sh
+
+FLASHER="${FLASHER:-build/preloader_flash}"
+IMG="${IMG:-$(dirname "$0")/../preloader-stock-rocknix/preloader-restore/preloader.img}"
+TMP=$(mktemp -d /tmp/preloader_flash.XXXXXX)
+trap 'rm -rf "$TMP"' EXIT INT TERM
+
+if [ ! -x "$FLASHER" ] || [ ! -f "$IMG" ]; then
+	echo "ERROR: need FLASHER=<native preloader_flash> and IMG=<preloader.img>." >&2
+	exit 1
+fi
+
+SIZE=$(stat -c%s "$IMG")
+if [ -n "$MTD" ]; then
+	DEV="$MTD"
+	READ() { dd if="$DEV" bs=131072 count=16 2>/dev/null; }
+	# zero the partition the way the eraser app leaves it
+	flash_erase "$DEV" 0 0 >/dev/null && head -c 2097152 /dev/zero > "$TMP/zero" \
+		&& nandwrite -q "$DEV" "$TMP/zero" || exit 1
+else
+	DEV="$TMP/standin.bin"
+	READ() { cat "$DEV"; }
+	head -c 2097152 /dev/zero > "$DEV"
+fi
+
+check() {
+	if READ | cmp -s -n "$SIZE" - "$IMG"; then
+		echo "== $1: partition holds the image"
+	else
+		echo "== $1: MISMATCH" >&2
+		exit 1
+	fi
+}
+
+echo "== 1: blank partition"
+"$FLASHER" -y -d "$DEV" "$IMG" || exit 1
+check 1
+
+echo "== 2: again"
+"$FLASHER" -y -d "$DEV" "$IMG" | grep -E '^(plan|Nothing)'
+check 2
+
+if [ -z "$MTD" ]; then
+	echo "== 3: two blocks changed"
+	printf 'XX' | dd of="$DEV" bs=1 seek=$((0x90000)) conv=notrunc 2>/dev/null
+	printf 'YY' | dd of="$DEV" bs=1 seek=$((0x1f0000)) conv=notrunc 2>/dev/null
+	"$FLASHER" -y -d "$DEV" "$IMG" | grep -E '^(plan|done|saved)'
+	check 3
+
+	# 16 MiB of 4 KiB blocks, so there is time to stop in the middle
+	echo "== 4: interrupted, then resumed"
+	head -c 16777216 /dev/zero > "$DEV"
+	"$FLASHER" -y -e 0x1000 -w 0x200 -d "$DEV" "$IMG" > "$TMP/log" &
+	PID=$!
+	# the plan line comes just before the first write
+	until grep -q '^plan' "$TMP/log" || ! kill -0 $PID 2>/dev/null; do sleep 0.01; done
+	kill -INT $PID
+	wait $PID
+	echo "exit $? (3: stopped)"
+	grep -E '^(done|Stopped|Cancelled)' "$TMP/log"
+	"$FLASHER" -y -e 0x1000 -w 0x200 -d "$DEV" "$IMG" | grep -E '^(plan|done)'
+	check 4
+
+	echo "== 5: bad blocks 2 and 9"
+	head -c 2097152 /dev/zero > "$DEV"
+	"$FLASHER" -y -B 2,9 -d "$DEV" "$IMG" | grep -E '^(plan|done)'
+	# block k of the image in the k-th good block
+	for k in 0 1 3 4 5 6 7 8 10 11 12 13 14 15; do
+		dd if="$DEV" bs=131072 skip=$k count=1 2>/dev/null
+	done | cmp -s -n $((14 * 131072)) - "$IMG" && echo "== 5: image in the good blocks"
+fi